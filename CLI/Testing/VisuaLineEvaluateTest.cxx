@@ -0,0 +1,119 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Laurent Chauvin, Brigham and Women's
+  Hospital. The project was supported by grants 5P01CA067165,
+  5R01CA124377, 5R01CA138586, 2R44DE019322, 7R01CA124377,
+  5R42CA137886, 8P41EB015898
+
+==============================================================================*/
+
+// Writes a small plan scene, evaluates it and checks the report has the
+// header and one row per path.
+
+// MRML includes
+#include <vtkMRMLAnnotationRulerNode.h>
+#include <vtkMRMLScene.h>
+
+// VTK includes
+#include <vtkNew.h>
+
+// STD includes
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+int ModuleEntryPoint(int argc, char* argv[]);
+
+namespace
+{
+
+//----------------------------------------------------------------------------
+void AddRuler(vtkMRMLScene* scene, const char* name, double entry[3], double target[3])
+{
+  vtkNew<vtkMRMLAnnotationRulerNode> ruler;
+  ruler->SetName(name);
+  ruler->SetPosition1(entry);
+  ruler->SetPosition2(target);
+  ruler->Initialize(scene);
+}
+
+} // end of anonymous namespace
+
+//----------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+  if (argc < 2)
+    {
+    std::cerr << "Usage: " << argv[0] << " <temporary directory>" << std::endl;
+    return EXIT_FAILURE;
+    }
+  std::string sceneFile = std::string(argv[1]) + "/VisuaLineEvaluateTest.mrml";
+  std::string reportFile = std::string(argv[1]) + "/VisuaLineEvaluateTest.csv";
+
+  const int numberOfPaths = 3;
+  {
+  vtkNew<vtkMRMLScene> scene;
+  for (int i = 0; i < numberOfPaths; ++i)
+    {
+    double entry[3] = {10.0 * i, 0.0, 50.0};
+    double target[3] = {10.0 * i, 0.0, 0.0};
+    std::string name = "Path" + std::string(1, static_cast<char>('0' + i));
+    AddRuler(scene.GetPointer(), name.c_str(), entry, target);
+    }
+  scene->SetURL(sceneFile.c_str());
+  if (!scene->Commit())
+    {
+    std::cerr << "Cannot write " << sceneFile << std::endl;
+    return EXIT_FAILURE;
+    }
+  }
+
+  std::string reportFlag = "--report";
+  std::string program = "VisuaLineEvaluate";
+  char* arguments[] = {&program[0], &reportFlag[0], &reportFile[0], &sceneFile[0]};
+  if (ModuleEntryPoint(4, arguments) != EXIT_SUCCESS)
+    {
+    std::cerr << "Evaluation failed" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  std::ifstream report(reportFile.c_str());
+  std::string line;
+  if (!std::getline(report, line) ||
+      line != "Scene,Path,PathNodeID,Length,InsertionDepth,Clearance,"
+              "TargetHitProbability,RiskProbability,Error")
+    {
+    std::cerr << "Unexpected header: " << line << std::endl;
+    return EXIT_FAILURE;
+    }
+  int numberOfRows = 0;
+  while (std::getline(report, line))
+    {
+    if (line.compare(0, sceneFile.size() + 1, sceneFile + ",") != 0)
+      {
+      std::cerr << "Unexpected row: " << line << std::endl;
+      return EXIT_FAILURE;
+      }
+    ++numberOfRows;
+    }
+  if (numberOfRows != numberOfPaths)
+    {
+    std::cerr << "Expected " << numberOfPaths << " rows, got " << numberOfRows << std::endl;
+    return EXIT_FAILURE;
+    }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,320 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Laurent Chauvin, Brigham and Women's
+  Hospital. The project was supported by grants 5P01CA067165,
+  5R01CA124377, 5R01CA138586, 2R44DE019322, 7R01CA124377,
+  5R42CA137886, 8P41EB015898
+
+==============================================================================*/
+
+// Scores the paths of plan scenes without user interface. Scenes are
+// spread over threads, each with its own scene and logic. MRML is not
+// thread safe (node observations go through a global event broker), so
+// everything touching the scene is serialized and only the computations
+// of the logic run in parallel.
+
+// VisuaLine Logic includes
+#include "vtkSlicerVisuaLineDistanceMap.h"
+#include "vtkSlicerVisuaLineLogic.h"
+#include "vtkSlicerVisuaLinePathStore.h"
+#include "vtkSlicerVisuaLineUncertaintyAnalysis.h"
+
+// MRML includes
+#include <vtkMRMLAnnotationFiducialNode.h>
+#include <vtkMRMLAnnotationFiducialsStorageNode.h>
+#include <vtkMRMLAnnotationHierarchyNode.h>
+#include <vtkMRMLAnnotationLineDisplayNode.h>
+#include <vtkMRMLAnnotationPointDisplayNode.h>
+#include <vtkMRMLAnnotationRulerNode.h>
+#include <vtkMRMLAnnotationRulerStorageNode.h>
+#include <vtkMRMLAnnotationTextDisplayNode.h>
+#include <vtkMRMLModelNode.h>
+#include <vtkMRMLScalarVolumeNode.h>
+#include <vtkMRMLScene.h>
+
+// VTK includes
+#include <vtkMath.h>
+#include <vtkMultiThreader.h>
+#include <vtkMutexLock.h>
+#include <vtkNew.h>
+#include <vtkSmartPointer.h>
+
+// STD includes
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "VisuaLineEvaluateCLP.h"
+
+namespace
+{
+
+//----------------------------------------------------------------------------
+struct Evaluation
+{
+  std::vector<std::string> Scenes;
+  std::string RiskVolume;
+  std::vector<int> RiskLabels;
+  int TargetLabel;
+  std::string SkinModel;
+  int NumberOfSamples;
+  unsigned int Seed;
+  double PositionError;
+  double AngularError;
+  double DepthError;
+  double TargetTolerance;
+  double RiskMargin;
+  int ThreadsPerScene;
+
+  // Per scene, written in scene order once all are evaluated
+  std::vector<std::string> Rows;
+  std::vector<std::string> Errors;
+
+  vtkSimpleMutexLock SceneLock;
+};
+
+//----------------------------------------------------------------------------
+void RegisterAnnotationNodes(vtkMRMLScene* scene)
+{
+  scene->RegisterNodeClass(vtkSmartPointer<vtkMRMLAnnotationHierarchyNode>::New());
+  scene->RegisterNodeClass(vtkSmartPointer<vtkMRMLAnnotationRulerNode>::New());
+  scene->RegisterNodeClass(vtkSmartPointer<vtkMRMLAnnotationRulerStorageNode>::New());
+  scene->RegisterNodeClass(vtkSmartPointer<vtkMRMLAnnotationFiducialNode>::New());
+  scene->RegisterNodeClass(vtkSmartPointer<vtkMRMLAnnotationFiducialsStorageNode>::New());
+  scene->RegisterNodeClass(vtkSmartPointer<vtkMRMLAnnotationLineDisplayNode>::New());
+  scene->RegisterNodeClass(vtkSmartPointer<vtkMRMLAnnotationPointDisplayNode>::New());
+  scene->RegisterNodeClass(vtkSmartPointer<vtkMRMLAnnotationTextDisplayNode>::New());
+}
+
+//----------------------------------------------------------------------------
+std::string FormatText(const std::string& text)
+{
+  if (text.find_first_of(",\"\n") == std::string::npos)
+    {
+    return text;
+    }
+  std::string quoted = "\"";
+  for (size_t i = 0; i < text.size(); ++i)
+    {
+    quoted += text[i] == '"' ? std::string("\"\"") : std::string(1, text[i]);
+    }
+  return quoted + "\"";
+}
+
+//----------------------------------------------------------------------------
+std::string FormatValue(double value)
+{
+  // Not computed values are left empty
+  if (vtkMath::IsNan(value))
+    {
+    return std::string();
+    }
+  std::ostringstream stream;
+  stream << value;
+  return stream.str();
+}
+
+//----------------------------------------------------------------------------
+void EvaluateScene(Evaluation* evaluation, int sceneIndex)
+{
+  const std::string& sceneFile = evaluation->Scenes[sceneIndex];
+  vtkSmartPointer<vtkMRMLScene> scene;
+  vtkSmartPointer<vtkSlicerVisuaLineLogic> logic;
+  vtkMRMLScalarVolumeNode* riskVolume = 0;
+  vtkMRMLModelNode* skin = 0;
+  std::string error;
+
+  evaluation->SceneLock.Lock();
+  scene = vtkSmartPointer<vtkMRMLScene>::New();
+  RegisterAnnotationNodes(scene);
+  logic = vtkSmartPointer<vtkSlicerVisuaLineLogic>::New();
+  logic->SetMRMLScene(scene);
+  scene->SetURL(sceneFile.c_str());
+  if (!scene->Connect())
+    {
+    error = "cannot read the scene";
+    }
+  else
+    {
+    logic->AddAllPathNodes();
+    if (!evaluation->RiskVolume.empty())
+      {
+      riskVolume = vtkMRMLScalarVolumeNode::SafeDownCast(
+        scene->GetFirstNodeByName(evaluation->RiskVolume.c_str()));
+      if (!riskVolume)
+        {
+        error = "no risk label map " + evaluation->RiskVolume;
+        }
+      }
+    if (!evaluation->SkinModel.empty())
+      {
+      skin = vtkMRMLModelNode::SafeDownCast(
+        scene->GetFirstNodeByName(evaluation->SkinModel.c_str()));
+      if (!skin)
+        {
+        error = "no skin model " + evaluation->SkinModel;
+        }
+      }
+    }
+  evaluation->SceneLock.Unlock();
+
+  if (error.empty())
+    {
+    // Only the logic from here on, no node is modified
+    vtkSlicerVisuaLineDistanceMap* distanceMap = logic->GetRiskDistanceMap();
+    distanceMap->RemoveAllRiskLabels();
+    for (size_t i = 0; i < evaluation->RiskLabels.size(); ++i)
+      {
+      distanceMap->AddRiskLabel(evaluation->RiskLabels[i]);
+      }
+    vtkSlicerVisuaLineUncertaintyAnalysis* analysis = logic->GetUncertaintyAnalysis();
+    analysis->SetNumberOfSamples(evaluation->NumberOfSamples);
+    analysis->SetSeed(evaluation->Seed);
+    analysis->SetEntryError(evaluation->PositionError);
+    analysis->SetTargetError(evaluation->PositionError);
+    analysis->SetAngularError(evaluation->AngularError);
+    analysis->SetDepthError(evaluation->DepthError);
+    analysis->SetTargetTolerance(evaluation->TargetTolerance);
+    analysis->SetRiskMargin(evaluation->RiskMargin);
+    analysis->SetTargetLabel(evaluation->TargetLabel);
+    analysis->SetNumberOfThreads(evaluation->ThreadsPerScene);
+    logic->AnalyzePathUncertainty(riskVolume);
+    logic->SetEntrySurfaceNode(skin);
+
+    logic->UpdatePathEntries();
+
+    // The report reads the path store only: no path node is expanded
+    std::ostringstream rows;
+    vtkSlicerVisuaLinePathStore* store = logic->GetPathStore();
+    for (int i = 0; i < store->GetNumberOfPaths(); ++i)
+      {
+      const char* pathNodeID = store->GetPathNodeID(i);
+      const char* name = logic->GetPathName(pathNodeID);
+      rows << FormatText(sceneFile) << ","
+           << FormatText(name ? name : "") << ","
+           << FormatText(pathNodeID) << ","
+           << FormatValue(store->GetPathMetric(
+                i, vtkSlicerVisuaLineLogic::GetLengthMetricName())) << ","
+           << FormatValue(store->GetPathMetric(
+                i, vtkSlicerVisuaLineLogic::GetInsertionDepthMetricName())) << ","
+           << FormatValue(store->GetPathMetric(
+                i, vtkSlicerVisuaLineLogic::GetClearanceMetricName())) << ","
+           << FormatValue(store->GetPathMetric(
+                i, vtkSlicerVisuaLineLogic::GetTargetHitProbabilityMetricName())) << ","
+           << FormatValue(store->GetPathMetric(
+                i, vtkSlicerVisuaLineLogic::GetRiskProbabilityMetricName())) << ",\n";
+      }
+    evaluation->Rows[sceneIndex] = rows.str();
+    }
+  else
+    {
+    evaluation->Errors[sceneIndex] = error;
+    }
+
+  // Releasing the scene removes observations too
+  evaluation->SceneLock.Lock();
+  logic->SetMRMLScene(0);
+  logic = 0;
+  scene->Clear(1);
+  scene = 0;
+  evaluation->SceneLock.Unlock();
+}
+
+//----------------------------------------------------------------------------
+VTK_THREAD_RETURN_TYPE EvaluateScenesThread(void* arg)
+{
+  vtkMultiThreader::ThreadInfo* info =
+    static_cast<vtkMultiThreader::ThreadInfo*>(arg);
+  Evaluation* evaluation = static_cast<Evaluation*>(info->UserData);
+
+  int numberOfScenes = static_cast<int>(evaluation->Scenes.size());
+  for (int i = info->ThreadID; i < numberOfScenes; i += info->NumberOfThreads)
+    {
+    EvaluateScene(evaluation, i);
+    }
+  return VTK_THREAD_RETURN_VALUE;
+}
+
+} // end of anonymous namespace
+
+//----------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+  PARSE_ARGS;
+
+  if (inputScenes.empty())
+    {
+    std::cerr << "No input scene" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  Evaluation evaluation;
+  evaluation.Scenes = inputScenes;
+  evaluation.RiskVolume = riskVolume;
+  evaluation.RiskLabels = riskLabels;
+  evaluation.TargetLabel = targetLabel;
+  evaluation.SkinModel = skinModel;
+  evaluation.NumberOfSamples = numberOfSamples;
+  evaluation.Seed = static_cast<unsigned int>(seed);
+  evaluation.PositionError = positionError;
+  evaluation.AngularError = angularError;
+  evaluation.DepthError = depthError;
+  evaluation.TargetTolerance = targetTolerance;
+  evaluation.RiskMargin = riskMargin;
+  evaluation.Rows.resize(inputScenes.size());
+  evaluation.Errors.resize(inputScenes.size());
+
+  // One thread per scene up to the number of cores, the cores left are
+  // shared by the path sampling of each scene
+  vtkNew<vtkMultiThreader> threader;
+  int numberOfCores = threads > 0 ? threads : threader->GetNumberOfThreads();
+  int numberOfSceneThreads =
+    std::max(1, std::min(numberOfCores, static_cast<int>(inputScenes.size())));
+  evaluation.ThreadsPerScene = std::max(1, numberOfCores / numberOfSceneThreads);
+  threader->SetNumberOfThreads(numberOfSceneThreads);
+  threader->SetSingleMethod(EvaluateScenesThread, &evaluation);
+  threader->SingleMethodExecute();
+
+  std::ofstream reportFile;
+  if (!report.empty())
+    {
+    reportFile.open(report.c_str());
+    if (!reportFile)
+      {
+      std::cerr << "Cannot write " << report << std::endl;
+      return EXIT_FAILURE;
+      }
+    }
+  std::ostream& out = report.empty() ? std::cout : reportFile;
+  out << "Scene,Path,PathNodeID,Length,InsertionDepth,Clearance,"
+      << "TargetHitProbability,RiskProbability,Error\n";
+  bool failed = false;
+  for (size_t i = 0; i < inputScenes.size(); ++i)
+    {
+    if (!evaluation.Errors[i].empty())
+      {
+      std::cerr << inputScenes[i] << ": " << evaluation.Errors[i] << std::endl;
+      out << FormatText(inputScenes[i]) << ",,,,,,,," << FormatText(evaluation.Errors[i]) << "\n";
+      failed = true;
+      }
+    out << evaluation.Rows[i];
+    }
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
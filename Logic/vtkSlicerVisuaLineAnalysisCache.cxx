@@ -0,0 +1,637 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Laurent Chauvin, Brigham and Women's
+  Hospital. The project was supported by grants 5P01CA067165,
+  5R01CA124377, 5R01CA138586, 2R44DE019322, 7R01CA124377,
+  5R42CA137886, 8P41EB015898
+
+==============================================================================*/
+
+// VisuaLine Logic includes
+#include "vtkSlicerVisuaLineAnalysisCache.h"
+
+// VTK includes
+#include <vtkObjectFactory.h>
+#include <vtksys/Directory.hxx>
+#include <vtksys/SystemTools.hxx>
+
+// STD includes
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <vector>
+
+#ifdef _WIN32
+# include <windows.h>
+#else
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+namespace
+{
+// Entry files start with the magic and the size of the data
+const char EntryMagic[8] = { 'V', 'L', 'C', 'A', 'C', 'H', 'E', '1' };
+const size_t EntryHeaderSize = 16;
+const char* EntryExtension = ".vlc";
+const char* IndexFileName = "index.txt";
+
+//----------------------------------------------------------------------------
+vtkTypeUInt64 Finalize(vtkTypeUInt64 hash)
+{
+  hash ^= hash >> 33;
+  hash *= 0xFF51AFD7ED558CCDULL;
+  hash ^= hash >> 33;
+  hash *= 0xC4CEB9FE1A85EC53ULL;
+  return hash ^ (hash >> 33);
+}
+
+//----------------------------------------------------------------------------
+// Keys are file names: only accept the ones made by Key
+bool IsValidKey(const std::string& key)
+{
+  if (key.size() != 32)
+    {
+    return false;
+    }
+  for (size_t i = 0; i < key.size(); ++i)
+    {
+    if (!isxdigit(static_cast<unsigned char>(key[i])))
+      {
+      return false;
+      }
+    }
+  return true;
+}
+}
+
+//----------------------------------------------------------------------------
+class vtkSlicerVisuaLineAnalysisCache::vtkInternal
+{
+public:
+  struct Entry
+    {
+    vtkIdType Size;        // file size, header included
+    vtkTypeUInt64 LastUse;
+    };
+
+  struct Mapping
+    {
+    const char* Address;
+    size_t Length;
+    int References;
+#ifdef _WIN32
+    HANDLE File;
+    HANDLE Map;
+#endif
+    };
+
+  vtkInternal()
+    : UseCounter(0), Size(0), IndexModified(false)
+    {
+    }
+
+  std::string EntryPath(const std::string& key)
+    {
+    return this->Directory + "/" + key + EntryExtension;
+    }
+
+  std::string IndexPath()
+    {
+    return this->Directory + "/" + IndexFileName;
+    }
+
+  void Touch(const std::string& key)
+    {
+    std::map<std::string, Entry>::iterator it = this->Entries.find(key);
+    if (it != this->Entries.end())
+      {
+      it->second.LastUse = ++this->UseCounter;
+      this->IndexModified = true;
+      }
+    }
+
+  void RemoveEntry(const std::string& key)
+    {
+    std::map<std::string, Entry>::iterator it = this->Entries.find(key);
+    if (it == this->Entries.end())
+      {
+      return;
+      }
+    vtksys::SystemTools::RemoveFile(this->EntryPath(key).c_str());
+    this->Size -= it->second.Size;
+    this->Entries.erase(it);
+    this->IndexModified = true;
+    }
+
+  bool MapFile(const std::string& path, Mapping& mapping);
+  void UnmapFile(Mapping& mapping);
+
+  std::string Directory;
+  std::map<std::string, Entry> Entries;
+  std::map<std::string, Mapping> Mappings;
+  vtkTypeUInt64 UseCounter;
+  vtkIdType Size;
+  bool IndexModified;
+};
+
+//----------------------------------------------------------------------------
+bool vtkSlicerVisuaLineAnalysisCache::vtkInternal
+::MapFile(const std::string& path, Mapping& mapping)
+{
+  mapping.Address = 0;
+  mapping.Length = 0;
+  mapping.References = 1;
+#ifdef _WIN32
+  mapping.File = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, 0,
+                             OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+  if (mapping.File == INVALID_HANDLE_VALUE)
+    {
+    return false;
+    }
+  LARGE_INTEGER length;
+  mapping.Map = GetFileSizeEx(mapping.File, &length) && length.QuadPart > 0 ?
+    CreateFileMappingA(mapping.File, 0, PAGE_READONLY, 0, 0, 0) : 0;
+  const void* address = mapping.Map ?
+    MapViewOfFile(mapping.Map, FILE_MAP_READ, 0, 0, 0) : 0;
+  if (!address)
+    {
+    if (mapping.Map)
+      {
+      CloseHandle(mapping.Map);
+      }
+    CloseHandle(mapping.File);
+    return false;
+    }
+  mapping.Length = static_cast<size_t>(length.QuadPart);
+#else
+  int file = open(path.c_str(), O_RDONLY);
+  if (file < 0)
+    {
+    return false;
+    }
+  struct stat status;
+  void* address = fstat(file, &status) == 0 && status.st_size > 0 ?
+    mmap(0, status.st_size, PROT_READ, MAP_PRIVATE, file, 0) : MAP_FAILED;
+  // The mapping keeps the file alive
+  close(file);
+  if (address == MAP_FAILED)
+    {
+    return false;
+    }
+  mapping.Length = static_cast<size_t>(status.st_size);
+#endif
+  mapping.Address = static_cast<const char*>(address);
+  return true;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineAnalysisCache::vtkInternal::UnmapFile(Mapping& mapping)
+{
+  if (!mapping.Address)
+    {
+    return;
+    }
+#ifdef _WIN32
+  UnmapViewOfFile(mapping.Address);
+  CloseHandle(mapping.Map);
+  CloseHandle(mapping.File);
+#else
+  munmap(const_cast<char*>(mapping.Address), mapping.Length);
+#endif
+  mapping.Address = 0;
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerVisuaLineAnalysisCache::Key::Key()
+{
+  this->Hash[0] = 0x6A09E667F3BCC908ULL;
+  this->Hash[1] = 0xBB67AE8584CAA73BULL;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineAnalysisCache::Key::Add(const void* data, size_t size)
+{
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  vtkTypeUInt64 hash0 = this->Hash[0];
+  vtkTypeUInt64 hash1 = this->Hash[1];
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8)
+    {
+    vtkTypeUInt64 word;
+    memcpy(&word, bytes + i, 8);
+    hash0 = (hash0 ^ word) * 0x9E3779B97F4A7C15ULL;
+    hash0 = (hash0 << 31) | (hash0 >> 33);
+    hash1 = (hash1 + word) * 0x87C37B91114253D5ULL;
+    hash1 = ((hash1 << 27) | (hash1 >> 37)) + hash0;
+    }
+  vtkTypeUInt64 tail = 0;
+  for (; i < size; ++i)
+    {
+    tail = (tail << 8) | bytes[i];
+    }
+  // The size separates successive additions
+  this->Hash[0] = Finalize(hash0 ^ tail ^ static_cast<vtkTypeUInt64>(size));
+  this->Hash[1] = Finalize(hash1 + tail + this->Hash[0]);
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineAnalysisCache::Key::Add(double value)
+{
+  this->Add(&value, sizeof(value));
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineAnalysisCache::Key::Add(int value)
+{
+  this->Add(&value, sizeof(value));
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineAnalysisCache::Key::Add(const std::string& value)
+{
+  this->Add(value.data(), value.size());
+}
+
+//----------------------------------------------------------------------------
+std::string vtkSlicerVisuaLineAnalysisCache::Key::ToString()const
+{
+  const char* digits = "0123456789abcdef";
+  std::string key(32, '0');
+  for (int i = 0; i < 32; ++i)
+    {
+    vtkTypeUInt64 hash = this->Hash[i / 16];
+    key[i] = digits[(hash >> (60 - 4 * (i % 16))) & 0xF];
+    }
+  return key;
+}
+
+//----------------------------------------------------------------------------
+vtkStandardNewMacro(vtkSlicerVisuaLineAnalysisCache);
+
+//----------------------------------------------------------------------------
+vtkSlicerVisuaLineAnalysisCache::vtkSlicerVisuaLineAnalysisCache()
+{
+  this->MaximumSize = 1024 * 1024 * 1024;
+  this->Internal = new vtkInternal;
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerVisuaLineAnalysisCache::~vtkSlicerVisuaLineAnalysisCache()
+{
+  this->Flush();
+  std::map<std::string, vtkInternal::Mapping>::iterator it;
+  for (it = this->Internal->Mappings.begin(); it != this->Internal->Mappings.end(); ++it)
+    {
+    this->Internal->UnmapFile(it->second);
+    }
+  delete this->Internal;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineAnalysisCache::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os, indent);
+  os << indent << "Directory: " << this->Internal->Directory << "\n";
+  os << indent << "MaximumSize: " << this->MaximumSize << "\n";
+  os << indent << "Size: " << this->Internal->Size << "\n";
+  os << indent << "NumberOfEntries: " << this->Internal->Entries.size() << "\n";
+  os << indent << "NumberOfMappings: " << this->Internal->Mappings.size() << "\n";
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineAnalysisCache::SetDirectory(const char* directory)
+{
+  std::string newDirectory = directory ? directory : "";
+  if (newDirectory == this->Internal->Directory)
+    {
+    return;
+    }
+  // Mappings stay valid, they do not depend on the directory
+  this->Flush();
+  this->Internal->Directory = newDirectory;
+  if (!newDirectory.empty() &&
+      !vtksys::SystemTools::MakeDirectory(newDirectory.c_str()))
+    {
+    vtkWarningMacro("Cannot create cache directory " << newDirectory);
+    this->Internal->Directory.clear();
+    }
+  this->LoadIndex();
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+const char* vtkSlicerVisuaLineAnalysisCache::GetDirectory()
+{
+  return this->Internal->Directory.c_str();
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerVisuaLineAnalysisCache::IsEnabled()
+{
+  return !this->Internal->Directory.empty();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineAnalysisCache::SetMaximumSize(vtkIdType size)
+{
+  if (this->MaximumSize == size)
+    {
+    return;
+    }
+  this->MaximumSize = size;
+  this->Evict(0);
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+vtkIdType vtkSlicerVisuaLineAnalysisCache::GetSize()
+{
+  return this->Internal->Size;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineAnalysisCache::LoadIndex()
+{
+  this->Internal->Entries.clear();
+  this->Internal->Size = 0;
+  this->Internal->UseCounter = 0;
+  this->Internal->IndexModified = false;
+  if (!this->IsEnabled())
+    {
+    return;
+    }
+
+  // The index only keeps the use order, the files are the entries
+  std::map<std::string, vtkTypeUInt64> lastUses;
+  std::ifstream index(this->Internal->IndexPath().c_str());
+  std::string key;
+  vtkTypeUInt64 lastUse;
+  while (index >> key >> lastUse)
+    {
+    lastUses[key] = lastUse;
+    }
+
+  vtksys::Directory directory;
+  directory.Load(this->Internal->Directory.c_str());
+  size_t extensionLength = strlen(EntryExtension);
+  for (unsigned long i = 0; i < directory.GetNumberOfFiles(); ++i)
+    {
+    std::string fileName = directory.GetFile(i);
+    std::string path = this->Internal->Directory + "/" + fileName;
+    if (fileName.size() > 4 &&
+        fileName.compare(fileName.size() - 4, 4, ".tmp") == 0)
+      {
+      // Left by an interrupted Store()
+      vtksys::SystemTools::RemoveFile(path.c_str());
+      continue;
+      }
+    if (fileName.size() <= extensionLength ||
+        fileName.compare(fileName.size() - extensionLength,
+                         extensionLength, EntryExtension) != 0)
+      {
+      continue;
+      }
+    key = fileName.substr(0, fileName.size() - extensionLength);
+    if (!IsValidKey(key))
+      {
+      continue;
+      }
+    vtkInternal::Entry& entry = this->Internal->Entries[key];
+    entry.Size = static_cast<vtkIdType>(vtksys::SystemTools::FileLength(path.c_str()));
+    std::map<std::string, vtkTypeUInt64>::iterator use = lastUses.find(key);
+    entry.LastUse = use != lastUses.end() ? use->second : 0;
+    this->Internal->UseCounter = std::max(this->Internal->UseCounter, entry.LastUse);
+    this->Internal->Size += entry.Size;
+    }
+  this->Evict(0);
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineAnalysisCache::Flush()
+{
+  if (!this->IsEnabled() || !this->Internal->IndexModified)
+    {
+    return;
+    }
+  std::string path = this->Internal->IndexPath();
+  std::string temporaryPath = path + ".tmp";
+  {
+  std::ofstream index(temporaryPath.c_str());
+  std::map<std::string, vtkInternal::Entry>::iterator it;
+  for (it = this->Internal->Entries.begin(); it != this->Internal->Entries.end(); ++it)
+    {
+    index << it->first << " " << it->second.LastUse << "\n";
+    }
+  if (!index)
+    {
+    vtkWarningMacro("Cannot write cache index " << temporaryPath);
+    return;
+    }
+  }
+  vtksys::SystemTools::RemoveFile(path.c_str());
+  if (rename(temporaryPath.c_str(), path.c_str()) != 0)
+    {
+    vtkWarningMacro("Cannot write cache index " << path);
+    return;
+    }
+  this->Internal->IndexModified = false;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineAnalysisCache::Evict(vtkIdType size)
+{
+  if (this->Internal->Size + size <= this->MaximumSize)
+    {
+    return;
+    }
+  std::vector<std::pair<vtkTypeUInt64, std::string> > entries;
+  std::map<std::string, vtkInternal::Entry>::iterator it;
+  for (it = this->Internal->Entries.begin(); it != this->Internal->Entries.end(); ++it)
+    {
+    // Mapped entries are in use
+    if (!this->Internal->Mappings.count(it->first))
+      {
+      entries.push_back(std::make_pair(it->second.LastUse, it->first));
+      }
+    }
+  std::sort(entries.begin(), entries.end());
+  for (size_t i = 0;
+       i < entries.size() && this->Internal->Size + size > this->MaximumSize; ++i)
+    {
+    this->Internal->RemoveEntry(entries[i].second);
+    }
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerVisuaLineAnalysisCache
+::Store(const std::string& key, const void* data, vtkIdType size)
+{
+  if (!this->IsEnabled() || !IsValidKey(key) || size < 0)
+    {
+    return false;
+    }
+  // Same key, same content
+  if (this->Internal->Entries.count(key))
+    {
+    this->Internal->Touch(key);
+    return true;
+    }
+  vtkIdType fileSize = static_cast<vtkIdType>(EntryHeaderSize) + size;
+  if (fileSize > this->MaximumSize)
+    {
+    return false;
+    }
+  this->Evict(fileSize);
+
+  // Write aside and rename, readers never see a partial entry
+  std::string path = this->Internal->EntryPath(key);
+  std::string temporaryPath = path + ".tmp";
+  {
+  std::ofstream file(temporaryPath.c_str(), std::ios::out | std::ios::binary);
+  vtkTypeUInt64 dataSize = static_cast<vtkTypeUInt64>(size);
+  file.write(EntryMagic, sizeof(EntryMagic));
+  file.write(reinterpret_cast<const char*>(&dataSize), sizeof(dataSize));
+  file.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+  if (!file)
+    {
+    file.close();
+    vtksys::SystemTools::RemoveFile(temporaryPath.c_str());
+    vtkWarningMacro("Cannot write cache entry " << path);
+    return false;
+    }
+  }
+  if (rename(temporaryPath.c_str(), path.c_str()) != 0)
+    {
+    vtksys::SystemTools::RemoveFile(temporaryPath.c_str());
+    return false;
+    }
+  vtkInternal::Entry& entry = this->Internal->Entries[key];
+  entry.Size = fileSize;
+  entry.LastUse = ++this->Internal->UseCounter;
+  this->Internal->Size += fileSize;
+  this->Internal->IndexModified = true;
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerVisuaLineAnalysisCache::Contains(const std::string& key)
+{
+  return this->Internal->Entries.count(key) > 0;
+}
+
+//----------------------------------------------------------------------------
+const void* vtkSlicerVisuaLineAnalysisCache
+::Map(const std::string& key, vtkIdType& size)
+{
+  size = 0;
+  std::map<std::string, vtkInternal::Mapping>::iterator mapped =
+    this->Internal->Mappings.find(key);
+  if (mapped != this->Internal->Mappings.end())
+    {
+    ++mapped->second.References;
+    this->Internal->Touch(key);
+    size = static_cast<vtkIdType>(mapped->second.Length - EntryHeaderSize);
+    return mapped->second.Address + EntryHeaderSize;
+    }
+  if (!this->Internal->Entries.count(key))
+    {
+    return 0;
+    }
+
+  vtkInternal::Mapping mapping;
+  if (!this->Internal->MapFile(this->Internal->EntryPath(key), mapping))
+    {
+    // Removed behind our back
+    this->Internal->Size -= this->Internal->Entries[key].Size;
+    this->Internal->Entries.erase(key);
+    this->Internal->IndexModified = true;
+    return 0;
+    }
+  vtkTypeUInt64 dataSize = 0;
+  if (mapping.Length >= EntryHeaderSize)
+    {
+    memcpy(&dataSize, mapping.Address + sizeof(EntryMagic), sizeof(dataSize));
+    }
+  if (mapping.Length < EntryHeaderSize ||
+      memcmp(mapping.Address, EntryMagic, sizeof(EntryMagic)) != 0 ||
+      dataSize != mapping.Length - EntryHeaderSize)
+    {
+    vtkWarningMacro("Removing corrupted cache entry " << key);
+    this->Internal->UnmapFile(mapping);
+    this->Internal->RemoveEntry(key);
+    return 0;
+    }
+  this->Internal->Mappings[key] = mapping;
+  this->Internal->Touch(key);
+  size = static_cast<vtkIdType>(dataSize);
+  return mapping.Address + EntryHeaderSize;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineAnalysisCache::Unmap(const std::string& key)
+{
+  std::map<std::string, vtkInternal::Mapping>::iterator mapped =
+    this->Internal->Mappings.find(key);
+  if (mapped == this->Internal->Mappings.end() || --mapped->second.References > 0)
+    {
+    return;
+    }
+  this->Internal->UnmapFile(mapped->second);
+  this->Internal->Mappings.erase(mapped);
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerVisuaLineAnalysisCache
+::Read(const std::string& key, void* data, vtkIdType size)
+{
+  vtkIdType cachedSize = 0;
+  const void* cached = this->Map(key, cachedSize);
+  bool read = cached && cachedSize == size;
+  if (read)
+    {
+    memcpy(data, cached, static_cast<size_t>(size));
+    }
+  if (cached)
+    {
+    this->Unmap(key);
+    }
+  return read;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineAnalysisCache::RemoveAllEntries()
+{
+  std::vector<std::string> keys;
+  std::map<std::string, vtkInternal::Entry>::iterator it;
+  for (it = this->Internal->Entries.begin(); it != this->Internal->Entries.end(); ++it)
+    {
+    if (!this->Internal->Mappings.count(it->first))
+      {
+      keys.push_back(it->first);
+      }
+    }
+  for (size_t i = 0; i < keys.size(); ++i)
+    {
+    this->Internal->RemoveEntry(keys[i]);
+    }
+  this->Flush();
+}
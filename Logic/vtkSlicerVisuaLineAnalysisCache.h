@@ -0,0 +1,124 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Laurent Chauvin, Brigham and Women's
+  Hospital. The project was supported by grants 5P01CA067165,
+  5R01CA124377, 5R01CA138586, 2R44DE019322, 7R01CA124377,
+  5R42CA137886, 8P41EB015898
+
+==============================================================================*/
+
+// .NAME vtkSlicerVisuaLineAnalysisCache - on-disk cache of analysis results
+// .SECTION Description
+// Content addressed store of expensive analysis results (distance maps,
+// uncertainty results). Entries are keyed by a hash of everything the
+// result depends on (volume data, path geometry, parameters), so a case
+// reopened later finds its results again and a stale entry can never be
+// returned. Entries are files of the cache directory, mapped in memory
+// when read. The least recently used entries are removed once the cache
+// grows over its maximum size.
+
+#ifndef __vtkSlicerVisuaLineAnalysisCache_h
+#define __vtkSlicerVisuaLineAnalysisCache_h
+
+// VTK includes
+#include <vtkObject.h>
+
+// STD includes
+#include <string>
+
+#include "vtkSlicerVisuaLineModuleLogicExport.h"
+
+/// \ingroup Slicer_QtModules_VisuaLine
+class VTK_SLICER_VISUALINE_MODULE_LOGIC_EXPORT vtkSlicerVisuaLineAnalysisCache :
+  public vtkObject
+{
+public:
+
+  static vtkSlicerVisuaLineAnalysisCache *New();
+  vtkTypeMacro(vtkSlicerVisuaLineAnalysisCache, vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  //BTX
+  /// 128 bit hash of the inputs of a result
+  class Key
+  {
+  public:
+    Key();
+    void Add(const void* data, size_t size);
+    void Add(double value);
+    void Add(int value);
+    void Add(const std::string& value);
+    /// 32 hexadecimal digits
+    std::string ToString()const;
+  private:
+    vtkTypeUInt64 Hash[2];
+  };
+  //ETX
+
+  /// Directory of the entries, created if needed. The cache is disabled
+  /// without directory.
+  void SetDirectory(const char* directory);
+  const char* GetDirectory();
+  bool IsEnabled();
+
+  /// Maximum size (bytes) of the entries, 1 GB by default
+  void SetMaximumSize(vtkIdType size);
+  vtkGetMacro(MaximumSize, vtkIdType);
+
+  /// Total size (bytes) of the entries
+  vtkIdType GetSize();
+
+  //BTX
+  /// Store the result of a key. Return false if it could not be written.
+  bool Store(const std::string& key, const void* data, vtkIdType size);
+
+  bool Contains(const std::string& key);
+
+  /// Map the result of a key in memory, 0 if not cached. The data stays
+  /// valid until Unmap() is called as many times as Map().
+  const void* Map(const std::string& key, vtkIdType& size);
+  void Unmap(const std::string& key);
+
+  /// Copy a result of known size. Return false if not cached.
+  bool Read(const std::string& key, void* data, vtkIdType size);
+  //ETX
+
+  /// Write the use order of the entries. Done on destruction.
+  void Flush();
+
+  /// Remove all the entries not mapped
+  void RemoveAllEntries();
+
+protected:
+  vtkSlicerVisuaLineAnalysisCache();
+  virtual ~vtkSlicerVisuaLineAnalysisCache();
+
+  void LoadIndex();
+  void Evict(vtkIdType size);
+
+  vtkIdType MaximumSize;
+
+  //BTX
+  class vtkInternal;
+  vtkInternal* Internal;
+  //ETX
+
+private:
+  vtkSlicerVisuaLineAnalysisCache(const vtkSlicerVisuaLineAnalysisCache&); // Not implemented
+  void operator=(const vtkSlicerVisuaLineAnalysisCache&);                   // Not implemented
+};
+
+#endif
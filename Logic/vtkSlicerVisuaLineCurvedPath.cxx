@@ -0,0 +1,427 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Laurent Chauvin, Brigham and Women's
+  Hospital. The project was supported by grants 5P01CA067165,
+  5R01CA124377, 5R01CA138586, 2R44DE019322, 7R01CA124377,
+  5R42CA137886, 8P41EB015898
+
+==============================================================================*/
+
+// VisuaLine Logic includes
+#include "vtkSlicerVisuaLineCurvedPath.h"
+
+// VTK includes
+#include <vtkDoubleArray.h>
+#include <vtkMath.h>
+#include <vtkObjectFactory.h>
+#include <vtkPoints.h>
+
+// STD includes
+#include <algorithm>
+
+//----------------------------------------------------------------------------
+vtkStandardNewMacro(vtkSlicerVisuaLineCurvedPath);
+
+//----------------------------------------------------------------------------
+vtkSlicerVisuaLineCurvedPath::vtkSlicerVisuaLineCurvedPath()
+{
+  this->Interpolation = vtkSlicerVisuaLineCurvedPath::Polyline;
+  this->SamplesPerSpan = 16;
+  this->SpanOffsetsDirty = true;
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerVisuaLineCurvedPath::~vtkSlicerVisuaLineCurvedPath()
+{
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineCurvedPath::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os, indent);
+  os << indent << "Interpolation: " << this->Interpolation << "\n";
+  os << indent << "SamplesPerSpan: " << this->SamplesPerSpan << "\n";
+  os << indent << "NumberOfControlPoints: "
+     << this->GetNumberOfControlPoints() << "\n";
+  os << indent << "Length: " << this->GetLength() << "\n";
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineCurvedPath::SetInterpolation(int interpolation)
+{
+  if (interpolation != vtkSlicerVisuaLineCurvedPath::Polyline &&
+      interpolation != vtkSlicerVisuaLineCurvedPath::Spline)
+    {
+    vtkErrorMacro("SetInterpolation: invalid interpolation " << interpolation);
+    return;
+    }
+  if (this->Interpolation == interpolation)
+    {
+    return;
+    }
+  this->Interpolation = interpolation;
+  for (int i = 0; i < static_cast<int>(this->Spans.size()); ++i)
+    {
+    this->TabulateSpan(i);
+    }
+  this->SpanOffsetsDirty = true;
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineCurvedPath::SetSamplesPerSpan(int samples)
+{
+  samples = std::max(1, samples);
+  if (this->SamplesPerSpan == samples)
+    {
+    return;
+    }
+  this->SamplesPerSpan = samples;
+  if (this->Interpolation == vtkSlicerVisuaLineCurvedPath::Spline)
+    {
+    for (int i = 0; i < static_cast<int>(this->Spans.size()); ++i)
+      {
+      this->TabulateSpan(i);
+      }
+    this->SpanOffsetsDirty = true;
+    }
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineCurvedPath::SetControlPoints(vtkPoints* points)
+{
+  this->ControlPoints.clear();
+  this->Spans.clear();
+  if (points)
+    {
+    this->ControlPoints.resize(3 * points->GetNumberOfPoints());
+    for (vtkIdType i = 0; i < points->GetNumberOfPoints(); ++i)
+      {
+      points->GetPoint(i, &this->ControlPoints[3 * i]);
+      }
+    }
+
+  int numberOfSpans = std::max(0, this->GetNumberOfControlPoints() - 1);
+  this->Spans.resize(numberOfSpans);
+  for (int i = 0; i < numberOfSpans; ++i)
+    {
+    this->TabulateSpan(i);
+    }
+  this->SpanOffsetsDirty = true;
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLineCurvedPath::GetNumberOfControlPoints()
+{
+  return static_cast<int>(this->ControlPoints.size() / 3);
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineCurvedPath::GetControlPoint(int index, double point[3])
+{
+  if (index < 0 || index >= this->GetNumberOfControlPoints())
+    {
+    vtkErrorMacro("GetControlPoint: index " << index << " out of range");
+    return;
+    }
+  point[0] = this->ControlPoints[3 * index];
+  point[1] = this->ControlPoints[3 * index + 1];
+  point[2] = this->ControlPoints[3 * index + 2];
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineCurvedPath::SetControlPoint(int index, const double point[3])
+{
+  int numberOfPoints = this->GetNumberOfControlPoints();
+  if (index < 0 || index >= numberOfPoints)
+    {
+    vtkErrorMacro("SetControlPoint: index " << index << " out of range");
+    return;
+    }
+  double* current = &this->ControlPoints[3 * index];
+  if (current[0] == point[0] && current[1] == point[1] && current[2] == point[2])
+    {
+    return;
+    }
+  current[0] = point[0];
+  current[1] = point[1];
+  current[2] = point[2];
+
+  // Span k goes from control point k to k+1. A Catmull-Rom span also
+  // depends on points k-1 and k+2.
+  int firstSpan = index - 1;
+  int lastSpan = index;
+  if (this->Interpolation == vtkSlicerVisuaLineCurvedPath::Spline)
+    {
+    firstSpan = index - 2;
+    lastSpan = index + 1;
+    }
+  firstSpan = std::max(0, firstSpan);
+  lastSpan = std::min(static_cast<int>(this->Spans.size()) - 1, lastSpan);
+  for (int i = firstSpan; i <= lastSpan; ++i)
+    {
+    this->TabulateSpan(i);
+    }
+  this->SpanOffsetsDirty = true;
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+double vtkSlicerVisuaLineCurvedPath::GetLength()
+{
+  this->UpdateSpanOffsets();
+  return this->SpanOffsets.empty() ? 0.0 : this->SpanOffsets.back();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineCurvedPath
+::EvaluateAtArcLength(double s, double point[3], double tangent[3])
+{
+  point[0] = point[1] = point[2] = 0.0;
+  tangent[0] = tangent[1] = tangent[2] = 0.0;
+  if (this->Spans.empty())
+    {
+    if (this->GetNumberOfControlPoints() == 1)
+      {
+      this->GetControlPoint(0, point);
+      }
+    return;
+    }
+
+  this->UpdateSpanOffsets();
+  double length = this->SpanOffsets.back();
+
+  int span = this->FindSpan(std::min(std::max(s, 0.0), length));
+  const Span& current = this->Spans[span];
+  double local = s - this->SpanOffsets[span];
+
+  // Sample segment containing the local arc length
+  const std::vector<double>& lengths = current.Lengths;
+  int last = static_cast<int>(lengths.size()) - 1;
+  int j = static_cast<int>(
+    std::upper_bound(lengths.begin(), lengths.end(), local) - lengths.begin()) - 1;
+  j = std::min(std::max(j, 0), last - 1);
+
+  const double* a = &current.Points[3 * j];
+  const double* b = &current.Points[3 * (j + 1)];
+  double segmentLength = lengths[j + 1] - lengths[j];
+  // t falls outside [0, 1] past either end of the curve, which extends it
+  // linearly along the end segments.
+  double t = segmentLength > 0 ? (local - lengths[j]) / segmentLength : 0.0;
+
+  for (int k = 0; k < 3; ++k)
+    {
+    tangent[k] = b[k] - a[k];
+    point[k] = a[k] + t * tangent[k];
+    }
+  vtkMath::Normalize(tangent);
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLineCurvedPath
+::IntersectWithPlane(const double origin[3], const double normal[3],
+                     vtkDoubleArray* arcLengths)
+{
+  if (!arcLengths)
+    {
+    return 0;
+    }
+  arcLengths->Reset();
+  this->UpdateSpanOffsets();
+
+  double n[3] = { normal[0], normal[1], normal[2] };
+  if (vtkMath::Normalize(n) == 0.0)
+    {
+    return 0;
+    }
+  double d = vtkMath::Dot(n, origin);
+
+  for (int span = 0; span < static_cast<int>(this->Spans.size()); ++span)
+    {
+    const Span& current = this->Spans[span];
+
+    // Reject the span if its bounding box is on one side of the plane
+    double minDistance = VTK_DOUBLE_MAX;
+    double maxDistance = VTK_DOUBLE_MIN;
+    for (int corner = 0; corner < 8; ++corner)
+      {
+      double c[3] = { current.Bounds[(corner & 1) ? 1 : 0],
+                      current.Bounds[(corner & 2) ? 3 : 2],
+                      current.Bounds[(corner & 4) ? 5 : 4] };
+      double distance = vtkMath::Dot(n, c) - d;
+      minDistance = std::min(minDistance, distance);
+      maxDistance = std::max(maxDistance, distance);
+      }
+    if (minDistance > 0 || maxDistance < 0)
+      {
+      continue;
+      }
+
+    int numberOfSamples = static_cast<int>(current.Lengths.size());
+    double previous = vtkMath::Dot(n, &current.Points[0]) - d;
+    for (int j = 1; j < numberOfSamples; ++j)
+      {
+      double next = vtkMath::Dot(n, &current.Points[3 * j]) - d;
+      // Half-open test so a crossing on a shared sample is reported once
+      if ((previous < 0) != (next < 0))
+        {
+        double t = (previous != next) ? previous / (previous - next) : 0.0;
+        double local = current.Lengths[j - 1] +
+          t * (current.Lengths[j] - current.Lengths[j - 1]);
+        arcLengths->InsertNextValue(this->SpanOffsets[span] + local);
+        }
+      previous = next;
+      }
+    }
+  return arcLengths->GetNumberOfTuples();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineCurvedPath::GetSampledPoints(vtkPoints* points)
+{
+  if (!points)
+    {
+    return;
+    }
+  points->Reset();
+  for (int span = 0; span < static_cast<int>(this->Spans.size()); ++span)
+    {
+    const Span& current = this->Spans[span];
+    int numberOfSamples = static_cast<int>(current.Lengths.size());
+    // First sample of a span is the last sample of the previous one
+    for (int j = (span == 0 ? 0 : 1); j < numberOfSamples; ++j)
+      {
+      points->InsertNextPoint(&current.Points[3 * j]);
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineCurvedPath::GetExtendedControlPoint(int index, double point[3])
+{
+  // Mirror the end points so the spline reaches entry and target with
+  // the direction of the first/last segment.
+  int numberOfPoints = this->GetNumberOfControlPoints();
+  if (index < 0)
+    {
+    double p0[3], p1[3];
+    this->GetControlPoint(0, p0);
+    this->GetControlPoint(std::min(1, numberOfPoints - 1), p1);
+    for (int k = 0; k < 3; ++k)
+      {
+      point[k] = 2 * p0[k] - p1[k];
+      }
+    return;
+    }
+  if (index >= numberOfPoints)
+    {
+    double pn[3], pm[3];
+    this->GetControlPoint(numberOfPoints - 1, pn);
+    this->GetControlPoint(std::max(0, numberOfPoints - 2), pm);
+    for (int k = 0; k < 3; ++k)
+      {
+      point[k] = 2 * pn[k] - pm[k];
+      }
+    return;
+    }
+  this->GetControlPoint(index, point);
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineCurvedPath::TabulateSpan(int span)
+{
+  Span& current = this->Spans[span];
+  int numberOfSegments =
+    (this->Interpolation == vtkSlicerVisuaLineCurvedPath::Spline) ?
+    this->SamplesPerSpan : 1;
+
+  double p0[3], p1[3], p2[3], p3[3];
+  this->GetExtendedControlPoint(span - 1, p0);
+  this->GetExtendedControlPoint(span, p1);
+  this->GetExtendedControlPoint(span + 1, p2);
+  this->GetExtendedControlPoint(span + 2, p3);
+
+  current.Points.resize(3 * (numberOfSegments + 1));
+  current.Lengths.resize(numberOfSegments + 1);
+  for (int j = 0; j <= numberOfSegments; ++j)
+    {
+    double t = static_cast<double>(j) / numberOfSegments;
+    double t2 = t * t;
+    double t3 = t2 * t;
+    double* sample = &current.Points[3 * j];
+    for (int k = 0; k < 3; ++k)
+      {
+      if (numberOfSegments == 1)
+        {
+        sample[k] = (1 - t) * p1[k] + t * p2[k];
+        }
+      else
+        {
+        // Uniform Catmull-Rom
+        sample[k] = 0.5 * ((2 * p1[k]) +
+                           (-p0[k] + p2[k]) * t +
+                           (2 * p0[k] - 5 * p1[k] + 4 * p2[k] - p3[k]) * t2 +
+                           (-p0[k] + 3 * p1[k] - 3 * p2[k] + p3[k]) * t3);
+        }
+      }
+    }
+
+  current.Bounds[0] = current.Bounds[2] = current.Bounds[4] = VTK_DOUBLE_MAX;
+  current.Bounds[1] = current.Bounds[3] = current.Bounds[5] = VTK_DOUBLE_MIN;
+  current.Lengths[0] = 0.0;
+  for (int j = 0; j <= numberOfSegments; ++j)
+    {
+    const double* sample = &current.Points[3 * j];
+    for (int k = 0; k < 3; ++k)
+      {
+      current.Bounds[2 * k] = std::min(current.Bounds[2 * k], sample[k]);
+      current.Bounds[2 * k + 1] = std::max(current.Bounds[2 * k + 1], sample[k]);
+      }
+    if (j > 0)
+      {
+      current.Lengths[j] = current.Lengths[j - 1] +
+        sqrt(vtkMath::Distance2BetweenPoints(sample - 3, sample));
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineCurvedPath::UpdateSpanOffsets()
+{
+  if (!this->SpanOffsetsDirty)
+    {
+    return;
+    }
+  // One addition per span: sample tables are local to their span.
+  this->SpanOffsets.resize(this->Spans.size() + 1);
+  this->SpanOffsets[0] = 0.0;
+  for (size_t i = 0; i < this->Spans.size(); ++i)
+    {
+    this->SpanOffsets[i + 1] = this->SpanOffsets[i] + this->Spans[i].Lengths.back();
+    }
+  this->SpanOffsetsDirty = false;
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLineCurvedPath::FindSpan(double s)
+{
+  int span = static_cast<int>(
+    std::upper_bound(this->SpanOffsets.begin(), this->SpanOffsets.end(), s)
+    - this->SpanOffsets.begin()) - 1;
+  return std::min(std::max(span, 0), static_cast<int>(this->Spans.size()) - 1);
+}
@@ -0,0 +1,123 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Laurent Chauvin, Brigham and Women's
+  Hospital. The project was supported by grants 5P01CA067165,
+  5R01CA124377, 5R01CA138586, 2R44DE019322, 7R01CA124377,
+  5R42CA137886, 8P41EB015898
+
+==============================================================================*/
+
+// .NAME vtkSlicerVisuaLineCurvedPath - polyline/spline needle trajectory
+// .SECTION Description
+// Trajectory through an ordered list of control points (entry first,
+// target last). Each span between two control points is tabulated by
+// arc length, so positions along the curve are found by a binary search
+// plus a linear interpolation. Moving one control point only re-tabulates
+// the spans it influences.
+
+#ifndef __vtkSlicerVisuaLineCurvedPath_h
+#define __vtkSlicerVisuaLineCurvedPath_h
+
+// VTK includes
+#include <vtkObject.h>
+
+// STD includes
+#include <vector>
+
+#include "vtkSlicerVisuaLineModuleLogicExport.h"
+
+class vtkDoubleArray;
+class vtkPoints;
+
+/// \ingroup Slicer_QtModules_VisuaLine
+class VTK_SLICER_VISUALINE_MODULE_LOGIC_EXPORT vtkSlicerVisuaLineCurvedPath :
+  public vtkObject
+{
+public:
+
+  static vtkSlicerVisuaLineCurvedPath *New();
+  vtkTypeMacro(vtkSlicerVisuaLineCurvedPath, vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  enum
+    {
+    Polyline = 0,
+    Spline
+    };
+
+  /// Interpolation between control points (Polyline or Spline).
+  void SetInterpolation(int interpolation);
+  vtkGetMacro(Interpolation, int);
+
+  /// Number of samples tabulated per spline span (polyline spans use 1).
+  void SetSamplesPerSpan(int samples);
+  vtkGetMacro(SamplesPerSpan, int);
+
+  /// Replace all control points. Re-tabulates the whole curve.
+  void SetControlPoints(vtkPoints* points);
+  int GetNumberOfControlPoints();
+  void GetControlPoint(int index, double point[3]);
+
+  /// Move one control point. Only the affected spans are re-tabulated.
+  void SetControlPoint(int index, const double point[3]);
+
+  /// Total arc length from entry to target.
+  double GetLength();
+
+  /// Point and unit tangent at arc length s from the entry point.
+  /// Outside [0, length] the curve is extended along its end tangents.
+  void EvaluateAtArcLength(double s, double point[3], double tangent[3]);
+
+  /// Arc lengths at which the curve crosses the plane, in increasing order.
+  /// Return the number of crossings.
+  int IntersectWithPlane(const double origin[3], const double normal[3],
+                         vtkDoubleArray* arcLengths);
+
+  /// Tabulated points of the whole curve, for display.
+  void GetSampledPoints(vtkPoints* points);
+
+protected:
+  vtkSlicerVisuaLineCurvedPath();
+  virtual ~vtkSlicerVisuaLineCurvedPath();
+
+  //BTX
+  struct Span
+    {
+    std::vector<double> Points;  // x,y,z per sample, first and last on control points
+    std::vector<double> Lengths; // arc length of each sample from span start
+    double Bounds[6];
+    };
+
+  void GetExtendedControlPoint(int index, double point[3]);
+  void TabulateSpan(int span);
+  void UpdateSpanOffsets();
+  int FindSpan(double s);
+
+  std::vector<double> ControlPoints;
+  std::vector<Span> Spans;
+  std::vector<double> SpanOffsets;
+  bool SpanOffsetsDirty;
+  //ETX
+
+  int Interpolation;
+  int SamplesPerSpan;
+
+private:
+  vtkSlicerVisuaLineCurvedPath(const vtkSlicerVisuaLineCurvedPath&); // Not implemented
+  void operator=(const vtkSlicerVisuaLineCurvedPath&);                // Not implemented
+};
+
+#endif
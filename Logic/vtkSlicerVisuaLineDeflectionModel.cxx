@@ -0,0 +1,449 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Laurent Chauvin, Brigham and Women's
+  Hospital. The project was supported by grants 5P01CA067165,
+  5R01CA124377, 5R01CA138586, 2R44DE019322, 7R01CA124377,
+  5R42CA137886, 8P41EB015898
+
+==============================================================================*/
+
+// VisuaLine Logic includes
+#include "vtkSlicerVisuaLineDeflectionModel.h"
+
+// VTK includes
+#include <vtkDataArray.h>
+#include <vtkImageData.h>
+#include <vtkMath.h>
+#include <vtkMatrix4x4.h>
+#include <vtkNew.h>
+#include <vtkObjectFactory.h>
+#include <vtkPointData.h>
+#include <vtkPoints.h>
+
+// STD includes
+#include <algorithm>
+#include <cmath>
+
+//----------------------------------------------------------------------------
+vtkStandardNewMacro(vtkSlicerVisuaLineDeflectionModel);
+
+//----------------------------------------------------------------------------
+vtkSlicerVisuaLineDeflectionModel::vtkSlicerVisuaLineDeflectionModel()
+{
+  this->Curvature = 0.002;
+  this->BevelAngle = 0.0;
+  this->StepLength = 1.0;
+  this->NumberOfThreads = 0;
+  this->DefaultStiffness = 1.0;
+  this->IntensityMapping = 0;
+  this->IntensityRange[0] = 0.0;
+  this->IntensityRange[1] = 1.0;
+  vtkMatrix4x4::Identity(this->RASToIJK);
+  this->Dimensions[0] = this->Dimensions[1] = this->Dimensions[2] = 0;
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerVisuaLineDeflectionModel::~vtkSlicerVisuaLineDeflectionModel()
+{
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineDeflectionModel::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os, indent);
+  os << indent << "Curvature: " << this->Curvature << "\n";
+  os << indent << "BevelAngle: " << this->BevelAngle << "\n";
+  os << indent << "StepLength: " << this->StepLength << "\n";
+  os << indent << "NumberOfThreads: " << this->NumberOfThreads << "\n";
+  os << indent << "Tissue: " << this->Tissue.GetPointer() << "\n";
+  os << indent << "DefaultStiffness: " << this->DefaultStiffness << "\n";
+  os << indent << "NumberOfLabelStiffnesses: " << this->LabelStiffnesses.size() << "\n";
+  os << indent << "IntensityMapping: " << this->IntensityMapping << "\n";
+  os << indent << "IntensityRange: " << this->IntensityRange[0] << " "
+     << this->IntensityRange[1] << "\n";
+  os << indent << "NumberOfPaths: " << this->GetNumberOfPaths() << "\n";
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineDeflectionModel
+::SetTissue(vtkImageData* tissue, vtkMatrix4x4* rasToIJK)
+{
+  double matrix[16];
+  vtkMatrix4x4::Identity(matrix);
+  if (rasToIJK)
+    {
+    for (int i = 0; i < 4; ++i)
+      {
+      for (int j = 0; j < 4; ++j)
+        {
+        matrix[4 * i + j] = rasToIJK->GetElement(i, j);
+        }
+      }
+    }
+  if (this->Tissue == tissue &&
+      std::equal(matrix, matrix + 16, this->RASToIJK))
+    {
+    return;
+    }
+  this->Tissue = tissue;
+  std::copy(matrix, matrix + 16, this->RASToIJK);
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+vtkImageData* vtkSlicerVisuaLineDeflectionModel::GetTissue()
+{
+  return this->Tissue;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineDeflectionModel::SetLabelStiffness(int label, double stiffness)
+{
+  std::map<int, double>::iterator it = this->LabelStiffnesses.find(label);
+  if (it != this->LabelStiffnesses.end() && it->second == stiffness)
+    {
+    return;
+    }
+  this->LabelStiffnesses[label] = stiffness;
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineDeflectionModel::RemoveAllLabelStiffnesses()
+{
+  if (this->LabelStiffnesses.empty())
+    {
+    return;
+    }
+  this->LabelStiffnesses.clear();
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLineDeflectionModel
+::SetPath(const char* pathNodeID, const double entry[3], const double target[3])
+{
+  std::string id = pathNodeID ? pathNodeID : "";
+  std::map<std::string, int>::iterator it = this->PathIndices.find(id);
+  if (it == this->PathIndices.end())
+    {
+    PathEntry path;
+    path.PathNodeID = id;
+    path.Modified = true;
+    path.TipError = vtkMath::Nan();
+    std::copy(entry, entry + 3, path.EndPoints);
+    std::copy(target, target + 3, path.EndPoints + 3);
+    std::copy(target, target + 3, path.Tip);
+    this->Paths.push_back(path);
+    int index = static_cast<int>(this->Paths.size()) - 1;
+    this->PathIndices[id] = index;
+    return index;
+    }
+
+  PathEntry& path = this->Paths[it->second];
+  if (!std::equal(entry, entry + 3, path.EndPoints) ||
+      !std::equal(target, target + 3, path.EndPoints + 3))
+    {
+    std::copy(entry, entry + 3, path.EndPoints);
+    std::copy(target, target + 3, path.EndPoints + 3);
+    path.Modified = true;
+    }
+  return it->second;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineDeflectionModel::RemovePath(const char* pathNodeID)
+{
+  std::map<std::string, int>::iterator it =
+    this->PathIndices.find(pathNodeID ? pathNodeID : "");
+  if (it == this->PathIndices.end())
+    {
+    return;
+    }
+  int index = it->second;
+  this->PathIndices.erase(it);
+  int last = static_cast<int>(this->Paths.size()) - 1;
+  if (index != last)
+    {
+    this->Paths[index] = this->Paths[last];
+    this->PathIndices[this->Paths[index].PathNodeID] = index;
+    }
+  this->Paths.pop_back();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineDeflectionModel::RemoveAllPaths()
+{
+  this->Paths.clear();
+  this->PathIndices.clear();
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLineDeflectionModel::GetNumberOfPaths()
+{
+  return static_cast<int>(this->Paths.size());
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLineDeflectionModel::GetPathIndex(const char* pathNodeID)
+{
+  std::map<std::string, int>::iterator it =
+    this->PathIndices.find(pathNodeID ? pathNodeID : "");
+  return it != this->PathIndices.end() ? it->second : -1;
+}
+
+//----------------------------------------------------------------------------
+const char* vtkSlicerVisuaLineDeflectionModel::GetPathNodeID(int index)
+{
+  return index >= 0 && index < this->GetNumberOfPaths() ?
+    this->Paths[index].PathNodeID.c_str() : 0;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineDeflectionModel::UpdateStiffness()
+{
+  vtkDataArray* scalars = this->Tissue ?
+    this->Tissue->GetPointData()->GetScalars() : 0;
+  if (!scalars)
+    {
+    this->Stiffnesses.clear();
+    return;
+    }
+  if (!this->Stiffnesses.empty() &&
+      this->StiffnessTime > this->GetMTime() &&
+      this->StiffnessTime > this->Tissue->GetMTime())
+    {
+    return;
+    }
+
+  // Labels and intensities are mapped once per voxel
+  this->Tissue->GetDimensions(this->Dimensions);
+  vtkIdType numberOfVoxels = scalars->GetNumberOfTuples();
+  this->Stiffnesses.resize(numberOfVoxels);
+  double range = this->IntensityRange[1] - this->IntensityRange[0];
+  for (vtkIdType voxel = 0; voxel < numberOfVoxels; ++voxel)
+    {
+    double value = scalars->GetTuple1(voxel);
+    double stiffness = this->DefaultStiffness;
+    if (this->IntensityMapping)
+      {
+      stiffness = range > 0 ?
+        std::min(1.0, std::max(0.0, (value - this->IntensityRange[0]) / range)) :
+        (value >= this->IntensityRange[1] ? 1.0 : 0.0);
+      }
+    else
+      {
+      std::map<int, double>::iterator it =
+        this->LabelStiffnesses.find(static_cast<int>(value));
+      if (it != this->LabelStiffnesses.end())
+        {
+        stiffness = it->second;
+        }
+      }
+    this->Stiffnesses[voxel] = static_cast<float>(stiffness);
+    }
+  this->StiffnessTime.Modified();
+}
+
+//----------------------------------------------------------------------------
+double vtkSlicerVisuaLineDeflectionModel::GetStiffness(const double ras[3])
+{
+  if (this->Stiffnesses.empty())
+    {
+    return this->DefaultStiffness;
+    }
+  vtkIdType voxel = 0;
+  vtkIdType stride = 1;
+  for (int axis = 0; axis < 3; ++axis)
+    {
+    const double* row = this->RASToIJK + 4 * axis;
+    double ijk = row[0] * ras[0] + row[1] * ras[1] + row[2] * ras[2] + row[3];
+    int index = static_cast<int>(floor(ijk + 0.5));
+    if (index < 0 || index >= this->Dimensions[axis])
+      {
+      return this->DefaultStiffness;
+      }
+    voxel += index * stride;
+    stride *= this->Dimensions[axis];
+    }
+  return this->Stiffnesses[voxel];
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineDeflectionModel::SimulatePath(int index)
+{
+  PathEntry& path = this->Paths[index];
+  const double* entry = path.EndPoints;
+  const double* target = path.EndPoints + 3;
+  double direction[3] = { target[0] - entry[0],
+                          target[1] - entry[1],
+                          target[2] - entry[2] };
+  double depth = vtkMath::Normalize(direction);
+  path.Points.assign(entry, entry + 3);
+  if (depth <= 0.0)
+    {
+    std::copy(target, target + 3, path.Tip);
+    path.TipError = 0.0;
+    return;
+    }
+
+  // Bevel direction normal to the insertion axis
+  double reference[3] = { 0.0, 1.0, 0.0 };
+  if (fabs(direction[1]) > 0.9)
+    {
+    reference[1] = 0.0;
+    reference[2] = 1.0;
+    }
+  double normal[3], binormal[3];
+  double projection = vtkMath::Dot(reference, direction);
+  for (int i = 0; i < 3; ++i)
+    {
+    normal[i] = reference[i] - projection * direction[i];
+    }
+  vtkMath::Normalize(normal);
+  vtkMath::Cross(direction, normal, binormal);
+  double bevelAngle = vtkMath::RadiansFromDegrees(this->BevelAngle);
+  for (int i = 0; i < 3; ++i)
+    {
+    normal[i] = cos(bevelAngle) * normal[i] + sin(bevelAngle) * binormal[i];
+    }
+
+  // The tip turns in the bevel plane by the curvature of the tissue at
+  // the start of each step, and moves along the chord of the arc
+  int numberOfSteps = std::max(1, static_cast<int>(ceil(depth / this->StepLength)));
+  double step = depth / numberOfSteps;
+  path.Points.reserve(3 * (numberOfSteps + 1));
+  double position[3] = { entry[0], entry[1], entry[2] };
+  for (int i = 0; i < numberOfSteps; ++i)
+    {
+    double angle = this->Curvature * this->GetStiffness(position) * step;
+    double c = cos(angle);
+    double s = sin(angle);
+    double chordAngle = 0.5 * angle;
+    double chord = angle > 0.0 ? step * sin(chordAngle) / chordAngle : step;
+    for (int j = 0; j < 3; ++j)
+      {
+      double nextDirection = c * direction[j] + s * normal[j];
+      double nextNormal = c * normal[j] - s * direction[j];
+      double chordDirection = cos(chordAngle) * direction[j] + sin(chordAngle) * normal[j];
+      position[j] += chord * chordDirection;
+      direction[j] = nextDirection;
+      normal[j] = nextNormal;
+      }
+    path.Points.insert(path.Points.end(), position, position + 3);
+    }
+  std::copy(position, position + 3, path.Tip);
+  path.TipError = sqrt(vtkMath::Distance2BetweenPoints(position, target));
+}
+
+//----------------------------------------------------------------------------
+VTK_THREAD_RETURN_TYPE vtkSlicerVisuaLineDeflectionModel
+::SimulatePathsThread(void* arg)
+{
+  vtkMultiThreader::ThreadInfo* info =
+    static_cast<vtkMultiThreader::ThreadInfo*>(arg);
+  vtkSlicerVisuaLineDeflectionModel* self =
+    static_cast<vtkSlicerVisuaLineDeflectionModel*>(info->UserData);
+
+  // Each path is written by one thread only
+  int numberOfPaths = static_cast<int>(self->SimulatedPaths.size());
+  for (int i = info->ThreadID; i < numberOfPaths; i += info->NumberOfThreads)
+    {
+    self->SimulatePath(self->SimulatedPaths[i]);
+    }
+  return VTK_THREAD_RETURN_VALUE;
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLineDeflectionModel::Update()
+{
+  // A new model or tissue changes every prediction
+  bool modelModified = this->SimulationTime < this->GetMTime() ||
+    (this->Tissue && this->SimulationTime < this->Tissue->GetMTime());
+  this->SimulatedPaths.clear();
+  for (int i = 0; i < this->GetNumberOfPaths(); ++i)
+    {
+    if (modelModified || this->Paths[i].Modified)
+      {
+      this->SimulatedPaths.push_back(i);
+      }
+    }
+  this->SimulationTime.Modified();
+  int numberOfSimulatedPaths = static_cast<int>(this->SimulatedPaths.size());
+  if (numberOfSimulatedPaths == 0)
+    {
+    return 0;
+    }
+
+  this->UpdateStiffness();
+  vtkNew<vtkMultiThreader> threader;
+  int numberOfThreads = this->NumberOfThreads > 0 ?
+    this->NumberOfThreads : threader->GetNumberOfThreads();
+  threader->SetNumberOfThreads(
+    std::max(1, std::min(numberOfThreads, numberOfSimulatedPaths)));
+  threader->SetSingleMethod(SimulatePathsThread, this);
+  threader->SingleMethodExecute();
+
+  for (int i = 0; i < numberOfSimulatedPaths; ++i)
+    {
+    this->Paths[this->SimulatedPaths[i]].Modified = false;
+    }
+  return numberOfSimulatedPaths;
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLineDeflectionModel::GetSimulatedPathIndex(int n)
+{
+  return n >= 0 && n < static_cast<int>(this->SimulatedPaths.size()) ?
+    this->SimulatedPaths[n] : -1;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineDeflectionModel::GetPredictedTip(int index, double tip[3])
+{
+  if (index < 0 || index >= this->GetNumberOfPaths())
+    {
+    tip[0] = tip[1] = tip[2] = vtkMath::Nan();
+    return;
+    }
+  std::copy(this->Paths[index].Tip, this->Paths[index].Tip + 3, tip);
+}
+
+//----------------------------------------------------------------------------
+double vtkSlicerVisuaLineDeflectionModel::GetTipError(int index)
+{
+  return index >= 0 && index < this->GetNumberOfPaths() ?
+    this->Paths[index].TipError : vtkMath::Nan();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineDeflectionModel::GetPredictedPath(int index, vtkPoints* points)
+{
+  if (!points)
+    {
+    return;
+    }
+  points->Reset();
+  if (index < 0 || index >= this->GetNumberOfPaths())
+    {
+    return;
+    }
+  const std::vector<double>& pathPoints = this->Paths[index].Points;
+  for (size_t i = 0; i + 2 < pathPoints.size(); i += 3)
+    {
+    points->InsertNextPoint(&pathPoints[i]);
+    }
+}
@@ -0,0 +1,176 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Laurent Chauvin, Brigham and Women's
+  Hospital. The project was supported by grants 5P01CA067165,
+  5R01CA124377, 5R01CA138586, 2R44DE019322, 7R01CA124377,
+  5R42CA137886, 8P41EB015898
+
+==============================================================================*/
+
+// .NAME vtkSlicerVisuaLineDeflectionModel - bevel-tip needle deflection
+// .SECTION Description
+// Predicts the trajectory of a bevel-tip needle inserted along straight
+// paths with a kinematic model: the tip follows arcs in the bevel plane
+// whose curvature scales with the stiffness of the tissue it crosses.
+// The needle is inserted from the entry for the planned depth; the tip
+// error is the distance from the predicted tip to the planned target.
+//
+// Stiffness (1 for the reference tissue of the curvature) comes from a
+// tissue volume: per label for label maps, or mapped linearly from the
+// intensity range. It is sampled once per voxel into a stiffness volume,
+// rebuilt only when the volume or the mapping change.
+//
+// Paths keep their predictions: Update() only simulates the paths added
+// or moved since the last update, all of them after a model change.
+// Paths are simulated in parallel.
+
+#ifndef __vtkSlicerVisuaLineDeflectionModel_h
+#define __vtkSlicerVisuaLineDeflectionModel_h
+
+// VTK includes
+#include <vtkMultiThreader.h>
+#include <vtkObject.h>
+#include <vtkSmartPointer.h>
+#include <vtkTimeStamp.h>
+
+// STD includes
+#include <map>
+#include <string>
+#include <vector>
+
+#include "vtkSlicerVisuaLineModuleLogicExport.h"
+
+class vtkImageData;
+class vtkMatrix4x4;
+class vtkPoints;
+
+/// \ingroup Slicer_QtModules_VisuaLine
+class VTK_SLICER_VISUALINE_MODULE_LOGIC_EXPORT vtkSlicerVisuaLineDeflectionModel :
+  public vtkObject
+{
+public:
+
+  static vtkSlicerVisuaLineDeflectionModel *New();
+  vtkTypeMacro(vtkSlicerVisuaLineDeflectionModel, vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  /// Curvature (1/mm) of the needle path in the reference tissue
+  vtkSetClampMacro(Curvature, double, 0.0, VTK_DOUBLE_MAX);
+  vtkGetMacro(Curvature, double);
+
+  /// Orientation (degrees) of the bevel around the insertion axis, from
+  /// the anterior direction (superior for anterior insertions). The
+  /// needle bends towards it.
+  vtkSetMacro(BevelAngle, double);
+  vtkGetMacro(BevelAngle, double);
+
+  /// Insertion step (mm) of the simulation
+  vtkSetClampMacro(StepLength, double, 0.01, VTK_DOUBLE_MAX);
+  vtkGetMacro(StepLength, double);
+
+  vtkSetMacro(NumberOfThreads, int);
+  vtkGetMacro(NumberOfThreads, int);
+
+  /// Tissue volume and its RAS to IJK matrix, none for a uniform tissue
+  void SetTissue(vtkImageData* tissue, vtkMatrix4x4* rasToIJK);
+  vtkImageData* GetTissue();
+
+  /// Stiffness of the unlisted labels and outside the tissue volume
+  vtkSetMacro(DefaultStiffness, double);
+  vtkGetMacro(DefaultStiffness, double);
+
+  /// Stiffness of the voxels of a label
+  void SetLabelStiffness(int label, double stiffness);
+  void RemoveAllLabelStiffnesses();
+
+  /// Map the intensities instead of the labels: stiffness goes from 0 at
+  /// the low end of the range to 1 at the high end.
+  vtkSetMacro(IntensityMapping, int);
+  vtkGetMacro(IntensityMapping, int);
+  vtkBooleanMacro(IntensityMapping, int);
+  vtkSetVector2Macro(IntensityRange, double);
+  vtkGetVector2Macro(IntensityRange, double);
+
+  /// Add a path or move it (world entry and target). Unmoved paths keep
+  /// their prediction. Return its index.
+  int SetPath(const char* pathNodeID, const double entry[3], const double target[3]);
+  /// The last path takes the index of the removed one
+  void RemovePath(const char* pathNodeID);
+  void RemoveAllPaths();
+  int GetNumberOfPaths();
+  int GetPathIndex(const char* pathNodeID);
+  const char* GetPathNodeID(int index);
+
+  /// Simulate the added and moved paths. Return their number.
+  int Update();
+  /// Index of the nth path simulated by the last update
+  int GetSimulatedPathIndex(int n);
+
+  /// Prediction of the last update: tip, distance (mm) from the tip to
+  /// the planned target (NaN if not simulated) and points of the
+  /// predicted trajectory, entry first.
+  void GetPredictedTip(int index, double tip[3]);
+  double GetTipError(int index);
+  void GetPredictedPath(int index, vtkPoints* points);
+
+protected:
+  vtkSlicerVisuaLineDeflectionModel();
+  virtual ~vtkSlicerVisuaLineDeflectionModel();
+
+  void UpdateStiffness();
+  double GetStiffness(const double ras[3]);
+  void SimulatePath(int index);
+  static VTK_THREAD_RETURN_TYPE SimulatePathsThread(void* arg);
+
+  double Curvature;
+  double BevelAngle;
+  double StepLength;
+  int NumberOfThreads;
+  double DefaultStiffness;
+  int IntensityMapping;
+  double IntensityRange[2];
+
+  //BTX
+  vtkSmartPointer<vtkImageData> Tissue;
+  double RASToIJK[16];
+  std::map<int, double> LabelStiffnesses;
+
+  // Stiffness of the tissue voxels
+  std::vector<float> Stiffnesses;
+  int Dimensions[3];
+  vtkTimeStamp StiffnessTime;
+
+  struct PathEntry
+    {
+    std::string PathNodeID;
+    double EndPoints[6];   // entry, target
+    bool Modified;
+    double Tip[3];
+    double TipError;
+    std::vector<double> Points;
+    };
+  std::vector<PathEntry> Paths;
+  std::map<std::string, int> PathIndices;
+  std::vector<int> SimulatedPaths;
+  vtkTimeStamp SimulationTime;
+  //ETX
+
+private:
+  vtkSlicerVisuaLineDeflectionModel(const vtkSlicerVisuaLineDeflectionModel&); // Not implemented
+  void operator=(const vtkSlicerVisuaLineDeflectionModel&);                    // Not implemented
+};
+
+#endif
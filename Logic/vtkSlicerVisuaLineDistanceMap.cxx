@@ -0,0 +1,431 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Laurent Chauvin, Brigham and Women's
+  Hospital. The project was supported by grants 5P01CA067165,
+  5R01CA124377, 5R01CA138586, 2R44DE019322, 7R01CA124377,
+  5R42CA137886, 8P41EB015898
+
+==============================================================================*/
+
+// VisuaLine Logic includes
+#include "vtkSlicerVisuaLineAnalysisCache.h"
+#include "vtkSlicerVisuaLineDistanceMap.h"
+
+// VTK includes
+#include <vtkDataArray.h>
+#include <vtkImageData.h>
+#include <vtkMath.h>
+#include <vtkMatrix4x4.h>
+#include <vtkObjectFactory.h>
+#include <vtkPointData.h>
+
+// STD includes
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+//----------------------------------------------------------------------------
+// Squared distance transform of one line (Felzenszwalb and Huttenlocher).
+// Sites at VTK_DOUBLE_MAX are empty. 'v' and 'z' hold n and n + 1 values.
+void DistanceTransformLine(const double* f, int n, double spacing,
+                           double* d, int* v, double* z)
+{
+  int k = -1;
+  for (int q = 0; q < n; ++q)
+    {
+    if (f[q] >= VTK_DOUBLE_MAX)
+      {
+      continue;
+      }
+    double xq = q * spacing;
+    double s = -VTK_DOUBLE_MAX;
+    while (k >= 0)
+      {
+      double xv = v[k] * spacing;
+      s = ((f[q] + xq * xq) - (f[v[k]] + xv * xv)) / (2.0 * (xq - xv));
+      if (s > z[k])
+        {
+        break;
+        }
+      --k;
+      }
+    ++k;
+    v[k] = q;
+    z[k] = k == 0 ? -VTK_DOUBLE_MAX : s;
+    }
+  if (k < 0)
+    {
+    std::fill(d, d + n, VTK_DOUBLE_MAX);
+    return;
+    }
+  z[k + 1] = VTK_DOUBLE_MAX;
+
+  int j = 0;
+  for (int q = 0; q < n; ++q)
+    {
+    double x = q * spacing;
+    while (z[j + 1] < x)
+      {
+      ++j;
+      }
+    double dx = x - v[j] * spacing;
+    d[q] = dx * dx + f[v[j]];
+    }
+}
+}
+
+//----------------------------------------------------------------------------
+vtkStandardNewMacro(vtkSlicerVisuaLineDistanceMap);
+
+//----------------------------------------------------------------------------
+vtkSlicerVisuaLineDistanceMap::vtkSlicerVisuaLineDistanceMap()
+{
+  vtkMatrix4x4::Identity(this->RASToIJK);
+  this->Dimensions[0] = this->Dimensions[1] = this->Dimensions[2] = 0;
+  this->MinimumStep = 0.5;
+  this->DistanceValues = 0;
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerVisuaLineDistanceMap::~vtkSlicerVisuaLineDistanceMap()
+{
+  this->ReleaseDistances();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineDistanceMap::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os, indent);
+  os << indent << "NumberOfRiskLabels: " << this->RiskLabels.size() << "\n";
+  os << indent << "Dimensions: " << this->Dimensions[0] << " "
+     << this->Dimensions[1] << " " << this->Dimensions[2] << "\n";
+  os << indent << "HasRisks: " << this->HasRisks() << "\n";
+  os << indent << "Key: " << this->Key << "\n";
+  os << indent << "Cached: " << !this->MappedKey.empty() << "\n";
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineDistanceMap
+::SetLabelMap(vtkImageData* labelMap, vtkMatrix4x4* rasToIJK)
+{
+  double matrix[16];
+  vtkMatrix4x4::Identity(matrix);
+  if (rasToIJK)
+    {
+    for (int i = 0; i < 4; ++i)
+      {
+      for (int j = 0; j < 4; ++j)
+        {
+        matrix[4 * i + j] = rasToIJK->GetElement(i, j);
+        }
+      }
+    }
+  if (this->LabelMap == labelMap &&
+      std::equal(matrix, matrix + 16, this->RASToIJK))
+    {
+    return;
+    }
+  this->LabelMap = labelMap;
+  std::copy(matrix, matrix + 16, this->RASToIJK);
+  this->LabelsTime.Modified();
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+vtkImageData* vtkSlicerVisuaLineDistanceMap::GetLabelMap()
+{
+  return this->LabelMap;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineDistanceMap::AddRiskLabel(int label)
+{
+  if (this->RiskLabels.insert(label).second)
+    {
+    this->LabelsTime.Modified();
+    this->Modified();
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineDistanceMap::RemoveAllRiskLabels()
+{
+  if (!this->RiskLabels.empty())
+    {
+    this->RiskLabels.clear();
+    this->LabelsTime.Modified();
+    this->Modified();
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineDistanceMap::SetCache(vtkSlicerVisuaLineAnalysisCache* cache)
+{
+  if (this->Cache == cache)
+    {
+    return;
+    }
+  // A mapping belongs to its cache: build again
+  this->ReleaseDistances();
+  this->Cache = cache;
+  this->LabelsTime.Modified();
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerVisuaLineAnalysisCache* vtkSlicerVisuaLineDistanceMap::GetCache()
+{
+  return this->Cache;
+}
+
+//----------------------------------------------------------------------------
+std::string vtkSlicerVisuaLineDistanceMap::GetKey()
+{
+  return this->Key;
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerVisuaLineDistanceMap::HasRisks()
+{
+  return this->DistanceValues != 0;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineDistanceMap::ReleaseDistances()
+{
+  if (!this->MappedKey.empty() && this->Cache)
+    {
+    this->Cache->Unmap(this->MappedKey);
+    }
+  this->MappedKey.clear();
+  std::vector<float>().swap(this->Distances);
+  this->DistanceValues = 0;
+}
+
+//----------------------------------------------------------------------------
+double vtkSlicerVisuaLineDistanceMap::GetMinimumStep()
+{
+  return this->MinimumStep;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineDistanceMap::Update()
+{
+  if (this->BuildTime > this->LabelsTime &&
+      (!this->LabelMap || this->BuildTime > this->LabelMap->GetMTime()))
+    {
+    return;
+    }
+
+  this->ReleaseDistances();
+  this->Key.clear();
+  this->Dimensions[0] = this->Dimensions[1] = this->Dimensions[2] = 0;
+  this->BuildTime.Modified();
+
+  vtkDataArray* scalars = this->LabelMap ?
+    this->LabelMap->GetPointData()->GetScalars() : 0;
+  if (!scalars)
+    {
+    return;
+    }
+  int* dimensions = this->LabelMap->GetDimensions();
+  int nx = dimensions[0], ny = dimensions[1], nz = dimensions[2];
+  vtkIdType numberOfVoxels = static_cast<vtkIdType>(nx) * ny * nz;
+  if (numberOfVoxels <= 0 || scalars->GetNumberOfTuples() < numberOfVoxels)
+    {
+    return;
+    }
+  std::copy(dimensions, dimensions + 3, this->Dimensions);
+
+  // Everything the distances depend on
+  vtkSlicerVisuaLineAnalysisCache::Key key;
+  key.Add(std::string("DistanceMap1"));
+  key.Add(dimensions, 3 * sizeof(int));
+  key.Add(this->RASToIJK, sizeof(this->RASToIJK));
+  key.Add(scalars->GetDataType());
+  key.Add(scalars->GetNumberOfComponents());
+  key.Add(scalars->GetVoidPointer(0), static_cast<size_t>(numberOfVoxels) *
+          scalars->GetNumberOfComponents() * scalars->GetDataTypeSize());
+  for (std::set<int>::iterator label = this->RiskLabels.begin();
+       label != this->RiskLabels.end(); ++label)
+    {
+    key.Add(*label);
+    }
+  this->Key = key.ToString();
+
+  // Voxel size is the length of the IJK axes in RAS
+  double ijkToRAS[16];
+  vtkMatrix4x4::Invert(this->RASToIJK, ijkToRAS);
+  double spacing[3];
+  for (int axis = 0; axis < 3; ++axis)
+    {
+    spacing[axis] = sqrt(ijkToRAS[axis] * ijkToRAS[axis] +
+                         ijkToRAS[4 + axis] * ijkToRAS[4 + axis] +
+                         ijkToRAS[8 + axis] * ijkToRAS[8 + axis]);
+    }
+  this->MinimumStep = 0.5 * std::min(spacing[0], std::min(spacing[1], spacing[2]));
+
+  vtkIdType mapSize = numberOfVoxels * static_cast<vtkIdType>(sizeof(float));
+  if (this->Cache)
+    {
+    vtkIdType size = 0;
+    const void* cached = this->Cache->Map(this->Key, size);
+    if (cached && size == mapSize)
+      {
+      this->DistanceValues = static_cast<const float*>(cached);
+      this->MappedKey = this->Key;
+      return;
+      }
+    if (cached)
+      {
+      this->Cache->Unmap(this->Key);
+      }
+    }
+
+  std::vector<double> distances(numberOfVoxels);
+  bool hasRisks = false;
+  for (vtkIdType voxel = 0; voxel < numberOfVoxels; ++voxel)
+    {
+    bool risk = this->RiskLabels.count(static_cast<int>(scalars->GetTuple1(voxel))) > 0;
+    distances[voxel] = risk ? 0.0 : VTK_DOUBLE_MAX;
+    hasRisks = hasRisks || risk;
+    }
+  if (!hasRisks)
+    {
+    return;
+    }
+
+  // Separable exact transform, one axis at a time
+  int maximumDimension = std::max(nx, std::max(ny, nz));
+  std::vector<double> line(maximumDimension), result(maximumDimension);
+  std::vector<double> z(maximumDimension + 1);
+  std::vector<int> v(maximumDimension);
+  vtkIdType strides[3] = { 1, nx, static_cast<vtkIdType>(nx) * ny };
+  for (int axis = 0; axis < 3; ++axis)
+    {
+    int n = dimensions[axis];
+    int other1 = (axis + 1) % 3, other2 = (axis + 2) % 3;
+    for (int b = 0; b < dimensions[other2]; ++b)
+      {
+      for (int a = 0; a < dimensions[other1]; ++a)
+        {
+        vtkIdType start = a * strides[other1] + b * strides[other2];
+        for (int i = 0; i < n; ++i)
+          {
+          line[i] = distances[start + i * strides[axis]];
+          }
+        DistanceTransformLine(&line[0], n, spacing[axis], &result[0], &v[0], &z[0]);
+        for (int i = 0; i < n; ++i)
+          {
+          distances[start + i * strides[axis]] = result[i];
+          }
+        }
+      }
+    }
+
+  this->Distances.resize(numberOfVoxels);
+  for (vtkIdType voxel = 0; voxel < numberOfVoxels; ++voxel)
+    {
+    this->Distances[voxel] = static_cast<float>(sqrt(distances[voxel]));
+    }
+  this->DistanceValues = &this->Distances[0];
+  if (this->Cache)
+    {
+    this->Cache->Store(this->Key, this->DistanceValues, mapSize);
+    this->Cache->Flush();
+    }
+}
+
+//----------------------------------------------------------------------------
+vtkIdType vtkSlicerVisuaLineDistanceMap::GetVoxel(const double ras[3])
+{
+  vtkIdType voxel = 0;
+  vtkIdType stride = 1;
+  for (int axis = 0; axis < 3; ++axis)
+    {
+    const double* row = this->RASToIJK + 4 * axis;
+    double ijk = row[0] * ras[0] + row[1] * ras[1] + row[2] * ras[2] + row[3];
+    int index = static_cast<int>(floor(ijk + 0.5));
+    if (index < 0 || index >= this->Dimensions[axis])
+      {
+      return -1;
+      }
+    voxel += index * stride;
+    stride *= this->Dimensions[axis];
+    }
+  return voxel;
+}
+
+//----------------------------------------------------------------------------
+vtkIdType vtkSlicerVisuaLineDistanceMap::GetClosestVoxel(const double ras[3])
+{
+  vtkIdType voxel = 0;
+  vtkIdType stride = 1;
+  for (int axis = 0; axis < 3; ++axis)
+    {
+    const double* row = this->RASToIJK + 4 * axis;
+    double ijk = row[0] * ras[0] + row[1] * ras[1] + row[2] * ras[2] + row[3];
+    int index = static_cast<int>(floor(ijk + 0.5));
+    index = std::max(0, std::min(index, this->Dimensions[axis] - 1));
+    voxel += index * stride;
+    stride *= this->Dimensions[axis];
+    }
+  return voxel;
+}
+
+//----------------------------------------------------------------------------
+double vtkSlicerVisuaLineDistanceMap::GetDistance(const double ras[3])
+{
+  if (!this->DistanceValues)
+    {
+    return VTK_DOUBLE_MAX;
+    }
+  return this->DistanceValues[this->GetClosestVoxel(ras)];
+}
+
+//----------------------------------------------------------------------------
+double vtkSlicerVisuaLineDistanceMap
+::GetMinimumDistance(const double from[3], const double to[3],
+                     double stopDistance, double tolerance)
+{
+  if (!this->DistanceValues)
+    {
+    return VTK_DOUBLE_MAX;
+    }
+  double direction[3] = { to[0] - from[0], to[1] - from[1], to[2] - from[2] };
+  double length = vtkMath::Normalize(direction);
+
+  // The distance changes at most as fast as the position: no risk is
+  // closer than 'd - step' within a step.
+  double minimum = VTK_DOUBLE_MAX;
+  double t = 0.0;
+  while (true)
+    {
+    double point[3] = { from[0] + t * direction[0],
+                        from[1] + t * direction[1],
+                        from[2] + t * direction[2] };
+    double distance = this->DistanceValues[this->GetClosestVoxel(point)];
+    minimum = std::min(minimum, distance);
+    if (minimum <= stopDistance || t >= length)
+      {
+      break;
+      }
+    double bound = std::max(stopDistance, minimum - tolerance);
+    t = std::min(t + std::max(distance - bound, this->MinimumStep), length);
+    }
+  return minimum;
+}
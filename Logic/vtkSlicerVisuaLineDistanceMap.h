@@ -0,0 +1,135 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Laurent Chauvin, Brigham and Women's
+  Hospital. The project was supported by grants 5P01CA067165,
+  5R01CA124377, 5R01CA138586, 2R44DE019322, 7R01CA124377,
+  5R42CA137886, 8P41EB015898
+
+==============================================================================*/
+
+// .NAME vtkSlicerVisuaLineDistanceMap - distance to risk structures
+// .SECTION Description
+// Euclidean distance (mm) from every voxel of a label map to the closest
+// voxel of a risk label. The map is built by Update() with a separable
+// exact transform and kept until the label map, its geometry or the risk
+// labels change, so several analyses can share it. Queries are read only
+// and may run from several threads.
+//
+// With a cache, built maps are stored under a key of the label map
+// content, its geometry and the risk labels, and mapped back from disk
+// when the same data is analyzed again.
+
+#ifndef __vtkSlicerVisuaLineDistanceMap_h
+#define __vtkSlicerVisuaLineDistanceMap_h
+
+// VTK includes
+#include <vtkObject.h>
+#include <vtkSmartPointer.h>
+#include <vtkTimeStamp.h>
+
+// STD includes
+#include <set>
+#include <string>
+#include <vector>
+
+#include "vtkSlicerVisuaLineModuleLogicExport.h"
+
+class vtkImageData;
+class vtkMatrix4x4;
+class vtkSlicerVisuaLineAnalysisCache;
+
+/// \ingroup Slicer_QtModules_VisuaLine
+class VTK_SLICER_VISUALINE_MODULE_LOGIC_EXPORT vtkSlicerVisuaLineDistanceMap :
+  public vtkObject
+{
+public:
+
+  static vtkSlicerVisuaLineDistanceMap *New();
+  vtkTypeMacro(vtkSlicerVisuaLineDistanceMap, vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  /// Label map and its RAS to IJK matrix. Setting the same ones again
+  /// keeps the map.
+  void SetLabelMap(vtkImageData* labelMap, vtkMatrix4x4* rasToIJK);
+  vtkImageData* GetLabelMap();
+
+  void AddRiskLabel(int label);
+  void RemoveAllRiskLabels();
+
+  /// Cache of the built maps, none by default
+  void SetCache(vtkSlicerVisuaLineAnalysisCache* cache);
+  vtkSlicerVisuaLineAnalysisCache* GetCache();
+
+  /// Build the map if the label map or the labels changed
+  void Update();
+
+  //BTX
+  /// Hash of the label map content, its geometry and the risk labels at
+  /// the last update, empty without label map. Base of the cache keys of
+  /// results derived from the label map.
+  std::string GetKey();
+  //ETX
+
+  /// True if the label map has risk voxels
+  bool HasRisks();
+
+  /// Voxel of a RAS point, -1 if outside the label map
+  vtkIdType GetVoxel(const double ras[3]);
+
+  /// Distance (mm) to the closest risk voxel. Outside the label map, the
+  /// distance at the closest voxel (a lower bound). VTK_DOUBLE_MAX if
+  /// there is no risk.
+  double GetDistance(const double ras[3]);
+
+  /// Smallest distance along a segment. Marching stops once below
+  /// 'stopDistance'; otherwise the minimum is found within 'tolerance'.
+  double GetMinimumDistance(const double from[3], const double to[3],
+                            double stopDistance, double tolerance);
+
+  /// Half of the smallest voxel size
+  double GetMinimumStep();
+
+protected:
+  vtkSlicerVisuaLineDistanceMap();
+  virtual ~vtkSlicerVisuaLineDistanceMap();
+
+  //BTX
+  vtkIdType GetClosestVoxel(const double ras[3]);
+  void ReleaseDistances();
+
+  vtkSmartPointer<vtkImageData> LabelMap;
+  double RASToIJK[16];
+  std::set<int> RiskLabels;
+  vtkTimeStamp LabelsTime;
+
+  vtkSmartPointer<vtkSlicerVisuaLineAnalysisCache> Cache;
+  std::string Key;
+
+  // Distances of the voxels, in Distances or in a cache mapping
+  const float* DistanceValues;
+  std::vector<float> Distances;
+  std::string MappedKey;
+  int Dimensions[3];
+  double MinimumStep;
+  vtkTimeStamp BuildTime;
+  //ETX
+
+private:
+  vtkSlicerVisuaLineDistanceMap(const vtkSlicerVisuaLineDistanceMap&); // Not implemented
+  void operator=(const vtkSlicerVisuaLineDistanceMap&);                // Not implemented
+};
+
+#endif
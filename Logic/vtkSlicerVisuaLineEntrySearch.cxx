@@ -0,0 +1,395 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Laurent Chauvin, Brigham and Women's
+  Hospital. The project was supported by grants 5P01CA067165,
+  5R01CA124377, 5R01CA138586, 2R44DE019322, 7R01CA124377,
+  5R42CA137886, 8P41EB015898
+
+==============================================================================*/
+
+// VisuaLine Logic includes
+#include "vtkSlicerVisuaLineDistanceMap.h"
+#include "vtkSlicerVisuaLineEntrySearch.h"
+
+// VTK includes
+#include <vtkCellArray.h>
+#include <vtkDataArray.h>
+#include <vtkIdList.h>
+#include <vtkMath.h>
+#include <vtkNew.h>
+#include <vtkObjectFactory.h>
+#include <vtkPointData.h>
+#include <vtkPointLocator.h>
+#include <vtkPolyData.h>
+
+// STD includes
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+struct CostLess
+{
+  CostLess(const std::vector<double>& costs) : Costs(costs) {}
+  bool operator()(int a, int b) const
+    {
+    return this->Costs[a] < this->Costs[b];
+    }
+  const std::vector<double>& Costs;
+};
+}
+
+//----------------------------------------------------------------------------
+vtkStandardNewMacro(vtkSlicerVisuaLineEntrySearch);
+
+//----------------------------------------------------------------------------
+vtkSlicerVisuaLineEntrySearch::vtkSlicerVisuaLineEntrySearch()
+{
+  this->MinimumLength = 0.0;
+  this->MaximumLength = 150.0;
+  this->MinimumClearance = 0.0;
+  this->MaximumAngle = 60.0;
+  this->LengthWeight = 1.0;
+  this->AngleWeight = 1.0;
+  this->ClearanceWeight = 1.0;
+  this->ClearanceSaturation = 20.0;
+  this->MinimumSpacing = 5.0;
+  this->NumberOfThreads = 0;
+  this->Target[0] = this->Target[1] = this->Target[2] = 0.0;
+  this->DistanceMap = vtkSmartPointer<vtkSlicerVisuaLineDistanceMap>::New();
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerVisuaLineEntrySearch::~vtkSlicerVisuaLineEntrySearch()
+{
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineEntrySearch::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os, indent);
+  os << indent << "MinimumLength: " << this->MinimumLength << "\n";
+  os << indent << "MaximumLength: " << this->MaximumLength << "\n";
+  os << indent << "MinimumClearance: " << this->MinimumClearance << "\n";
+  os << indent << "MaximumAngle: " << this->MaximumAngle << "\n";
+  os << indent << "LengthWeight: " << this->LengthWeight << "\n";
+  os << indent << "AngleWeight: " << this->AngleWeight << "\n";
+  os << indent << "ClearanceWeight: " << this->ClearanceWeight << "\n";
+  os << indent << "ClearanceSaturation: " << this->ClearanceSaturation << "\n";
+  os << indent << "MinimumSpacing: " << this->MinimumSpacing << "\n";
+  os << indent << "NumberOfThreads: " << this->NumberOfThreads << "\n";
+  os << indent << "NumberOfCandidates: " << this->GetNumberOfCandidates() << "\n";
+  os << indent << "NumberOfResults: " << this->GetNumberOfResults() << "\n";
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineEntrySearch::SetSkinSurface(vtkPolyData* surface)
+{
+  if (this->SkinSurface == surface)
+    {
+    return;
+    }
+  this->SkinSurface = surface;
+  this->Locator = 0;
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+vtkPolyData* vtkSlicerVisuaLineEntrySearch::GetSkinSurface()
+{
+  return this->SkinSurface;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineEntrySearch
+::SetDistanceMap(vtkSlicerVisuaLineDistanceMap* distanceMap)
+{
+  if (this->DistanceMap == distanceMap)
+    {
+    return;
+    }
+  this->DistanceMap = distanceMap;
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerVisuaLineDistanceMap* vtkSlicerVisuaLineEntrySearch::GetDistanceMap()
+{
+  return this->DistanceMap;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineEntrySearch::UpdateSurface()
+{
+  if (!this->SkinSurface || !this->SkinSurface->GetPoints())
+    {
+    this->Locator = 0;
+    this->Normals.clear();
+    return;
+    }
+  if (this->Locator && this->SurfaceTime > this->SkinSurface->GetMTime())
+    {
+    return;
+    }
+
+  this->Locator = vtkSmartPointer<vtkPointLocator>::New();
+  this->Locator->SetDataSet(this->SkinSurface);
+  this->Locator->BuildLocator();
+
+  vtkIdType numberOfPoints = this->SkinSurface->GetNumberOfPoints();
+  this->Normals.assign(3 * numberOfPoints, 0.0);
+  vtkDataArray* pointNormals = this->SkinSurface->GetPointData()->GetNormals();
+  if (pointNormals && pointNormals->GetNumberOfComponents() == 3 &&
+      pointNormals->GetNumberOfTuples() == numberOfPoints)
+    {
+    for (vtkIdType i = 0; i < numberOfPoints; ++i)
+      {
+      pointNormals->GetTuple(i, &this->Normals[3 * i]);
+      }
+    }
+  else
+    {
+    // Area weighted polygon normals (Newell), summed at the points
+    vtkCellArray* polys = this->SkinSurface->GetPolys();
+    vtkIdType numberOfCellPoints = 0;
+    vtkIdType* cellPoints = 0;
+    for (polys->InitTraversal(); polys->GetNextCell(numberOfCellPoints, cellPoints);)
+      {
+      double normal[3] = { 0.0, 0.0, 0.0 };
+      for (vtkIdType i = 0; i < numberOfCellPoints; ++i)
+        {
+        double p[3], q[3];
+        this->SkinSurface->GetPoint(cellPoints[i], p);
+        this->SkinSurface->GetPoint(cellPoints[(i + 1) % numberOfCellPoints], q);
+        normal[0] += (p[1] - q[1]) * (p[2] + q[2]);
+        normal[1] += (p[2] - q[2]) * (p[0] + q[0]);
+        normal[2] += (p[0] - q[0]) * (p[1] + q[1]);
+        }
+      for (vtkIdType i = 0; i < numberOfCellPoints; ++i)
+        {
+        double* pointNormal = &this->Normals[3 * cellPoints[i]];
+        pointNormal[0] += normal[0];
+        pointNormal[1] += normal[1];
+        pointNormal[2] += normal[2];
+        }
+      }
+    }
+  for (vtkIdType i = 0; i < numberOfPoints; ++i)
+    {
+    vtkMath::Normalize(&this->Normals[3 * i]);
+    }
+  this->SurfaceTime.Modified();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineEntrySearch::EvaluateCandidate(int candidate)
+{
+  this->Costs[candidate] = VTK_DOUBLE_MAX;
+  vtkIdType pointId = this->Candidates[candidate];
+
+  // Cheap constraints first, the clearance marches through the map
+  double entry[3];
+  this->SkinSurface->GetPoint(pointId, entry);
+  double direction[3] = { entry[0] - this->Target[0],
+                          entry[1] - this->Target[1],
+                          entry[2] - this->Target[2] };
+  double length = vtkMath::Normalize(direction);
+  this->Lengths[candidate] = length;
+  if (length < this->MinimumLength || length > this->MaximumLength || length == 0.0)
+    {
+    return;
+    }
+
+  // Skin normals may point inwards
+  double cosine = fabs(vtkMath::Dot(direction, &this->Normals[3 * pointId]));
+  double angle = vtkMath::DegreesFromRadians(acos(std::min(cosine, 1.0)));
+  this->Angles[candidate] = angle;
+  if (angle > this->MaximumAngle)
+    {
+    return;
+    }
+
+  double clearance = VTK_DOUBLE_MAX;
+  vtkSlicerVisuaLineDistanceMap* distanceMap = this->DistanceMap;
+  if (distanceMap->HasRisks())
+    {
+    clearance = distanceMap->GetMinimumDistance(
+      entry, this->Target, this->MinimumClearance, distanceMap->GetMinimumStep());
+    if (clearance < this->MinimumClearance)
+      {
+      this->Clearances[candidate] = clearance;
+      return;
+      }
+    }
+  this->Clearances[candidate] = distanceMap->HasRisks() ? clearance : vtkMath::Nan();
+
+  double cost = 0.0;
+  if (this->MaximumLength > 0)
+    {
+    cost += this->LengthWeight * length / this->MaximumLength;
+    }
+  if (this->MaximumAngle > 0)
+    {
+    cost += this->AngleWeight * angle / this->MaximumAngle;
+    }
+  if (this->ClearanceSaturation > 0)
+    {
+    cost += this->ClearanceWeight *
+      (1.0 - std::min(clearance, this->ClearanceSaturation) / this->ClearanceSaturation);
+    }
+  this->Costs[candidate] = cost;
+}
+
+//----------------------------------------------------------------------------
+VTK_THREAD_RETURN_TYPE vtkSlicerVisuaLineEntrySearch
+::EvaluateCandidatesThread(void* arg)
+{
+  vtkMultiThreader::ThreadInfo* info =
+    static_cast<vtkMultiThreader::ThreadInfo*>(arg);
+  vtkSlicerVisuaLineEntrySearch* self =
+    static_cast<vtkSlicerVisuaLineEntrySearch*>(info->UserData);
+
+  int numberOfCandidates = self->GetNumberOfCandidates();
+  for (int i = info->ThreadID; i < numberOfCandidates; i += info->NumberOfThreads)
+    {
+    self->EvaluateCandidate(i);
+    }
+  return VTK_THREAD_RETURN_VALUE;
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLineEntrySearch::Search(const double target[3], int k)
+{
+  this->Candidates.clear();
+  this->Results.clear();
+  this->UpdateSurface();
+  if (!this->Locator || k <= 0)
+    {
+    return 0;
+    }
+  if (!this->DistanceMap)
+    {
+    this->DistanceMap = vtkSmartPointer<vtkSlicerVisuaLineDistanceMap>::New();
+    }
+  this->DistanceMap->Update();
+  std::copy(target, target + 3, this->Target);
+
+  // Only the skin within reach of the target
+  vtkNew<vtkIdList> pointIds;
+  this->Locator->FindPointsWithinRadius(this->MaximumLength, this->Target,
+                                        pointIds.GetPointer());
+  int numberOfCandidates = static_cast<int>(pointIds->GetNumberOfIds());
+  this->Candidates.resize(numberOfCandidates);
+  for (int i = 0; i < numberOfCandidates; ++i)
+    {
+    this->Candidates[i] = pointIds->GetId(i);
+    }
+  this->Costs.assign(numberOfCandidates, VTK_DOUBLE_MAX);
+  this->Lengths.assign(numberOfCandidates, vtkMath::Nan());
+  this->Clearances.assign(numberOfCandidates, vtkMath::Nan());
+  this->Angles.assign(numberOfCandidates, vtkMath::Nan());
+  if (numberOfCandidates == 0)
+    {
+    return 0;
+    }
+
+  vtkNew<vtkMultiThreader> threader;
+  int numberOfThreads = this->NumberOfThreads > 0 ?
+    this->NumberOfThreads : threader->GetNumberOfThreads();
+  threader->SetNumberOfThreads(std::max(1, std::min(numberOfThreads, numberOfCandidates)));
+  threader->SetSingleMethod(EvaluateCandidatesThread, this);
+  threader->SingleMethodExecute();
+
+  // Best first, skipping entries too close to a better one
+  std::vector<int> order;
+  for (int i = 0; i < numberOfCandidates; ++i)
+    {
+    if (this->Costs[i] < VTK_DOUBLE_MAX)
+      {
+      order.push_back(i);
+      }
+    }
+  std::sort(order.begin(), order.end(), CostLess(this->Costs));
+  double minimumSpacing2 = this->MinimumSpacing * this->MinimumSpacing;
+  for (size_t i = 0; i < order.size() && static_cast<int>(this->Results.size()) < k; ++i)
+    {
+    double entry[3];
+    this->SkinSurface->GetPoint(this->Candidates[order[i]], entry);
+    bool spaced = true;
+    for (size_t j = 0; j < this->Results.size() && spaced; ++j)
+      {
+      double other[3];
+      this->SkinSurface->GetPoint(this->Candidates[this->Results[j]], other);
+      spaced = vtkMath::Distance2BetweenPoints(entry, other) >= minimumSpacing2;
+      }
+    if (spaced)
+      {
+      this->Results.push_back(order[i]);
+      }
+    }
+  return static_cast<int>(this->Results.size());
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLineEntrySearch::GetNumberOfCandidates()
+{
+  return static_cast<int>(this->Candidates.size());
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLineEntrySearch::GetNumberOfResults()
+{
+  return static_cast<int>(this->Results.size());
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineEntrySearch::GetResultEntry(int result, double entry[3])
+{
+  if (result < 0 || result >= this->GetNumberOfResults())
+    {
+    entry[0] = entry[1] = entry[2] = 0.0;
+    return;
+    }
+  this->SkinSurface->GetPoint(this->Candidates[this->Results[result]], entry);
+}
+
+//----------------------------------------------------------------------------
+double vtkSlicerVisuaLineEntrySearch::GetResultCost(int result)
+{
+  return result >= 0 && result < this->GetNumberOfResults() ?
+    this->Costs[this->Results[result]] : vtkMath::Nan();
+}
+
+//----------------------------------------------------------------------------
+double vtkSlicerVisuaLineEntrySearch::GetResultLength(int result)
+{
+  return result >= 0 && result < this->GetNumberOfResults() ?
+    this->Lengths[this->Results[result]] : vtkMath::Nan();
+}
+
+//----------------------------------------------------------------------------
+double vtkSlicerVisuaLineEntrySearch::GetResultClearance(int result)
+{
+  return result >= 0 && result < this->GetNumberOfResults() ?
+    this->Clearances[this->Results[result]] : vtkMath::Nan();
+}
+
+//----------------------------------------------------------------------------
+double vtkSlicerVisuaLineEntrySearch::GetResultAngle(int result)
+{
+  return result >= 0 && result < this->GetNumberOfResults() ?
+    this->Angles[this->Results[result]] : vtkMath::Nan();
+}
@@ -0,0 +1,160 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Laurent Chauvin, Brigham and Women's
+  Hospital. The project was supported by grants 5P01CA067165,
+  5R01CA124377, 5R01CA138586, 2R44DE019322, 7R01CA124377,
+  5R42CA137886, 8P41EB015898
+
+==============================================================================*/
+
+// .NAME vtkSlicerVisuaLineEntrySearch - entry point search over a skin surface
+// .SECTION Description
+// Proposes entry points for a target among the points of a skin surface.
+// Points within reach are found with a point locator, then scored in
+// parallel on path length, clearance to the risk structures of a
+// vtkSlicerVisuaLineDistanceMap and angle to the skin normal. Candidates
+// breaking a constraint are rejected. The best entries are returned,
+// at least MinimumSpacing apart so they are real alternatives.
+//
+// Normals and the locator are built on the first search and kept until
+// the surface changes; the distance map is shared with other analyses.
+
+#ifndef __vtkSlicerVisuaLineEntrySearch_h
+#define __vtkSlicerVisuaLineEntrySearch_h
+
+// VTK includes
+#include <vtkMultiThreader.h>
+#include <vtkObject.h>
+#include <vtkSmartPointer.h>
+#include <vtkTimeStamp.h>
+
+// STD includes
+#include <vector>
+
+#include "vtkSlicerVisuaLineModuleLogicExport.h"
+
+class vtkPointLocator;
+class vtkPolyData;
+class vtkSlicerVisuaLineDistanceMap;
+
+/// \ingroup Slicer_QtModules_VisuaLine
+class VTK_SLICER_VISUALINE_MODULE_LOGIC_EXPORT vtkSlicerVisuaLineEntrySearch :
+  public vtkObject
+{
+public:
+
+  static vtkSlicerVisuaLineEntrySearch *New();
+  vtkTypeMacro(vtkSlicerVisuaLineEntrySearch, vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  /// Skin surface in world coordinates. Point normals are used if any.
+  void SetSkinSurface(vtkPolyData* surface);
+  vtkPolyData* GetSkinSurface();
+
+  /// Risk distances. The search owns one by default.
+  void SetDistanceMap(vtkSlicerVisuaLineDistanceMap* distanceMap);
+  vtkSlicerVisuaLineDistanceMap* GetDistanceMap();
+
+  /// Constraints: path length range (mm), smallest clearance to a risk
+  /// (mm) and largest angle between the path and the skin normal (degrees)
+  vtkSetMacro(MinimumLength, double);
+  vtkGetMacro(MinimumLength, double);
+  vtkSetMacro(MaximumLength, double);
+  vtkGetMacro(MaximumLength, double);
+  vtkSetMacro(MinimumClearance, double);
+  vtkGetMacro(MinimumClearance, double);
+  vtkSetMacro(MaximumAngle, double);
+  vtkGetMacro(MaximumAngle, double);
+
+  /// Cost of a candidate, lower is better:
+  ///   LengthWeight * length / MaximumLength
+  /// + AngleWeight * angle / MaximumAngle
+  /// + ClearanceWeight * (1 - min(clearance, ClearanceSaturation) / ClearanceSaturation)
+  vtkSetMacro(LengthWeight, double);
+  vtkGetMacro(LengthWeight, double);
+  vtkSetMacro(AngleWeight, double);
+  vtkGetMacro(AngleWeight, double);
+  vtkSetMacro(ClearanceWeight, double);
+  vtkGetMacro(ClearanceWeight, double);
+  vtkSetMacro(ClearanceSaturation, double);
+  vtkGetMacro(ClearanceSaturation, double);
+
+  /// Smallest distance (mm) between two proposed entries
+  vtkSetMacro(MinimumSpacing, double);
+  vtkGetMacro(MinimumSpacing, double);
+
+  vtkSetMacro(NumberOfThreads, int);
+  vtkGetMacro(NumberOfThreads, int);
+
+  /// Score the entries for a target and keep the 'k' best.
+  /// Return the number of results.
+  int Search(const double target[3], int k);
+
+  /// Number of candidates within reach in the last search
+  int GetNumberOfCandidates();
+
+  /// Results of the last search, best first
+  int GetNumberOfResults();
+  void GetResultEntry(int result, double entry[3]);
+  double GetResultCost(int result);
+  double GetResultLength(int result);
+  double GetResultClearance(int result);
+  double GetResultAngle(int result);
+
+protected:
+  vtkSlicerVisuaLineEntrySearch();
+  virtual ~vtkSlicerVisuaLineEntrySearch();
+
+  void UpdateSurface();
+  void EvaluateCandidate(int candidate);
+  static VTK_THREAD_RETURN_TYPE EvaluateCandidatesThread(void* arg);
+
+  double MinimumLength;
+  double MaximumLength;
+  double MinimumClearance;
+  double MaximumAngle;
+  double LengthWeight;
+  double AngleWeight;
+  double ClearanceWeight;
+  double ClearanceSaturation;
+  double MinimumSpacing;
+  int NumberOfThreads;
+
+  //BTX
+  vtkSmartPointer<vtkPolyData> SkinSurface;
+  vtkSmartPointer<vtkSlicerVisuaLineDistanceMap> DistanceMap;
+
+  // Built from the surface
+  vtkSmartPointer<vtkPointLocator> Locator;
+  std::vector<double> Normals;  // 3 per point
+  vtkTimeStamp SurfaceTime;
+
+  // Last search, per candidate
+  double Target[3];
+  std::vector<vtkIdType> Candidates;
+  std::vector<double> Costs;
+  std::vector<double> Lengths;
+  std::vector<double> Clearances;
+  std::vector<double> Angles;
+  std::vector<int> Results;
+  //ETX
+
+private:
+  vtkSlicerVisuaLineEntrySearch(const vtkSlicerVisuaLineEntrySearch&); // Not implemented
+  void operator=(const vtkSlicerVisuaLineEntrySearch&);                // Not implemented
+};
+
+#endif
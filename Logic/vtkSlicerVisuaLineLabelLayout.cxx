@@ -0,0 +1,186 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Laurent Chauvin, Brigham and Women's
+  Hospital. The project was supported by grants 5P01CA067165,
+  5R01CA124377, 5R01CA138586, 2R44DE019322, 7R01CA124377,
+  5R42CA137886, 8P41EB015898
+
+==============================================================================*/
+
+// VisuaLine Logic includes
+#include "vtkSlicerVisuaLineLabelLayout.h"
+
+// VTK includes
+#include <vtkObjectFactory.h>
+
+// STD includes
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+struct RankLess
+{
+  RankLess(const std::vector<double>& ranks) : Ranks(ranks) {}
+  bool operator()(int a, int b) const
+    {
+    return this->Ranks[a] < this->Ranks[b];
+    }
+  const std::vector<double>& Ranks;
+};
+}
+
+//----------------------------------------------------------------------------
+vtkStandardNewMacro(vtkSlicerVisuaLineLabelLayout);
+
+//----------------------------------------------------------------------------
+vtkSlicerVisuaLineLabelLayout::vtkSlicerVisuaLineLabelLayout()
+{
+  this->ViewSize[0] = 0;
+  this->ViewSize[1] = 0;
+  this->LabelSize[0] = 80.0;
+  this->LabelSize[1] = 16.0;
+  this->MaximumNumberOfLabels = -1;
+  this->GridSize[0] = 0;
+  this->GridSize[1] = 0;
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerVisuaLineLabelLayout::~vtkSlicerVisuaLineLabelLayout()
+{
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineLabelLayout::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os, indent);
+  os << indent << "ViewSize: " << this->ViewSize[0] << " "
+     << this->ViewSize[1] << "\n";
+  os << indent << "LabelSize: " << this->LabelSize[0] << " "
+     << this->LabelSize[1] << "\n";
+  os << indent << "MaximumNumberOfLabels: " << this->MaximumNumberOfLabels << "\n";
+  os << indent << "NumberOfLabels: " << this->GetNumberOfLabels() << "\n";
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineLabelLayout::RemoveAllLabels()
+{
+  this->Anchors.clear();
+  this->Ranks.clear();
+  this->Placed.clear();
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLineLabelLayout::AddLabel(double x, double y, double rank)
+{
+  this->Anchors.push_back(x);
+  this->Anchors.push_back(y);
+  this->Ranks.push_back(rank);
+  this->Placed.push_back(0);
+  return static_cast<int>(this->Ranks.size()) - 1;
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLineLabelLayout::GetNumberOfLabels()
+{
+  return static_cast<int>(this->Ranks.size());
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerVisuaLineLabelLayout::IsLabelPlaced(int index)
+{
+  if (index < 0 || index >= this->GetNumberOfLabels())
+    {
+    return false;
+    }
+  return this->Placed[index] != 0;
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerVisuaLineLabelLayout::Overlaps(int label, int cellX, int cellY)
+{
+  // Cells are as large as a label: an overlapping label is anchored in
+  // the same cell or in one of its 8 neighbours.
+  const double* anchor = &this->Anchors[2 * label];
+  for (int y = std::max(cellY - 1, 0);
+       y <= std::min(cellY + 1, this->GridSize[1] - 1); ++y)
+    {
+    for (int x = std::max(cellX - 1, 0);
+         x <= std::min(cellX + 1, this->GridSize[0] - 1); ++x)
+      {
+      const std::vector<int>& cell = this->Cells[y * this->GridSize[0] + x];
+      for (size_t i = 0; i < cell.size(); ++i)
+        {
+        const double* other = &this->Anchors[2 * cell[i]];
+        if (fabs(anchor[0] - other[0]) < this->LabelSize[0] &&
+            fabs(anchor[1] - other[1]) < this->LabelSize[1])
+          {
+          return true;
+          }
+        }
+      }
+    }
+  return false;
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLineLabelLayout::Layout()
+{
+  std::fill(this->Placed.begin(), this->Placed.end(), 0);
+  if (this->ViewSize[0] <= 0 || this->ViewSize[1] <= 0 ||
+      this->LabelSize[0] <= 0 || this->LabelSize[1] <= 0)
+    {
+    return 0;
+    }
+
+  this->GridSize[0] = static_cast<int>(ceil(this->ViewSize[0] / this->LabelSize[0]));
+  this->GridSize[1] = static_cast<int>(ceil(this->ViewSize[1] / this->LabelSize[1]));
+  this->Cells.assign(this->GridSize[0] * this->GridSize[1], std::vector<int>());
+
+  std::vector<int> order;
+  order.reserve(this->Ranks.size());
+  for (int i = 0; i < this->GetNumberOfLabels(); ++i)
+    {
+    const double* anchor = &this->Anchors[2 * i];
+    if (anchor[0] >= 0 && anchor[0] < this->ViewSize[0] &&
+        anchor[1] >= 0 && anchor[1] < this->ViewSize[1])
+      {
+      order.push_back(i);
+      }
+    }
+  std::stable_sort(order.begin(), order.end(), RankLess(this->Ranks));
+
+  int numberOfPlacedLabels = 0;
+  for (size_t i = 0; i < order.size(); ++i)
+    {
+    if (this->MaximumNumberOfLabels >= 0 &&
+        numberOfPlacedLabels >= this->MaximumNumberOfLabels)
+      {
+      break;
+      }
+    int label = order[i];
+    int cellX = static_cast<int>(this->Anchors[2 * label] / this->LabelSize[0]);
+    int cellY = static_cast<int>(this->Anchors[2 * label + 1] / this->LabelSize[1]);
+    if (this->Overlaps(label, cellX, cellY))
+      {
+      continue;
+      }
+    this->Cells[cellY * this->GridSize[0] + cellX].push_back(label);
+    this->Placed[label] = 1;
+    ++numberOfPlacedLabels;
+    }
+  return numberOfPlacedLabels;
+}
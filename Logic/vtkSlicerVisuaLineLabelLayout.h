@@ -0,0 +1,100 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Laurent Chauvin, Brigham and Women's
+  Hospital. The project was supported by grants 5P01CA067165,
+  5R01CA124377, 5R01CA138586, 2R44DE019322, 7R01CA124377,
+  5R42CA137886, 8P41EB015898
+
+==============================================================================*/
+
+// .NAME vtkSlicerVisuaLineLabelLayout - screen space label overlap culling
+// .SECTION Description
+// Places labels anchored at display positions, most relevant first, and
+// drops every label whose box overlaps one already placed. Placed boxes
+// are binned into a grid of label sized cells so each label is only
+// tested against the placed labels of its neighbour cells.
+
+#ifndef __vtkSlicerVisuaLineLabelLayout_h
+#define __vtkSlicerVisuaLineLabelLayout_h
+
+// VTK includes
+#include <vtkObject.h>
+
+// STD includes
+#include <vector>
+
+#include "vtkSlicerVisuaLineModuleLogicExport.h"
+
+/// \ingroup Slicer_QtModules_VisuaLine
+class VTK_SLICER_VISUALINE_MODULE_LOGIC_EXPORT vtkSlicerVisuaLineLabelLayout :
+  public vtkObject
+{
+public:
+
+  static vtkSlicerVisuaLineLabelLayout *New();
+  vtkTypeMacro(vtkSlicerVisuaLineLabelLayout, vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  /// Size of the view in pixels. Labels outside are not placed.
+  vtkSetVector2Macro(ViewSize, int);
+  vtkGetVector2Macro(ViewSize, int);
+
+  /// Size in pixels of a label box, centered on its anchor
+  vtkSetVector2Macro(LabelSize, double);
+  vtkGetVector2Macro(LabelSize, double);
+
+  /// Maximum number of placed labels, no limit if negative
+  vtkSetMacro(MaximumNumberOfLabels, int);
+  vtkGetMacro(MaximumNumberOfLabels, int);
+
+  void RemoveAllLabels();
+
+  /// Add a label anchored at a display position (pixels). Labels with
+  /// the lowest rank are placed first. Return the label index.
+  int AddLabel(double x, double y, double rank);
+  int GetNumberOfLabels();
+
+  /// Place the labels. Return the number of placed labels.
+  int Layout();
+  bool IsLabelPlaced(int index);
+
+protected:
+  vtkSlicerVisuaLineLabelLayout();
+  virtual ~vtkSlicerVisuaLineLabelLayout();
+
+  //BTX
+  bool Overlaps(int label, int cellX, int cellY);
+
+  int ViewSize[2];
+  double LabelSize[2];
+  int MaximumNumberOfLabels;
+
+  // Per label, indexed alike
+  std::vector<double> Anchors;  // x, y
+  std::vector<double> Ranks;
+  std::vector<char> Placed;
+
+  // Placed labels of each grid cell
+  int GridSize[2];
+  std::vector<std::vector<int> > Cells;
+  //ETX
+
+private:
+  vtkSlicerVisuaLineLabelLayout(const vtkSlicerVisuaLineLabelLayout&); // Not implemented
+  void operator=(const vtkSlicerVisuaLineLabelLayout&);                // Not implemented
+};
+
+#endif
@@ -21,13 +21,354 @@
 ==============================================================================*/
 
 // VisuaLine Logic includes
+#include "vtkSlicerVisuaLineAnalysisCache.h"
+#include "vtkSlicerVisuaLineCurvedPath.h"
+#include "vtkSlicerVisuaLineDeflectionModel.h"
+#include "vtkSlicerVisuaLineDistanceMap.h"
+#include "vtkSlicerVisuaLineEntrySearch.h"
+#include "vtkSlicerVisuaLineLabelLayout.h"
 #include "vtkSlicerVisuaLineLogic.h"
+#include "vtkSlicerVisuaLineNameIndex.h"
+#include "vtkSlicerVisuaLinePathClustering.h"
+#include "vtkSlicerVisuaLinePathStore.h"
+#include "vtkSlicerVisuaLineProfiler.h"
+#include "vtkSlicerVisuaLineReachabilityMap.h"
+#include "vtkSlicerVisuaLineSurfaceLocator.h"
+#include "vtkSlicerVisuaLineTemplateGrid.h"
+#include "vtkSlicerVisuaLineUncertaintyAnalysis.h"
+#include "vtkSlicerVisuaLineUndoJournal.h"
+
+// MRML includes
+#include <vtkMRMLAnnotationFiducialNode.h>
+#include <vtkMRMLAnnotationHierarchyNode.h>
+#include <vtkMRMLAnnotationLineDisplayNode.h>
+#include <vtkMRMLAnnotationPointDisplayNode.h>
+#include <vtkMRMLAnnotationRulerNode.h>
+#include <vtkMRMLAnnotationTextDisplayNode.h>
+#include <vtkMRMLLinearTransformNode.h>
+#include <vtkMRMLModelDisplayNode.h>
+#include <vtkMRMLModelNode.h>
+#include <vtkMRMLScalarVolumeNode.h>
+#include <vtkMRMLScene.h>
+#include <vtkMRMLSliceNode.h>
+#include <vtkMRMLTransformNode.h>
 
 // VTK includes
+#include <vtkCallbackCommand.h>
+#include <vtkCamera.h>
+#include <vtkCellArray.h>
+#include <vtkDoubleArray.h>
+#include <vtkImageData.h>
+#include <vtkLine.h>
+#include <vtkMath.h>
+#include <vtkMatrix4x4.h>
 #include <vtkNew.h>
+#include <vtkObjectFactory.h>
+#include <vtkPoints.h>
+#include <vtkPolyData.h>
+#include <vtkSmartPointer.h>
+#include <vtkWeakPointer.h>
 
 // STD includes
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+//----------------------------------------------------------------------------
+namespace
+{
+// Tags of the nodes owned by the logic, so they are reused when a scene
+// is loaded instead of being created again
+const char* TargetOfAttributeName = "VisuaLine.TargetOf";
+const char* VirtualOffsetOfAttributeName = "VisuaLine.VirtualOffsetOf";
+const char* VirtualOffsetAttributeName = "VisuaLine.VirtualOffset";
+
+// A node with its display, storage and hierarchy nodes
+void GetNodeAndDependents(vtkMRMLScene* scene, vtkMRMLNode* node,
+                          std::vector<vtkMRMLNode*>& nodes)
+{
+  if (!node || !node->GetID())
+    {
+    return;
+    }
+  vtkMRMLDisplayableNode* displayable = vtkMRMLDisplayableNode::SafeDownCast(node);
+  for (int i = 0; displayable && i < displayable->GetNumberOfDisplayNodes(); ++i)
+    {
+    if (displayable->GetNthDisplayNode(i))
+      {
+      nodes.push_back(displayable->GetNthDisplayNode(i));
+      }
+    }
+  if (displayable && displayable->GetStorageNode())
+    {
+    nodes.push_back(displayable->GetStorageNode());
+    }
+  vtkMRMLHierarchyNode* hierarchy = scene ?
+    vtkMRMLHierarchyNode::GetAssociatedHierarchyNode(scene, node->GetID()) : 0;
+  if (hierarchy)
+    {
+    nodes.push_back(hierarchy);
+    }
+  nodes.push_back(node);
+}
+
+// Model drawn by the logic, hidden from the editors and not saved with
+// the scene. Owned by the scene.
+vtkMRMLModelNode* AddHelperModel(vtkMRMLScene* scene, const char* name,
+                                 double r, double g, double b)
+{
+  vtkNew<vtkMRMLModelDisplayNode> display;
+  display->SetColor(r, g, b);
+  display->SetSliceIntersectionVisibility(1);
+  display->SaveWithSceneOff();
+  scene->AddNode(display.GetPointer());
+
+  vtkNew<vtkMRMLModelNode> model;
+  model->SetName(name);
+  model->HideFromEditorsOn();
+  model->SaveWithSceneOff();
+  model->SetAndObserveDisplayNodeID(display->GetID());
+  scene->AddNode(model.GetPointer());
+  return model.GetPointer();
+}
+}
+
+//----------------------------------------------------------------------------
+class vtkSlicerVisuaLineLogic::vtkInternal
+{
+public:
+  struct CurveEntry
+    {
+    vtkSmartPointer<vtkSlicerVisuaLineCurvedPath> Curve;
+    std::string ModelNodeID;
+    };
+
+  struct TemplateGridEntry
+    {
+    vtkSmartPointer<vtkSlicerVisuaLineTemplateGrid> Grid;
+    std::string ModelNodeID;
+    std::map<int, std::string> HoleRulerIDs;
+    };
+
+  std::vector<TemplateGridEntry>::iterator FindTemplateGrid(
+    vtkSlicerVisuaLineTemplateGrid* grid)
+    {
+    std::vector<TemplateGridEntry>::iterator it = this->TemplateGrids.begin();
+    for (; it != this->TemplateGrids.end(); ++it)
+      {
+      if (it->Grid == grid)
+        {
+        break;
+        }
+      }
+    return it;
+    }
+
+  // Curved paths, keyed by ruler node ID
+  std::map<std::string, CurveEntry> Curves;
+  std::vector<TemplateGridEntry> TemplateGrids;
+
+  vtkSmartPointer<vtkSlicerVisuaLinePathStore> PathStore;
+  vtkSmartPointer<vtkSlicerVisuaLineNameIndex> NameIndex;
+  vtkSmartPointer<vtkSlicerVisuaLineProfiler> Profiler;
+  vtkSmartPointer<vtkSlicerVisuaLineUndoJournal> UndoJournal;
+  // Set while the journal is replayed or must not record
+  int JournalSuspended;
+  std::set<std::string> ObservedTransformNodeIDs;
+
+  // Surface locators, keyed by model node ID
+  struct SurfaceLocatorEntry
+    {
+    SurfaceLocatorEntry() : SurfaceTime(0), TransformTime(0) {}
+    vtkSmartPointer<vtkSlicerVisuaLineSurfaceLocator> Locator;
+    vtkWeakPointer<vtkPolyData> Surface;
+    vtkWeakPointer<vtkMRMLTransformNode> TransformNode;
+    unsigned long SurfaceTime;
+    unsigned long TransformTime;
+    };
+  std::map<std::string, SurfaceLocatorEntry> SurfaceLocators;
+  vtkWeakPointer<vtkMRMLModelNode> EntrySurfaceNode;
+  std::string EntrySurfaceNodeID;
+  vtkSlicerVisuaLineSurfaceLocator* EntrySurfaceLocator;
+  // Paths to intersect again with the entry surface
+  std::set<std::string> EntryModifiedPaths;
+
+  // Path model. Nodes are weak references so a node deleted behind our
+  // back reads as NULL instead of dangling.
+  enum
+    {
+    PathRole = 0,
+    TargetRole,
+    HierarchyRole
+    };
+
+  // Display nodes hidden by the level of detail
+  enum
+    {
+    GlyphsHidden = 0x1,
+    LabelHidden = 0x2,
+    TargetLabelHidden = 0x4
+    };
+
+  struct PathRecord
+    {
+    PathRecord() : VirtualOffset(0.0), HasSkinEntry(false), Compact(false),
+      LevelOfDetailHidden(0) {}
+    vtkWeakPointer<vtkMRMLAnnotationRulerNode> PathNode;
+    vtkWeakPointer<vtkMRMLAnnotationFiducialNode> TargetNode;
+    vtkWeakPointer<vtkMRMLAnnotationRulerNode> VirtualOffsetNode;
+    double VirtualOffset;
+    std::string HierarchyNodeID;
+    // Crossing with the entry surface
+    bool HasSkinEntry;
+    double SkinEntry[3];
+    // No MRML node, see SetCompactStorage()
+    bool Compact;
+    // Display nodes the level of detail must show again, the others keep
+    // the visibility set by the user
+    int LevelOfDetailHidden;
+    };
+
+  struct ObservedNode
+    {
+    // Hierarchy node ID for HierarchyRole
+    std::string PathNodeID;
+    int Role;
+    vtkWeakPointer<vtkMRMLNode> Node;
+    };
+
+  PathRecord* FindPath(const char* pathNodeID)
+    {
+    if (!pathNodeID)
+      {
+      return 0;
+      }
+    std::map<std::string, PathRecord>::iterator it = this->Paths.find(pathNodeID);
+    return it != this->Paths.end() ? &it->second : 0;
+    }
+
+  // Display visibility, compact paths keep it in their record
+  bool IsPathVisible(const char* pathNodeID)
+    {
+    PathRecord* record = this->FindPath(pathNodeID);
+    if (record && record->Compact)
+      {
+      vtkSlicerVisuaLinePathStore::CompactRecord* compact =
+        this->PathStore->GetCompactRecord(this->PathStore->GetPathIndex(pathNodeID));
+      return compact && (compact->Flags & vtkSlicerVisuaLinePathStore::VisibleFlag);
+      }
+    return record && record->PathNode && record->PathNode->GetDisplayVisibility();
+    }
+
+  // Visibility of the display nodes hidden by the level of detail, the
+  // record still lists them
+  void SetLevelOfDetailNodesVisibility(PathRecord& record, bool visible)
+    {
+    if (!record.PathNode)
+      {
+      return;
+      }
+    // In the order of the flags
+    vtkMRMLDisplayNode* displayNodes[3] =
+      {
+      record.PathNode->GetAnnotationPointDisplayNode(),
+      record.PathNode->GetAnnotationTextDisplayNode(),
+      record.TargetNode ? record.TargetNode->GetAnnotationTextDisplayNode() : 0
+      };
+    for (int i = 0; i < 3; ++i)
+      {
+      if (displayNodes[i] && (record.LevelOfDetailHidden & (1 << i)))
+        {
+        displayNodes[i]->SetVisibility(visible);
+        }
+      }
+    }
+
+  // Keyed by path node ID
+  std::map<std::string, PathRecord> Paths;
+  // Keyed by observed node ID, one observer per node
+  std::map<std::string, ObservedNode> ObservedNodes;
+  // Paths of each managed hierarchy, keyed by hierarchy node ID
+  std::map<std::string, std::set<std::string> > HierarchyPaths;
+
+  // Change set collected by the widget
+  std::vector<std::string> ModifiedPaths;
+  std::set<std::string> ModifiedPathSet;
+  bool ModifiedEventPending;
+
+  // Set while the logic moves targets/offsets itself
+  int Synchronizing;
+
+  // Set while node events of a batch operation are ignored
+  int IgnoreNodeEvents;
+
+  // Compact paths expanded while the scene is saved
+  std::vector<std::string> SavedCompactPathNodeIDs;
+
+  // Tagged nodes added during batch processing
+  std::vector<std::string> PendingNodeIDs;
+  int LoadingPaths;
+  // Path lists of the paths loaded by the last batch
+  std::set<std::string> LoadedHierarchyNodeIDs;
+
+  // Set while a hierarchy is synchronized. Targets created meanwhile
+  // modify the active hierarchy.
+  int UpdatingHierarchy;
+
+  // Path lists added by the current import, then the ones not indexed
+  // yet and the next child of the first one
+  std::vector<std::string> ImportedHierarchyNodeIDs;
+  std::deque<std::string> PreIndexHierarchyNodeIDs;
+  int PreIndexChild;
+  // Paths pre-indexed without curve and target, with the list they were
+  // found in. Both are created when a list takes the path.
+  std::map<std::string, std::string> PreIndexedPaths;
+
+  // Level of detail
+  bool LevelOfDetailEnabled;
+  double LevelOfDetailDistance;
+  std::set<std::string> SelectedPaths;
+  vtkSmartPointer<vtkSlicerVisuaLineLabelLayout> LabelLayout;
+
+  // Compact storage, compact paths are drawn by one model. It is updated
+  // once at the end of a batch.
+  bool CompactStorage;
+  std::string CompactPathsModelNodeID;
+  int CompactBatch;
+
+  vtkSmartPointer<vtkSlicerVisuaLineAnalysisCache> AnalysisCache;
+  vtkSmartPointer<vtkSlicerVisuaLineDistanceMap> RiskDistanceMap;
+  vtkSmartPointer<vtkSlicerVisuaLineUncertaintyAnalysis> UncertaintyAnalysis;
+  vtkSmartPointer<vtkSlicerVisuaLineEntrySearch> EntrySearch;
+  vtkSmartPointer<vtkSlicerVisuaLinePathClustering> PathClustering;
+
+  // Needle deflection, predicted trajectories are drawn by one model.
+  // Paths to set again on the model, and the paths drawn.
+  vtkSmartPointer<vtkSlicerVisuaLineDeflectionModel> DeflectionModel;
+  bool DeflectionPredictionEnabled;
+  std::string DeflectionModelNodeID;
+  std::set<std::string> DeflectionModifiedPaths;
+  std::set<std::string> DeflectionVisiblePaths;
+
+  vtkSmartPointer<vtkSlicerVisuaLineReachabilityMap> ReachabilityMap;
+
+  // Skin model hardened to world coordinates, with its strips split in
+  // triangles, for the entry search
+  vtkSmartPointer<vtkPolyData> WorldSkin;
+  vtkWeakPointer<vtkMRMLModelNode> WorldSkinModel;
+  unsigned long WorldSkinTime;
+};
 
 //----------------------------------------------------------------------------
 vtkStandardNewMacro(vtkSlicerVisuaLineLogic);
@@ -35,11 +376,62 @@ vtkStandardNewMacro(vtkSlicerVisuaLineLogic);
 //----------------------------------------------------------------------------
 vtkSlicerVisuaLineLogic::vtkSlicerVisuaLineLogic()
 {
+  this->Internal = new vtkInternal;
+  this->Internal->PathStore = vtkSmartPointer<vtkSlicerVisuaLinePathStore>::New();
+  this->Internal->NameIndex = vtkSmartPointer<vtkSlicerVisuaLineNameIndex>::New();
+  this->Internal->Profiler = vtkSmartPointer<vtkSlicerVisuaLineProfiler>::New();
+  this->Internal->UndoJournal = vtkSmartPointer<vtkSlicerVisuaLineUndoJournal>::New();
+  this->Internal->JournalSuspended = 0;
+  this->Internal->ModifiedEventPending = false;
+  this->Internal->Synchronizing = 0;
+  this->Internal->IgnoreNodeEvents = 0;
+  this->Internal->LoadingPaths = 0;
+  this->Internal->UpdatingHierarchy = 0;
+  this->Internal->PreIndexChild = 0;
+  this->Internal->LevelOfDetailEnabled = false;
+  this->Internal->LevelOfDetailDistance = 300.0;
+  this->Internal->CompactStorage = false;
+  this->Internal->CompactBatch = 0;
+  this->Internal->LabelLayout = vtkSmartPointer<vtkSlicerVisuaLineLabelLayout>::New();
+  this->Internal->AnalysisCache = vtkSmartPointer<vtkSlicerVisuaLineAnalysisCache>::New();
+  this->Internal->RiskDistanceMap = vtkSmartPointer<vtkSlicerVisuaLineDistanceMap>::New();
+  this->Internal->RiskDistanceMap->SetCache(this->Internal->AnalysisCache);
+  this->Internal->UncertaintyAnalysis =
+    vtkSmartPointer<vtkSlicerVisuaLineUncertaintyAnalysis>::New();
+  this->Internal->UncertaintyAnalysis->SetDistanceMap(this->Internal->RiskDistanceMap);
+  this->Internal->UncertaintyAnalysis->SetCache(this->Internal->AnalysisCache);
+  this->Internal->EntrySearch = vtkSmartPointer<vtkSlicerVisuaLineEntrySearch>::New();
+  this->Internal->EntrySearch->SetDistanceMap(this->Internal->RiskDistanceMap);
+  this->Internal->PathClustering = vtkSmartPointer<vtkSlicerVisuaLinePathClustering>::New();
+  this->Internal->DeflectionModel =
+    vtkSmartPointer<vtkSlicerVisuaLineDeflectionModel>::New();
+  this->Internal->DeflectionPredictionEnabled = false;
+  this->Internal->ReachabilityMap =
+    vtkSmartPointer<vtkSlicerVisuaLineReachabilityMap>::New();
+  this->Internal->ReachabilityMap->SetCache(this->Internal->AnalysisCache);
+  this->Internal->WorldSkinTime = 0;
+  this->Internal->EntrySurfaceLocator = 0;
 }
 
 //----------------------------------------------------------------------------
 vtkSlicerVisuaLineLogic::~vtkSlicerVisuaLineLogic()
 {
+  for (size_t i = 0; i < this->Internal->TemplateGrids.size(); ++i)
+    {
+    this->Internal->TemplateGrids[i].Grid->RemoveObservers(
+      vtkCommand::ModifiedEvent, this->GetMRMLNodesCallbackCommand());
+    }
+  std::map<std::string, vtkInternal::ObservedNode>::iterator it =
+    this->Internal->ObservedNodes.begin();
+  for (; it != this->Internal->ObservedNodes.end(); ++it)
+    {
+    if (it->second.Node)
+      {
+      it->second.Node->RemoveObservers(vtkCommand::ModifiedEvent,
+                                       this->GetMRMLNodesCallbackCommand());
+      }
+    }
+  delete this->Internal;
 }
 
 //----------------------------------------------------------------------------
@@ -55,6 +447,10 @@ void vtkSlicerVisuaLineLogic::SetMRMLSceneInternal(vtkMRMLScene * newScene)
   events->InsertNextValue(vtkMRMLScene::NodeAddedEvent);
   events->InsertNextValue(vtkMRMLScene::NodeRemovedEvent);
   events->InsertNextValue(vtkMRMLScene::EndBatchProcessEvent);
+  events->InsertNextValue(vtkMRMLScene::EndCloseEvent);
+  events->InsertNextValue(vtkMRMLScene::EndImportEvent);
+  events->InsertNextValue(vtkMRMLScene::StartSaveEvent);
+  events->InsertNextValue(vtkMRMLScene::EndSaveEvent);
   this->SetAndObserveMRMLSceneEventsInternal(newScene, events.GetPointer());
 }
 
@@ -68,17 +464,4228 @@ void vtkSlicerVisuaLineLogic::RegisterNodes()
 void vtkSlicerVisuaLineLogic::UpdateFromMRMLScene()
 {
   assert(this->GetMRMLScene() != 0);
+
+  this->LoadPendingPaths();
+
+  // Removals during the batch deferred this
+  this->UpdateTransformObservers();
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic::OnMRMLSceneEndImport()
+{
+  this->QueuePathHierarchies();
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic::OnMRMLSceneEndClose()
+{
+  this->Internal->ImportedHierarchyNodeIDs.clear();
+  this->Internal->PreIndexHierarchyNodeIDs.clear();
+  this->Internal->PreIndexChild = 0;
+  this->Internal->PreIndexedPaths.clear();
+  this->Internal->LoadedHierarchyNodeIDs.clear();
+  // Curve models went with the scene
+  this->Internal->Curves.clear();
+
+  // Nodes of the history are gone
+  this->Internal->UndoJournal->Clear();
+
+  // Compact paths of the lists removed with the scene are already gone
+  std::vector<std::string> compactPathNodeIDs;
+  std::map<std::string, vtkInternal::PathRecord>::iterator it;
+  for (it = this->Internal->Paths.begin(); it != this->Internal->Paths.end(); ++it)
+    {
+    if (it->second.Compact)
+      {
+      compactPathNodeIDs.push_back(it->first);
+      }
+    }
+  ++this->Internal->CompactBatch;
+  for (size_t i = 0; i < compactPathNodeIDs.size(); ++i)
+    {
+    this->RemovePathNode(compactPathNodeIDs[i].c_str());
+    }
+  --this->Internal->CompactBatch;
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic
+::ProcessMRMLSceneEvents(vtkObject* caller, unsigned long event, void* callData)
+{
+  if (event == vtkMRMLScene::StartSaveEvent ||
+      event == vtkMRMLScene::EndSaveEvent)
+    {
+    this->SaveCompactPaths(event == vtkMRMLScene::StartSaveEvent);
+    this->SaveLevelOfDetail(event == vtkMRMLScene::StartSaveEvent);
+    }
+  this->Superclass::ProcessMRMLSceneEvents(caller, event, callData);
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic
+::OnMRMLSceneNodeAdded(vtkMRMLNode* node)
+{
+  if (!node || !node->GetID() || !this->GetMRMLScene() ||
+      !this->GetMRMLScene()->IsBatchProcessing())
+    {
+    return;
+    }
+
+  // Candidate path lists, queued when the import ends
+  if (this->GetMRMLScene()->IsImporting() &&
+      vtkMRMLAnnotationHierarchyNode::SafeDownCast(node))
+    {
+    this->Internal->ImportedHierarchyNodeIDs.push_back(node->GetID());
+    }
+
+  // Only queued, paths are built once the batch ends
+  if (node->GetAttribute(TargetOfAttributeName) ||
+      node->GetAttribute(VirtualOffsetOfAttributeName))
+    {
+    this->Internal->PendingNodeIDs.push_back(node->GetID());
+    }
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic::LoadPendingPaths()
+{
+  vtkMRMLScene* scene = this->GetMRMLScene();
+  std::vector<std::string> pending;
+  pending.swap(this->Internal->PendingNodeIDs);
+  if (!scene || pending.empty())
+    {
+    return;
+    }
+  this->Internal->LoadedHierarchyNodeIDs.clear();
+
+  // Sort tagged nodes by path, nodes removed since are skipped
+  std::map<std::string, vtkMRMLAnnotationFiducialNode*> targets;
+  std::map<std::string, vtkMRMLAnnotationRulerNode*> offsets;
+  for (size_t i = 0; i < pending.size(); ++i)
+    {
+    vtkMRMLNode* node = scene->GetNodeByID(pending[i].c_str());
+    if (!node)
+      {
+      continue;
+      }
+    vtkMRMLAnnotationFiducialNode* target =
+      vtkMRMLAnnotationFiducialNode::SafeDownCast(node);
+    vtkMRMLAnnotationRulerNode* offset =
+      vtkMRMLAnnotationRulerNode::SafeDownCast(node);
+    if (target && target->GetAttribute(TargetOfAttributeName))
+      {
+      targets[target->GetAttribute(TargetOfAttributeName)] = target;
+      }
+    else if (offset && offset->GetAttribute(VirtualOffsetOfAttributeName))
+      {
+      offsets[offset->GetAttribute(VirtualOffsetOfAttributeName)] = offset;
+      }
+    }
+
+  // A path is a ruler with a target
+  int numberOfLoadedPaths = 0;
+  ++this->Internal->LoadingPaths;
+  std::map<std::string, vtkMRMLAnnotationFiducialNode*>::iterator it;
+  for (it = targets.begin(); it != targets.end(); ++it)
+    {
+    vtkMRMLAnnotationRulerNode* path = vtkMRMLAnnotationRulerNode::SafeDownCast(
+      scene->GetNodeByID(it->first.c_str()));
+    if (!path || this->Internal->FindPath(it->first.c_str()))
+      {
+      continue;
+      }
+    std::map<std::string, vtkMRMLAnnotationRulerNode*>::iterator offset =
+      offsets.find(it->first);
+    this->ManagePathNode(path, it->second,
+                         offset != offsets.end() ? offset->second : 0);
+    ++numberOfLoadedPaths;
+
+    // Index the path under its path list
+    vtkMRMLHierarchyNode* pathHierarchy =
+      vtkMRMLHierarchyNode::GetAssociatedHierarchyNode(scene, it->first.c_str());
+    vtkMRMLHierarchyNode* parent =
+      pathHierarchy ? pathHierarchy->GetParentNode() : 0;
+    if (vtkMRMLAnnotationHierarchyNode::SafeDownCast(parent) && parent->GetID())
+      {
+      this->ObserveNode(parent, parent->GetID(), vtkInternal::HierarchyRole);
+      this->SetPathHierarchy(it->first, parent->GetID());
+      this->Internal->LoadedHierarchyNodeIDs.insert(parent->GetID());
+      }
+    }
+  if (this->Internal->CompactStorage)
+    {
+    ++this->Internal->CompactBatch;
+    for (it = targets.begin(); it != targets.end(); ++it)
+      {
+      this->CompactPathNode(it->first);
+      }
+    --this->Internal->CompactBatch;
+    this->UpdateCompactPathsDisplay();
+    }
+  --this->Internal->LoadingPaths;
+
+  if (numberOfLoadedPaths > 0)
+    {
+    this->UpdateTransformObservers();
+    this->InvokeEvent(PathsLoadedEvent);
+    }
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic
+::OnMRMLSceneNodeRemoved(vtkMRMLNode* node)
+{
+  if (!node || !node->GetID())
+    {
+    return;
+    }
+
+  if (this->Internal->SurfaceLocators.erase(node->GetID()) > 0 &&
+      this->Internal->EntrySurfaceNodeID == node->GetID())
+    {
+    this->SetEntrySurfaceNode(0);
+    }
+
+  // Removed by the logic when the path was compacted
+  vtkInternal::PathRecord* compactRecord = this->Internal->FindPath(node->GetID());
+  if (compactRecord && compactRecord->Compact)
+    {
+    return;
+    }
+
+  // Managed path or target deleted
+  std::map<std::string, vtkInternal::ObservedNode>::iterator observed =
+    this->Internal->ObservedNodes.find(node->GetID());
+  if (observed != this->Internal->ObservedNodes.end())
+    {
+    std::string pathNodeID = observed->second.PathNodeID;
+    if (observed->second.Role == vtkInternal::HierarchyRole)
+      {
+      this->RemovePathHierarchy(pathNodeID.c_str());
+      return;
+      }
+    else if (observed->second.Role == vtkInternal::PathRole)
+      {
+      // Deleted with its ruler, unlike a path that is only unmanaged
+      std::vector<vtkMRMLNode*> nodes;
+      vtkInternal::PathRecord* record = this->Internal->FindPath(pathNodeID.c_str());
+      vtkMRMLScene* scene = this->GetMRMLScene();
+      if (record && scene && !scene->IsClosing())
+        {
+        GetNodeAndDependents(scene, record->VirtualOffsetNode, nodes);
+        GetNodeAndDependents(scene, record->TargetNode, nodes);
+        }
+      std::vector<vtkSmartPointer<vtkMRMLNode> > removedNodes(nodes.begin(), nodes.end());
+      this->RemovePathNode(pathNodeID.c_str());
+      for (size_t i = 0; i < removedNodes.size(); ++i)
+        {
+        if (scene->IsNodePresent(removedNodes[i]))
+          {
+          scene->RemoveNode(removedNodes[i]);
+          }
+        }
+      }
+    else
+      {
+      this->ReleaseNode(node->GetID());
+      vtkInternal::PathRecord* record =
+        this->Internal->FindPath(pathNodeID.c_str());
+      if (record)
+        {
+        record->TargetNode = 0;
+        }
+      }
+    this->MarkPathModified(pathNodeID);
+    }
+
+  if (!vtkMRMLAnnotationRulerNode::SafeDownCast(node))
+    {
+    return;
+    }
+
+  // Template hole ruler deleted: draw the hole with its grid again
+  std::vector<vtkInternal::TemplateGridEntry>::iterator it =
+    this->Internal->TemplateGrids.begin();
+  for (; it != this->Internal->TemplateGrids.end(); ++it)
+    {
+    std::map<int, std::string>::iterator hole = it->HoleRulerIDs.begin();
+    for (; hole != it->HoleRulerIDs.end(); ++hole)
+      {
+      if (hole->second == node->GetID())
+        {
+        it->Grid->SetHoleMaterialized(hole->first, false);
+        it->HoleRulerIDs.erase(hole);
+        return;
+        }
+      }
+    }
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic
+::ProcessMRMLNodesEvents(vtkObject* caller, unsigned long event, void* callData)
+{
+  vtkSlicerVisuaLineCountMacro(this->Internal->Profiler, "Logic::NodeEvent");
+  vtkSlicerVisuaLineTemplateGrid* grid =
+    vtkSlicerVisuaLineTemplateGrid::SafeDownCast(caller);
+  if (grid && event == vtkCommand::ModifiedEvent)
+    {
+    this->UpdateTemplateGridDisplay(grid);
+    this->InvokeEvent(TemplateGridsModifiedEvent, grid);
+    return;
+    }
+  vtkMRMLTransformNode* transformNode = vtkMRMLTransformNode::SafeDownCast(caller);
+  if (transformNode && event == vtkMRMLTransformableNode::TransformModifiedEvent)
+    {
+    this->OnTransformNodeModified(transformNode);
+    return;
+    }
+
+  // Single dispatch point for path and target nodes, by node ID
+  vtkMRMLNode* node = vtkMRMLNode::SafeDownCast(caller);
+  if (node && node->GetID() && event == vtkCommand::ModifiedEvent)
+    {
+    std::map<std::string, vtkInternal::ObservedNode>::iterator it =
+      this->Internal->ObservedNodes.find(node->GetID());
+    if (it != this->Internal->ObservedNodes.end())
+      {
+      if (this->Internal->IgnoreNodeEvents > 0)
+        {
+        vtkSlicerVisuaLineCountMacro(this->Internal->Profiler, "Logic::IgnoredNodeEvent");
+        return;
+        }
+      std::string pathNodeID = it->second.PathNodeID;
+      if (it->second.Role == vtkInternal::HierarchyRole)
+        {
+        this->UpdatePathHierarchy(pathNodeID.c_str());
+        }
+      else if (it->second.Role == vtkInternal::PathRole)
+        {
+        this->OnPathNodeModified(pathNodeID);
+        }
+      else
+        {
+        this->OnTargetNodeModified(pathNodeID);
+        }
+      return;
+      }
+    }
+  this->Superclass::ProcessMRMLNodesEvents(caller, event, callData);
+}
+
+
+//---------------------------------------------------------------------------
+const char* vtkSlicerVisuaLineLogic::GetControlPointsAttributeName()
+{
+  return "VisuaLine.ControlPoints";
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic
+::SetPathControlPoints(vtkMRMLAnnotationRulerNode* path,
+                       vtkPoints* points, int interpolation)
+{
+  if (!path || !path->GetID())
+    {
+    return;
+    }
+
+  std::map<std::string, vtkInternal::CurveEntry>::iterator it =
+    this->Internal->Curves.find(path->GetID());
+
+  if (!points || points->GetNumberOfPoints() < 3)
+    {
+    // Back to a straight ruler
+    path->RemoveAttribute(this->GetControlPointsAttributeName());
+    this->RemoveCurvedPath(path->GetID());
+    return;
+    }
+
+  if (it == this->Internal->Curves.end())
+    {
+    vtkInternal::CurveEntry entry;
+    entry.Curve = vtkSmartPointer<vtkSlicerVisuaLineCurvedPath>::New();
+    it = this->Internal->Curves.insert(
+      std::make_pair(std::string(path->GetID()), entry)).first;
+    }
+  vtkSlicerVisuaLineCurvedPath* curve = it->second.Curve;
+
+  // Ends follow the ruler
+  vtkNew<vtkPoints> controlPoints;
+  controlPoints->DeepCopy(points);
+  double p1[3], p2[3];
+  path->GetPosition1(p1);
+  path->GetPosition2(p2);
+  controlPoints->SetPoint(0, p1);
+  controlPoints->SetPoint(controlPoints->GetNumberOfPoints() - 1, p2);
+  curve->SetInterpolation(interpolation);
+  curve->SetControlPoints(controlPoints.GetPointer());
+
+  this->UpdateCurveDisplay(path);
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic
+::SetPathControlPoint(vtkMRMLAnnotationRulerNode* path, int index,
+                      const double point[3])
+{
+  vtkSlicerVisuaLineCurvedPath* curve = this->GetCurvedPath(path);
+  if (!curve || index < 0 || index >= curve->GetNumberOfControlPoints())
+    {
+    return;
+    }
+
+  // Ends follow the ruler, its modification updates the end spans
+  if (index == 0)
+    {
+    path->SetPosition1(const_cast<double*>(point));
+    return;
+    }
+  if (index == curve->GetNumberOfControlPoints() - 1)
+    {
+    path->SetPosition2(const_cast<double*>(point));
+    return;
+    }
+  curve->SetControlPoint(index, point);
+  this->UpdateCurveDisplay(path);
+}
+
+//---------------------------------------------------------------------------
+vtkSlicerVisuaLineCurvedPath* vtkSlicerVisuaLineLogic
+::GetCurvedPath(vtkMRMLAnnotationRulerNode* path)
+{
+  if (!path || !path->GetID())
+    {
+    return 0;
+    }
+
+  std::map<std::string, vtkInternal::CurveEntry>::iterator it =
+    this->Internal->Curves.find(path->GetID());
+  return it != this->Internal->Curves.end() ? it->second.Curve.GetPointer() : 0;
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic::LoadCurvedPath(vtkMRMLAnnotationRulerNode* path)
+{
+  // Curve saved with the scene
+  const char* attribute = path ?
+    path->GetAttribute(this->GetControlPointsAttributeName()) : 0;
+  if (!attribute || this->GetCurvedPath(path))
+    {
+    return;
+    }
+  std::istringstream stream(attribute);
+  int interpolation = vtkSlicerVisuaLineCurvedPath::Polyline;
+  stream >> interpolation;
+  vtkNew<vtkPoints> points;
+  double point[3];
+  while (stream >> point[0] >> point[1] >> point[2])
+    {
+    points->InsertNextPoint(point);
+    }
+  if (points->GetNumberOfPoints() >= 3)
+    {
+    this->SetPathControlPoints(path, points.GetPointer(), interpolation);
+    }
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic::RemoveCurvedPath(const std::string& pathNodeID)
+{
+  std::map<std::string, vtkInternal::CurveEntry>::iterator it =
+    this->Internal->Curves.find(pathNodeID);
+  if (it == this->Internal->Curves.end())
+    {
+    return;
+    }
+  vtkMRMLScene* scene = this->GetMRMLScene();
+  vtkMRMLModelNode* model = (scene && !scene->IsClosing()) ?
+    vtkMRMLModelNode::SafeDownCast(scene->GetNodeByID(it->second.ModelNodeID.c_str())) : 0;
+  if (model)
+    {
+    if (model->GetDisplayNode())
+      {
+      scene->RemoveNode(model->GetDisplayNode());
+      }
+    scene->RemoveNode(model);
+    }
+  this->Internal->Curves.erase(it);
+
+  // The ruler line is drawn again, its control points stay in its
+  // attribute
+  vtkMRMLAnnotationRulerNode* path = scene ?
+    vtkMRMLAnnotationRulerNode::SafeDownCast(scene->GetNodeByID(pathNodeID.c_str())) : 0;
+  if (path && path->GetAnnotationLineDisplayNode())
+    {
+    path->GetAnnotationLineDisplayNode()->SetVisibility(1);
+    }
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic::UpdateCurvedPath(vtkMRMLAnnotationRulerNode* path)
+{
+  vtkSlicerVisuaLineCurvedPath* curve = this->GetCurvedPath(path);
+  if (!curve)
+    {
+    return;
+    }
+
+  // Only the end spans are re-tabulated
+  unsigned long mtime = curve->GetMTime();
+  double p1[3], p2[3];
+  path->GetPosition1(p1);
+  path->GetPosition2(p2);
+  curve->SetControlPoint(0, p1);
+  curve->SetControlPoint(curve->GetNumberOfControlPoints() - 1, p2);
+  if (curve->GetMTime() != mtime)
+    {
+    this->UpdateCurveDisplay(path);
+    }
+  else
+    {
+    this->UpdateCurveModel(path);
+    }
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic::UpdateCurveModel(vtkMRMLAnnotationRulerNode* path)
+{
+  std::map<std::string, vtkInternal::CurveEntry>::iterator it =
+    path ? this->Internal->Curves.find(path->GetID()) : this->Internal->Curves.end();
+  vtkMRMLScene* scene = this->GetMRMLScene();
+  vtkMRMLModelNode* model = (it != this->Internal->Curves.end() && scene) ?
+    vtkMRMLModelNode::SafeDownCast(scene->GetNodeByID(it->second.ModelNodeID.c_str())) : 0;
+  if (!model)
+    {
+    return;
+    }
+
+  // Drawn as the ruler, whose coordinates the curve points are in
+  const char* transformNodeID = path->GetTransformNodeID();
+  const char* modelTransformNodeID = model->GetTransformNodeID();
+  if (transformNodeID ? (!modelTransformNodeID ||
+                         strcmp(transformNodeID, modelTransformNodeID) != 0) :
+      modelTransformNodeID != 0)
+    {
+    model->SetAndObserveTransformNodeID(transformNodeID);
+    }
+  vtkMRMLDisplayNode* display = model->GetDisplayNode();
+  if (display && display->GetVisibility() != path->GetDisplayVisibility())
+    {
+    display->SetVisibility(path->GetDisplayVisibility());
+    }
+}
+
+//---------------------------------------------------------------------------
+double vtkSlicerVisuaLineLogic::GetPathLength(vtkMRMLAnnotationRulerNode* path)
+{
+  if (!path)
+    {
+    return 0.0;
+    }
+  vtkSlicerVisuaLineCurvedPath* curve = this->GetCurvedPath(path);
+  if (curve)
+    {
+    return curve->GetLength();
+    }
+  double p1[3], p2[3];
+  this->GetPathWorldEndPoints(path, p1, p2);
+  return sqrt(vtkMath::Distance2BetweenPoints(p1, p2));
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic
+::GetPointAlongPath(vtkMRMLAnnotationRulerNode* path, double distance,
+                    double point[3], double direction[3])
+{
+  if (!path)
+    {
+    return;
+    }
+  vtkSlicerVisuaLineCurvedPath* curve = this->GetCurvedPath(path);
+  if (curve)
+    {
+    // Control points are in ruler coordinates
+    double localPoint[3], localDirection[3], localAhead[3], ahead[3];
+    curve->EvaluateAtArcLength(distance, localPoint, localDirection);
+    int index = this->Internal->PathStore->GetPathIndex(path->GetID());
+    for (int i = 0; i < 3; ++i)
+      {
+      localAhead[i] = localPoint[i] + localDirection[i];
+      }
+    this->Internal->PathStore->LocalToWorld(index, localPoint, point);
+    this->Internal->PathStore->LocalToWorld(index, localAhead, ahead);
+    vtkMath::Subtract(ahead, point, direction);
+    vtkMath::Normalize(direction);
+    return;
+    }
+
+  double p1[3], p2[3];
+  this->GetPathWorldEndPoints(path, p1, p2);
+  vtkMath::Subtract(p2, p1, direction);
+  vtkMath::Normalize(direction);
+  for (int i = 0; i < 3; ++i)
+    {
+    point[i] = p1[i] + direction[i] * distance;
+    }
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic
+::GetVirtualOffsetTip(vtkMRMLAnnotationRulerNode* path, double offset,
+                      double tip[3])
+{
+  double direction[3];
+  this->GetPointAlongPath(path, this->GetPathLength(path) + offset,
+                          tip, direction);
+}
+
+//---------------------------------------------------------------------------
+int vtkSlicerVisuaLineLogic
+::IntersectPathWithSlice(vtkMRMLAnnotationRulerNode* path,
+                         vtkMRMLSliceNode* slice, vtkPoints* intersections)
+{
+  if (!path || !slice || !intersections)
+    {
+    return 0;
+    }
+  intersections->Reset();
+
+  vtkMatrix4x4* sliceToRAS = slice->GetSliceToRAS();
+  double origin[3], normal[3];
+  for (int i = 0; i < 3; ++i)
+    {
+    origin[i] = sliceToRAS->GetElement(i, 3);
+    normal[i] = sliceToRAS->GetElement(i, 2);
+    }
+
+  vtkSlicerVisuaLineCurvedPath* curve = this->GetCurvedPath(path);
+  if (curve)
+    {
+    // Intersect in ruler coordinates (rigid transforms)
+    vtkSlicerVisuaLinePathStore* store = this->Internal->PathStore;
+    int index = store->GetPathIndex(path->GetID());
+    double ahead[3], localOrigin[3], localAhead[3], localNormal[3];
+    vtkMath::Add(origin, normal, ahead);
+    store->WorldToLocal(index, origin, localOrigin);
+    store->WorldToLocal(index, ahead, localAhead);
+    vtkMath::Subtract(localAhead, localOrigin, localNormal);
+
+    vtkNew<vtkDoubleArray> arcLengths;
+    curve->IntersectWithPlane(localOrigin, localNormal, arcLengths.GetPointer());
+    for (vtkIdType i = 0; i < arcLengths->GetNumberOfTuples(); ++i)
+      {
+      double point[3], tangent[3], worldPoint[3];
+      curve->EvaluateAtArcLength(arcLengths->GetValue(i), point, tangent);
+      store->LocalToWorld(index, point, worldPoint);
+      intersections->InsertNextPoint(worldPoint);
+      }
+    return intersections->GetNumberOfPoints();
+    }
+
+  double p1[3], p2[3];
+  this->GetPathWorldEndPoints(path, p1, p2);
+  double d1 = vtkMath::Dot(normal, p1) - vtkMath::Dot(normal, origin);
+  double d2 = vtkMath::Dot(normal, p2) - vtkMath::Dot(normal, origin);
+  if ((d1 < 0) != (d2 < 0))
+    {
+    double t = d1 / (d1 - d2);
+    intersections->InsertNextPoint(p1[0] + t * (p2[0] - p1[0]),
+                                   p1[1] + t * (p2[1] - p1[1]),
+                                   p1[2] + t * (p2[2] - p1[2]));
+    }
+  return intersections->GetNumberOfPoints();
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic::UpdateCurveDisplay(vtkMRMLAnnotationRulerNode* path)
+{
+  std::map<std::string, vtkInternal::CurveEntry>::iterator it =
+    this->Internal->Curves.find(path->GetID());
+  vtkMRMLScene* scene = this->GetMRMLScene();
+  if (it == this->Internal->Curves.end() || !scene)
+    {
+    return;
+    }
+  vtkSlicerVisuaLineCurvedPath* curve = it->second.Curve;
+
+  // Save control points with the ruler
+  std::ostringstream attribute;
+  attribute << std::setprecision(17) << curve->GetInterpolation();
+  for (int i = 0; i < curve->GetNumberOfControlPoints(); ++i)
+    {
+    double point[3];
+    curve->GetControlPoint(i, point);
+    attribute << " " << point[0] << " " << point[1] << " " << point[2];
+    }
+  path->SetAttribute(this->GetControlPointsAttributeName(), attribute.str().c_str());
+
+  vtkMRMLModelNode* model = vtkMRMLModelNode::SafeDownCast(
+    scene->GetNodeByID(it->second.ModelNodeID.c_str()));
+  if (!model)
+    {
+    // Rebuilt from the control points attribute when loaded
+    std::string name = std::string(path->GetName() ? path->GetName() : "") + "_Curve";
+    model = AddHelperModel(scene, name.c_str(), 1, 1, 0);
+    it->second.ModelNodeID = model->GetID();
+
+    // The curve replaces the straight ruler line
+    if (path->GetAnnotationLineDisplayNode())
+      {
+      path->GetAnnotationLineDisplayNode()->SetVisibility(0);
+      }
+    }
+
+  vtkNew<vtkPoints> points;
+  curve->GetSampledPoints(points.GetPointer());
+  vtkNew<vtkCellArray> lines;
+  lines->InsertNextCell(points->GetNumberOfPoints());
+  for (vtkIdType i = 0; i < points->GetNumberOfPoints(); ++i)
+    {
+    lines->InsertCellPoint(i);
+    }
+  vtkNew<vtkPolyData> polyData;
+  polyData->SetPoints(points.GetPointer());
+  polyData->SetLines(lines.GetPointer());
+  model->SetAndObservePolyData(polyData.GetPointer());
+  this->UpdateCurveModel(path);
+}
+
+//---------------------------------------------------------------------------
+vtkSlicerVisuaLineTemplateGrid* vtkSlicerVisuaLineLogic
+::AddTemplateGrid(const char* name)
+{
+  vtkInternal::TemplateGridEntry entry;
+  entry.Grid = vtkSmartPointer<vtkSlicerVisuaLineTemplateGrid>::New();
+  entry.Grid->SetName(name);
+  entry.Grid->AddObserver(vtkCommand::ModifiedEvent,
+                          this->GetMRMLNodesCallbackCommand());
+  this->Internal->TemplateGrids.push_back(entry);
+  this->InvokeEvent(TemplateGridsModifiedEvent, entry.Grid.GetPointer());
+  return entry.Grid;
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic
+::RemoveTemplateGrid(vtkSlicerVisuaLineTemplateGrid* grid)
+{
+  std::vector<vtkInternal::TemplateGridEntry>::iterator it =
+    this->Internal->FindTemplateGrid(grid);
+  if (it == this->Internal->TemplateGrids.end())
+    {
+    return;
+    }
+
+  // Materialized holes stay in the scene as regular rulers
+  grid->RemoveObservers(vtkCommand::ModifiedEvent,
+                        this->GetMRMLNodesCallbackCommand());
+  vtkMRMLNode* model = this->GetMRMLScene() ?
+    this->GetMRMLScene()->GetNodeByID(it->ModelNodeID.c_str()) : 0;
+  if (model)
+    {
+    this->GetMRMLScene()->RemoveNode(model);
+    }
+  this->Internal->TemplateGrids.erase(it);
+  this->InvokeEvent(TemplateGridsModifiedEvent);
+}
+
+//---------------------------------------------------------------------------
+int vtkSlicerVisuaLineLogic::GetNumberOfTemplateGrids()
+{
+  return static_cast<int>(this->Internal->TemplateGrids.size());
+}
+
+//---------------------------------------------------------------------------
+vtkSlicerVisuaLineTemplateGrid* vtkSlicerVisuaLineLogic::GetNthTemplateGrid(int n)
+{
+  if (n < 0 || n >= this->GetNumberOfTemplateGrids())
+    {
+    return 0;
+    }
+  return this->Internal->TemplateGrids[n].Grid;
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic
+::SetTemplateGridVisibility(vtkSlicerVisuaLineTemplateGrid* grid, bool visible)
+{
+  std::vector<vtkInternal::TemplateGridEntry>::iterator it =
+    this->Internal->FindTemplateGrid(grid);
+  if (it == this->Internal->TemplateGrids.end() || !this->GetMRMLScene())
+    {
+    return;
+    }
+  vtkMRMLModelNode* model = vtkMRMLModelNode::SafeDownCast(
+    this->GetMRMLScene()->GetNodeByID(it->ModelNodeID.c_str()));
+  if (model && model->GetDisplayNode())
+    {
+    model->GetDisplayNode()->SetVisibility(visible ? 1 : 0);
+    }
+}
+
+//---------------------------------------------------------------------------
+vtkMRMLAnnotationRulerNode* vtkSlicerVisuaLineLogic
+::MaterializeTemplateHole(vtkSlicerVisuaLineTemplateGrid* grid, int hole,
+                          vtkMRMLAnnotationHierarchyNode* hierarchy)
+{
+  std::vector<vtkInternal::TemplateGridEntry>::iterator it =
+    this->Internal->FindTemplateGrid(grid);
+  vtkMRMLScene* scene = this->GetMRMLScene();
+  if (it == this->Internal->TemplateGrids.end() || !scene ||
+      hole < 0 || hole >= grid->GetNumberOfHoles())
+    {
+    return 0;
+    }
+
+  std::map<int, std::string>::iterator existing = it->HoleRulerIDs.find(hole);
+  if (existing != it->HoleRulerIDs.end())
+    {
+    vtkMRMLAnnotationRulerNode* ruler = vtkMRMLAnnotationRulerNode::SafeDownCast(
+      scene->GetNodeByID(existing->second.c_str()));
+    if (ruler)
+      {
+      return ruler;
+      }
+    it->HoleRulerIDs.erase(existing);
+    }
+
+  double entry[3], target[3];
+  grid->GetHoleTrajectory(hole, entry, target);
+  std::string name = std::string(grid->GetName() ? grid->GetName() : "Template")
+    + "_" + grid->GetHoleName(hole);
+
+  vtkSmartPointer<vtkMRMLAnnotationRulerNode> ruler =
+    vtkSmartPointer<vtkMRMLAnnotationRulerNode>::New();
+  ruler->SetName(name.c_str());
+  ruler->SetPosition1(entry);
+  ruler->SetPosition2(target);
+  ruler->Initialize(scene);
+
+  this->AddRulerToHierarchy(ruler, hierarchy);
+
+  it->HoleRulerIDs[hole] = ruler->GetID();
+  grid->SetHoleMaterialized(hole, true);
+  return ruler;
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic
+::AddRulerToHierarchy(vtkMRMLAnnotationRulerNode* ruler,
+                      vtkMRMLAnnotationHierarchyNode* hierarchy)
+{
+  vtkMRMLScene* scene = this->GetMRMLScene();
+  if (!scene || !ruler || !ruler->GetID() || !hierarchy || !hierarchy->GetID())
+    {
+    return;
+    }
+
+  // Move the ruler under the requested path list
+  vtkMRMLHierarchyNode* rulerHierarchy =
+    vtkMRMLHierarchyNode::GetAssociatedHierarchyNode(scene, ruler->GetID());
+  if (!rulerHierarchy)
+    {
+    vtkNew<vtkMRMLAnnotationHierarchyNode> newHierarchy;
+    newHierarchy->HideFromEditorsOn();
+    scene->AddNode(newHierarchy.GetPointer());
+    newHierarchy->SetDisplayableNodeID(ruler->GetID());
+    rulerHierarchy = newHierarchy.GetPointer();
+    }
+  rulerHierarchy->SetParentNodeID(hierarchy->GetID());
+
+  if (this->IsPathHierarchyManaged(hierarchy->GetID()))
+    {
+    this->AddPathNode(ruler);
+    this->SetPathHierarchy(ruler->GetID(), hierarchy->GetID());
+    this->MarkPathModified(ruler->GetID());
+    }
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic
+::UpdateTemplateGridDisplay(vtkSlicerVisuaLineTemplateGrid* grid)
+{
+  std::vector<vtkInternal::TemplateGridEntry>::iterator it =
+    this->Internal->FindTemplateGrid(grid);
+  vtkMRMLScene* scene = this->GetMRMLScene();
+  if (it == this->Internal->TemplateGrids.end() || !scene)
+    {
+    return;
+    }
+
+  vtkMRMLModelNode* model = vtkMRMLModelNode::SafeDownCast(
+    scene->GetNodeByID(it->ModelNodeID.c_str()));
+  if (!model)
+    {
+    if (grid->GetNumberOfActiveHoles() == 0)
+      {
+      // Nothing to draw yet
+      return;
+      }
+    // Grids are not saved, neither is their drawing
+    model = AddHelperModel(scene, grid->GetName() ? grid->GetName() : "Template",
+                           0, 0.8, 1);
+    it->ModelNodeID = model->GetID();
+    }
+
+  // All holes of the grid share one polydata
+  model->SetAndObservePolyData(grid->GetTrajectoriesPolyData());
+}
+
+//---------------------------------------------------------------------------
+vtkSlicerVisuaLinePathStore* vtkSlicerVisuaLineLogic::GetPathStore()
+{
+  return this->Internal->PathStore;
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic::AddPathNode(vtkMRMLAnnotationRulerNode* path)
+{
+  // Pre-indexed paths only miss their curve and target
+  if (path && path->GetID() && this->Internal->PreIndexedPaths.count(path->GetID()))
+    {
+    this->FinishPreIndexedPath(path->GetID());
+    return;
+    }
+  this->ManagePathNode(path, 0, 0);
+}
+
+//---------------------------------------------------------------------------
+int vtkSlicerVisuaLineLogic::AddAllPathNodes()
+{
+  vtkMRMLScene* scene = this->GetMRMLScene();
+  if (!scene)
+    {
+    return 0;
+    }
+
+  // Collect first, managing adds target fiducials to the scene
+  std::vector<vtkMRMLNode*> nodes;
+  scene->GetNodesByClass("vtkMRMLAnnotationRulerNode", nodes);
+  std::vector<vtkSmartPointer<vtkMRMLAnnotationRulerNode> > rulers;
+  for (size_t i = 0; i < nodes.size(); ++i)
+    {
+    vtkMRMLAnnotationRulerNode* ruler = vtkMRMLAnnotationRulerNode::SafeDownCast(nodes[i]);
+    if (ruler && ruler->GetID() && !ruler->GetAttribute(VirtualOffsetOfAttributeName) &&
+        !this->IsPathManaged(ruler->GetID()))
+      {
+      rulers.push_back(ruler);
+      }
+    }
+  for (size_t i = 0; i < rulers.size(); ++i)
+    {
+    this->AddPathNode(rulers[i]);
+    }
+  return static_cast<int>(rulers.size());
+}
+
+//---------------------------------------------------------------------------
+namespace
+{
+// Target fiducial of a path, hidden by default
+vtkMRMLAnnotationFiducialNode* CreatePathTarget(vtkMRMLScene* scene,
+                                                const std::string& pathNodeID,
+                                                double position[3])
+{
+  vtkSmartPointer<vtkMRMLAnnotationFiducialNode> target =
+    vtkSmartPointer<vtkMRMLAnnotationFiducialNode>::New();
+  target->SetAttribute(TargetOfAttributeName, pathNodeID.c_str());
+  target->Initialize(scene);
+  target->SetFiducialCoordinates(position);
+  target->SetDisplayVisibility(0);
+  // Owned by the scene
+  return target;
+}
 }
 
 //---------------------------------------------------------------------------
 void vtkSlicerVisuaLineLogic
-::OnMRMLSceneNodeAdded(vtkMRMLNode* vtkNotUsed(node))
+::ManagePathNode(vtkMRMLAnnotationRulerNode* path,
+                 vtkMRMLAnnotationFiducialNode* target,
+                 vtkMRMLAnnotationRulerNode* virtualOffset)
+{
+  if (!path || !path->GetID() || !this->GetMRMLScene())
+    {
+    return;
+    }
+  std::string pathNodeID = path->GetID();
+  if (this->Internal->FindPath(pathNodeID.c_str()))
+    {
+    return;
+    }
+
+  // Record first so reentrant calls see the path as managed
+  vtkInternal::PathRecord& record = this->Internal->Paths[pathNodeID];
+  record.PathNode = path;
+  this->Internal->PathStore->AddPath(pathNodeID.c_str());
+  this->UpdatePathNode(path);
+
+  // Pre-indexing leaves the scene as loaded
+  bool preIndexed = this->Internal->PreIndexedPaths.count(pathNodeID) != 0;
+  if (!preIndexed)
+    {
+    this->LoadCurvedPath(path);
+    }
+  if (!target && !preIndexed)
+    {
+    double p1[3], p2[3];
+    this->GetPathWorldEndPoints(path, p1, p2);
+    target = CreatePathTarget(this->GetMRMLScene(), pathNodeID, p2);
+    }
+  record.TargetNode = target;
+
+  if (virtualOffset)
+    {
+    const char* offset = virtualOffset->GetAttribute(VirtualOffsetAttributeName);
+    record.VirtualOffsetNode = virtualOffset;
+    record.VirtualOffset = offset ? atof(offset) : 0.0;
+    this->UpdatePathTargetAndOffset(pathNodeID);
+    }
+  else if (this->Internal->LoadingPaths > 0)
+    {
+    this->UpdatePathTargetAndOffset(pathNodeID);
+    }
+
+  this->ObserveNode(path, pathNodeID, vtkInternal::PathRole);
+  this->ObserveNode(target, pathNodeID, vtkInternal::TargetRole);
+  this->UpdatePathMetrics(pathNodeID);
+  this->RecordPathState(pathNodeID);
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic::FinishPreIndexedPath(const std::string& pathNodeID)
+{
+  std::map<std::string, std::string>::iterator it =
+    this->Internal->PreIndexedPaths.find(pathNodeID);
+  if (it == this->Internal->PreIndexedPaths.end())
+    {
+    return;
+    }
+  this->Internal->PreIndexedPaths.erase(it);
+  vtkInternal::PathRecord* record = this->Internal->FindPath(pathNodeID.c_str());
+  if (!record || !record->PathNode || !this->GetMRMLScene())
+    {
+    return;
+    }
+  this->LoadCurvedPath(record->PathNode);
+  if (!record->TargetNode)
+    {
+    double p1[3], p2[3];
+    this->GetPathWorldEndPoints(record->PathNode, p1, p2);
+    record->TargetNode = CreatePathTarget(this->GetMRMLScene(), pathNodeID, p2);
+    }
+  this->ObserveNode(record->TargetNode, pathNodeID, vtkInternal::TargetRole);
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic::RemovePathNode(const char* pathNodeID)
+{
+  vtkInternal::PathRecord* record = this->Internal->FindPath(pathNodeID);
+  if (!record)
+    {
+    return;
+    }
+  std::string removedID = pathNodeID;
+  vtkMRMLScene* scene = this->GetMRMLScene();
+  bool compact = record->Compact;
+  if (compact && scene && !scene->IsClosing() &&
+      scene->GetNodeByID(record->HierarchyNodeID.c_str()))
+    {
+    // Left in its list as a regular ruler, as the other paths
+    this->ExpandPathNode(removedID);
+    record = this->Internal->FindPath(removedID.c_str());
+    if (!record)
+      {
+      return;
+      }
+    }
+
+  ++this->Internal->IgnoreNodeEvents;
+  this->Internal->SetLevelOfDetailNodesVisibility(*record, true);
+  --this->Internal->IgnoreNodeEvents;
+  if (record->TargetNode && record->TargetNode->GetID())
+    {
+    this->ReleaseNode(record->TargetNode->GetID());
+    record->TargetNode->SetDisplayVisibility(0);
+    }
+  if (record->VirtualOffsetNode)
+    {
+    record->VirtualOffsetNode->SetDisplayVisibility(0);
+    }
+  this->ReleaseNode(removedID);
+  this->RemoveCurvedPath(removedID);
+  std::map<std::string, std::set<std::string> >::iterator hierarchy =
+    this->Internal->HierarchyPaths.find(record->HierarchyNodeID);
+  if (hierarchy != this->Internal->HierarchyPaths.end())
+    {
+    hierarchy->second.erase(removedID);
+    }
+  this->Internal->Paths.erase(removedID);
+  this->Internal->NameIndex->RemoveName(removedID.c_str());
+  this->Internal->SelectedPaths.erase(removedID);
+  this->Internal->EntryModifiedPaths.erase(removedID);
+  this->Internal->PreIndexedPaths.erase(removedID);
+  // Dropped from the predictions on their next update
+  this->Internal->DeflectionModifiedPaths.insert(removedID);
+
+  this->Internal->PathStore->RemovePath(removedID.c_str());
+  if (!this->IsTransformObserverUpdateDeferred())
+    {
+    this->UpdateTransformObservers();
+    }
+  if (compact)
+    {
+    this->UpdateCompactPathsDisplay();
+    }
+  // Undone by managing the path again, if its node is still there
+  this->RecordPathState(removedID);
+}
+
+//---------------------------------------------------------------------------
+bool vtkSlicerVisuaLineLogic::IsPathManaged(const char* pathNodeID)
 {
+  return this->Internal->FindPath(pathNodeID) != 0;
 }
 
 //---------------------------------------------------------------------------
 void vtkSlicerVisuaLineLogic
-::OnMRMLSceneNodeRemoved(vtkMRMLNode* vtkNotUsed(node))
+::AddPathHierarchy(vtkMRMLAnnotationHierarchyNode* hierarchy)
 {
+  if (!hierarchy || !hierarchy->GetID() ||
+      this->IsPathHierarchyManaged(hierarchy->GetID()))
+    {
+    return;
+    }
+  std::string hierarchyNodeID = hierarchy->GetID();
+  this->Internal->HierarchyPaths[hierarchyNodeID];
+  this->ObserveNode(hierarchy, hierarchyNodeID, vtkInternal::HierarchyRole);
+  this->UpdatePathHierarchy(hierarchyNodeID.c_str());
+
+  // Rulers pre-indexed for the list and moved out since are in no list
+  std::vector<std::string> movedPathNodeIDs;
+  std::map<std::string, std::string>::iterator it;
+  for (it = this->Internal->PreIndexedPaths.begin();
+       it != this->Internal->PreIndexedPaths.end(); ++it)
+    {
+    if (it->second == hierarchyNodeID)
+      {
+      movedPathNodeIDs.push_back(it->first);
+      }
+    }
+  ++this->Internal->JournalSuspended;
+  for (size_t i = 0; i < movedPathNodeIDs.size(); ++i)
+    {
+    vtkInternal::PathRecord* record = this->Internal->FindPath(movedPathNodeIDs[i].c_str());
+    if (record && record->HierarchyNodeID.empty())
+      {
+      this->RemovePathNode(movedPathNodeIDs[i].c_str());
+      this->MarkPathModified(movedPathNodeIDs[i]);
+      }
+    this->Internal->PreIndexedPaths.erase(movedPathNodeIDs[i]);
+    }
+  --this->Internal->JournalSuspended;
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic::RemovePathHierarchy(const char* hierarchyNodeID)
+{
+  if (!this->IsPathHierarchyManaged(hierarchyNodeID))
+    {
+    return;
+    }
+  std::string removedID = hierarchyNodeID;
+  this->ReleaseNode(removedID);
+
+  std::set<std::string> paths;
+  paths.swap(this->Internal->HierarchyPaths[removedID]);
+  this->Internal->HierarchyPaths.erase(removedID);
+  // Compact paths are created again in the list if it is still there,
+  // dropped otherwise
+  vtkMRMLScene* scene = this->GetMRMLScene();
+  bool expandCompactPaths = scene && !scene->IsClosing() &&
+    scene->GetNodeByID(removedID.c_str());
+  // Not an edit of the paths: the list is loaded again when selected
+  ++this->Internal->JournalSuspended;
+  ++this->Internal->CompactBatch;
+  std::set<std::string>::iterator it;
+  for (it = paths.begin(); it != paths.end(); ++it)
+    {
+    vtkInternal::PathRecord* record = this->Internal->FindPath(it->c_str());
+    if (record && record->Compact && expandCompactPaths)
+      {
+      this->ExpandPathNode(*it);
+      record = this->Internal->FindPath(it->c_str());
+      }
+    if (record)
+      {
+      record->HierarchyNodeID.clear();
+      }
+    this->RemovePathNode(it->c_str());
+    this->Internal->UndoJournal->ForgetPath(*it);
+    this->MarkPathModified(*it);
+    }
+  --this->Internal->CompactBatch;
+  --this->Internal->JournalSuspended;
+  this->UpdateCompactPathsDisplay();
 }
 
+//---------------------------------------------------------------------------
+bool vtkSlicerVisuaLineLogic::IsPathHierarchyManaged(const char* hierarchyNodeID)
+{
+  return hierarchyNodeID &&
+    this->Internal->HierarchyPaths.count(hierarchyNodeID) != 0;
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic::UpdatePathHierarchy(const char* hierarchyNodeID)
+{
+  vtkMRMLScene* scene = this->GetMRMLScene();
+  if (!scene || !this->IsPathHierarchyManaged(hierarchyNodeID) ||
+      scene->IsBatchProcessing() || this->Internal->UpdatingHierarchy > 0)
+    {
+    return;
+    }
+  std::string hierarchyID = hierarchyNodeID;
+  vtkMRMLAnnotationHierarchyNode* hierarchy =
+    vtkMRMLAnnotationHierarchyNode::SafeDownCast(scene->GetNodeByID(hierarchyNodeID));
+  if (!hierarchy)
+    {
+    return;
+    }
+
+  // Rulers now in the hierarchy
+  ++this->Internal->UpdatingHierarchy;
+  std::set<std::string> current;
+  int childCount = hierarchy->GetNumberOfChildrenNodes();
+  for (int i = 0; i < childCount; ++i)
+    {
+    vtkMRMLHierarchyNode* child = hierarchy->GetNthChildNode(i);
+    vtkMRMLAnnotationRulerNode* ruler = child ?
+      vtkMRMLAnnotationRulerNode::SafeDownCast(child->GetAssociatedNode()) : 0;
+    if (!ruler || !ruler->GetID() ||
+        ruler->GetAttribute(VirtualOffsetOfAttributeName))
+      {
+      continue;
+      }
+    std::string pathNodeID = ruler->GetID();
+    current.insert(pathNodeID);
+
+    vtkInternal::PathRecord* record = this->Internal->FindPath(pathNodeID.c_str());
+    if (!record)
+      {
+      this->AddPathNode(ruler);
+      this->SetPathHierarchy(pathNodeID, hierarchyID);
+      this->MarkPathModified(pathNodeID);
+      }
+    else if (record->HierarchyNodeID != hierarchyID)
+      {
+      // Moved from another path list, or pre-indexed
+      this->FinishPreIndexedPath(pathNodeID);
+      this->SetPathHierarchy(pathNodeID, hierarchyID);
+      this->MarkPathModified(pathNodeID);
+      }
+    }
+
+  // Rulers moved out of the hierarchy are no longer managed. Compact
+  // paths have no ruler to move.
+  std::set<std::string> previous = this->Internal->HierarchyPaths[hierarchyID];
+  std::set<std::string>::iterator it;
+  for (it = previous.begin(); it != previous.end(); ++it)
+    {
+    if (current.find(*it) == current.end() && !this->IsPathCompact(it->c_str()))
+      {
+      this->RemovePathNode(it->c_str());
+      this->MarkPathModified(*it);
+      }
+    }
+  --this->Internal->UpdatingHierarchy;
+}
+
+//---------------------------------------------------------------------------
+namespace
+{
+// Ruler of a path list child, virtual offsets excluded
+vtkMRMLAnnotationRulerNode* GetChildPathNode(vtkMRMLHierarchyNode* hierarchy, int index)
+{
+  vtkMRMLHierarchyNode* child = hierarchy->GetNthChildNode(index);
+  vtkMRMLAnnotationRulerNode* ruler = child ?
+    vtkMRMLAnnotationRulerNode::SafeDownCast(child->GetAssociatedNode()) : 0;
+  if (!ruler || !ruler->GetID() ||
+      ruler->GetAttribute(VirtualOffsetOfAttributeName))
+    {
+    return 0;
+    }
+  return ruler;
+}
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic::QueuePathHierarchies()
+{
+  vtkMRMLScene* scene = this->GetMRMLScene();
+  std::vector<std::string> imported;
+  imported.swap(this->Internal->ImportedHierarchyNodeIDs);
+  if (!scene)
+    {
+    return;
+    }
+  std::set<std::string> queued(this->Internal->PreIndexHierarchyNodeIDs.begin(),
+                               this->Internal->PreIndexHierarchyNodeIDs.end());
+  size_t previousSize = queued.size();
+
+  // Imported lists holding rulers directly, the top level one excluded
+  for (size_t i = 0; i < imported.size(); ++i)
+    {
+    vtkMRMLHierarchyNode* hierarchy = vtkMRMLHierarchyNode::SafeDownCast(
+      scene->GetNodeByID(imported[i].c_str()));
+    if (!hierarchy || !hierarchy->GetParentNode() ||
+        this->IsPathHierarchyManaged(imported[i].c_str()) ||
+        queued.count(imported[i]))
+      {
+      continue;
+      }
+    int childCount = hierarchy->GetNumberOfChildrenNodes();
+    for (int j = 0; j < childCount; ++j)
+      {
+      if (GetChildPathNode(hierarchy, j))
+        {
+        this->Internal->PreIndexHierarchyNodeIDs.push_back(imported[i]);
+        queued.insert(imported[i]);
+        break;
+        }
+      }
+    }
+  if (queued.size() > previousSize)
+    {
+    this->InvokeEvent(PathHierarchiesQueuedEvent);
+    }
+}
+
+//---------------------------------------------------------------------------
+int vtkSlicerVisuaLineLogic::PreIndexPathHierarchies(int maximumNumberOfPaths)
+{
+  vtkMRMLScene* scene = this->GetMRMLScene();
+  if (!scene || scene->IsBatchProcessing())
+    {
+    return this->GetNumberOfPathHierarchiesToIndex();
+    }
+  vtkSlicerVisuaLineProfileMacro(this->Internal->Profiler, "Logic::PreIndexPathHierarchies");
+
+  // Not an edit of the paths, as selecting the list
+  ++this->Internal->JournalSuspended;
+  int numberOfPaths = 0;
+  std::deque<std::string>& queue = this->Internal->PreIndexHierarchyNodeIDs;
+  while (!queue.empty() && numberOfPaths < maximumNumberOfPaths)
+    {
+    std::string hierarchyNodeID = queue.front();
+    vtkMRMLAnnotationHierarchyNode* hierarchy =
+      vtkMRMLAnnotationHierarchyNode::SafeDownCast(
+        scene->GetNodeByID(hierarchyNodeID.c_str()));
+    // Skipped if removed or selected meanwhile
+    if (hierarchy && !this->IsPathHierarchyManaged(hierarchyNodeID.c_str()))
+      {
+      // Only the path store and name index are filled, a few paths per
+      // call. The list is managed when selected.
+      int childCount = hierarchy->GetNumberOfChildrenNodes();
+      for (; this->Internal->PreIndexChild < childCount &&
+             numberOfPaths < maximumNumberOfPaths; ++this->Internal->PreIndexChild)
+        {
+        vtkMRMLAnnotationRulerNode* ruler =
+          GetChildPathNode(hierarchy, this->Internal->PreIndexChild);
+        if (ruler && !this->IsPathManaged(ruler->GetID()))
+          {
+          this->Internal->PreIndexedPaths[ruler->GetID()] = hierarchyNodeID;
+          this->ManagePathNode(ruler, 0, 0);
+          ++numberOfPaths;
+          }
+        }
+      if (this->Internal->PreIndexChild < childCount)
+        {
+        break;
+        }
+      }
+    queue.pop_front();
+    this->Internal->PreIndexChild = 0;
+    }
+  --this->Internal->JournalSuspended;
+  return this->GetNumberOfPathHierarchiesToIndex();
+}
+
+//---------------------------------------------------------------------------
+int vtkSlicerVisuaLineLogic::GetNumberOfPathHierarchiesToIndex()
+{
+  return static_cast<int>(this->Internal->PreIndexHierarchyNodeIDs.size());
+}
+
+//---------------------------------------------------------------------------
+const char* vtkSlicerVisuaLineLogic::GetPathHierarchyNodeID(const char* pathNodeID)
+{
+  vtkInternal::PathRecord* record = this->Internal->FindPath(pathNodeID);
+  return (record && !record->HierarchyNodeID.empty()) ?
+    record->HierarchyNodeID.c_str() : 0;
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic
+::SetPathHierarchy(const std::string& pathNodeID, const std::string& hierarchyNodeID)
+{
+  vtkInternal::PathRecord* record = this->Internal->FindPath(pathNodeID.c_str());
+  if (!record || record->HierarchyNodeID == hierarchyNodeID)
+    {
+    return;
+    }
+  if (!record->HierarchyNodeID.empty())
+    {
+    this->Internal->HierarchyPaths[record->HierarchyNodeID].erase(pathNodeID);
+    }
+  record->HierarchyNodeID = hierarchyNodeID;
+  this->Internal->HierarchyPaths[hierarchyNodeID].insert(pathNodeID);
+  this->RecordPathState(pathNodeID);
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic
+::GetHierarchyPaths(const char* hierarchyNodeID, std::vector<std::string>& pathNodeIDs)
+{
+  pathNodeIDs.clear();
+  std::map<std::string, std::set<std::string> >::iterator it =
+    hierarchyNodeID ? this->Internal->HierarchyPaths.find(hierarchyNodeID) :
+    this->Internal->HierarchyPaths.end();
+  if (it != this->Internal->HierarchyPaths.end())
+    {
+    pathNodeIDs.assign(it->second.begin(), it->second.end());
+    }
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic
+::GetLoadedPathHierarchies(std::vector<std::string>& hierarchyNodeIDs)
+{
+  hierarchyNodeIDs.assign(this->Internal->LoadedHierarchyNodeIDs.begin(),
+                          this->Internal->LoadedHierarchyNodeIDs.end());
+}
+
+//---------------------------------------------------------------------------
+const char* vtkSlicerVisuaLineLogic::GetPathName(const char* pathNodeID)
+{
+  vtkInternal::PathRecord* record = this->Internal->FindPath(pathNodeID);
+  if (record && record->Compact)
+    {
+    vtkSlicerVisuaLinePathStore* store = this->Internal->PathStore;
+    return store->GetCompactRecord(store->GetPathIndex(pathNodeID))->Name.c_str();
+    }
+  return record && record->PathNode ? record->PathNode->GetName() : 0;
+}
+
+//---------------------------------------------------------------------------
+namespace
+{
+// State of the nodes of a path kept in its compact record
+void GetNodeState(vtkMRMLAnnotationRulerNode* path,
+                  vtkMRMLAnnotationFiducialNode* target,
+                  vtkSlicerVisuaLinePathStore::CompactRecord& record)
+{
+  record.Name = path->GetName() ? path->GetName() : "";
+  record.Flags = 0;
+  if (path->GetDisplayVisibility())
+    {
+    record.Flags |= vtkSlicerVisuaLinePathStore::VisibleFlag;
+    }
+  if (path->GetLocked())
+    {
+    record.Flags |= vtkSlicerVisuaLinePathStore::LockedFlag;
+    }
+  if (target && target->GetDisplayVisibility())
+    {
+    record.Flags |= vtkSlicerVisuaLinePathStore::TargetVisibleFlag;
+    }
+  vtkMRMLAnnotationLineDisplayNode* line = path->GetAnnotationLineDisplayNode();
+  if (line)
+    {
+    double* color = line->GetColor();
+    for (int i = 0; i < 3; ++i)
+      {
+      record.Color[i] = static_cast<float>(color[i]);
+      }
+    }
+}
+
+void SetNodeState(const vtkSlicerVisuaLinePathStore::CompactRecord& record,
+                  vtkMRMLAnnotationRulerNode* path,
+                  vtkMRMLAnnotationFiducialNode* target)
+{
+  path->SetLocked((record.Flags & vtkSlicerVisuaLinePathStore::LockedFlag) ? 1 : 0);
+  if (path->GetAnnotationLineDisplayNode())
+    {
+    path->GetAnnotationLineDisplayNode()->SetColor(
+      record.Color[0], record.Color[1], record.Color[2]);
+    }
+  path->SetDisplayVisibility(
+    (record.Flags & vtkSlicerVisuaLinePathStore::VisibleFlag) ? 1 : 0);
+  if (target)
+    {
+    target->SetDisplayVisibility(
+      (record.Flags & vtkSlicerVisuaLinePathStore::TargetVisibleFlag) ? 1 : 0);
+    }
+}
+
+// Display settings besides the color and visibility kept in a compact
+// record are the ones of a new display node, and the display node shows
+// as the node does
+bool HasDefaultDisplayState(vtkMRMLDisplayNode* displayNode, bool visible,
+                            bool compareColor)
+{
+  if (!displayNode)
+    {
+    return true;
+    }
+  vtkSmartPointer<vtkMRMLDisplayNode> defaults;
+  defaults.TakeReference(vtkMRMLDisplayNode::SafeDownCast(displayNode->CreateNodeInstance()));
+  if (!defaults || (displayNode->GetVisibility() != 0) != visible ||
+      displayNode->GetOpacity() != defaults->GetOpacity() ||
+      vtkMath::Distance2BetweenPoints(displayNode->GetSelectedColor(),
+                                      defaults->GetSelectedColor()) > 0.0 ||
+      (compareColor && vtkMath::Distance2BetweenPoints(displayNode->GetColor(),
+                                                       defaults->GetColor()) > 0.0))
+    {
+    return false;
+    }
+  vtkMRMLAnnotationPointDisplayNode* point =
+    vtkMRMLAnnotationPointDisplayNode::SafeDownCast(displayNode);
+  vtkMRMLAnnotationTextDisplayNode* text =
+    vtkMRMLAnnotationTextDisplayNode::SafeDownCast(displayNode);
+  vtkMRMLAnnotationLineDisplayNode* line =
+    vtkMRMLAnnotationLineDisplayNode::SafeDownCast(displayNode);
+  if (point)
+    {
+    vtkMRMLAnnotationPointDisplayNode* defaultPoint =
+      vtkMRMLAnnotationPointDisplayNode::SafeDownCast(defaults);
+    return point->GetGlyphScale() == defaultPoint->GetGlyphScale() &&
+      point->GetGlyphType() == defaultPoint->GetGlyphType();
+    }
+  if (text)
+    {
+    return text->GetTextScale() ==
+      vtkMRMLAnnotationTextDisplayNode::SafeDownCast(defaults)->GetTextScale();
+    }
+  if (line)
+    {
+    return line->GetLineThickness() ==
+      vtkMRMLAnnotationLineDisplayNode::SafeDownCast(defaults)->GetLineThickness();
+    }
+  return true;
+}
+
+// Whether a compact record and the logic tags are enough to create the
+// node again as it is: no description, no other attribute and default
+// display settings
+bool HasDefaultNodeState(vtkMRMLDisplayableNode* node)
+{
+  if (!node)
+    {
+    return true;
+    }
+  if (node->GetDescription() && *node->GetDescription())
+    {
+    return false;
+    }
+  std::vector<std::string> attributeNames = node->GetAttributeNames();
+  for (size_t i = 0; i < attributeNames.size(); ++i)
+    {
+    if (attributeNames[i].compare(0, 10, "VisuaLine.") != 0)
+      {
+      return false;
+      }
+    }
+  for (int i = 0; i < node->GetNumberOfDisplayNodes(); ++i)
+    {
+    // Line color and path visibility are in the record
+    vtkMRMLDisplayNode* displayNode = node->GetNthDisplayNode(i);
+    bool isLine = vtkMRMLAnnotationLineDisplayNode::SafeDownCast(displayNode) != 0;
+    if (!HasDefaultDisplayState(displayNode, node->GetDisplayVisibility() != 0, !isLine))
+      {
+      return false;
+      }
+    }
+  return true;
+}
+
+// Estimated from the node class, its strings and its polydata
+vtkIdType GetNodeMemorySize(vtkMRMLNode* node)
+{
+  size_t size = sizeof(vtkMRMLNode);
+  if (vtkMRMLAnnotationRulerNode::SafeDownCast(node))
+    {
+    size = sizeof(vtkMRMLAnnotationRulerNode);
+    }
+  else if (vtkMRMLAnnotationFiducialNode::SafeDownCast(node))
+    {
+    size = sizeof(vtkMRMLAnnotationFiducialNode);
+    }
+  else if (vtkMRMLAnnotationLineDisplayNode::SafeDownCast(node))
+    {
+    size = sizeof(vtkMRMLAnnotationLineDisplayNode);
+    }
+  else if (vtkMRMLAnnotationPointDisplayNode::SafeDownCast(node))
+    {
+    size = sizeof(vtkMRMLAnnotationPointDisplayNode);
+    }
+  else if (vtkMRMLAnnotationTextDisplayNode::SafeDownCast(node))
+    {
+    size = sizeof(vtkMRMLAnnotationTextDisplayNode);
+    }
+  else if (vtkMRMLAnnotationHierarchyNode::SafeDownCast(node))
+    {
+    size = sizeof(vtkMRMLAnnotationHierarchyNode);
+    }
+  else if (vtkMRMLDisplayNode::SafeDownCast(node))
+    {
+    size = sizeof(vtkMRMLDisplayNode);
+    }
+  vtkIdType memorySize = static_cast<vtkIdType>(size);
+  memorySize += node->GetName() ? strlen(node->GetName()) : 0;
+  memorySize += node->GetID() ? strlen(node->GetID()) : 0;
+  vtkMRMLModelNode* model = vtkMRMLModelNode::SafeDownCast(node);
+  if (model && model->GetPolyData())
+    {
+    memorySize += 1024 * static_cast<vtkIdType>(model->GetPolyData()->GetActualMemorySize());
+    }
+  return memorySize;
+}
+
+void AddNodeMemoryUsage(vtkMRMLScene* scene, vtkMRMLNode* node,
+                        vtkSlicerVisuaLineLogic::MemoryUsage& usage)
+{
+  std::vector<vtkMRMLNode*> nodes;
+  GetNodeAndDependents(scene, node, nodes);
+  for (size_t i = 0; i < nodes.size(); ++i)
+    {
+    ++usage.NumberOfNodes;
+    usage.NodeSize += GetNodeMemorySize(nodes[i]);
+    }
+}
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic::SetCompactStorage(bool enabled)
+{
+  if (this->Internal->CompactStorage == enabled)
+    {
+    return;
+    }
+  this->Internal->CompactStorage = enabled;
+
+  // IDs first: expanding a path whose ID was taken meanwhile manages a
+  // new path in place of its record
+  std::vector<std::string> pathNodeIDs;
+  std::map<std::string, vtkInternal::PathRecord>::iterator it;
+  for (it = this->Internal->Paths.begin(); it != this->Internal->Paths.end(); ++it)
+    {
+    if (it->second.Compact != enabled &&
+        (!enabled || !this->Internal->SelectedPaths.count(it->first)))
+      {
+      pathNodeIDs.push_back(it->first);
+      }
+    }
+  ++this->Internal->CompactBatch;
+  for (size_t i = 0; i < pathNodeIDs.size(); ++i)
+    {
+    if (enabled)
+      {
+      this->CompactPathNode(pathNodeIDs[i]);
+      }
+    else
+      {
+      this->ExpandPathNode(pathNodeIDs[i]);
+      }
+    }
+  --this->Internal->CompactBatch;
+  this->UpdateCompactPathsDisplay();
+}
+
+//---------------------------------------------------------------------------
+bool vtkSlicerVisuaLineLogic::GetCompactStorage()
+{
+  return this->Internal->CompactStorage;
+}
+
+//---------------------------------------------------------------------------
+bool vtkSlicerVisuaLineLogic::CompactPath(const char* pathNodeID)
+{
+  if (!pathNodeID || !this->CompactPathNode(pathNodeID))
+    {
+    return false;
+    }
+  this->UpdateCompactPathsDisplay();
+  return true;
+}
+
+//---------------------------------------------------------------------------
+bool vtkSlicerVisuaLineLogic::ExpandPath(const char* pathNodeID)
+{
+  if (!this->IsPathCompact(pathNodeID) || !this->ExpandPathNode(pathNodeID))
+    {
+    return false;
+    }
+  this->UpdateCompactPathsDisplay();
+  return true;
+}
+
+//---------------------------------------------------------------------------
+bool vtkSlicerVisuaLineLogic::IsPathCompact(const char* pathNodeID)
+{
+  vtkInternal::PathRecord* record = this->Internal->FindPath(pathNodeID);
+  return record && record->Compact;
+}
+
+//---------------------------------------------------------------------------
+int vtkSlicerVisuaLineLogic::GetNumberOfCompactPaths()
+{
+  return this->Internal->PathStore->GetNumberOfCompactPaths();
+}
+
+//---------------------------------------------------------------------------
+bool vtkSlicerVisuaLineLogic::CompactPathNode(const std::string& pathNodeID)
+{
+  vtkInternal::PathRecord* record = this->Internal->FindPath(pathNodeID.c_str());
+  vtkMRMLScene* scene = this->GetMRMLScene();
+  // Curves and paths outside a list keep their nodes
+  if (!scene || !record || record->Compact || !record->PathNode ||
+      record->HierarchyNodeID.empty() ||
+      this->Internal->Curves.count(pathNodeID) ||
+      record->PathNode->GetAttribute(GetControlPointsAttributeName()))
+    {
+    return false;
+    }
+
+  // Saved with the visibility set by the user
+  ++this->Internal->IgnoreNodeEvents;
+  this->Internal->SetLevelOfDetailNodesVisibility(*record, true);
+  record->LevelOfDetailHidden = 0;
+  --this->Internal->IgnoreNodeEvents;
+  // The record only holds name, color, visibility and lock
+  if (!HasDefaultNodeState(record->PathNode) ||
+      !HasDefaultNodeState(record->TargetNode))
+    {
+    return false;
+    }
+
+  vtkSlicerVisuaLinePathStore* store = this->Internal->PathStore;
+  vtkSlicerVisuaLinePathStore::CompactRecord compact;
+  GetNodeState(record->PathNode, record->TargetNode, compact);
+  store->SetCompactRecord(store->GetPathIndex(pathNodeID.c_str()), compact);
+
+  // Compact before removing: the removal events are skipped
+  this->ReleaseNode(pathNodeID);
+  if (record->TargetNode && record->TargetNode->GetID())
+    {
+    this->ReleaseNode(record->TargetNode->GetID());
+    }
+  record->Compact = true;
+  std::vector<vtkMRMLNode*> nodes;
+  GetNodeAndDependents(scene, record->PathNode, nodes);
+  GetNodeAndDependents(scene, record->TargetNode, nodes);
+  GetNodeAndDependents(scene, record->VirtualOffsetNode, nodes);
+  std::vector<vtkSmartPointer<vtkMRMLNode> > removedNodes(nodes.begin(), nodes.end());
+  record->PathNode = 0;
+  record->TargetNode = 0;
+  record->VirtualOffsetNode = 0;
+
+  ++this->Internal->IgnoreNodeEvents;
+  for (size_t i = 0; i < removedNodes.size(); ++i)
+    {
+    if (scene->IsNodePresent(removedNodes[i]))
+      {
+      scene->RemoveNode(removedNodes[i]);
+      }
+    }
+  --this->Internal->IgnoreNodeEvents;
+  return true;
+}
+
+//---------------------------------------------------------------------------
+bool vtkSlicerVisuaLineLogic::ExpandPathNode(const std::string& pathNodeID)
+{
+  vtkInternal::PathRecord* record = this->Internal->FindPath(pathNodeID.c_str());
+  vtkMRMLScene* scene = this->GetMRMLScene();
+  vtkMRMLAnnotationHierarchyNode* hierarchy = (scene && record) ?
+    vtkMRMLAnnotationHierarchyNode::SafeDownCast(
+      scene->GetNodeByID(record->HierarchyNodeID.c_str())) : 0;
+  if (!record || !record->Compact || !hierarchy)
+    {
+    return false;
+    }
+
+  vtkSlicerVisuaLinePathStore* store = this->Internal->PathStore;
+  int index = store->GetPathIndex(pathNodeID.c_str());
+  vtkSlicerVisuaLinePathStore::CompactRecord compact = *store->GetCompactRecord(index);
+  std::string transformNodeID = store->GetPathTransformNodeID(index) ?
+    store->GetPathTransformNodeID(index) : "";
+  double p1[3], p2[3];
+  store->GetLocalEndPoints(index, p1, p2);
+
+  // Same ID: the widget, the undo journal and the template holes know
+  // the path by it
+  ++this->Internal->IgnoreNodeEvents;
+  ++this->Internal->JournalSuspended;
+  vtkSmartPointer<vtkMRMLAnnotationRulerNode> path =
+    vtkSmartPointer<vtkMRMLAnnotationRulerNode>::New();
+  path->SetID(pathNodeID.c_str());
+  path->SetName(compact.Name.c_str());
+  path->SetPosition1(p1);
+  path->SetPosition2(p2);
+  path->Initialize(scene);
+  if (!transformNodeID.empty())
+    {
+    path->SetAndObserveTransformNodeID(transformNodeID.c_str());
+    }
+
+  if (!path->GetID() || pathNodeID != path->GetID())
+    {
+    // ID taken meanwhile, the path is managed again as a new one
+    double offset = record->VirtualOffset;
+    store->RemoveCompactRecord(index);
+    record->Compact = false;
+    this->RemovePathNode(pathNodeID.c_str());
+    this->MarkPathModified(pathNodeID);
+    this->AddRulerToHierarchy(path, hierarchy);
+    SetNodeState(compact, path, this->GetPathTargetNode(path->GetID()));
+    if (offset != 0.0)
+      {
+      this->SetPathVirtualOffset(path->GetID(), offset);
+      }
+    --this->Internal->JournalSuspended;
+    --this->Internal->IgnoreNodeEvents;
+    return false;
+    }
+
+  store->RemoveCompactRecord(index);
+  record->Compact = false;
+  record->PathNode = path;
+  // Managed already, only put under its list
+  this->AddRulerToHierarchy(path, hierarchy);
+
+  double world1[3], world2[3];
+  store->GetWorldEndPoints(index, world1, world2);
+  record->TargetNode = CreatePathTarget(scene, pathNodeID, world2);
+  SetNodeState(compact, path, record->TargetNode);
+  if (record->VirtualOffset != 0.0)
+    {
+    this->SetPathVirtualOffset(pathNodeID.c_str(), record->VirtualOffset);
+    }
+  this->ObserveNode(path, pathNodeID, vtkInternal::PathRole);
+  this->ObserveNode(record->TargetNode, pathNodeID, vtkInternal::TargetRole);
+  --this->Internal->JournalSuspended;
+  --this->Internal->IgnoreNodeEvents;
+  this->MarkPathModified(pathNodeID);
+  return true;
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic::UpdateCompactPathsDisplay()
+{
+  vtkMRMLScene* scene = this->GetMRMLScene();
+  vtkSlicerVisuaLinePathStore* store = this->Internal->PathStore;
+  if (!scene || scene->IsClosing() || this->Internal->CompactBatch > 0)
+    {
+    return;
+    }
+
+  vtkMRMLModelNode* model = vtkMRMLModelNode::SafeDownCast(
+    scene->GetNodeByID(this->Internal->CompactPathsModelNodeID.c_str()));
+  if (!model)
+    {
+    if (store->GetNumberOfCompactPaths() == 0)
+      {
+      // Nothing to draw yet
+      return;
+      }
+    // Compact paths are saved as rulers
+    model = AddHelperModel(scene, "CompactPaths", 1, 0.5, 0);
+    this->Internal->CompactPathsModelNodeID = model->GetID();
+    }
+
+  // One line per visible compact path, in world coordinates
+  vtkNew<vtkPoints> points;
+  vtkNew<vtkCellArray> lines;
+  for (int i = 0; i < store->GetNumberOfPaths(); ++i)
+    {
+    vtkSlicerVisuaLinePathStore::CompactRecord* record = store->GetCompactRecord(i);
+    if (!record || !(record->Flags & vtkSlicerVisuaLinePathStore::VisibleFlag))
+      {
+      continue;
+      }
+    double p1[3], p2[3];
+    store->GetWorldEndPoints(i, p1, p2);
+    lines->InsertNextCell(2);
+    lines->InsertCellPoint(points->InsertNextPoint(p1));
+    lines->InsertCellPoint(points->InsertNextPoint(p2));
+    }
+  vtkNew<vtkPolyData> polyData;
+  polyData->SetPoints(points.GetPointer());
+  polyData->SetLines(lines.GetPointer());
+  model->SetAndObservePolyData(polyData.GetPointer());
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic::SaveCompactPaths(bool save)
+{
+  vtkMRMLScene* scene = this->GetMRMLScene();
+  if (!scene)
+    {
+    return;
+    }
+
+  // Saved as rulers with their own IDs, compacted again after the save
+  ++this->Internal->CompactBatch;
+  if (save)
+    {
+    this->Internal->SavedCompactPathNodeIDs.clear();
+    std::map<std::string, vtkInternal::PathRecord>::iterator it;
+    for (it = this->Internal->Paths.begin(); it != this->Internal->Paths.end(); ++it)
+      {
+      if (it->second.Compact)
+        {
+        this->Internal->SavedCompactPathNodeIDs.push_back(it->first);
+        }
+      }
+    for (size_t i = 0; i < this->Internal->SavedCompactPathNodeIDs.size(); ++i)
+      {
+      this->ExpandPathNode(this->Internal->SavedCompactPathNodeIDs[i]);
+      }
+    }
+  else
+    {
+    for (size_t i = 0; i < this->Internal->SavedCompactPathNodeIDs.size(); ++i)
+      {
+      this->CompactPathNode(this->Internal->SavedCompactPathNodeIDs[i]);
+      }
+    this->Internal->SavedCompactPathNodeIDs.clear();
+    }
+  --this->Internal->CompactBatch;
+  this->UpdateCompactPathsDisplay();
+}
+
+//---------------------------------------------------------------------------
+vtkSlicerVisuaLineLogic::MemoryUsage::MemoryUsage()
+  : NumberOfPaths(0), NumberOfCompactPaths(0), NumberOfNodes(0),
+    NodeSize(0), RecordSize(0)
+{
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic
+::GetPathMemoryUsage(const char* pathNodeID, MemoryUsage& usage)
+{
+  vtkInternal::PathRecord* record = this->Internal->FindPath(pathNodeID);
+  if (!record)
+    {
+    return;
+    }
+  ++usage.NumberOfPaths;
+  usage.NumberOfCompactPaths += record->Compact ? 1 : 0;
+
+  // Path record, its key and its arrays in the store
+  vtkSlicerVisuaLinePathStore* store = this->Internal->PathStore;
+  usage.RecordSize += sizeof(vtkInternal::PathRecord) + sizeof(std::string) +
+    strlen(pathNodeID) + record->HierarchyNodeID.capacity() +
+    store->GetPathMemorySize(store->GetPathIndex(pathNodeID));
+
+  vtkMRMLNode* nodes[3] =
+    { record->PathNode, record->TargetNode, record->VirtualOffsetNode };
+  for (int i = 0; i < 3; ++i)
+    {
+    AddNodeMemoryUsage(this->GetMRMLScene(), nodes[i], usage);
+    }
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic
+::GetHierarchyMemoryUsage(const char* hierarchyNodeID, MemoryUsage& usage)
+{
+  if (!hierarchyNodeID)
+    {
+    std::map<std::string, vtkInternal::PathRecord>::iterator it;
+    for (it = this->Internal->Paths.begin(); it != this->Internal->Paths.end(); ++it)
+      {
+      if (it->second.HierarchyNodeID.empty())
+        {
+        this->GetPathMemoryUsage(it->first.c_str(), usage);
+        }
+      }
+    return;
+    }
+  std::map<std::string, std::set<std::string> >::iterator it =
+    this->Internal->HierarchyPaths.find(hierarchyNodeID);
+  if (it == this->Internal->HierarchyPaths.end())
+    {
+    return;
+    }
+  AddNodeMemoryUsage(this->GetMRMLScene(), this->GetMRMLScene() ?
+    this->GetMRMLScene()->GetNodeByID(hierarchyNodeID) : 0, usage);
+  std::set<std::string>::iterator path;
+  for (path = it->second.begin(); path != it->second.end(); ++path)
+    {
+    this->GetPathMemoryUsage(path->c_str(), usage);
+    }
+}
+
+//---------------------------------------------------------------------------
+namespace
+{
+void PrintMemoryUsage(ostream& os, const std::string& name,
+                      const vtkSlicerVisuaLineLogic::MemoryUsage& usage)
+{
+  os << std::left << std::setw(40) << name << std::right
+     << std::setw(10) << usage.NumberOfPaths
+     << std::setw(10) << usage.NumberOfCompactPaths
+     << std::setw(10) << usage.NumberOfNodes
+     << std::setw(14) << usage.NodeSize
+     << std::setw(14) << usage.RecordSize << "\n";
+}
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic::PrintMemoryReport(ostream& os)
+{
+  vtkMRMLScene* scene = this->GetMRMLScene();
+  os << std::left << std::setw(40) << "Path list / path" << std::right
+     << std::setw(10) << "Paths" << std::setw(10) << "Compact"
+     << std::setw(10) << "Nodes" << std::setw(14) << "Node bytes"
+     << std::setw(14) << "Record bytes" << "\n";
+
+  // Lists first, then their paths
+  MemoryUsage total;
+  std::vector<std::string> hierarchyNodeIDs;
+  std::map<std::string, std::set<std::string> >::iterator it;
+  for (it = this->Internal->HierarchyPaths.begin();
+       it != this->Internal->HierarchyPaths.end(); ++it)
+    {
+    hierarchyNodeIDs.push_back(it->first);
+    }
+  hierarchyNodeIDs.push_back(std::string());
+  for (size_t i = 0; i < hierarchyNodeIDs.size(); ++i)
+    {
+    const char* hierarchyNodeID =
+      hierarchyNodeIDs[i].empty() ? 0 : hierarchyNodeIDs[i].c_str();
+    MemoryUsage usage;
+    this->GetHierarchyMemoryUsage(hierarchyNodeID, usage);
+    vtkMRMLNode* hierarchy = scene && hierarchyNodeID ?
+      scene->GetNodeByID(hierarchyNodeID) : 0;
+    std::string name = !hierarchyNodeID ? std::string("(no list)") :
+      (hierarchy && hierarchy->GetName() ? hierarchy->GetName() : hierarchyNodeIDs[i]);
+    PrintMemoryUsage(os, name, usage);
+    total.NumberOfPaths += usage.NumberOfPaths;
+    total.NumberOfCompactPaths += usage.NumberOfCompactPaths;
+    total.NumberOfNodes += usage.NumberOfNodes;
+    total.NodeSize += usage.NodeSize;
+    total.RecordSize += usage.RecordSize;
+    }
+  PrintMemoryUsage(os, "Total", total);
+
+  os << "\n";
+  vtkSlicerVisuaLinePathStore* store = this->Internal->PathStore;
+  for (int i = 0; i < store->GetNumberOfPaths(); ++i)
+    {
+    MemoryUsage usage;
+    this->GetPathMemoryUsage(store->GetPathNodeID(i), usage);
+    const char* name = this->GetPathName(store->GetPathNodeID(i));
+    PrintMemoryUsage(os, name ? name : store->GetPathNodeID(i), usage);
+    }
+}
+
+//---------------------------------------------------------------------------
+bool vtkSlicerVisuaLineLogic::WriteMemoryReport(const char* fileName)
+{
+  if (!fileName)
+    {
+    return false;
+    }
+  std::ofstream file(fileName);
+  if (!file)
+    {
+    vtkErrorMacro("WriteMemoryReport: cannot write " << fileName);
+    return false;
+    }
+  this->PrintMemoryReport(file);
+  file.close();
+  return !file.fail();
+}
+
+//---------------------------------------------------------------------------
+vtkMRMLAnnotationRulerNode* vtkSlicerVisuaLineLogic::GetPathNode(const char* pathNodeID)
+{
+  vtkInternal::PathRecord* record = this->Internal->FindPath(pathNodeID);
+  return record ? record->PathNode.GetPointer() : 0;
+}
+
+//---------------------------------------------------------------------------
+vtkMRMLAnnotationRulerNode* vtkSlicerVisuaLineLogic
+::GetOrExpandPathNode(const char* pathNodeID)
+{
+  this->ExpandPath(pathNodeID);
+  return this->GetPathNode(pathNodeID);
+}
+
+//---------------------------------------------------------------------------
+vtkMRMLAnnotationFiducialNode* vtkSlicerVisuaLineLogic
+::GetPathTargetNode(const char* pathNodeID)
+{
+  vtkInternal::PathRecord* record = this->Internal->FindPath(pathNodeID);
+  return record ? record->TargetNode.GetPointer() : 0;
+}
+
+//---------------------------------------------------------------------------
+vtkMRMLAnnotationRulerNode* vtkSlicerVisuaLineLogic
+::GetPathVirtualOffsetNode(const char* pathNodeID)
+{
+  vtkInternal::PathRecord* record = this->Internal->FindPath(pathNodeID);
+  return record ? record->VirtualOffsetNode.GetPointer() : 0;
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic
+::SetPathVirtualOffset(const char* pathNodeID, double offset)
+{
+  vtkSlicerVisuaLineProfileMacro(this->Internal->Profiler, "Logic::SetPathVirtualOffset");
+  vtkInternal::PathRecord* record = this->Internal->FindPath(pathNodeID);
+  if (!record || (!record->PathNode && !record->Compact) || !this->GetMRMLScene())
+    {
+    return;
+    }
+
+  // Compact paths get their offset ruler with their other nodes
+  if (!record->VirtualOffsetNode && !record->Compact)
+    {
+    // Create new ruler for virtual tip
+    vtkSmartPointer<vtkMRMLAnnotationRulerNode> virtualTip
+      = vtkSmartPointer<vtkMRMLAnnotationRulerNode>::New();
+    virtualTip->HideFromEditorsOff();
+    virtualTip->SetAttribute(VirtualOffsetOfAttributeName, pathNodeID);
+    virtualTip->Initialize(this->GetMRMLScene());
+
+    // Set color to green
+    if (virtualTip->GetAnnotationLineDisplayNode() &&
+        virtualTip->GetAnnotationPointDisplayNode() &&
+        virtualTip->GetAnnotationTextDisplayNode())
+      {
+      virtualTip->GetAnnotationLineDisplayNode()->SetColor(0,1,0);
+      virtualTip->GetAnnotationPointDisplayNode()->SetColor(0,1,0);
+      virtualTip->GetAnnotationTextDisplayNode()->SetColor(0,1,0);
+      }
+    virtualTip->SetLocked(1);
+    record->VirtualOffsetNode = virtualTip;
+    }
+
+  // Saved with the scene
+  if (record->VirtualOffsetNode)
+    {
+    std::ostringstream offsetString;
+    offsetString << offset;
+    record->VirtualOffsetNode->SetAttribute(VirtualOffsetAttributeName,
+                                            offsetString.str().c_str());
+    }
+  record->VirtualOffset = offset;
+  vtkSlicerVisuaLinePathStore* store = this->Internal->PathStore;
+  store->SetPathMetric(store->GetPathIndex(pathNodeID),
+                       GetVirtualOffsetMetricName(), offset);
+  this->UpdatePathTargetAndOffset(pathNodeID);
+  // Tip depth follows
+  this->MarkPathModified(pathNodeID);
+  this->RecordPathState(pathNodeID);
+}
+
+//---------------------------------------------------------------------------
+double vtkSlicerVisuaLineLogic::GetPathVirtualOffset(const char* pathNodeID)
+{
+  // DistanceMeasurement of the offset ruler is only initialized once a
+  // point is moved, so the value is kept here.
+  vtkInternal::PathRecord* record = this->Internal->FindPath(pathNodeID);
+  return record ? record->VirtualOffset : 0.0;
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic
+::TakeModifiedPaths(std::vector<std::string>& pathNodeIDs)
+{
+  pathNodeIDs.clear();
+  pathNodeIDs.swap(this->Internal->ModifiedPaths);
+  this->Internal->ModifiedPathSet.clear();
+  this->Internal->ModifiedEventPending = false;
+}
+
+//---------------------------------------------------------------------------
+int vtkSlicerVisuaLineLogic
+::SetPathsVisibility(const std::vector<std::string>& pathNodeIDs, bool visible)
+{
+  int numberOfChangedNodes = 0;
+  bool compactPathsModified = false;
+  vtkSlicerVisuaLinePathStore* store = this->Internal->PathStore;
+  // Display nodes request a render each, the views render once at the end
+  vtkMRMLScene* scene = pathNodeIDs.size() > 1 ? this->GetMRMLScene() : 0;
+  if (scene)
+    {
+    scene->StartState(vtkMRMLScene::BatchProcessState);
+    }
+  ++this->Internal->IgnoreNodeEvents;
+  this->Internal->UndoJournal->BeginEntry();
+  for (size_t i = 0; i < pathNodeIDs.size(); ++i)
+    {
+    vtkInternal::PathRecord* record = this->Internal->FindPath(pathNodeIDs[i].c_str());
+    if (!record)
+      {
+      continue;
+      }
+    if (record->Compact)
+      {
+      // Path and target flags, a flag counts as a node
+      const unsigned int mask = vtkSlicerVisuaLinePathStore::VisibleFlag |
+        vtkSlicerVisuaLinePathStore::TargetVisibleFlag;
+      vtkSlicerVisuaLinePathStore::CompactRecord* compact =
+        store->GetCompactRecord(store->GetPathIndex(pathNodeIDs[i].c_str()));
+      unsigned int flags = visible ? (compact->Flags | mask) : (compact->Flags & ~mask);
+      numberOfChangedNodes += ((flags ^ compact->Flags) & vtkSlicerVisuaLinePathStore::VisibleFlag) ? 1 : 0;
+      numberOfChangedNodes += ((flags ^ compact->Flags) & vtkSlicerVisuaLinePathStore::TargetVisibleFlag) ? 1 : 0;
+      compactPathsModified = compactPathsModified || flags != compact->Flags;
+      compact->Flags = flags;
+      this->Internal->DeflectionModifiedPaths.insert(pathNodeIDs[i]);
+      this->RecordPathState(pathNodeIDs[i]);
+      continue;
+      }
+    vtkMRMLDisplayableNode* nodes[3] =
+      { record->PathNode, record->TargetNode, record->VirtualOffsetNode };
+    for (int j = 0; j < 3; ++j)
+      {
+      // Offset ruler stays hidden while the offset is 0
+      bool nodeVisible = visible && (j != 2 || record->VirtualOffset != 0);
+      if (nodes[j] && (nodes[j]->GetDisplayVisibility() != 0) != nodeVisible)
+        {
+        nodes[j]->SetDisplayVisibility(nodeVisible);
+        ++numberOfChangedNodes;
+        }
+      }
+    // Node events are ignored, the curve and prediction follow here
+    this->UpdateCurveModel(record->PathNode);
+    this->Internal->DeflectionModifiedPaths.insert(pathNodeIDs[i]);
+    this->RecordPathState(pathNodeIDs[i]);
+    }
+  this->Internal->UndoJournal->EndEntry();
+  --this->Internal->IgnoreNodeEvents;
+  if (compactPathsModified)
+    {
+    this->UpdateCompactPathsDisplay();
+    }
+  if (scene)
+    {
+    scene->EndState(vtkMRMLScene::BatchProcessState);
+    }
+  return numberOfChangedNodes;
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic::GetWorldEndPointsArray(vtkDoubleArray* endPoints)
+{
+  this->Internal->PathStore->GetWorldEndPointsArray(endPoints);
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic::GetVirtualOffsetsArray(vtkDoubleArray* offsets)
+{
+  this->Internal->PathStore->GetMetricArray(GetVirtualOffsetMetricName(), offsets);
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic::GetVisibilityArray(vtkDoubleArray* visibility)
+{
+  if (!visibility)
+    {
+    return;
+    }
+  vtkSlicerVisuaLinePathStore* store = this->Internal->PathStore;
+  visibility->Initialize();
+  visibility->SetNumberOfComponents(1);
+  visibility->SetNumberOfTuples(store->GetNumberOfPaths());
+  for (int i = 0; i < store->GetNumberOfPaths(); ++i)
+    {
+    visibility->SetValue(i, this->Internal->IsPathVisible(store->GetPathNodeID(i)) ? 1.0 : 0.0);
+    }
+}
+
+//---------------------------------------------------------------------------
+namespace
+{
+bool IsPathArrayValid(vtkDataArray* array, int numberOfComponents, int numberOfPaths)
+{
+  return array && array->GetNumberOfComponents() == numberOfComponents &&
+    array->GetNumberOfTuples() == numberOfPaths;
+}
+}
+
+//---------------------------------------------------------------------------
+int vtkSlicerVisuaLineLogic::SetWorldEndPointsArray(vtkDataArray* endPoints)
+{
+  vtkSlicerVisuaLinePathStore* store = this->Internal->PathStore;
+  int numberOfPaths = store->GetNumberOfPaths();
+  if (!IsPathArrayValid(endPoints, 6, numberOfPaths))
+    {
+    vtkErrorMacro("SetWorldEndPointsArray: expected " << numberOfPaths
+                  << " tuples of 6 components");
+    return 0;
+    }
+
+  // Move the rulers first, one modified event each and none handled
+  // here, then update what depends on them path by path
+  std::vector<std::string> movedPathNodeIDs;
+  ++this->Internal->IgnoreNodeEvents;
+  for (int i = 0; i < numberOfPaths; ++i)
+    {
+    vtkInternal::PathRecord* record = this->Internal->FindPath(store->GetPathNodeID(i));
+    if (!record || (!record->PathNode && !record->Compact))
+      {
+      continue;
+      }
+    // Compared with the rulers, the store follows them only once their
+    // events are handled
+    double world[6], p1[3], p2[3];
+    endPoints->GetTuple(i, world);
+    if (record->Compact)
+      {
+      store->GetWorldEndPoints(i, p1, p2);
+      }
+    else
+      {
+      this->GetPathWorldEndPoints(record->PathNode, p1, p2);
+      }
+    if (vtkMath::Distance2BetweenPoints(p1, world) <= 1e-12 &&
+        vtkMath::Distance2BetweenPoints(p2, world + 3) <= 1e-12)
+      {
+      continue;
+      }
+    double local1[3], local2[3];
+    store->WorldToLocal(i, world, local1);
+    store->WorldToLocal(i, world + 3, local2);
+    if (record->Compact)
+      {
+      // No ruler, the store holds the geometry
+      store->SetLocalEndPoints(i, local1, local2);
+      movedPathNodeIDs.push_back(store->GetPathNodeID(i));
+      continue;
+      }
+    int wasModifying = record->PathNode->StartModify();
+    record->PathNode->SetPosition1(local1);
+    record->PathNode->SetPosition2(local2);
+    record->PathNode->EndModify(wasModifying);
+    movedPathNodeIDs.push_back(store->GetPathNodeID(i));
+    }
+  --this->Internal->IgnoreNodeEvents;
+
+  // One undo entry for the batch
+  this->Internal->UndoJournal->BeginEntry();
+  ++this->Internal->CompactBatch;
+  for (size_t i = 0; i < movedPathNodeIDs.size(); ++i)
+    {
+    this->OnPathNodeModified(movedPathNodeIDs[i]);
+    }
+  --this->Internal->CompactBatch;
+  this->Internal->UndoJournal->EndEntry();
+  this->UpdateCompactPathsDisplay();
+  return static_cast<int>(movedPathNodeIDs.size());
+}
+
+//---------------------------------------------------------------------------
+int vtkSlicerVisuaLineLogic::SetVirtualOffsetsArray(vtkDataArray* offsets)
+{
+  vtkSlicerVisuaLinePathStore* store = this->Internal->PathStore;
+  int numberOfPaths = store->GetNumberOfPaths();
+  if (!IsPathArrayValid(offsets, 1, numberOfPaths))
+    {
+    vtkErrorMacro("SetVirtualOffsetsArray: expected " << numberOfPaths << " values");
+    return 0;
+    }
+
+  // Offset rulers are not paths: the store keeps its indices
+  int numberOfModifiedPaths = 0;
+  ++this->Internal->IgnoreNodeEvents;
+  this->Internal->UndoJournal->BeginEntry();
+  for (int i = 0; i < numberOfPaths; ++i)
+    {
+    double offset = offsets->GetComponent(i, 0);
+    if (offset != this->GetPathVirtualOffset(store->GetPathNodeID(i)))
+      {
+      this->SetPathVirtualOffset(store->GetPathNodeID(i), offset);
+      ++numberOfModifiedPaths;
+      }
+    }
+  this->Internal->UndoJournal->EndEntry();
+  --this->Internal->IgnoreNodeEvents;
+  return numberOfModifiedPaths;
+}
+
+//---------------------------------------------------------------------------
+int vtkSlicerVisuaLineLogic::SetVisibilityArray(vtkDataArray* visibility)
+{
+  vtkSlicerVisuaLinePathStore* store = this->Internal->PathStore;
+  int numberOfPaths = store->GetNumberOfPaths();
+  if (!IsPathArrayValid(visibility, 1, numberOfPaths))
+    {
+    vtkErrorMacro("SetVisibilityArray: expected " << numberOfPaths << " values");
+    return 0;
+    }
+
+  std::vector<std::string> shownPathNodeIDs;
+  std::vector<std::string> hiddenPathNodeIDs;
+  for (int i = 0; i < numberOfPaths; ++i)
+    {
+    if (visibility->GetComponent(i, 0) != 0.0)
+      {
+      shownPathNodeIDs.push_back(store->GetPathNodeID(i));
+      }
+    else
+      {
+      hiddenPathNodeIDs.push_back(store->GetPathNodeID(i));
+      }
+    }
+  this->Internal->UndoJournal->BeginEntry();
+  int numberOfChangedNodes = this->SetPathsVisibility(shownPathNodeIDs, true) +
+    this->SetPathsVisibility(hiddenPathNodeIDs, false);
+  this->Internal->UndoJournal->EndEntry();
+  return numberOfChangedNodes;
+}
+
+//---------------------------------------------------------------------------
+namespace
+{
+// Rows are formatted with sprintf and written straight to the stream
+// buffer, the stream keeps no row.
+class ReportWriter
+{
+public:
+  ReportWriter(std::ostream& stream, int format)
+    : Stream(stream), Format(format), FirstField(true) {}
+
+  void BeginRow()
+    {
+    this->FirstField = true;
+    this->Stream.put(this->Format == vtkSlicerVisuaLineLogic::JSONFormat ? '{' : '\n');
+    }
+  void EndRow()
+    {
+    if (this->Format == vtkSlicerVisuaLineLogic::JSONFormat)
+      {
+      this->Stream.put('}');
+      }
+    }
+  void Text(const char* key, const char* text)
+    {
+    this->Key(key);
+    text = text ? text : "";
+    bool json = this->Format == vtkSlicerVisuaLineLogic::JSONFormat;
+    if (!json && !strpbrk(text, ",\"\r\n"))
+      {
+      this->Stream << text;
+      return;
+      }
+    // JSON strings and CSV fields with separators are quoted
+    this->Stream.put('"');
+    for (const char* c = text; *c; ++c)
+      {
+      if (*c == '"')
+        {
+        this->Stream << (json ? "\\\"" : "\"\"");
+        }
+      else if (json && *c == '\\')
+        {
+        this->Stream << "\\\\";
+        }
+      else if (json && static_cast<unsigned char>(*c) < 0x20)
+        {
+        char escaped[8];
+        sprintf(escaped, "\\u%04x", static_cast<unsigned char>(*c));
+        this->Stream << escaped;
+        }
+      else
+        {
+        this->Stream.put(*c);
+        }
+      }
+    this->Stream.put('"');
+    }
+  void Value(const char* key, double value)
+    {
+    this->Key(key);
+    this->Number(value);
+    }
+  void Point(const char* key, const double point[3])
+    {
+    if (this->Format == vtkSlicerVisuaLineLogic::JSONFormat)
+      {
+      this->Key(key);
+      this->Stream.put('[');
+      for (int i = 0; i < 3; ++i)
+        {
+        if (i > 0)
+          {
+          this->Stream.put(',');
+          }
+        this->Number(point[i]);
+        }
+      this->Stream.put(']');
+      return;
+      }
+    const char* axes[3] = { "R", "A", "S" };
+    for (int i = 0; i < 3; ++i)
+      {
+      std::string column = std::string(key) + axes[i];
+      this->Value(column.c_str(), point[i]);
+      }
+    }
+  void Header(const char* key)
+    {
+    this->Key(0);
+    this->Stream << key;
+    }
+
+private:
+  void Number(double value)
+    {
+    if (vtkMath::IsNan(value))
+      {
+      // Not computed
+      if (this->Format == vtkSlicerVisuaLineLogic::JSONFormat)
+        {
+        this->Stream << "null";
+        }
+      return;
+      }
+    char buffer[32];
+    int length = sprintf(buffer, "%.10g", value);
+    this->Stream.write(buffer, length);
+    }
+  void Key(const char* key)
+    {
+    bool json = this->Format == vtkSlicerVisuaLineLogic::JSONFormat;
+    if (!this->FirstField)
+      {
+      this->Stream.put(',');
+      }
+    this->FirstField = false;
+    if (json && key)
+      {
+      this->Stream << '"' << key << "\":";
+      }
+    }
+
+  std::ostream& Stream;
+  int Format;
+  bool FirstField;
+};
+}
+
+//---------------------------------------------------------------------------
+vtkSlicerVisuaLineUndoJournal* vtkSlicerVisuaLineLogic::GetUndoJournal()
+{
+  return this->Internal->UndoJournal;
+}
+
+//---------------------------------------------------------------------------
+bool vtkSlicerVisuaLineLogic::Undo()
+{
+  return this->ReplayUndoJournal(false);
+}
+
+//---------------------------------------------------------------------------
+bool vtkSlicerVisuaLineLogic::Redo()
+{
+  return this->ReplayUndoJournal(true);
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic::RecordPathState(const std::string& pathNodeID)
+{
+  if (this->Internal->JournalSuspended > 0)
+    {
+    return;
+    }
+  vtkInternal::PathRecord* record = this->Internal->FindPath(pathNodeID.c_str());
+  vtkMRMLAnnotationRulerNode* path = record ? record->PathNode.GetPointer() : 0;
+  if (!record && this->GetMRMLScene())
+    {
+    path = vtkMRMLAnnotationRulerNode::SafeDownCast(
+      this->GetMRMLScene()->GetNodeByID(pathNodeID.c_str()));
+    }
+  bool compact = record && record->Compact;
+  if (!path && !compact)
+    {
+    // Node deleted, nothing to restore
+    this->Internal->UndoJournal->ForgetPath(pathNodeID);
+    return;
+    }
+
+  vtkSlicerVisuaLineUndoJournal::PathState state;
+  if (compact)
+    {
+    vtkSlicerVisuaLinePathStore* store = this->Internal->PathStore;
+    store->GetLocalEndPoints(store->GetPathIndex(pathNodeID.c_str()),
+                             state.Position1, state.Position2);
+    }
+  else
+    {
+    path->GetPosition1(state.Position1);
+    path->GetPosition2(state.Position2);
+    }
+  state.Visible = compact ? this->Internal->IsPathVisible(pathNodeID.c_str()) :
+    path->GetDisplayVisibility() != 0;
+  state.Managed = record != 0;
+  if (record)
+    {
+    state.VirtualOffset = record->VirtualOffset;
+    state.HierarchyNodeID = record->HierarchyNodeID;
+    }
+  this->Internal->UndoJournal->RecordState(pathNodeID, state);
+}
+
+//---------------------------------------------------------------------------
+bool vtkSlicerVisuaLineLogic::ReplayUndoJournal(bool redo)
+{
+  vtkSlicerVisuaLineUndoJournal* journal = this->Internal->UndoJournal;
+  vtkMRMLScene* scene = this->GetMRMLScene();
+  std::vector<vtkSlicerVisuaLineUndoJournal::PathChange> changes;
+  if (!scene || !(redo ? journal->Redo(changes) : journal->Undo(changes)))
+    {
+    return false;
+    }
+
+  // The journal already holds the restored states
+  ++this->Internal->JournalSuspended;
+  ++this->Internal->CompactBatch;
+  std::vector<std::string> shownPathNodeIDs;
+  std::vector<std::string> hiddenPathNodeIDs;
+  for (size_t i = 0; i < changes.size(); ++i)
+    {
+    const vtkSlicerVisuaLineUndoJournal::PathChange& change = changes[i];
+    const std::string& pathNodeID = change.PathNodeID;
+    vtkMRMLAnnotationRulerNode* path = vtkMRMLAnnotationRulerNode::SafeDownCast(
+      scene->GetNodeByID(pathNodeID.c_str()));
+    if (!path && !this->IsPathCompact(pathNodeID.c_str()))
+      {
+      continue;
+      }
+    vtkSlicerVisuaLineUndoJournal::PathState state;
+    vtkSlicerVisuaLineUndoJournal::RestoreState(change, redo, state);
+
+    if (change.Fields & vtkSlicerVisuaLineUndoJournal::ManagedField)
+      {
+      if (!state.Managed)
+        {
+        this->RemovePathNode(pathNodeID.c_str());
+        this->MarkPathModified(pathNodeID);
+        continue;
+        }
+      if (!this->IsPathManaged(pathNodeID.c_str()))
+        {
+        this->AddPathNode(path);
+        if (!state.HierarchyNodeID.empty())
+          {
+          this->SetPathHierarchy(pathNodeID, state.HierarchyNodeID);
+          }
+        }
+      }
+    else if (!this->IsPathManaged(pathNodeID.c_str()))
+      {
+      // Stopped being managed with its list
+      continue;
+      }
+
+    if (change.Fields & vtkSlicerVisuaLineUndoJournal::GeometryField)
+      {
+      if (this->IsPathCompact(pathNodeID.c_str()))
+        {
+        vtkSlicerVisuaLinePathStore* store = this->Internal->PathStore;
+        store->SetLocalEndPoints(store->GetPathIndex(pathNodeID.c_str()),
+                                 state.Position1, state.Position2);
+        }
+      else
+        {
+        ++this->Internal->IgnoreNodeEvents;
+        int wasModifying = path->StartModify();
+        path->SetPosition1(state.Position1);
+        path->SetPosition2(state.Position2);
+        path->EndModify(wasModifying);
+        --this->Internal->IgnoreNodeEvents;
+        }
+      this->OnPathNodeModified(pathNodeID);
+      }
+    if (change.Fields & vtkSlicerVisuaLineUndoJournal::VirtualOffsetField)
+      {
+      this->SetPathVirtualOffset(pathNodeID.c_str(), state.VirtualOffset);
+      }
+    if (change.Fields & vtkSlicerVisuaLineUndoJournal::VisibilityField)
+      {
+      (state.Visible ? shownPathNodeIDs : hiddenPathNodeIDs).push_back(pathNodeID);
+      }
+    this->MarkPathModified(pathNodeID);
+    }
+  this->SetPathsVisibility(shownPathNodeIDs, true);
+  this->SetPathsVisibility(hiddenPathNodeIDs, false);
+  --this->Internal->CompactBatch;
+  --this->Internal->JournalSuspended;
+  this->UpdateCompactPathsDisplay();
+  return true;
+}
+
+//---------------------------------------------------------------------------
+bool vtkSlicerVisuaLineLogic::ExportPaths(const char* fileName, int format)
+{
+  vtkSlicerVisuaLineProfileMacro(this->Internal->Profiler, "Logic::ExportPaths");
+  if (!fileName)
+    {
+    return false;
+    }
+  std::ofstream file(fileName, std::ios::out | std::ios::binary);
+  if (!file)
+    {
+    vtkErrorMacro("ExportPaths: cannot write " << fileName);
+    return false;
+    }
+  // Right after open and before any output, where every library honors it
+  std::vector<char> buffer(1 << 20);
+  file.rdbuf()->pubsetbuf(&buffer[0], static_cast<std::streamsize>(buffer.size()));
+
+  // Cached values only: nothing is computed again here
+  vtkSlicerVisuaLinePathStore* store = this->Internal->PathStore;
+  std::vector<std::string> metricNames;
+  store->GetMetricNames(metricNames);
+  std::vector<const std::vector<double>*> metrics;
+  for (size_t i = 0; i < metricNames.size(); ++i)
+    {
+    metrics.push_back(store->GetMetric(metricNames[i].c_str()));
+    }
+
+  ReportWriter writer(file, format);
+  if (format == JSONFormat)
+    {
+    file << "[";
+    }
+  else
+    {
+    const char* columns[] = { "Name", "PathNodeID", "EntryR", "EntryA", "EntryS",
+      "TargetR", "TargetA", "TargetS", "TipR", "TipA", "TipS",
+      "CoronalAngle", "SagittalAngle" };
+    for (size_t i = 0; i < sizeof(columns) / sizeof(columns[0]); ++i)
+      {
+      writer.Header(columns[i]);
+      }
+    for (size_t i = 0; i < metricNames.size(); ++i)
+      {
+      writer.Header(metricNames[i].c_str());
+      }
+    }
+
+  int numberOfRows = 0;
+  for (int i = 0; i < store->GetNumberOfPaths(); ++i)
+    {
+    vtkInternal::PathRecord* record = this->Internal->FindPath(store->GetPathNodeID(i));
+    if (!record || (!record->PathNode && !record->Compact))
+      {
+      continue;
+      }
+    double entry[3], target[3], tip[3], direction[3];
+    store->GetWorldEndPoints(i, entry, target);
+    vtkMath::Subtract(target, entry, direction);
+    if (record->Compact)
+      {
+      // Compact paths are straight
+      double unit[3] = { direction[0], direction[1], direction[2] };
+      vtkMath::Normalize(unit);
+      for (int j = 0; j < 3; ++j)
+        {
+        tip[j] = target[j] + record->VirtualOffset * unit[j];
+        }
+      }
+    else
+      {
+      this->GetVirtualOffsetTip(record->PathNode, record->VirtualOffset, tip);
+      }
+    double coronalAngle = vtkMath::DegreesFromRadians(atan2(direction[0], fabs(direction[2])));
+    double sagittalAngle = vtkMath::DegreesFromRadians(atan2(direction[1], fabs(direction[2])));
+
+    if (format == JSONFormat)
+      {
+      file << (numberOfRows > 0 ? ",\n" : "\n");
+      }
+    writer.BeginRow();
+    writer.Text("Name", this->GetPathName(store->GetPathNodeID(i)));
+    writer.Text("PathNodeID", store->GetPathNodeID(i));
+    writer.Point("Entry", entry);
+    writer.Point("Target", target);
+    writer.Point("Tip", tip);
+    writer.Value("CoronalAngle", coronalAngle);
+    writer.Value("SagittalAngle", sagittalAngle);
+    for (size_t j = 0; j < metrics.size(); ++j)
+      {
+      writer.Value(metricNames[j].c_str(), metrics[j] ? (*metrics[j])[i] : vtkMath::Nan());
+      }
+    writer.EndRow();
+    ++numberOfRows;
+    }
+  file << (format == JSONFormat ? "\n]\n" : "\n");
+  file.close();
+  return !file.fail();
+}
+
+//---------------------------------------------------------------------------
+namespace
+{
+// Metrics of the former geometry of a moved path read as not computed
+// until their analysis runs again. Length and offset are kept up to date.
+void InvalidateGeometryMetrics(vtkSlicerVisuaLinePathStore* store, int index)
+{
+  const char* names[] =
+    {
+    vtkSlicerVisuaLineLogic::GetClearanceMetricName(),
+    vtkSlicerVisuaLineLogic::GetTargetHitProbabilityMetricName(),
+    vtkSlicerVisuaLineLogic::GetRiskProbabilityMetricName(),
+    vtkSlicerVisuaLineLogic::GetInsertionDepthMetricName(),
+    vtkSlicerVisuaLineLogic::GetTipErrorMetricName(),
+    vtkSlicerVisuaLineLogic::GetReachableMetricName()
+    };
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i)
+    {
+    if (store->GetMetric(names[i]))
+      {
+      store->SetPathMetric(index, names[i], vtkMath::Nan());
+      }
+    }
+}
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic::OnPathNodeModified(const std::string& pathNodeID)
+{
+  vtkSlicerVisuaLineProfileMacro(this->Internal->Profiler, "Logic::OnPathNodeModified");
+  vtkInternal::PathRecord* record = this->Internal->FindPath(pathNodeID.c_str());
+  if (record && record->Compact)
+    {
+    // Geometry was set in the store, compact paths are straight
+    vtkSlicerVisuaLinePathStore* store = this->Internal->PathStore;
+    int index = store->GetPathIndex(pathNodeID.c_str());
+    double p1[3], p2[3];
+    store->GetWorldEndPoints(index, p1, p2);
+    store->SetPathMetric(index, GetLengthMetricName(),
+                         sqrt(vtkMath::Distance2BetweenPoints(p1, p2)));
+    InvalidateGeometryMetrics(store, index);
+    this->Internal->EntryModifiedPaths.insert(pathNodeID);
+    this->Internal->DeflectionModifiedPaths.insert(pathNodeID);
+    this->MarkPathModified(pathNodeID);
+    this->RecordPathState(pathNodeID);
+    this->UpdateCompactPathsDisplay();
+    return;
+    }
+  if (!record || !record->PathNode)
+    {
+    return;
+    }
+
+  // Update stored geometry and curve ends, then what depends on them
+  vtkSlicerVisuaLinePathStore* store = this->Internal->PathStore;
+  int index = store->GetPathIndex(pathNodeID.c_str());
+  double oldP1[3], oldP2[3], p1[3], p2[3];
+  store->GetWorldEndPoints(index, oldP1, oldP2);
+  this->UpdatePathNode(record->PathNode);
+  this->UpdateCurvedPath(record->PathNode);
+  this->UpdatePathTargetAndOffset(pathNodeID);
+  this->UpdatePathMetrics(pathNodeID);
+  index = store->GetPathIndex(pathNodeID.c_str());
+  store->GetWorldEndPoints(index, p1, p2);
+  if (vtkMath::Distance2BetweenPoints(oldP1, p1) > 0.0 ||
+      vtkMath::Distance2BetweenPoints(oldP2, p2) > 0.0)
+    {
+    InvalidateGeometryMetrics(store, index);
+    }
+  this->MarkPathModified(pathNodeID);
+  this->RecordPathState(pathNodeID);
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic::UpdatePathMetrics(const std::string& pathNodeID)
+{
+  vtkInternal::PathRecord* record = this->Internal->FindPath(pathNodeID.c_str());
+  if (!record || !record->PathNode)
+    {
+    return;
+    }
+
+  // Renames only touch the grams of the name
+  this->Internal->NameIndex->SetName(pathNodeID.c_str(), record->PathNode->GetName());
+  this->Internal->EntryModifiedPaths.insert(pathNodeID);
+  this->Internal->DeflectionModifiedPaths.insert(pathNodeID);
+
+  vtkSlicerVisuaLinePathStore* store = this->Internal->PathStore;
+  int index = store->GetPathIndex(pathNodeID.c_str());
+  store->SetPathMetric(index, GetLengthMetricName(),
+                       this->GetPathLength(record->PathNode));
+  store->SetPathMetric(index, GetVirtualOffsetMetricName(), record->VirtualOffset);
+}
+
+//---------------------------------------------------------------------------
+const char* vtkSlicerVisuaLineLogic::GetLengthMetricName()
+{
+  return "Length";
+}
+
+//---------------------------------------------------------------------------
+const char* vtkSlicerVisuaLineLogic::GetClearanceMetricName()
+{
+  return "Clearance";
+}
+
+//---------------------------------------------------------------------------
+const char* vtkSlicerVisuaLineLogic::GetVirtualOffsetMetricName()
+{
+  return "VirtualOffset";
+}
+
+//---------------------------------------------------------------------------
+const char* vtkSlicerVisuaLineLogic::GetTargetHitProbabilityMetricName()
+{
+  return "TargetHitProbability";
+}
+
+//---------------------------------------------------------------------------
+const char* vtkSlicerVisuaLineLogic::GetRiskProbabilityMetricName()
+{
+  return "RiskProbability";
+}
+
+//---------------------------------------------------------------------------
+const char* vtkSlicerVisuaLineLogic::GetInsertionDepthMetricName()
+{
+  return "InsertionDepth";
+}
+
+//---------------------------------------------------------------------------
+const char* vtkSlicerVisuaLineLogic::GetTipErrorMetricName()
+{
+  return "TipError";
+}
+
+//---------------------------------------------------------------------------
+const char* vtkSlicerVisuaLineLogic::GetReachableMetricName()
+{
+  return "Reachable";
+}
+
+//---------------------------------------------------------------------------
+vtkSlicerVisuaLineAnalysisCache* vtkSlicerVisuaLineLogic::GetAnalysisCache()
+{
+  return this->Internal->AnalysisCache;
+}
+
+//---------------------------------------------------------------------------
+vtkSlicerVisuaLineDistanceMap* vtkSlicerVisuaLineLogic::GetRiskDistanceMap()
+{
+  return this->Internal->RiskDistanceMap;
+}
+
+//---------------------------------------------------------------------------
+namespace
+{
+// Paths are in world coordinates
+void GetWorldToIJKMatrix(vtkMRMLScalarVolumeNode* volume, vtkMatrix4x4* worldToIJK)
+{
+  volume->GetRASToIJKMatrix(worldToIJK);
+  vtkMRMLTransformNode* transformNode = volume->GetParentTransformNode();
+  if (transformNode)
+    {
+    vtkNew<vtkMatrix4x4> worldToRAS;
+    vtkNew<vtkMatrix4x4> rasToIJK;
+    transformNode->GetMatrixTransformToWorld(worldToRAS.GetPointer());
+    worldToRAS->Invert();
+    rasToIJK->DeepCopy(worldToIJK);
+    vtkMatrix4x4::Multiply4x4(rasToIJK.GetPointer(), worldToRAS.GetPointer(),
+                              worldToIJK);
+    }
+}
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic::SetRiskLabelMap(vtkMRMLScalarVolumeNode* labelMap)
+{
+  vtkNew<vtkMatrix4x4> worldToIJK;
+  vtkImageData* labels = labelMap ? labelMap->GetImageData() : 0;
+  if (labels)
+    {
+    GetWorldToIJKMatrix(labelMap, worldToIJK.GetPointer());
+    }
+  this->Internal->RiskDistanceMap->SetLabelMap(labels, worldToIJK.GetPointer());
+}
+
+//---------------------------------------------------------------------------
+vtkSlicerVisuaLineUncertaintyAnalysis* vtkSlicerVisuaLineLogic::GetUncertaintyAnalysis()
+{
+  return this->Internal->UncertaintyAnalysis;
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic
+::AnalyzePathUncertainty(vtkMRMLScalarVolumeNode* labelMap)
+{
+  vtkSlicerVisuaLinePathStore* store = this->Internal->PathStore;
+  std::vector<std::string> pathNodeIDs;
+  pathNodeIDs.reserve(store->GetNumberOfPaths());
+  for (int i = 0; i < store->GetNumberOfPaths(); ++i)
+    {
+    pathNodeIDs.push_back(store->GetPathNodeID(i));
+    }
+  this->AnalyzePathUncertainty(labelMap, pathNodeIDs);
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic
+::AnalyzePathUncertainty(vtkMRMLScalarVolumeNode* labelMap,
+                         const std::vector<std::string>& pathNodeIDs)
+{
+  vtkSlicerVisuaLineProfileMacro(this->Internal->Profiler, "Logic::AnalyzePathUncertainty");
+  vtkSlicerVisuaLineUncertaintyAnalysis* analysis = this->Internal->UncertaintyAnalysis;
+  vtkSlicerVisuaLinePathStore* store = this->Internal->PathStore;
+  this->SetRiskLabelMap(labelMap);
+
+  analysis->RemoveAllPaths();
+  std::vector<int> indices;
+  for (size_t i = 0; i < pathNodeIDs.size(); ++i)
+    {
+    int index = store->GetPathIndex(pathNodeIDs[i].c_str());
+    if (index < 0)
+      {
+      continue;
+      }
+    double p1[3], p2[3];
+    store->GetWorldEndPoints(index, p1, p2);
+    analysis->AddPath(pathNodeIDs[i].c_str(), p1, p2);
+    indices.push_back(index);
+    }
+  analysis->Update();
+
+  for (size_t i = 0; i < indices.size(); ++i)
+    {
+    int index = indices[i];
+    store->SetPathMetric(index, GetTargetHitProbabilityMetricName(),
+                         analysis->GetTargetHitProbability(static_cast<int>(i)));
+    store->SetPathMetric(index, GetRiskProbabilityMetricName(),
+                         analysis->GetRiskProbability(static_cast<int>(i)));
+    store->SetPathMetric(index, GetClearanceMetricName(),
+                         analysis->GetClearance(static_cast<int>(i)));
+    this->MarkPathModified(store->GetPathNodeID(index));
+    }
+}
+
+//---------------------------------------------------------------------------
+vtkSlicerVisuaLineEntrySearch* vtkSlicerVisuaLineLogic::GetEntrySearch()
+{
+  return this->Internal->EntrySearch;
+}
+
+//---------------------------------------------------------------------------
+int vtkSlicerVisuaLineLogic
+::ProposePathEntries(vtkMRMLAnnotationFiducialNode* target,
+                     vtkMRMLModelNode* skin, int k,
+                     vtkMRMLAnnotationHierarchyNode* hierarchy)
+{
+  vtkMRMLScene* scene = this->GetMRMLScene();
+  if (!scene || !target || !skin || !skin->GetPolyData() ||
+      !target->GetFiducialCoordinates())
+    {
+    return 0;
+    }
+
+  // Harden the skin once, the search keeps its locator while the
+  // surface is unchanged. Strips are split in triangles, the search reads
+  // polygons only.
+  vtkInternal* internal = this->Internal;
+  vtkPolyData* surface = skin->GetPolyData();
+  vtkMRMLTransformNode* transformNode = skin->GetParentTransformNode();
+  if (transformNode || surface->GetNumberOfStrips() > 0)
+    {
+    unsigned long skinTime = transformNode ?
+      std::max(surface->GetMTime(), transformNode->GetMTime()) : surface->GetMTime();
+    if (!internal->WorldSkin || internal->WorldSkinModel != skin ||
+        internal->WorldSkinTime != skinTime)
+      {
+      vtkSmartPointer<vtkPoints> worldPoints = surface->GetPoints();
+      if (transformNode)
+        {
+        vtkNew<vtkMatrix4x4> skinToWorld;
+        transformNode->GetMatrixTransformToWorld(skinToWorld.GetPointer());
+        worldPoints = vtkSmartPointer<vtkPoints>::New();
+        worldPoints->SetNumberOfPoints(surface->GetNumberOfPoints());
+        for (vtkIdType i = 0; i < surface->GetNumberOfPoints(); ++i)
+          {
+          double point[4] = { 0.0, 0.0, 0.0, 1.0 };
+          surface->GetPoint(i, point);
+          skinToWorld->MultiplyPoint(point, point);
+          worldPoints->SetPoint(i, point);
+          }
+        }
+      vtkNew<vtkCellArray> polys;
+      polys->DeepCopy(surface->GetPolys());
+      vtkCellArray* strips = surface->GetStrips();
+      vtkIdType numberOfStripPoints = 0;
+      vtkIdType* stripPoints = 0;
+      for (strips->InitTraversal(); strips->GetNextCell(numberOfStripPoints, stripPoints);)
+        {
+        for (vtkIdType i = 0; i + 2 < numberOfStripPoints; ++i)
+          {
+          // Every other triangle of a strip is flipped
+          vtkIdType triangle[3] = { stripPoints[i], stripPoints[i + 1], stripPoints[i + 2] };
+          if (i % 2)
+            {
+            std::swap(triangle[0], triangle[1]);
+            }
+          polys->InsertNextCell(3, triangle);
+          }
+        }
+      internal->WorldSkin = vtkSmartPointer<vtkPolyData>::New();
+      internal->WorldSkin->SetPoints(worldPoints);
+      internal->WorldSkin->SetPolys(polys.GetPointer());
+      internal->WorldSkinModel = skin;
+      internal->WorldSkinTime = skinTime;
+      }
+    surface = internal->WorldSkin;
+    }
+
+  vtkSlicerVisuaLineEntrySearch* search = internal->EntrySearch;
+  search->SetSkinSurface(surface);
+  // Rulers are created in world coordinates
+  double targetPosition[4] = { 0.0, 0.0, 0.0, 1.0 };
+  std::copy(target->GetFiducialCoordinates(), target->GetFiducialCoordinates() + 3,
+            targetPosition);
+  vtkMRMLTransformNode* targetTransformNode = target->GetParentTransformNode();
+  if (targetTransformNode)
+    {
+    vtkNew<vtkMatrix4x4> targetToWorld;
+    targetTransformNode->GetMatrixTransformToWorld(targetToWorld.GetPointer());
+    targetToWorld->MultiplyPoint(targetPosition, targetPosition);
+    }
+  int numberOfResults = search->Search(targetPosition, k);
+
+  std::string targetName = target->GetName() ? target->GetName() : "Target";
+  for (int i = 0; i < numberOfResults; ++i)
+    {
+    double entry[3];
+    search->GetResultEntry(i, entry);
+    std::stringstream name;
+    name << targetName << "_Entry" << (i + 1);
+
+    vtkSmartPointer<vtkMRMLAnnotationRulerNode> ruler =
+      vtkSmartPointer<vtkMRMLAnnotationRulerNode>::New();
+    ruler->SetName(name.str().c_str());
+    ruler->SetPosition1(entry);
+    ruler->SetPosition2(targetPosition);
+    ruler->Initialize(scene);
+    if (hierarchy && hierarchy->GetID())
+      {
+      this->AddRulerToHierarchy(ruler, hierarchy);
+      }
+    else
+      {
+      this->AddPathNode(ruler);
+      }
+    }
+  return numberOfResults;
+}
+
+//---------------------------------------------------------------------------
+vtkSlicerVisuaLinePathClustering* vtkSlicerVisuaLineLogic::GetPathClustering()
+{
+  return this->Internal->PathClustering;
+}
+
+//---------------------------------------------------------------------------
+int vtkSlicerVisuaLineLogic
+::FindDuplicatePaths(const std::vector<std::string>& pathNodeIDs,
+                     std::vector<std::vector<std::string> >& clusters)
+{
+  vtkSlicerVisuaLineProfileMacro(this->Internal->Profiler, "Logic::FindDuplicatePaths");
+  vtkSlicerVisuaLinePathClustering* clustering = this->Internal->PathClustering;
+  vtkSlicerVisuaLinePathStore* store = this->Internal->PathStore;
+  clusters.clear();
+
+  // Compact paths included, the store has the geometry of all paths
+  clustering->RemoveAllPaths();
+  int numberOfPaths = pathNodeIDs.empty() ?
+    store->GetNumberOfPaths() : static_cast<int>(pathNodeIDs.size());
+  for (int i = 0; i < numberOfPaths; ++i)
+    {
+    int index = pathNodeIDs.empty() ? i : store->GetPathIndex(pathNodeIDs[i].c_str());
+    if (index < 0)
+      {
+      continue;
+      }
+    double p1[3], p2[3];
+    store->GetWorldEndPoints(index, p1, p2);
+    clustering->AddPath(store->GetPathNodeID(index), p1, p2);
+    }
+  clustering->Update();
+
+  clusters.resize(clustering->GetNumberOfClusters());
+  std::vector<int> indices;
+  for (int cluster = 0; cluster < clustering->GetNumberOfClusters(); ++cluster)
+    {
+    clustering->GetClusterPaths(cluster, indices);
+    for (size_t i = 0; i < indices.size(); ++i)
+      {
+      clusters[cluster].push_back(clustering->GetPathNodeID(indices[i]));
+      }
+    }
+  return static_cast<int>(clusters.size());
+}
+
+//---------------------------------------------------------------------------
+int vtkSlicerVisuaLineLogic::MergePaths(const std::vector<std::string>& pathNodeIDs)
+{
+  vtkMRMLScene* scene = this->GetMRMLScene();
+  if (!scene || pathNodeIDs.size() < 2 || !this->IsPathManaged(pathNodeIDs[0].c_str()))
+    {
+    return 0;
+    }
+
+  // Removed paths cannot be managed again, the merge is not journaled
+  ++this->Internal->JournalSuspended;
+
+  // Nodes first: removing a path drops its record
+  vtkSlicerVisuaLinePathStore* store = this->Internal->PathStore;
+  std::vector<vtkSmartPointer<vtkMRMLNode> > removedNodes;
+  int numberOfRemovedPaths = 0;
+  bool compactPathsRemoved = false;
+  for (size_t i = 1; i < pathNodeIDs.size(); ++i)
+    {
+    if (pathNodeIDs[i] == pathNodeIDs[0])
+      {
+      continue;
+      }
+    vtkInternal::PathRecord* record = this->Internal->FindPath(pathNodeIDs[i].c_str());
+    if (record && record->Compact)
+      {
+      // No node to remove, the record goes with the path
+      store->RemoveCompactRecord(store->GetPathIndex(pathNodeIDs[i].c_str()));
+      record->Compact = false;
+      this->RemovePathNode(pathNodeIDs[i].c_str());
+      this->MarkPathModified(pathNodeIDs[i]);
+      compactPathsRemoved = true;
+      ++numberOfRemovedPaths;
+      continue;
+      }
+    if (!record || !record->PathNode)
+      {
+      continue;
+      }
+    std::vector<vtkMRMLNode*> nodes;
+    GetNodeAndDependents(scene, record->VirtualOffsetNode, nodes);
+    GetNodeAndDependents(scene, record->TargetNode, nodes);
+    GetNodeAndDependents(scene, record->PathNode, nodes);
+    removedNodes.insert(removedNodes.end(), nodes.begin(), nodes.end());
+    ++numberOfRemovedPaths;
+    }
+
+  // The removal events stop managing the paths
+  scene->StartState(vtkMRMLScene::BatchProcessState);
+  for (size_t i = 0; i < removedNodes.size(); ++i)
+    {
+    if (scene->IsNodePresent(removedNodes[i]))
+      {
+      scene->RemoveNode(removedNodes[i]);
+      }
+    }
+  scene->EndState(vtkMRMLScene::BatchProcessState);
+  --this->Internal->JournalSuspended;
+  if (compactPathsRemoved)
+    {
+    this->UpdateCompactPathsDisplay();
+    }
+  return numberOfRemovedPaths;
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic::SetEntrySurfaceNode(vtkMRMLModelNode* surface)
+{
+  vtkInternal* internal = this->Internal;
+  std::string surfaceNodeID = surface && surface->GetID() ? surface->GetID() : "";
+  if (internal->EntrySurfaceNode == surface && internal->EntrySurfaceNodeID == surfaceNodeID)
+    {
+    return;
+    }
+  internal->EntrySurfaceNode = surface;
+  internal->EntrySurfaceNodeID = surfaceNodeID;
+  internal->EntrySurfaceLocator = 0;
+
+  // Every path crosses a different surface
+  vtkSlicerVisuaLinePathStore* store = internal->PathStore;
+  for (int i = 0; i < store->GetNumberOfPaths(); ++i)
+    {
+    internal->EntryModifiedPaths.insert(store->GetPathNodeID(i));
+    this->MarkPathModified(store->GetPathNodeID(i));
+    }
+}
+
+//---------------------------------------------------------------------------
+vtkMRMLModelNode* vtkSlicerVisuaLineLogic::GetEntrySurfaceNode()
+{
+  return this->Internal->EntrySurfaceNode;
+}
+
+//---------------------------------------------------------------------------
+int vtkSlicerVisuaLineLogic::UpdatePathEntries()
+{
+  vtkSlicerVisuaLineProfileMacro(this->Internal->Profiler, "Logic::UpdatePathEntries");
+  vtkInternal* internal = this->Internal;
+  vtkSlicerVisuaLinePathStore* store = internal->PathStore;
+  vtkMRMLModelNode* surfaceNode = internal->EntrySurfaceNode;
+  vtkPolyData* surface = surfaceNode ? surfaceNode->GetPolyData() : 0;
+
+  // Rebuild the locator when the surface or its transform changed. All
+  // the paths are intersected again then.
+  vtkSlicerVisuaLineSurfaceLocator* locator = 0;
+  if (surface)
+    {
+    vtkInternal::SurfaceLocatorEntry& entry =
+      internal->SurfaceLocators[internal->EntrySurfaceNodeID];
+    vtkMRMLTransformNode* transformNode = surfaceNode->GetParentTransformNode();
+    unsigned long transformTime = transformNode ? transformNode->GetMTime() : 0;
+    if (!entry.Locator || entry.Surface != surface ||
+        entry.SurfaceTime != surface->GetMTime() ||
+        entry.TransformNode != transformNode || entry.TransformTime != transformTime)
+      {
+      vtkNew<vtkMatrix4x4> surfaceToWorld;
+      if (transformNode)
+        {
+        transformNode->GetMatrixTransformToWorld(surfaceToWorld.GetPointer());
+        }
+      if (!entry.Locator)
+        {
+        entry.Locator = vtkSmartPointer<vtkSlicerVisuaLineSurfaceLocator>::New();
+        }
+      entry.Locator->BuildLocator(surface, surfaceToWorld.GetPointer());
+      entry.Surface = surface;
+      entry.SurfaceTime = surface->GetMTime();
+      entry.TransformNode = transformNode;
+      entry.TransformTime = transformTime;
+      internal->EntrySurfaceLocator = 0;
+      }
+    locator = entry.Locator;
+    }
+  if (locator != internal->EntrySurfaceLocator)
+    {
+    internal->EntrySurfaceLocator = locator;
+    for (int i = 0; i < store->GetNumberOfPaths(); ++i)
+      {
+      internal->EntryModifiedPaths.insert(store->GetPathNodeID(i));
+      }
+    }
+  if (internal->EntryModifiedPaths.empty())
+    {
+    return 0;
+    }
+
+  // Cast from the target through the ruler entry, past it in case the
+  // entry was planned under the skin
+  const double margin = 100.0;
+  std::vector<int> indices;
+  std::vector<double> lengths;
+  if (locator)
+    {
+    locator->RemoveAllSegments();
+    }
+  for (std::set<std::string>::iterator it = internal->EntryModifiedPaths.begin();
+       it != internal->EntryModifiedPaths.end(); ++it)
+    {
+    int index = store->GetPathIndex(it->c_str());
+    if (index < 0)
+      {
+      continue;
+      }
+    indices.push_back(index);
+    double p1[3], p2[3], direction[3];
+    store->GetWorldEndPoints(index, p1, p2);
+    vtkMath::Subtract(p1, p2, direction);
+    double length = vtkMath::Normalize(direction);
+    if (!locator || length <= 0.0)
+      {
+      lengths.push_back(0.0);
+      continue;
+      }
+    double end[3];
+    for (int j = 0; j < 3; ++j)
+      {
+      end[j] = p2[j] + (length + margin) * direction[j];
+      }
+    lengths.push_back(length + margin);
+    locator->AddSegment(p2, end);
+    }
+  if (locator)
+    {
+    locator->IntersectSegments();
+    }
+
+  int segment = 0;
+  for (size_t i = 0; i < indices.size(); ++i)
+    {
+    vtkInternal::PathRecord* record =
+      internal->FindPath(store->GetPathNodeID(indices[i]));
+    double t = 0.0;
+    double depth = vtkMath::Nan();
+    bool hit = lengths[i] > 0.0 &&
+      locator->GetSegmentIntersection(segment++, t, record->SkinEntry);
+    if (hit)
+      {
+      depth = t * lengths[i];
+      }
+    record->HasSkinEntry = hit;
+    store->SetPathMetric(indices[i], GetInsertionDepthMetricName(), depth);
+    }
+  internal->EntryModifiedPaths.clear();
+  return static_cast<int>(indices.size());
+}
+
+//---------------------------------------------------------------------------
+bool vtkSlicerVisuaLineLogic::GetPathSkinEntry(const char* pathNodeID, double entry[3])
+{
+  this->UpdatePathEntries();
+  vtkInternal::PathRecord* record = this->Internal->FindPath(pathNodeID);
+  if (!record || !record->HasSkinEntry)
+    {
+    return false;
+    }
+  std::copy(record->SkinEntry, record->SkinEntry + 3, entry);
+  return true;
+}
+
+//---------------------------------------------------------------------------
+double vtkSlicerVisuaLineLogic::GetPathInsertionDepth(const char* pathNodeID)
+{
+  this->UpdatePathEntries();
+  vtkSlicerVisuaLinePathStore* store = this->Internal->PathStore;
+  int index = store->GetPathIndex(pathNodeID);
+  const std::vector<double>* depths = store->GetMetric(GetInsertionDepthMetricName());
+  return index >= 0 && depths ? (*depths)[index] : vtkMath::Nan();
+}
+
+//---------------------------------------------------------------------------
+double vtkSlicerVisuaLineLogic::GetPathTipDepth(const char* pathNodeID)
+{
+  // NaN stays NaN
+  return this->GetPathInsertionDepth(pathNodeID) + this->GetPathVirtualOffset(pathNodeID);
+}
+
+//---------------------------------------------------------------------------
+vtkSlicerVisuaLineDeflectionModel* vtkSlicerVisuaLineLogic::GetDeflectionModel()
+{
+  return this->Internal->DeflectionModel;
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic::SetDeflectionTissueNode(vtkMRMLScalarVolumeNode* tissue)
+{
+  vtkSlicerVisuaLineDeflectionModel* deflection = this->Internal->DeflectionModel;
+  vtkNew<vtkMatrix4x4> worldToIJK;
+  vtkImageData* image = tissue ? tissue->GetImageData() : 0;
+  if (image)
+    {
+    GetWorldToIJKMatrix(tissue, worldToIJK.GetPointer());
+    deflection->SetIntensityMapping(!tissue->GetLabelMap());
+    if (!tissue->GetLabelMap())
+      {
+      deflection->SetIntensityRange(image->GetScalarRange());
+      }
+    }
+  deflection->SetTissue(image, worldToIJK.GetPointer());
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic::SetDeflectionPredictionEnabled(bool enabled)
+{
+  vtkInternal* internal = this->Internal;
+  if (internal->DeflectionPredictionEnabled == enabled)
+    {
+    return;
+    }
+  internal->DeflectionPredictionEnabled = enabled;
+  internal->DeflectionModifiedPaths.clear();
+  if (enabled)
+    {
+    vtkSlicerVisuaLinePathStore* store = internal->PathStore;
+    for (int i = 0; i < store->GetNumberOfPaths(); ++i)
+      {
+      internal->DeflectionModifiedPaths.insert(store->GetPathNodeID(i));
+      }
+    this->UpdatePathDeflections();
+    return;
+    }
+
+  // Predictions are simulated again when enabled
+  internal->DeflectionModel->RemoveAllPaths();
+  internal->DeflectionVisiblePaths.clear();
+  vtkMRMLScene* scene = this->GetMRMLScene();
+  vtkMRMLNode* model = scene ?
+    scene->GetNodeByID(internal->DeflectionModelNodeID.c_str()) : 0;
+  if (model)
+    {
+    scene->RemoveNode(model);
+    }
+  internal->DeflectionModelNodeID.clear();
+}
+
+//---------------------------------------------------------------------------
+bool vtkSlicerVisuaLineLogic::GetDeflectionPredictionEnabled()
+{
+  return this->Internal->DeflectionPredictionEnabled;
+}
+
+//---------------------------------------------------------------------------
+int vtkSlicerVisuaLineLogic::UpdatePathDeflections()
+{
+  vtkSlicerVisuaLineProfileMacro(this->Internal->Profiler, "Logic::UpdatePathDeflections");
+  vtkInternal* internal = this->Internal;
+  vtkMRMLScene* scene = this->GetMRMLScene();
+  if (!internal->DeflectionPredictionEnabled || !scene || scene->IsClosing())
+    {
+    return 0;
+    }
+  vtkSlicerVisuaLinePathStore* store = internal->PathStore;
+  vtkSlicerVisuaLineDeflectionModel* deflection = internal->DeflectionModel;
+
+  // Only the paths modified since the last update are set again. Removed
+  // ones are dropped, paths with the same end points keep their
+  // prediction.
+  bool drawingModified = false;
+  std::set<std::string>::iterator it = internal->DeflectionModifiedPaths.begin();
+  for (; it != internal->DeflectionModifiedPaths.end(); ++it)
+    {
+    int index = store->GetPathIndex(it->c_str());
+    if (index < 0)
+      {
+      if (deflection->GetPathIndex(it->c_str()) >= 0)
+        {
+        deflection->RemovePath(it->c_str());
+        drawingModified = true;
+        }
+      drawingModified = internal->DeflectionVisiblePaths.erase(*it) > 0 || drawingModified;
+      continue;
+      }
+    double p1[3], p2[3];
+    store->GetWorldEndPoints(index, p1, p2);
+    deflection->SetPath(it->c_str(), p1, p2);
+    bool visible = internal->IsPathVisible(it->c_str());
+    if (visible != (internal->DeflectionVisiblePaths.count(*it) > 0))
+      {
+      if (visible)
+        {
+        internal->DeflectionVisiblePaths.insert(*it);
+        }
+      else
+        {
+        internal->DeflectionVisiblePaths.erase(*it);
+        }
+      drawingModified = true;
+      }
+    }
+  internal->DeflectionModifiedPaths.clear();
+
+  // A new model or tissue simulates every path again
+  int numberOfSimulatedPaths = deflection->Update();
+  for (int i = 0; i < numberOfSimulatedPaths; ++i)
+    {
+    int index = deflection->GetSimulatedPathIndex(i);
+    store->SetPathMetric(store->GetPathIndex(deflection->GetPathNodeID(index)),
+                         GetTipErrorMetricName(), deflection->GetTipError(index));
+    }
+
+  vtkMRMLModelNode* model = vtkMRMLModelNode::SafeDownCast(
+    scene->GetNodeByID(internal->DeflectionModelNodeID.c_str()));
+  if (model && numberOfSimulatedPaths == 0 && !drawingModified)
+    {
+    return 0;
+    }
+  if (!model)
+    {
+    // Predictions are simulated again from the saved rulers
+    model = AddHelperModel(scene, "PredictedDeflection", 1, 0, 1);
+    internal->DeflectionModelNodeID = model->GetID();
+    }
+
+  // One polyline per visible path, in world coordinates
+  vtkNew<vtkPoints> points;
+  vtkNew<vtkCellArray> lines;
+  vtkNew<vtkPoints> pathPoints;
+  for (it = internal->DeflectionVisiblePaths.begin();
+       it != internal->DeflectionVisiblePaths.end(); ++it)
+    {
+    deflection->GetPredictedPath(
+      deflection->GetPathIndex(it->c_str()), pathPoints.GetPointer());
+    if (pathPoints->GetNumberOfPoints() < 2)
+      {
+      continue;
+      }
+    lines->InsertNextCell(pathPoints->GetNumberOfPoints());
+    for (vtkIdType j = 0; j < pathPoints->GetNumberOfPoints(); ++j)
+      {
+      lines->InsertCellPoint(points->InsertNextPoint(pathPoints->GetPoint(j)));
+      }
+    }
+  vtkNew<vtkPolyData> polyData;
+  polyData->SetPoints(points.GetPointer());
+  polyData->SetLines(lines.GetPointer());
+  model->SetAndObservePolyData(polyData.GetPointer());
+  return numberOfSimulatedPaths;
+}
+
+//---------------------------------------------------------------------------
+double vtkSlicerVisuaLineLogic::GetPathTipError(const char* pathNodeID)
+{
+  if (!this->Internal->DeflectionPredictionEnabled)
+    {
+    return vtkMath::Nan();
+    }
+  vtkSlicerVisuaLinePathStore* store = this->Internal->PathStore;
+  return store->GetPathMetric(store->GetPathIndex(pathNodeID), GetTipErrorMetricName());
+}
+
+//---------------------------------------------------------------------------
+vtkSlicerVisuaLineReachabilityMap* vtkSlicerVisuaLineLogic::GetReachabilityMap()
+{
+  return this->Internal->ReachabilityMap;
+}
+
+//---------------------------------------------------------------------------
+int vtkSlicerVisuaLineLogic::UpdatePathReachability()
+{
+  vtkSlicerVisuaLinePathStore* store = this->Internal->PathStore;
+  std::vector<std::string> pathNodeIDs(store->GetNumberOfPaths());
+  for (int i = 0; i < store->GetNumberOfPaths(); ++i)
+    {
+    pathNodeIDs[i] = store->GetPathNodeID(i);
+    }
+  return this->UpdatePathReachability(pathNodeIDs);
+}
+
+//---------------------------------------------------------------------------
+int vtkSlicerVisuaLineLogic
+::UpdatePathReachability(const std::vector<std::string>& pathNodeIDs)
+{
+  vtkSlicerVisuaLineProfileMacro(this->Internal->Profiler, "Logic::UpdatePathReachability");
+  vtkSlicerVisuaLinePathStore* store = this->Internal->PathStore;
+  vtkSlicerVisuaLineReachabilityMap* map = this->Internal->ReachabilityMap;
+  map->Update();
+
+  // One lookup per path
+  bool hasGuides = map->GetNumberOfGuides() > 0;
+  int numberOfUnreachablePaths = 0;
+  for (size_t i = 0; i < pathNodeIDs.size(); ++i)
+    {
+    int index = store->GetPathIndex(pathNodeIDs[i].c_str());
+    if (index < 0)
+      {
+      continue;
+      }
+    double reachable = vtkMath::Nan();
+    if (hasGuides)
+      {
+      double p1[3], p2[3];
+      store->GetWorldEndPoints(index, p1, p2);
+      reachable = map->IsReachable(p1, p2) ? 1.0 : 0.0;
+      numberOfUnreachablePaths += reachable == 0.0 ? 1 : 0;
+      }
+    store->SetPathMetric(index, GetReachableMetricName(), reachable);
+    }
+  return numberOfUnreachablePaths;
+}
+
+//---------------------------------------------------------------------------
+bool vtkSlicerVisuaLineLogic::IsPathReachable(const char* pathNodeID)
+{
+  vtkSlicerVisuaLinePathStore* store = this->Internal->PathStore;
+  // NaN (no guides) is reachable
+  return !(store->GetPathMetric(store->GetPathIndex(pathNodeID),
+                                GetReachableMetricName()) == 0.0);
+}
+
+//---------------------------------------------------------------------------
+int vtkSlicerVisuaLineLogic
+::SnapPathsToReachable(const std::vector<std::string>& pathNodeIDs)
+{
+  vtkSlicerVisuaLinePathStore* store = this->Internal->PathStore;
+  vtkSlicerVisuaLineReachabilityMap* map = this->Internal->ReachabilityMap;
+  map->Update();
+
+  // Moved in one batch, the other paths keep their end points
+  vtkNew<vtkDoubleArray> endPoints;
+  endPoints->SetNumberOfComponents(6);
+  endPoints->SetNumberOfTuples(store->GetNumberOfPaths());
+  for (int i = 0; i < store->GetNumberOfPaths(); ++i)
+    {
+    double world[6];
+    store->GetWorldEndPoints(i, world, world + 3);
+    endPoints->SetTuple(i, world);
+    }
+  bool snapped = false;
+  for (size_t i = 0; i < pathNodeIDs.size(); ++i)
+    {
+    int index = store->GetPathIndex(pathNodeIDs[i].c_str());
+    double world[6], snappedWorld[6];
+    if (index < 0)
+      {
+      continue;
+      }
+    endPoints->GetTuple(index, world);
+    if (!map->IsReachable(world, world + 3) &&
+        map->SnapToReachable(world, world + 3, snappedWorld, snappedWorld + 3))
+      {
+      endPoints->SetTuple(index, snappedWorld);
+      snapped = true;
+      }
+    }
+  return snapped ? this->SetWorldEndPointsArray(endPoints.GetPointer()) : 0;
+}
+
+//---------------------------------------------------------------------------
+vtkSlicerVisuaLineNameIndex* vtkSlicerVisuaLineLogic::GetNameIndex()
+{
+  return this->Internal->NameIndex;
+}
+
+//---------------------------------------------------------------------------
+vtkSlicerVisuaLineLogic::PathFilter::PathFilter()
+{
+  this->LengthRange[0] = this->ClearanceRange[0] = -VTK_DOUBLE_MAX;
+  this->LengthRange[1] = this->ClearanceRange[1] = VTK_DOUBLE_MAX;
+  this->Visibility = -1;
+}
+
+//---------------------------------------------------------------------------
+namespace
+{
+bool IsRangeSet(const double range[2])
+{
+  return range[0] != -VTK_DOUBLE_MAX || range[1] != VTK_DOUBLE_MAX;
+}
+
+bool InRange(const std::vector<double>* values, int index, const double range[2])
+{
+  // NaN (not computed) is out of any range
+  double value = values ? (*values)[index] : vtkMath::Nan();
+  return value >= range[0] && value <= range[1];
+}
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic
+::FindPaths(const PathFilter& filter, std::vector<std::string>& pathNodeIDs)
+{
+  std::vector<std::string> candidates;
+  this->Internal->NameIndex->Find(filter.Text, candidates);
+
+  vtkSlicerVisuaLinePathStore* store = this->Internal->PathStore;
+  bool checkLength = IsRangeSet(filter.LengthRange);
+  bool checkClearance = IsRangeSet(filter.ClearanceRange);
+  const std::vector<double>* lengths = store->GetMetric(GetLengthMetricName());
+  const std::vector<double>* clearances = store->GetMetric(GetClearanceMetricName());
+
+  pathNodeIDs.clear();
+  for (size_t i = 0; i < candidates.size(); ++i)
+    {
+    int index = store->GetPathIndex(candidates[i].c_str());
+    if (index < 0 ||
+        (checkLength && !InRange(lengths, index, filter.LengthRange)) ||
+        (checkClearance && !InRange(clearances, index, filter.ClearanceRange)))
+      {
+      continue;
+      }
+    if (filter.Visibility >= 0 &&
+        this->Internal->IsPathVisible(candidates[i].c_str()) != (filter.Visibility != 0))
+      {
+      continue;
+      }
+    pathNodeIDs.push_back(candidates[i]);
+    }
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic::SetLevelOfDetailEnabled(bool enabled)
+{
+  this->Internal->LevelOfDetailEnabled = enabled;
+}
+
+//---------------------------------------------------------------------------
+bool vtkSlicerVisuaLineLogic::GetLevelOfDetailEnabled()
+{
+  return this->Internal->LevelOfDetailEnabled;
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic::SetLevelOfDetailDistance(double distance)
+{
+  this->Internal->LevelOfDetailDistance = distance;
+}
+
+//---------------------------------------------------------------------------
+double vtkSlicerVisuaLineLogic::GetLevelOfDetailDistance()
+{
+  return this->Internal->LevelOfDetailDistance;
+}
+
+//---------------------------------------------------------------------------
+vtkSlicerVisuaLineProfiler* vtkSlicerVisuaLineLogic::GetProfiler()
+{
+  return this->Internal->Profiler;
+}
+
+//---------------------------------------------------------------------------
+vtkSlicerVisuaLineLabelLayout* vtkSlicerVisuaLineLogic::GetLabelLayout()
+{
+  return this->Internal->LabelLayout;
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic
+::SetSelectedPaths(const std::vector<std::string>& pathNodeIDs)
+{
+  std::set<std::string> previous;
+  previous.swap(this->Internal->SelectedPaths);
+  this->Internal->SelectedPaths.insert(pathNodeIDs.begin(), pathNodeIDs.end());
+  if (!this->Internal->CompactStorage)
+    {
+    return;
+    }
+
+  // Selected paths get their nodes back, unselected ones lose them again
+  ++this->Internal->CompactBatch;
+  std::set<std::string>::iterator it;
+  for (it = this->Internal->SelectedPaths.begin();
+       it != this->Internal->SelectedPaths.end(); ++it)
+    {
+    this->ExpandPathNode(*it);
+    }
+  for (it = previous.begin(); it != previous.end(); ++it)
+    {
+    if (this->Internal->SelectedPaths.find(*it) == this->Internal->SelectedPaths.end())
+      {
+      this->CompactPathNode(*it);
+      }
+    }
+  --this->Internal->CompactBatch;
+  this->UpdateCompactPathsDisplay();
+}
+
+//---------------------------------------------------------------------------
+namespace
+{
+// Hide a display node, or show it again if the level of detail hid it.
+// Display nodes hidden by the user are left hidden.
+int SetLevelOfDetailVisibility(vtkMRMLDisplayNode* displayNode, bool visible,
+                               int flag, int& hidden)
+{
+  if (!displayNode)
+    {
+    return 0;
+    }
+  if (visible)
+    {
+    bool wasHidden = (hidden & flag) != 0;
+    hidden &= ~flag;
+    if (!wasHidden || displayNode->GetVisibility())
+      {
+      return 0;
+      }
+    displayNode->SetVisibility(1);
+    return 1;
+    }
+  if (!displayNode->GetVisibility())
+    {
+    return 0;
+    }
+  displayNode->SetVisibility(0);
+  hidden |= flag;
+  return 1;
+}
+}
+
+//---------------------------------------------------------------------------
+int vtkSlicerVisuaLineLogic
+::UpdateLevelOfDetail(vtkCamera* camera, int width, int height)
+{
+  vtkSlicerVisuaLineProfileMacro(this->Internal->Profiler, "Logic::UpdateLevelOfDetail");
+  vtkSlicerVisuaLinePathStore* store = this->Internal->PathStore;
+  vtkSlicerVisuaLineLabelLayout* layout = this->Internal->LabelLayout;
+  bool enabled = this->Internal->LevelOfDetailEnabled &&
+    camera && width > 0 && height > 0;
+  int numberOfPaths = store->GetNumberOfPaths();
+
+  // Per stored path: glyphs kept, label index (-1: no label)
+  std::vector<char> glyphs(numberOfPaths, 1);
+  std::vector<int> labels(numberOfPaths, -1);
+  layout->RemoveAllLabels();
+  layout->SetViewSize(width, height);
+
+  if (enabled)
+    {
+    double cameraPosition[3];
+    camera->GetPosition(cameraPosition);
+    vtkMatrix4x4* worldToView = camera->GetCompositeProjectionTransformMatrix(
+      static_cast<double>(width) / height, -1, 1);
+    double distanceLimit = this->Internal->LevelOfDetailDistance;
+
+    for (int i = 0; i < numberOfPaths; ++i)
+      {
+      vtkInternal::PathRecord* record = this->Internal->FindPath(store->GetPathNodeID(i));
+      if (!record || !record->PathNode || !record->PathNode->GetDisplayVisibility())
+        {
+        continue;
+        }
+      bool selected = this->Internal->SelectedPaths.count(store->GetPathNodeID(i)) > 0;
+
+      double p1[3], p2[3], closest[3], t;
+      store->GetWorldEndPoints(i, p1, p2);
+      double distance = sqrt(vtkLine::DistanceToLine(cameraPosition, p1, p2, t, closest));
+      glyphs[i] = selected || distance <= distanceLimit;
+
+      // Ruler label is drawn at the middle of the path
+      double anchor[4] =
+        { 0.5 * (p1[0] + p2[0]), 0.5 * (p1[1] + p2[1]), 0.5 * (p1[2] + p2[2]), 1.0 };
+      double view[4];
+      worldToView->MultiplyPoint(anchor, view);
+      if (view[3] <= 0)
+        {
+        // Behind the camera
+        continue;
+        }
+      double x = (view[0] / view[3] + 1.0) * 0.5 * width;
+      double y = (view[1] / view[3] + 1.0) * 0.5 * height;
+      // Selected paths rank before the others, closest first
+      double rank = selected ? -1.0 / (1.0 + distance) : distance;
+      labels[i] = layout->AddLabel(x, y, rank);
+      }
+    layout->Layout();
+    }
+
+  int numberOfChangedNodes = 0;
+  ++this->Internal->IgnoreNodeEvents;
+  for (int i = 0; i < numberOfPaths; ++i)
+    {
+    vtkInternal::PathRecord* record = this->Internal->FindPath(store->GetPathNodeID(i));
+    if (!record || !record->PathNode ||
+        (enabled && !record->PathNode->GetDisplayVisibility()))
+      {
+      continue;
+      }
+    bool label = !enabled || layout->IsLabelPlaced(labels[i]);
+    int& hidden = record->LevelOfDetailHidden;
+    numberOfChangedNodes += SetLevelOfDetailVisibility(
+      record->PathNode->GetAnnotationPointDisplayNode(), glyphs[i] != 0,
+      vtkInternal::GlyphsHidden, hidden);
+    numberOfChangedNodes += SetLevelOfDetailVisibility(
+      record->PathNode->GetAnnotationTextDisplayNode(), label,
+      vtkInternal::LabelHidden, hidden);
+    if (record->TargetNode)
+      {
+      // Target name follows the path label
+      numberOfChangedNodes += SetLevelOfDetailVisibility(
+        record->TargetNode->GetAnnotationTextDisplayNode(), label,
+        vtkInternal::TargetLabelHidden, hidden);
+      }
+    }
+  --this->Internal->IgnoreNodeEvents;
+  return numberOfChangedNodes;
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic::SaveLevelOfDetail(bool save)
+{
+  ++this->Internal->IgnoreNodeEvents;
+  std::map<std::string, vtkInternal::PathRecord>::iterator it =
+    this->Internal->Paths.begin();
+  for (; it != this->Internal->Paths.end(); ++it)
+    {
+    this->Internal->SetLevelOfDetailNodesVisibility(it->second, save);
+    }
+  --this->Internal->IgnoreNodeEvents;
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic::OnTargetNodeModified(const std::string& pathNodeID)
+{
+  vtkSlicerVisuaLineProfileMacro(this->Internal->Profiler, "Logic::OnTargetNodeModified");
+  if (this->Internal->Synchronizing > 0)
+    {
+    return;
+    }
+  vtkInternal::PathRecord* record = this->Internal->FindPath(pathNodeID.c_str());
+  if (!record || !record->PathNode || !record->TargetNode)
+    {
+    return;
+    }
+
+  // Target is in world coordinates, skip the round trip if it already
+  // matches the path.
+  double* targetPosition = record->TargetNode->GetFiducialCoordinates();
+  double p1[3], p2[3], localTarget[3];
+  this->GetPathWorldEndPoints(record->PathNode, p1, p2);
+  if (vtkMath::Distance2BetweenPoints(p2, targetPosition) > 1e-12)
+    {
+    this->WorldToPathLocal(record->PathNode, targetPosition, localTarget);
+    // Path modification updates the virtual offset
+    record->PathNode->SetPosition2(localTarget);
+    }
+  this->MarkPathModified(pathNodeID);
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic
+::UpdatePathTargetAndOffset(const std::string& pathNodeID)
+{
+  vtkInternal::PathRecord* record = this->Internal->FindPath(pathNodeID.c_str());
+  if (!record || !record->PathNode)
+    {
+    return;
+    }
+
+  double p1[3], p2[3];
+  this->GetPathWorldEndPoints(record->PathNode, p1, p2);
+
+  ++this->Internal->Synchronizing;
+  if (record->TargetNode)
+    {
+    double* target = record->TargetNode->GetFiducialCoordinates();
+    if (!target || vtkMath::Distance2BetweenPoints(p2, target) > 1e-12)
+      {
+      record->TargetNode->SetFiducialCoordinates(p2);
+      }
+    }
+  if (record->VirtualOffsetNode)
+    {
+    double tip[3];
+    this->GetVirtualOffsetTip(record->PathNode, record->VirtualOffset, tip);
+    record->VirtualOffsetNode->SetPosition1(p2);
+    record->VirtualOffsetNode->SetPosition2(tip);
+
+    // Workaround for issue on top
+    record->VirtualOffsetNode->SetDisplayVisibility(record->VirtualOffset != 0);
+    record->VirtualOffsetNode->Modified();
+    }
+  --this->Internal->Synchronizing;
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic::MarkPathModified(const std::string& pathNodeID)
+{
+  if (!this->Internal->ModifiedPathSet.insert(pathNodeID).second)
+    {
+    return;
+    }
+  this->Internal->ModifiedPaths.push_back(pathNodeID);
+
+  // One event per change set, whatever its size
+  if (!this->Internal->ModifiedEventPending)
+    {
+    this->Internal->ModifiedEventPending = true;
+    vtkSlicerVisuaLineCountMacro(this->Internal->Profiler, "Logic::PathsModifiedEvent");
+    this->InvokeEvent(PathsModifiedEvent);
+    }
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic
+::ObserveNode(vtkMRMLNode* node, const std::string& pathNodeID, int role)
+{
+  if (!node || !node->GetID() ||
+      this->Internal->ObservedNodes.count(node->GetID()))
+    {
+    return;
+    }
+  vtkInternal::ObservedNode& observed = this->Internal->ObservedNodes[node->GetID()];
+  observed.PathNodeID = pathNodeID;
+  observed.Role = role;
+  observed.Node = node;
+  node->AddObserver(vtkCommand::ModifiedEvent, this->GetMRMLNodesCallbackCommand());
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic::ReleaseNode(const std::string& nodeID)
+{
+  std::map<std::string, vtkInternal::ObservedNode>::iterator it =
+    this->Internal->ObservedNodes.find(nodeID);
+  if (it == this->Internal->ObservedNodes.end())
+    {
+    return;
+    }
+  if (it->second.Node)
+    {
+    it->second.Node->RemoveObservers(vtkCommand::ModifiedEvent,
+                                     this->GetMRMLNodesCallbackCommand());
+    }
+  this->Internal->ObservedNodes.erase(it);
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic::UpdatePathNode(vtkMRMLAnnotationRulerNode* path)
+{
+  if (!path)
+    {
+    return;
+    }
+  vtkSlicerVisuaLinePathStore* store = this->Internal->PathStore;
+  int index = store->GetPathIndex(path->GetID());
+  if (index < 0)
+    {
+    return;
+    }
+
+  vtkMRMLTransformNode* transformNode = path->GetParentTransformNode();
+  const char* transformNodeID = transformNode ? transformNode->GetID() : 0;
+  const char* currentID = store->GetPathTransformNodeID(index);
+  bool transformChanged = transformNodeID ?
+    (!currentID || strcmp(currentID, transformNodeID) != 0) : (currentID != 0);
+
+  if (transformChanged && transformNode &&
+      store->GetNumberOfPathsWithTransform(transformNodeID) == 0)
+    {
+    // First path under this transform: get its current matrix
+    vtkNew<vtkMatrix4x4> localToWorld;
+    transformNode->GetMatrixTransformToWorld(localToWorld.GetPointer());
+    store->SetTransformToWorld(transformNodeID, localToWorld.GetPointer());
+    }
+
+  double p1[3], p2[3];
+  path->GetPosition1(p1);
+  path->GetPosition2(p2);
+  store->SetPathTransformNodeID(index, transformNodeID);
+  store->SetLocalEndPoints(index, p1, p2);
+
+  if (transformChanged && !this->IsTransformObserverUpdateDeferred())
+    {
+    this->UpdateTransformObservers();
+    }
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic
+::GetPathWorldEndPoints(vtkMRMLAnnotationRulerNode* path, double p1[3], double p2[3])
+{
+  if (!path)
+    {
+    return;
+    }
+  int index = this->Internal->PathStore->GetPathIndex(path->GetID());
+  if (index < 0)
+    {
+    path->GetPosition1(p1);
+    path->GetPosition2(p2);
+    return;
+    }
+  this->Internal->PathStore->GetWorldEndPoints(index, p1, p2);
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic
+::WorldToPathLocal(vtkMRMLAnnotationRulerNode* path,
+                   const double world[3], double local[3])
+{
+  int index = path ? this->Internal->PathStore->GetPathIndex(path->GetID()) : -1;
+  this->Internal->PathStore->WorldToLocal(index, world, local);
+}
+
+//---------------------------------------------------------------------------
+bool vtkSlicerVisuaLineLogic::IsTransformObserverUpdateDeferred()
+{
+  // Done once when loading or at the end of the batch
+  return this->Internal->LoadingPaths > 0 ||
+    (this->GetMRMLScene() && this->GetMRMLScene()->IsBatchProcessing());
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic::UpdateTransformObservers()
+{
+  vtkMRMLScene* scene = this->GetMRMLScene();
+  vtkSlicerVisuaLinePathStore* store = this->Internal->PathStore;
+
+  // One observer per transform node, whatever its number of paths
+  std::set<std::string> needed;
+  for (int i = 0; i < store->GetNumberOfPaths(); ++i)
+    {
+    const char* transformNodeID = store->GetPathTransformNodeID(i);
+    if (transformNodeID)
+      {
+      needed.insert(transformNodeID);
+      }
+    }
+
+  std::set<std::string>& observed = this->Internal->ObservedTransformNodeIDs;
+  std::set<std::string>::iterator it;
+  for (it = observed.begin(); it != observed.end(); ++it)
+    {
+    vtkMRMLNode* node = scene ? scene->GetNodeByID(it->c_str()) : 0;
+    if (node && needed.find(*it) == needed.end())
+      {
+      node->RemoveObservers(vtkMRMLTransformableNode::TransformModifiedEvent,
+                            this->GetMRMLNodesCallbackCommand());
+      }
+    }
+  for (it = needed.begin(); it != needed.end(); ++it)
+    {
+    vtkMRMLNode* node = scene ? scene->GetNodeByID(it->c_str()) : 0;
+    if (node && observed.find(*it) == observed.end())
+      {
+      node->AddObserver(vtkMRMLTransformableNode::TransformModifiedEvent,
+                        this->GetMRMLNodesCallbackCommand());
+      }
+    }
+  observed.swap(needed);
+}
+
+//---------------------------------------------------------------------------
+void vtkSlicerVisuaLineLogic
+::OnTransformNodeModified(vtkMRMLTransformNode* transformNode)
+{
+  vtkSlicerVisuaLineProfileMacro(this->Internal->Profiler, "Logic::OnTransformNodeModified");
+  if (!transformNode || !transformNode->GetID())
+    {
+    return;
+    }
+
+  // Paths keep their last linear placement under a non-linear transform
+  if (!transformNode->IsLinear())
+    {
+    vtkWarningMacro("OnTransformNodeModified: non-linear transform "
+                    << transformNode->GetID() << " is ignored");
+    return;
+    }
+
+  // Re-harden every path under this transform in one batch
+  vtkNew<vtkMatrix4x4> localToWorld;
+  transformNode->GetMatrixTransformToWorld(localToWorld.GetPointer());
+
+  vtkSlicerVisuaLinePathStore* store = this->Internal->PathStore;
+  if (store->SetTransformToWorld(transformNode->GetID(),
+                                 localToWorld.GetPointer()) == 0)
+    {
+    return;
+    }
+
+  // Dependent nodes follow, and a single change set reaches the widget.
+  // No path is removed meanwhile: the store keeps its indices.
+  const std::vector<int>& members =
+    store->GetPathsWithTransform(transformNode->GetID());
+  bool compactPathsMoved = false;
+  for (size_t i = 0; i < members.size(); ++i)
+    {
+    std::string pathNodeID = store->GetPathNodeID(members[i]);
+    this->UpdatePathTargetAndOffset(pathNodeID);
+    InvalidateGeometryMetrics(store, members[i]);
+    this->Internal->EntryModifiedPaths.insert(pathNodeID);
+    this->Internal->DeflectionModifiedPaths.insert(pathNodeID);
+    this->MarkPathModified(pathNodeID);
+    compactPathsMoved = compactPathsMoved || this->IsPathCompact(pathNodeID.c_str());
+    }
+  if (compactPathsMoved)
+    {
+    this->UpdateCompactPathsDisplay();
+    }
+}
@@ -32,13 +32,42 @@
 // Slicer includes
 #include "vtkSlicerModuleLogic.h"
 
-// MRML includes
+// VTK includes
+#include <vtkCommand.h>
 
 // STD includes
 #include <cstdlib>
+#include <string>
+#include <vector>
 
 #include "vtkSlicerVisuaLineModuleLogicExport.h"
 
+class vtkCamera;
+class vtkDataArray;
+class vtkDoubleArray;
+class vtkMRMLAnnotationFiducialNode;
+class vtkMRMLAnnotationHierarchyNode;
+class vtkMRMLAnnotationRulerNode;
+class vtkMRMLModelNode;
+class vtkMRMLScalarVolumeNode;
+class vtkMRMLSliceNode;
+class vtkMRMLTransformNode;
+class vtkPoints;
+class vtkSlicerVisuaLineAnalysisCache;
+class vtkSlicerVisuaLineCurvedPath;
+class vtkSlicerVisuaLineDeflectionModel;
+class vtkSlicerVisuaLineDistanceMap;
+class vtkSlicerVisuaLineEntrySearch;
+class vtkSlicerVisuaLineLabelLayout;
+class vtkSlicerVisuaLineNameIndex;
+class vtkSlicerVisuaLinePathClustering;
+class vtkSlicerVisuaLinePathStore;
+class vtkSlicerVisuaLineProfiler;
+class vtkSlicerVisuaLineReachabilityMap;
+class vtkSlicerVisuaLineSurfaceLocator;
+class vtkSlicerVisuaLineTemplateGrid;
+class vtkSlicerVisuaLineUndoJournal;
+class vtkSlicerVisuaLineUncertaintyAnalysis;
 
 /// \ingroup Slicer_QtModules_ExtensionTemplate
 class VTK_SLICER_VISUALINE_MODULE_LOGIC_EXPORT vtkSlicerVisuaLineLogic :
@@ -50,6 +79,402 @@ public:
   vtkTypeMacro(vtkSlicerVisuaLineLogic, vtkSlicerModuleLogic);
   void PrintSelf(ostream& os, vtkIndent indent);
 
+  enum
+    {
+    /// Template grids were added, removed or modified
+    TemplateGridsModifiedEvent = vtkCommand::UserEvent + 1,
+    /// Managed paths were modified or removed. Sent once until the
+    /// changes are collected with TakeModifiedPaths().
+    PathsModifiedEvent,
+    /// Paths of a loaded scene are managed. Sent once per batch.
+    PathsLoadedEvent,
+    /// Path lists of an imported scene wait for PreIndexPathHierarchies()
+    PathHierarchiesQueuedEvent
+    };
+
+  enum
+    {
+    CSVFormat = 0,
+    JSONFormat
+    };
+
+  /// Geometry of all managed paths
+  vtkSlicerVisuaLinePathStore* GetPathStore();
+
+  /// Manage a path: its target fiducial is created and both nodes are
+  /// observed by the logic. Its world end points follow its parent
+  /// transform.
+  void AddPathNode(vtkMRMLAnnotationRulerNode* path);
+  /// Manage every ruler of the scene but the virtual offsets, e.g. to
+  /// evaluate a plan without widget. Return the number of added paths.
+  int AddAllPathNodes();
+  /// Stop managing a path. Its target and virtual offset are hidden.
+  void RemovePathNode(const char* pathNodeID);
+  bool IsPathManaged(const char* pathNodeID);
+
+  /// Nodes of a managed path, NULL if deleted, not managed or compact
+  vtkMRMLAnnotationRulerNode* GetPathNode(const char* pathNodeID);
+  vtkMRMLAnnotationFiducialNode* GetPathTargetNode(const char* pathNodeID);
+  vtkMRMLAnnotationRulerNode* GetPathVirtualOffsetNode(const char* pathNodeID);
+  /// Ruler of a managed path, creating the nodes of a compact path first
+  /// (see ExpandPath())
+  vtkMRMLAnnotationRulerNode* GetOrExpandPathNode(const char* pathNodeID);
+
+  /// Virtual tip 'offset' mm past the target. The offset ruler is
+  /// created on first use.
+  void SetPathVirtualOffset(const char* pathNodeID, double offset);
+  double GetPathVirtualOffset(const char* pathNodeID);
+
+  //BTX
+  /// IDs of the paths modified or removed since the last call
+  void TakeModifiedPaths(std::vector<std::string>& pathNodeIDs);
+
+  /// Show or hide paths with their target and virtual offset in one
+  /// pass. Nodes already in that state are skipped and the logic ignores
+  /// the modified events of the batch. Several paths change within a
+  /// scene batch process, so that the views render once at its end.
+  /// Return the number of changed nodes.
+  int SetPathsVisibility(const std::vector<std::string>& pathNodeIDs, bool visible);
+  //ETX
+
+  /// Bulk access for scripts, one value or tuple per path in path store
+  /// order (GetPathStore()->GetPathNodeIDs()). End points have 6
+  /// components: entry then target, in world coordinates. Getters fill
+  /// copies, edited arrays are applied with the setters.
+  void GetWorldEndPointsArray(vtkDoubleArray* endPoints);
+  void GetVirtualOffsetsArray(vtkDoubleArray* offsets);
+  /// Display visibility (0 or 1), copied from the path nodes
+  void GetVisibilityArray(vtkDoubleArray* visibility);
+
+  /// Apply a whole array in one batch: node events of the batch are
+  /// ignored and the widget gets a single change set. Return the number
+  /// of changed paths (nodes for the visibility), 0 if the array does not
+  /// match the paths.
+  int SetWorldEndPointsArray(vtkDataArray* endPoints);
+  int SetVirtualOffsetsArray(vtkDataArray* offsets);
+  int SetVisibilityArray(vtkDataArray* visibility);
+
+  /// Undo history of the path geometry, virtual offset, visibility and
+  /// removal, path by path. Journal revisions give the plan changes since
+  /// an earlier revision.
+  vtkSlicerVisuaLineUndoJournal* GetUndoJournal();
+  /// Restore the paths of the last (next) journal entry. Return false if
+  /// there is nothing to undo (redo).
+  bool Undo();
+  bool Redo();
+
+  /// Write every managed path to a file: name, node ID, world entry,
+  /// target and virtual offset tip, insertion angles and all the path
+  /// metrics (length, clearance, probabilities...). Angles (degrees) are
+  /// those of the entry to target direction from the S axis, in the
+  /// coronal (R) and sagittal (A) planes. Metrics not computed, or not
+  /// computed again since the path moved, are written empty in CSV and
+  /// null in JSON. Metrics are written as cached: call UpdatePathEntries()
+  /// first for up to date insertion depths. Nothing is modified. Rows are
+  /// streamed from the path store through a buffered file. Return false
+  /// on write error.
+  bool ExportPaths(const char* fileName, int format);
+
+  /// Manage every ruler of an annotation hierarchy (plan, alternative,
+  /// executed needles...). Rulers added to or removed from it later are
+  /// followed. Several hierarchies can be managed at once.
+  void AddPathHierarchy(vtkMRMLAnnotationHierarchyNode* hierarchy);
+  /// Stop managing a hierarchy and its paths
+  void RemovePathHierarchy(const char* hierarchyNodeID);
+  bool IsPathHierarchyManaged(const char* hierarchyNodeID);
+  /// Synchronize the managed paths with the hierarchy content
+  void UpdatePathHierarchy(const char* hierarchyNodeID);
+  /// Index the paths of the lists queued when a scene is imported, at most
+  /// maximumNumberOfPaths new paths per call so it can run while the
+  /// application is idle. Only the path store and name index are filled:
+  /// targets and curves are created when a list is selected with
+  /// AddPathHierarchy(). Return the number of lists left.
+  int PreIndexPathHierarchies(int maximumNumberOfPaths);
+  int GetNumberOfPathHierarchiesToIndex();
+  /// Hierarchy of a managed path, NULL if none
+  const char* GetPathHierarchyNodeID(const char* pathNodeID);
+  //BTX
+  /// Managed paths of a hierarchy, compact ones included
+  void GetHierarchyPaths(const char* hierarchyNodeID,
+                         std::vector<std::string>& pathNodeIDs);
+  /// Hierarchies of the paths of the last PathsLoadedEvent
+  void GetLoadedPathHierarchies(std::vector<std::string>& hierarchyNodeIDs);
+  //ETX
+  /// Name of a managed path, without creating the nodes of a compact path
+  const char* GetPathName(const char* pathNodeID);
+
+  /// Compact storage of the paths. A compact path has no MRML node: its
+  /// geometry stays in the path store with a packed record (name, color,
+  /// visibility and lock) and all compact paths are drawn as one model.
+  /// Its nodes are created again on demand (GetOrExpandPathNode(),
+  /// selection...).
+  /// Enabled, every unselected straight path of a path list is compacted,
+  /// and paths are compacted again when unselected. Paths with a
+  /// description, other attributes or custom display settings keep their
+  /// nodes. Compact paths are saved as rulers, with their node IDs, and
+  /// compacted again when loaded.
+  void SetCompactStorage(bool enabled);
+  bool GetCompactStorage();
+  /// Compact or expand one path. Return false if the path is not managed
+  /// or cannot be compacted (curved path, not in a path list).
+  bool CompactPath(const char* pathNodeID);
+  bool ExpandPath(const char* pathNodeID);
+  bool IsPathCompact(const char* pathNodeID);
+  int GetNumberOfCompactPaths();
+
+  //BTX
+  /// Memory used by paths: MRML nodes (path, target, virtual offset with
+  /// their display, storage and hierarchy nodes) and logic records. Sizes
+  /// in bytes, estimated from the node classes and their polydata.
+  struct MemoryUsage
+    {
+    MemoryUsage();
+    int NumberOfPaths;
+    int NumberOfCompactPaths;
+    int NumberOfNodes;
+    vtkIdType NodeSize;
+    vtkIdType RecordSize;
+    };
+  /// Add the usage of a path, or of all the paths of a hierarchy (NULL for
+  /// the paths in no hierarchy), to 'usage'
+  void GetPathMemoryUsage(const char* pathNodeID, MemoryUsage& usage);
+  void GetHierarchyMemoryUsage(const char* hierarchyNodeID, MemoryUsage& usage);
+  //ETX
+  /// Per hierarchy and per path memory usage, as text
+  void PrintMemoryReport(ostream& os);
+  bool WriteMemoryReport(const char* fileName);
+
+  /// Names of the per path metrics kept in the path store. When a path
+  /// moves, its length and offset are updated and the metrics of its
+  /// analyses are set to NaN until they run again.
+  static const char* GetLengthMetricName();
+  static const char* GetClearanceMetricName();
+  static const char* GetVirtualOffsetMetricName();
+
+  /// Names of all managed paths
+  vtkSlicerVisuaLineNameIndex* GetNameIndex();
+
+  //BTX
+  /// Criteria of FindPaths(). Ranges left to their default are not
+  /// checked, paths without the metric fail the other ones.
+  struct PathFilter
+    {
+    PathFilter();
+    std::string Text;
+    double LengthRange[2];
+    double ClearanceRange[2];
+    int Visibility; // -1: any, 0: hidden, 1: visible
+    };
+
+  /// Managed paths whose name contains the filter text (case insensitive)
+  /// and whose metrics match the filter.
+  void FindPaths(const PathFilter& filter, std::vector<std::string>& pathNodeIDs);
+  //ETX
+
+  /// On-disk cache of the risk distance maps and uncertainty results,
+  /// disabled until its directory is set (the module sets one).
+  vtkSlicerVisuaLineAnalysisCache* GetAnalysisCache();
+
+  /// Distances to the risk labels of the risk label map, shared by the
+  /// uncertainty analysis and the entry search. Risk labels are set on it.
+  vtkSlicerVisuaLineDistanceMap* GetRiskDistanceMap();
+  /// Label map of the risk structures (NULL for none). The distance map
+  /// is only rebuilt when the label map or the risk labels change.
+  void SetRiskLabelMap(vtkMRMLScalarVolumeNode* labelMap);
+
+  /// Monte Carlo placement error of the paths. Error model, seed and
+  /// target label are set on it and kept between analyses.
+  vtkSlicerVisuaLineUncertaintyAnalysis* GetUncertaintyAnalysis();
+
+  /// Sample perturbed insertions of the managed paths against a label map
+  /// (NULL: target sphere only, no risk), which becomes the risk label
+  /// map. Target hit and risk probabilities and the clearance are stored
+  /// as path metrics.
+  void AnalyzePathUncertainty(vtkMRMLScalarVolumeNode* labelMap);
+  //BTX
+  void AnalyzePathUncertainty(vtkMRMLScalarVolumeNode* labelMap,
+                              const std::vector<std::string>& pathNodeIDs);
+  //ETX
+  static const char* GetTargetHitProbabilityMetricName();
+  static const char* GetRiskProbabilityMetricName();
+
+  /// Entry point search over a skin surface. Constraints and weights are
+  /// set on it.
+  vtkSlicerVisuaLineEntrySearch* GetEntrySearch();
+
+  /// Propose the 'k' best entries on a skin model for a target, scored on
+  /// length, clearance to the risk label map and angle to the skin. A
+  /// ruler is created from each entry to the target, under the hierarchy
+  /// if any. Return the number of created rulers.
+  int ProposePathEntries(vtkMRMLAnnotationFiducialNode* target,
+                         vtkMRMLModelNode* skin, int k,
+                         vtkMRMLAnnotationHierarchyNode* hierarchy);
+
+  /// Near-duplicate detection of the paths. Entry, target and angular
+  /// tolerances are set on it.
+  vtkSlicerVisuaLinePathClustering* GetPathClustering();
+  //BTX
+  /// Group managed paths (all if none given) into clusters of near
+  /// duplicates, each listing its representative first. Return the
+  /// number of clusters.
+  int FindDuplicatePaths(const std::vector<std::string>& pathNodeIDs,
+                         std::vector<std::vector<std::string> >& clusters);
+  /// Merge paths into the first one: the others are removed from the
+  /// scene with their target and virtual offset, compact ones without
+  /// being expanded. The merge is not recorded in the undo journal.
+  /// Return the number of removed paths.
+  int MergePaths(const std::vector<std::string>& pathNodeIDs);
+  //ETX
+
+  /// Surface (skin) where the paths enter. Each path is cast from its
+  /// target through its ruler entry: the first crossing is the skin entry
+  /// and its distance to the target the insertion depth. Surfaces keep
+  /// their locator while their geometry and transform are unchanged.
+  void SetEntrySurfaceNode(vtkMRMLModelNode* surface);
+  vtkMRMLModelNode* GetEntrySurfaceNode();
+
+  /// Intersect the paths moved since the last update with the entry
+  /// surface, in one parallel batch. Getters below call it as needed.
+  /// Return the number of updated paths.
+  int UpdatePathEntries();
+
+  /// Skin entry of a path, false if the path does not cross the surface
+  bool GetPathSkinEntry(const char* pathNodeID, double entry[3]);
+  /// Depth (mm) from the skin entry to the target, and to the virtual
+  /// offset tip. NaN if the path does not cross the surface.
+  double GetPathInsertionDepth(const char* pathNodeID);
+  double GetPathTipDepth(const char* pathNodeID);
+  static const char* GetInsertionDepthMetricName();
+
+  /// Bevel-tip deflection of the needle along the paths. Curvature,
+  /// bevel and label stiffnesses are set on it.
+  vtkSlicerVisuaLineDeflectionModel* GetDeflectionModel();
+  /// Tissue the needle crosses (NULL for uniform tissue). Label maps give
+  /// the stiffness per label, other volumes through their intensity range.
+  void SetDeflectionTissueNode(vtkMRMLScalarVolumeNode* tissue);
+  /// Predicted trajectories are drawn by one model, next to the rulers
+  void SetDeflectionPredictionEnabled(bool enabled);
+  bool GetDeflectionPredictionEnabled();
+  /// Simulate the paths moved since the last update, all of them after a
+  /// change of the model or tissue, and redraw the predicted trajectories
+  /// of the visible paths if one changed or was shown or hidden. Return
+  /// the number of simulated paths.
+  int UpdatePathDeflections();
+  /// Distance (mm) from the predicted tip to the target, NaN if the
+  /// prediction is disabled
+  double GetPathTipError(const char* pathNodeID);
+  static const char* GetTipErrorMetricName();
+
+  /// Trajectories the delivery device (template, robot) can reach. Its
+  /// guides are set on it, built maps go to the analysis cache.
+  vtkSlicerVisuaLineReachabilityMap* GetReachabilityMap();
+  /// Build the map if its guides changed and flag the paths it cannot
+  /// deliver in the reachable metric (NaN without guides). Return the
+  /// number of unreachable paths.
+  int UpdatePathReachability();
+  //BTX
+  /// Same for some paths only, after they moved
+  int UpdatePathReachability(const std::vector<std::string>& pathNodeIDs);
+  //ETX
+  /// False only for paths the device cannot deliver
+  bool IsPathReachable(const char* pathNodeID);
+  //BTX
+  /// Move the unreachable paths to the closest reachable trajectories, in
+  /// one undo step. Return the number of moved paths.
+  int SnapPathsToReachable(const std::vector<std::string>& pathNodeIDs);
+  //ETX
+  static const char* GetReachableMetricName();
+
+  /// Call counts and timings of the node handlers, offset changes, level
+  /// of detail and batch updates. Disabled by default; the module widget
+  /// records its own slots and the 3D view rendering in it as well.
+  vtkSlicerVisuaLineProfiler* GetProfiler();
+
+  /// Level of detail of the path displays. Unselected paths farther from
+  /// the camera than the distance (mm) are drawn as plain lines, without
+  /// end point glyphs. Labels go through the label layout: only the non
+  /// overlapping ones are drawn, selected and closest paths first. Off by
+  /// default.
+  void SetLevelOfDetailEnabled(bool enabled);
+  bool GetLevelOfDetailEnabled();
+  void SetLevelOfDetailDistance(double distance);
+  double GetLevelOfDetailDistance();
+  vtkSlicerVisuaLineLabelLayout* GetLabelLayout();
+
+  //BTX
+  /// Paths kept at full detail and labelled first
+  void SetSelectedPaths(const std::vector<std::string>& pathNodeIDs);
+  //ETX
+
+  /// Update the glyphs and labels of the visible paths for a camera and
+  /// a view size in pixels. Only display nodes that change are modified.
+  /// Disabled, the glyphs and labels it hid are shown again; the ones
+  /// hidden by the user stay hidden. Return the number of changed display
+  /// nodes.
+  int UpdateLevelOfDetail(vtkCamera* camera, int width, int height);
+
+  /// Refresh the stored end points and parent transform of a path.
+  void UpdatePathNode(vtkMRMLAnnotationRulerNode* path);
+
+  /// End points in world coordinates (ruler coordinates if not managed)
+  void GetPathWorldEndPoints(vtkMRMLAnnotationRulerNode* path,
+                             double p1[3], double p2[3]);
+
+  /// Convert a world point into the ruler coordinates of the path
+  void WorldToPathLocal(vtkMRMLAnnotationRulerNode* path,
+                        const double world[3], double local[3]);
+
+  /// Ruler attribute storing the control points of a curved path
+  static const char* GetControlPointsAttributeName();
+
+  /// Make the path a curved trajectory through the given points (entry
+  /// first, target last). The end points are kept on the ruler end points.
+  /// Less than 3 points turns the path back into a straight line.
+  void SetPathControlPoints(vtkMRMLAnnotationRulerNode* path,
+                            vtkPoints* points, int interpolation);
+
+  /// Move one control point of a curved path. Only the spans around it
+  /// are computed again. The end points move the ruler end points.
+  void SetPathControlPoint(vtkMRMLAnnotationRulerNode* path, int index,
+                           const double point[3]);
+
+  /// Curve of the path, or NULL if the path is straight. Curves saved
+  /// with a ruler are read when the path is managed.
+  vtkSlicerVisuaLineCurvedPath* GetCurvedPath(vtkMRMLAnnotationRulerNode* path);
+
+  /// Move the curve ends onto the ruler end points after it was edited.
+  void UpdateCurvedPath(vtkMRMLAnnotationRulerNode* path);
+
+  /// Length of the path along the curve
+  double GetPathLength(vtkMRMLAnnotationRulerNode* path);
+
+  /// Point and direction (world) at a distance from the entry, along the
+  /// path. Beyond the target the path is extended along its last direction.
+  void GetPointAlongPath(vtkMRMLAnnotationRulerNode* path, double distance,
+                         double point[3], double direction[3]);
+
+  /// Virtual tip 'offset' mm past the target along the path
+  void GetVirtualOffsetTip(vtkMRMLAnnotationRulerNode* path, double offset,
+                           double tip[3]);
+
+  /// Points where the path crosses the slice plane
+  int IntersectPathWithSlice(vtkMRMLAnnotationRulerNode* path,
+                             vtkMRMLSliceNode* slice, vtkPoints* intersections);
+
+  /// Add a needle guide template. Its holes are drawn as one model and
+  /// only become rulers when materialized.
+  vtkSlicerVisuaLineTemplateGrid* AddTemplateGrid(const char* name);
+  void RemoveTemplateGrid(vtkSlicerVisuaLineTemplateGrid* grid);
+  int GetNumberOfTemplateGrids();
+  vtkSlicerVisuaLineTemplateGrid* GetNthTemplateGrid(int n);
+  void SetTemplateGridVisibility(vtkSlicerVisuaLineTemplateGrid* grid, bool visible);
+
+  /// Ruler of a template hole, created on first request and added to the
+  /// hierarchy (if any). Later requests return the same ruler.
+  vtkMRMLAnnotationRulerNode* MaterializeTemplateHole(
+    vtkSlicerVisuaLineTemplateGrid* grid, int hole,
+    vtkMRMLAnnotationHierarchyNode* hierarchy);
+
 protected:
   vtkSlicerVisuaLineLogic();
   virtual ~vtkSlicerVisuaLineLogic();
@@ -57,10 +482,68 @@ protected:
   virtual void SetMRMLSceneInternal(vtkMRMLScene* newScene);
   /// Register MRML Node classes to Scene. Gets called automatically when the MRMLScene is attached to this logic class.
   virtual void RegisterNodes();
+  /// Manage the paths queued during batch processing in one pass
   virtual void UpdateFromMRMLScene();
   virtual void OnMRMLSceneNodeAdded(vtkMRMLNode* node);
   virtual void OnMRMLSceneNodeRemoved(vtkMRMLNode* node);
+  virtual void OnMRMLSceneEndClose();
+  virtual void OnMRMLSceneEndImport();
+  virtual void ProcessMRMLSceneEvents(vtkObject* caller,
+                                      unsigned long event,
+                                      void* callData);
+
+  virtual void ProcessMRMLNodesEvents(vtkObject* caller,
+                                      unsigned long event,
+                                      void* callData);
+
+  /// Manage a path, reusing its target and offset nodes when given
+  void ManagePathNode(vtkMRMLAnnotationRulerNode* path,
+                      vtkMRMLAnnotationFiducialNode* target,
+                      vtkMRMLAnnotationRulerNode* virtualOffset);
+  void LoadPendingPaths();
+  /// Queue the unmanaged path lists added by the import for pre-indexing
+  void QueuePathHierarchies();
+  bool IsTransformObserverUpdateDeferred();
+
+  void UpdateCurveDisplay(vtkMRMLAnnotationRulerNode* path);
+  /// Visibility and transform of the curve model follow the ruler
+  void UpdateCurveModel(vtkMRMLAnnotationRulerNode* path);
+  /// Read the control points saved with the ruler
+  void LoadCurvedPath(vtkMRMLAnnotationRulerNode* path);
+  void UpdateTransformObservers();
+  void OnTransformNodeModified(vtkMRMLTransformNode* transformNode);
+  //BTX
+  /// Create the curve and target of a pre-indexed path
+  void FinishPreIndexedPath(const std::string& pathNodeID);
+  void OnPathNodeModified(const std::string& pathNodeID);
+  void RemoveCurvedPath(const std::string& pathNodeID);
+  void OnTargetNodeModified(const std::string& pathNodeID);
+  void UpdatePathTargetAndOffset(const std::string& pathNodeID);
+  void MarkPathModified(const std::string& pathNodeID);
+  void ObserveNode(vtkMRMLNode* node, const std::string& pathNodeID, int role);
+  void SetPathHierarchy(const std::string& pathNodeID,
+                        const std::string& hierarchyNodeID);
+  void ReleaseNode(const std::string& nodeID);
+  void UpdatePathMetrics(const std::string& pathNodeID);
+  void RecordPathState(const std::string& pathNodeID);
+  bool CompactPathNode(const std::string& pathNodeID);
+  bool ExpandPathNode(const std::string& pathNodeID);
+  //ETX
+  void UpdateCompactPathsDisplay();
+  /// Compact paths are expanded when the scene is saved and compacted
+  /// again after
+  void SaveCompactPaths(bool save);
+  /// Glyphs and labels hidden by the level of detail are saved visible
+  void SaveLevelOfDetail(bool save);
+  bool ReplayUndoJournal(bool redo);
+  void UpdateTemplateGridDisplay(vtkSlicerVisuaLineTemplateGrid* grid);
+  /// Put a new ruler under a path list, managed if the list is
+  void AddRulerToHierarchy(vtkMRMLAnnotationRulerNode* ruler,
+                           vtkMRMLAnnotationHierarchyNode* hierarchy);
+
 private:
+  class vtkInternal;
+  vtkInternal* Internal;
 
   vtkSlicerVisuaLineLogic(const vtkSlicerVisuaLineLogic&); // Not implemented
   void operator=(const vtkSlicerVisuaLineLogic&);               // Not implemented
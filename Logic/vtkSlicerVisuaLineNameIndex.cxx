@@ -0,0 +1,227 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Laurent Chauvin, Brigham and Women's
+  Hospital. The project was supported by grants 5P01CA067165,
+  5R01CA124377, 5R01CA138586, 2R44DE019322, 7R01CA124377,
+  5R42CA137886, 8P41EB015898
+
+==============================================================================*/
+
+// VisuaLine Logic includes
+#include "vtkSlicerVisuaLineNameIndex.h"
+
+// VTK includes
+#include <vtkObjectFactory.h>
+
+// STD includes
+#include <algorithm>
+#include <cctype>
+
+namespace
+{
+const size_t MaximumGramLength = 3;
+}
+
+//----------------------------------------------------------------------------
+vtkStandardNewMacro(vtkSlicerVisuaLineNameIndex);
+
+//----------------------------------------------------------------------------
+vtkSlicerVisuaLineNameIndex::vtkSlicerVisuaLineNameIndex()
+{
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerVisuaLineNameIndex::~vtkSlicerVisuaLineNameIndex()
+{
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineNameIndex::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os, indent);
+  os << indent << "NumberOfNames: " << this->GetNumberOfNames() << "\n";
+  os << indent << "NumberOfGrams: " << this->Postings.size() << "\n";
+}
+
+//----------------------------------------------------------------------------
+std::string vtkSlicerVisuaLineNameIndex::Normalize(const char* text)
+{
+  std::string normalized = text ? text : "";
+  for (size_t i = 0; i < normalized.size(); ++i)
+    {
+    normalized[i] = static_cast<char>(
+      tolower(static_cast<unsigned char>(normalized[i])));
+    }
+  return normalized;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineNameIndex::SetName(const char* nodeID, const char* name)
+{
+  if (!nodeID)
+    {
+    return;
+    }
+  std::string normalized = Normalize(name);
+  std::map<std::string, int>::iterator it = this->SlotByNodeID.find(nodeID);
+  if (it != this->SlotByNodeID.end())
+    {
+    if (this->Names[it->second] == normalized)
+      {
+      return;
+      }
+    // Rename: only the grams of this name change
+    this->RemoveGrams(it->second);
+    this->Names[it->second] = normalized;
+    this->AddGrams(it->second);
+    this->Modified();
+    return;
+    }
+
+  int slot;
+  if (!this->FreeSlots.empty())
+    {
+    slot = this->FreeSlots.back();
+    this->FreeSlots.pop_back();
+    this->NodeIDs[slot] = nodeID;
+    this->Names[slot] = normalized;
+    }
+  else
+    {
+    slot = static_cast<int>(this->NodeIDs.size());
+    this->NodeIDs.push_back(nodeID);
+    this->Names.push_back(normalized);
+    }
+  this->SlotByNodeID[nodeID] = slot;
+  this->AddGrams(slot);
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineNameIndex::RemoveName(const char* nodeID)
+{
+  std::map<std::string, int>::iterator it =
+    nodeID ? this->SlotByNodeID.find(nodeID) : this->SlotByNodeID.end();
+  if (it == this->SlotByNodeID.end())
+    {
+    return;
+    }
+  int slot = it->second;
+  this->RemoveGrams(slot);
+  this->NodeIDs[slot].clear();
+  this->Names[slot].clear();
+  this->FreeSlots.push_back(slot);
+  this->SlotByNodeID.erase(it);
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineNameIndex::RemoveAllNames()
+{
+  this->NodeIDs.clear();
+  this->Names.clear();
+  this->FreeSlots.clear();
+  this->SlotByNodeID.clear();
+  this->Postings.clear();
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLineNameIndex::GetNumberOfNames()
+{
+  return static_cast<int>(this->SlotByNodeID.size());
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineNameIndex::AddGrams(int slot)
+{
+  const std::string& name = this->Names[slot];
+  for (size_t length = 1; length <= MaximumGramLength; ++length)
+    {
+    for (size_t i = 0; i + length <= name.size(); ++i)
+      {
+      this->Postings[name.substr(i, length)].insert(slot);
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineNameIndex::RemoveGrams(int slot)
+{
+  const std::string& name = this->Names[slot];
+  for (size_t length = 1; length <= MaximumGramLength; ++length)
+    {
+    for (size_t i = 0; i + length <= name.size(); ++i)
+      {
+      std::map<std::string, std::set<int> >::iterator posting =
+        this->Postings.find(name.substr(i, length));
+      if (posting == this->Postings.end())
+        {
+        continue;
+        }
+      posting->second.erase(slot);
+      if (posting->second.empty())
+        {
+        this->Postings.erase(posting);
+        }
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineNameIndex
+::Find(const std::string& text, std::vector<std::string>& nodeIDs)
+{
+  nodeIDs.clear();
+  std::string query = Normalize(text.c_str());
+  if (query.empty())
+    {
+    std::map<std::string, int>::iterator it = this->SlotByNodeID.begin();
+    for (; it != this->SlotByNodeID.end(); ++it)
+      {
+      nodeIDs.push_back(it->first);
+      }
+    return;
+    }
+
+  // Shortest posting list among the grams of the query
+  size_t gramLength = std::min(query.size(), MaximumGramLength);
+  const std::set<int>* candidates = 0;
+  for (size_t i = 0; i + gramLength <= query.size(); ++i)
+    {
+    std::map<std::string, std::set<int> >::iterator posting =
+      this->Postings.find(query.substr(i, gramLength));
+    if (posting == this->Postings.end())
+      {
+      return;
+      }
+    if (!candidates || posting->second.size() < candidates->size())
+      {
+      candidates = &posting->second;
+      }
+    }
+
+  // Short queries are grams themselves, longer ones are verified
+  std::set<int>::const_iterator it = candidates->begin();
+  for (; it != candidates->end(); ++it)
+    {
+    if (query.size() <= MaximumGramLength ||
+        this->Names[*it].find(query) != std::string::npos)
+      {
+      nodeIDs.push_back(this->NodeIDs[*it]);
+      }
+    }
+}
@@ -0,0 +1,90 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Laurent Chauvin, Brigham and Women's
+  Hospital. The project was supported by grants 5P01CA067165,
+  5R01CA124377, 5R01CA138586, 2R44DE019322, 7R01CA124377,
+  5R42CA137886, 8P41EB015898
+
+==============================================================================*/
+
+// .NAME vtkSlicerVisuaLineNameIndex - n-gram index of path names
+// .SECTION Description
+// Case insensitive substring search over path names. Every 1, 2 and 3
+// character sequence of a name points to the name, so a query is
+// answered from the shortest posting list of its trigrams instead of a
+// scan of all names. Names are added, renamed and removed one at a time.
+
+#ifndef __vtkSlicerVisuaLineNameIndex_h
+#define __vtkSlicerVisuaLineNameIndex_h
+
+// VTK includes
+#include <vtkObject.h>
+
+// STD includes
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "vtkSlicerVisuaLineModuleLogicExport.h"
+
+/// \ingroup Slicer_QtModules_VisuaLine
+class VTK_SLICER_VISUALINE_MODULE_LOGIC_EXPORT vtkSlicerVisuaLineNameIndex :
+  public vtkObject
+{
+public:
+
+  static vtkSlicerVisuaLineNameIndex *New();
+  vtkTypeMacro(vtkSlicerVisuaLineNameIndex, vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  /// Add a node name or update it if the node is already indexed.
+  void SetName(const char* nodeID, const char* name);
+  void RemoveName(const char* nodeID);
+  void RemoveAllNames();
+
+  int GetNumberOfNames();
+
+  //BTX
+  /// IDs of the nodes whose name contains 'text'. An empty text matches
+  /// all nodes.
+  void Find(const std::string& text, std::vector<std::string>& nodeIDs);
+  //ETX
+
+protected:
+  vtkSlicerVisuaLineNameIndex();
+  virtual ~vtkSlicerVisuaLineNameIndex();
+
+  //BTX
+  static std::string Normalize(const char* text);
+  void AddGrams(int slot);
+  void RemoveGrams(int slot);
+
+  // Per slot, a slot is reused once freed
+  std::vector<std::string> NodeIDs;
+  std::vector<std::string> Names;   // lower case
+  std::vector<int> FreeSlots;
+
+  std::map<std::string, int> SlotByNodeID;
+  std::map<std::string, std::set<int> > Postings;
+  //ETX
+
+private:
+  vtkSlicerVisuaLineNameIndex(const vtkSlicerVisuaLineNameIndex&); // Not implemented
+  void operator=(const vtkSlicerVisuaLineNameIndex&);              // Not implemented
+};
+
+#endif
@@ -0,0 +1,341 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Laurent Chauvin, Brigham and Women's
+  Hospital. The project was supported by grants 5P01CA067165,
+  5R01CA124377, 5R01CA138586, 2R44DE019322, 7R01CA124377,
+  5R42CA137886, 8P41EB015898
+
+==============================================================================*/
+
+// VisuaLine Logic includes
+#include "vtkSlicerVisuaLinePathClustering.h"
+
+// VTK includes
+#include <vtkMath.h>
+#include <vtkObjectFactory.h>
+
+// STD includes
+#include <algorithm>
+#include <cmath>
+
+//----------------------------------------------------------------------------
+vtkStandardNewMacro(vtkSlicerVisuaLinePathClustering);
+
+//----------------------------------------------------------------------------
+vtkSlicerVisuaLinePathClustering::vtkSlicerVisuaLinePathClustering()
+{
+  this->EntryTolerance = 2.0;
+  this->TargetTolerance = 2.0;
+  this->AngularTolerance = 5.0;
+  this->ClusterOffsets.push_back(0);
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerVisuaLinePathClustering::~vtkSlicerVisuaLinePathClustering()
+{
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLinePathClustering::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os, indent);
+  os << indent << "EntryTolerance: " << this->EntryTolerance << "\n";
+  os << indent << "TargetTolerance: " << this->TargetTolerance << "\n";
+  os << indent << "AngularTolerance: " << this->AngularTolerance << "\n";
+  os << indent << "NumberOfPaths: " << this->GetNumberOfPaths() << "\n";
+  os << indent << "NumberOfClusters: " << this->GetNumberOfClusters() << "\n";
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLinePathClustering::RemoveAllPaths()
+{
+  this->PathNodeIDs.clear();
+  this->EndPoints.clear();
+  this->Clusters.clear();
+  this->Cells.clear();
+  this->Buckets.clear();
+  this->NextInBucket.clear();
+  this->Parents.clear();
+  this->ClusterOffsets.assign(1, 0);
+  this->ClusterPaths.clear();
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLinePathClustering
+::AddPath(const char* pathNodeID, const double entry[3], const double target[3])
+{
+  this->PathNodeIDs.push_back(pathNodeID ? pathNodeID : "");
+  this->EndPoints.insert(this->EndPoints.end(), entry, entry + 3);
+  this->EndPoints.insert(this->EndPoints.end(), target, target + 3);
+  this->Clusters.push_back(-1);
+  return static_cast<int>(this->PathNodeIDs.size()) - 1;
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLinePathClustering::GetNumberOfPaths()
+{
+  return static_cast<int>(this->PathNodeIDs.size());
+}
+
+//----------------------------------------------------------------------------
+const char* vtkSlicerVisuaLinePathClustering::GetPathNodeID(int index)
+{
+  return index >= 0 && index < this->GetNumberOfPaths() ?
+    this->PathNodeIDs[index].c_str() : 0;
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerVisuaLinePathClustering::AreDuplicates(int a, int b)
+{
+  const double* pointsA = &this->EndPoints[6 * a];
+  const double* pointsB = &this->EndPoints[6 * b];
+  if (vtkMath::Distance2BetweenPoints(pointsA, pointsB) >
+      this->EntryTolerance * this->EntryTolerance ||
+      vtkMath::Distance2BetweenPoints(pointsA + 3, pointsB + 3) >
+      this->TargetTolerance * this->TargetTolerance)
+    {
+    return false;
+    }
+
+  // Directions of degenerate paths are not compared
+  double directionA[3], directionB[3];
+  for (int i = 0; i < 3; ++i)
+    {
+    directionA[i] = pointsA[i + 3] - pointsA[i];
+    directionB[i] = pointsB[i + 3] - pointsB[i];
+    }
+  double lengths = vtkMath::Norm(directionA) * vtkMath::Norm(directionB);
+  return lengths <= 0 || vtkMath::Dot(directionA, directionB) >=
+    lengths * cos(vtkMath::RadiansFromDegrees(this->AngularTolerance));
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLinePathClustering::FindRoot(int index)
+{
+  int root = index;
+  while (this->Parents[root] != root)
+    {
+    root = this->Parents[root];
+    }
+  // Path compression
+  while (this->Parents[index] != root)
+    {
+    int parent = this->Parents[index];
+    this->Parents[index] = root;
+    index = parent;
+    }
+  return root;
+}
+
+//----------------------------------------------------------------------------
+unsigned int vtkSlicerVisuaLinePathClustering::GetBucket(const int cell[6])
+{
+  unsigned int hash = 2166136261u;
+  for (int i = 0; i < 6; ++i)
+    {
+    hash = (hash ^ static_cast<unsigned int>(cell[i])) * 16777619u;
+    hash ^= hash >> 15;
+    }
+  return hash & static_cast<unsigned int>(this->Buckets.size() - 1);
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLinePathClustering::Update()
+{
+  int numberOfPaths = this->GetNumberOfPaths();
+  this->Clusters.assign(numberOfPaths, -1);
+  this->ClusterOffsets.assign(1, 0);
+  this->ClusterPaths.clear();
+  if (numberOfPaths < 2)
+    {
+    return;
+    }
+
+  // Cells twice as large as the tolerances. 'Sides' is the neighbour
+  // cell on the side of the path in each of the 6 dimensions.
+  double cellSizes[6];
+  for (int i = 0; i < 3; ++i)
+    {
+    cellSizes[i] = 2.0 * this->EntryTolerance;
+    cellSizes[i + 3] = 2.0 * this->TargetTolerance;
+    }
+  this->Cells.resize(6 * numberOfPaths);
+  std::vector<signed char> sides(6 * numberOfPaths);
+  for (int i = 0; i < 6 * numberOfPaths; ++i)
+    {
+    double cell = floor(this->EndPoints[i] / cellSizes[i % 6]);
+    this->Cells[i] = static_cast<int>(cell);
+    sides[i] = (this->EndPoints[i] - cell * cellSizes[i % 6] <
+                0.5 * cellSizes[i % 6]) ? -1 : 1;
+    }
+
+  // At least two buckets per path
+  size_t numberOfBuckets = 1;
+  while (numberOfBuckets < 2 * static_cast<size_t>(numberOfPaths))
+    {
+    numberOfBuckets *= 2;
+    }
+  this->Buckets.assign(numberOfBuckets, -1);
+  this->NextInBucket.resize(numberOfPaths);
+  for (int i = 0; i < numberOfPaths; ++i)
+    {
+    unsigned int bucket = this->GetBucket(&this->Cells[6 * i]);
+    this->NextInBucket[i] = this->Buckets[bucket];
+    this->Buckets[bucket] = i;
+    }
+
+  this->Parents.resize(numberOfPaths);
+  for (int i = 0; i < numberOfPaths; ++i)
+    {
+    this->Parents[i] = i;
+    }
+  for (int i = 0; i < numberOfPaths; ++i)
+    {
+    const int* cell = &this->Cells[6 * i];
+    for (int neighbour = 0; neighbour < 64; ++neighbour)
+      {
+      int neighbourCell[6];
+      for (int d = 0; d < 6; ++d)
+        {
+        neighbourCell[d] = cell[d] + (((neighbour >> d) & 1) ? sides[6 * i + d] : 0);
+        }
+      unsigned int bucket = this->GetBucket(neighbourCell);
+      for (int j = this->Buckets[bucket]; j >= 0; j = this->NextInBucket[j])
+        {
+        // Each pair once, bucket collisions skipped
+        if (j <= i || !std::equal(neighbourCell, neighbourCell + 6, &this->Cells[6 * j]))
+          {
+          continue;
+          }
+        int rootI = this->FindRoot(i);
+        int rootJ = this->FindRoot(j);
+        if (rootI != rootJ && this->AreDuplicates(i, j))
+          {
+          this->Parents[std::max(rootI, rootJ)] = std::min(rootI, rootJ);
+          }
+        }
+      }
+    }
+
+  // Clusters numbered by their first path. Roots are the smallest index
+  // of their cluster, so they come before their paths.
+  std::vector<int> sizes(numberOfPaths, 0);
+  for (int i = 0; i < numberOfPaths; ++i)
+    {
+    ++sizes[this->FindRoot(i)];
+    }
+  int numberOfClusters = 0;
+  for (int i = 0; i < numberOfPaths; ++i)
+    {
+    int root = this->FindRoot(i);
+    if (sizes[root] < 2)
+      {
+      continue;
+      }
+    if (root == i)
+      {
+      this->Clusters[i] = numberOfClusters++;
+      this->ClusterOffsets.push_back(this->ClusterOffsets.back() + sizes[i]);
+      }
+    else
+      {
+      this->Clusters[i] = this->Clusters[root];
+      }
+    }
+  std::vector<int> filled(this->ClusterOffsets.begin(), this->ClusterOffsets.end() - 1);
+  this->ClusterPaths.resize(this->ClusterOffsets.back());
+  for (int i = 0; i < numberOfPaths; ++i)
+    {
+    if (this->Clusters[i] >= 0)
+      {
+      this->ClusterPaths[filled[this->Clusters[i]]++] = i;
+      }
+    }
+
+  // Representative first
+  for (int cluster = 0; cluster < numberOfClusters; ++cluster)
+    {
+    int* paths = &this->ClusterPaths[this->ClusterOffsets[cluster]];
+    int size = this->GetClusterSize(cluster);
+    double mean[6] = { 0, 0, 0, 0, 0, 0 };
+    for (int i = 0; i < size; ++i)
+      {
+      for (int d = 0; d < 6; ++d)
+        {
+        mean[d] += this->EndPoints[6 * paths[i] + d] / size;
+        }
+      }
+    int closest = 0;
+    double closestDistance = VTK_DOUBLE_MAX;
+    for (int i = 0; i < size; ++i)
+      {
+      const double* points = &this->EndPoints[6 * paths[i]];
+      double distance = vtkMath::Distance2BetweenPoints(points, mean) +
+        vtkMath::Distance2BetweenPoints(points + 3, mean + 3);
+      if (distance < closestDistance)
+        {
+        closest = i;
+        closestDistance = distance;
+        }
+      }
+    std::swap(paths[0], paths[closest]);
+    }
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLinePathClustering::GetNumberOfClusters()
+{
+  return static_cast<int>(this->ClusterOffsets.size()) - 1;
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLinePathClustering::GetPathCluster(int index)
+{
+  return index >= 0 && index < this->GetNumberOfPaths() ?
+    this->Clusters[index] : -1;
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLinePathClustering::GetClusterSize(int cluster)
+{
+  return cluster >= 0 && cluster < this->GetNumberOfClusters() ?
+    this->ClusterOffsets[cluster + 1] - this->ClusterOffsets[cluster] : 0;
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLinePathClustering::GetClusterRepresentative(int cluster)
+{
+  return cluster >= 0 && cluster < this->GetNumberOfClusters() ?
+    this->ClusterPaths[this->ClusterOffsets[cluster]] : -1;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLinePathClustering
+::GetClusterPaths(int cluster, std::vector<int>& indices)
+{
+  indices.clear();
+  if (cluster >= 0 && cluster < this->GetNumberOfClusters())
+    {
+    indices.assign(this->ClusterPaths.begin() + this->ClusterOffsets[cluster],
+                   this->ClusterPaths.begin() + this->ClusterOffsets[cluster + 1]);
+    }
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLinePathClustering::GetNumberOfDuplicatePaths()
+{
+  return static_cast<int>(this->ClusterPaths.size()) - this->GetNumberOfClusters();
+}
@@ -0,0 +1,127 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Laurent Chauvin, Brigham and Women's
+  Hospital. The project was supported by grants 5P01CA067165,
+  5R01CA124377, 5R01CA138586, 2R44DE019322, 7R01CA124377,
+  5R42CA137886, 8P41EB015898
+
+==============================================================================*/
+
+// .NAME vtkSlicerVisuaLinePathClustering - near-duplicate paths
+// .SECTION Description
+// Finds the paths whose entries and targets are within tolerances of each
+// other and whose directions differ by less than an angle, and groups
+// them into clusters (a path is in the cluster of any of its duplicates).
+//
+// Paths are hashed by their entry and target, quantized into cells twice
+// as large as the tolerances: the duplicates of a path are in the cell of
+// the path or in the neighbour cell on the closer side, i.e. in 2^6 cells
+// of the hash. Clustering is then linear in the number of paths, unless
+// most of them are duplicates of each other.
+
+#ifndef __vtkSlicerVisuaLinePathClustering_h
+#define __vtkSlicerVisuaLinePathClustering_h
+
+// VTK includes
+#include <vtkObject.h>
+
+// STD includes
+#include <string>
+#include <vector>
+
+#include "vtkSlicerVisuaLineModuleLogicExport.h"
+
+/// \ingroup Slicer_QtModules_VisuaLine
+class VTK_SLICER_VISUALINE_MODULE_LOGIC_EXPORT vtkSlicerVisuaLinePathClustering :
+  public vtkObject
+{
+public:
+
+  static vtkSlicerVisuaLinePathClustering *New();
+  vtkTypeMacro(vtkSlicerVisuaLinePathClustering, vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  /// Largest distance (mm) between the entries and between the targets
+  /// of duplicate paths
+  vtkSetClampMacro(EntryTolerance, double, 1e-3, VTK_DOUBLE_MAX);
+  vtkGetMacro(EntryTolerance, double);
+  vtkSetClampMacro(TargetTolerance, double, 1e-3, VTK_DOUBLE_MAX);
+  vtkGetMacro(TargetTolerance, double);
+
+  /// Largest angle (degrees) between the directions of duplicate paths
+  vtkSetClampMacro(AngularTolerance, double, 0.0, 180.0);
+  vtkGetMacro(AngularTolerance, double);
+
+  void RemoveAllPaths();
+  /// Add a path (world entry and target). Return its index.
+  int AddPath(const char* pathNodeID, const double entry[3], const double target[3]);
+  int GetNumberOfPaths();
+  const char* GetPathNodeID(int index);
+
+  /// Find the duplicates and clusters of all paths
+  void Update();
+
+  /// Clusters of at least two paths found by the last update
+  int GetNumberOfClusters();
+  /// Cluster of a path, -1 if the path has no duplicate
+  int GetPathCluster(int index);
+  int GetClusterSize(int cluster);
+  /// Path closest to the mean entry and target of its cluster
+  int GetClusterRepresentative(int cluster);
+  //BTX
+  /// Paths of a cluster, its representative first
+  void GetClusterPaths(int cluster, std::vector<int>& indices);
+  //ETX
+  /// Paths that are in a cluster but not its representative
+  int GetNumberOfDuplicatePaths();
+
+protected:
+  vtkSlicerVisuaLinePathClustering();
+  virtual ~vtkSlicerVisuaLinePathClustering();
+
+  //BTX
+  bool AreDuplicates(int a, int b);
+  int FindRoot(int index);
+  unsigned int GetBucket(const int cell[6]);
+
+  double EntryTolerance;
+  double TargetTolerance;
+  double AngularTolerance;
+
+  // Per path, indexed alike
+  std::vector<std::string> PathNodeIDs;
+  std::vector<double> EndPoints;   // entry, target: 6 per path
+  std::vector<int> Clusters;
+
+  // Hash of the entry and target cells: first path of each bucket, then
+  // next path of the same bucket
+  std::vector<int> Cells;          // 6 per path
+  std::vector<int> Buckets;
+  std::vector<int> NextInBucket;
+  // Union-find of the duplicates
+  std::vector<int> Parents;
+
+  // Paths of each cluster, representative first
+  std::vector<int> ClusterOffsets; // NumberOfClusters + 1
+  std::vector<int> ClusterPaths;
+  //ETX
+
+private:
+  vtkSlicerVisuaLinePathClustering(const vtkSlicerVisuaLinePathClustering&); // Not implemented
+  void operator=(const vtkSlicerVisuaLinePathClustering&);                   // Not implemented
+};
+
+#endif
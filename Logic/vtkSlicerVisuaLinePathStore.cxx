@@ -0,0 +1,617 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Laurent Chauvin, Brigham and Women's
+  Hospital. The project was supported by grants 5P01CA067165,
+  5R01CA124377, 5R01CA138586, 2R44DE019322, 7R01CA124377,
+  5R42CA137886, 8P41EB015898
+
+==============================================================================*/
+
+// VisuaLine Logic includes
+#include "vtkSlicerVisuaLinePathStore.h"
+
+// VTK includes
+#include <vtkDoubleArray.h>
+#include <vtkMath.h>
+#include <vtkMatrix4x4.h>
+#include <vtkObjectFactory.h>
+#include <vtkStringArray.h>
+
+// STD includes
+#include <algorithm>
+
+namespace
+{
+//----------------------------------------------------------------------------
+void TransformPoint(const double m[16], const double in[3], double out[3])
+{
+  double x = in[0], y = in[1], z = in[2];
+  out[0] = m[0] * x + m[1] * y + m[2]  * z + m[3];
+  out[1] = m[4] * x + m[5] * y + m[6]  * z + m[7];
+  out[2] = m[8] * x + m[9] * y + m[10] * z + m[11];
+}
+}
+
+//----------------------------------------------------------------------------
+vtkStandardNewMacro(vtkSlicerVisuaLinePathStore);
+
+//----------------------------------------------------------------------------
+vtkSlicerVisuaLinePathStore::CompactRecord::CompactRecord()
+{
+  this->Color[0] = this->Color[1] = this->Color[2] = 1.0f;
+  this->Flags = VisibleFlag;
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerVisuaLinePathStore::vtkSlicerVisuaLinePathStore()
+{
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerVisuaLinePathStore::~vtkSlicerVisuaLinePathStore()
+{
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLinePathStore::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os, indent);
+  os << indent << "NumberOfPaths: " << this->GetNumberOfPaths() << "\n";
+  os << indent << "NumberOfTransformGroups: "
+     << this->TransformGroups.size() << "\n";
+  os << indent << "NumberOfCompactPaths: " << this->GetNumberOfCompactPaths() << "\n";
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLinePathStore::AddPath(const char* pathNodeID)
+{
+  if (!pathNodeID)
+    {
+    return -1;
+    }
+  std::map<std::string, int>::iterator it = this->IndexByNodeID.find(pathNodeID);
+  if (it != this->IndexByNodeID.end())
+    {
+    return it->second;
+    }
+
+  int index = this->GetNumberOfPaths();
+  this->NodeIDs.push_back(pathNodeID);
+  this->LocalPoints.resize(6 * (index + 1), 0.0);
+  this->WorldPoints.resize(6 * (index + 1), 0.0);
+  this->Groups.push_back(-1);
+  this->GroupSlots.push_back(-1);
+  this->CompactSlots.push_back(-1);
+  std::map<std::string, std::vector<double> >::iterator metric;
+  for (metric = this->Metrics.begin(); metric != this->Metrics.end(); ++metric)
+    {
+    metric->second.push_back(vtkMath::Nan());
+    }
+  this->IndexByNodeID[pathNodeID] = index;
+  this->Modified();
+  return index;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLinePathStore::RemovePath(const char* pathNodeID)
+{
+  int index = this->GetPathIndex(pathNodeID);
+  if (index < 0)
+    {
+    return;
+    }
+  // pathNodeID may point into NodeIDs
+  std::string removedID = pathNodeID;
+  this->RemoveFromGroup(index);
+  this->RemoveCompactRecord(index);
+
+  // Move the last path into the hole
+  int last = this->GetNumberOfPaths() - 1;
+  if (index != last)
+    {
+    this->NodeIDs[index] = this->NodeIDs[last];
+    std::copy(&this->LocalPoints[6 * last], &this->LocalPoints[6 * last] + 6,
+              &this->LocalPoints[6 * index]);
+    std::copy(&this->WorldPoints[6 * last], &this->WorldPoints[6 * last] + 6,
+              &this->WorldPoints[6 * index]);
+    this->Groups[index] = this->Groups[last];
+    this->GroupSlots[index] = this->GroupSlots[last];
+    this->CompactSlots[index] = this->CompactSlots[last];
+    std::map<std::string, std::vector<double> >::iterator metric;
+    for (metric = this->Metrics.begin(); metric != this->Metrics.end(); ++metric)
+      {
+      metric->second[index] = metric->second[last];
+      }
+    if (this->Groups[index] >= 0)
+      {
+      this->TransformGroups[this->Groups[index]].Members[this->GroupSlots[index]] = index;
+      }
+    this->IndexByNodeID[this->NodeIDs[index]] = index;
+    }
+
+  this->IndexByNodeID.erase(removedID);
+  this->NodeIDs.pop_back();
+  this->LocalPoints.resize(6 * last);
+  this->WorldPoints.resize(6 * last);
+  this->Groups.pop_back();
+  this->GroupSlots.pop_back();
+  this->CompactSlots.pop_back();
+  std::map<std::string, std::vector<double> >::iterator metric;
+  for (metric = this->Metrics.begin(); metric != this->Metrics.end(); ++metric)
+    {
+    metric->second.pop_back();
+    }
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLinePathStore::RemoveAllPaths()
+{
+  this->NodeIDs.clear();
+  this->LocalPoints.clear();
+  this->WorldPoints.clear();
+  this->Groups.clear();
+  this->GroupSlots.clear();
+  this->CompactSlots.clear();
+  this->CompactRecords.clear();
+  this->FreeCompactSlots.clear();
+  this->Metrics.clear();
+  this->IndexByNodeID.clear();
+  for (size_t i = 0; i < this->TransformGroups.size(); ++i)
+    {
+    this->TransformGroups[i].Members.clear();
+    }
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLinePathStore::GetNumberOfPaths()
+{
+  return static_cast<int>(this->NodeIDs.size());
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLinePathStore::GetPathIndex(const char* pathNodeID)
+{
+  if (!pathNodeID)
+    {
+    return -1;
+    }
+  std::map<std::string, int>::iterator it = this->IndexByNodeID.find(pathNodeID);
+  return it != this->IndexByNodeID.end() ? it->second : -1;
+}
+
+//----------------------------------------------------------------------------
+const char* vtkSlicerVisuaLinePathStore::GetPathNodeID(int index)
+{
+  if (index < 0 || index >= this->GetNumberOfPaths())
+    {
+    return 0;
+    }
+  return this->NodeIDs[index].c_str();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLinePathStore
+::SetLocalEndPoints(int index, const double p1[3], const double p2[3])
+{
+  if (index < 0 || index >= this->GetNumberOfPaths())
+    {
+    return;
+    }
+  double* local = &this->LocalPoints[6 * index];
+  std::copy(p1, p1 + 3, local);
+  std::copy(p2, p2 + 3, local + 3);
+  this->HardenPath(index);
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLinePathStore
+::GetLocalEndPoints(int index, double p1[3], double p2[3])
+{
+  if (index < 0 || index >= this->GetNumberOfPaths())
+    {
+    return;
+    }
+  const double* local = &this->LocalPoints[6 * index];
+  std::copy(local, local + 3, p1);
+  std::copy(local + 3, local + 6, p2);
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLinePathStore
+::GetWorldEndPoints(int index, double p1[3], double p2[3])
+{
+  if (index < 0 || index >= this->GetNumberOfPaths())
+    {
+    return;
+    }
+  const double* world = &this->WorldPoints[6 * index];
+  std::copy(world, world + 3, p1);
+  std::copy(world + 3, world + 6, p2);
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLinePathStore
+::SetPathTransformNodeID(int index, const char* transformNodeID)
+{
+  if (index < 0 || index >= this->GetNumberOfPaths())
+    {
+    return;
+    }
+  int group = (transformNodeID && *transformNodeID) ?
+    this->GetGroup(transformNodeID, true) : -1;
+  if (group == this->Groups[index])
+    {
+    return;
+    }
+  this->RemoveFromGroup(index);
+  if (group >= 0)
+    {
+    std::vector<int>& members = this->TransformGroups[group].Members;
+    this->GroupSlots[index] = static_cast<int>(members.size());
+    members.push_back(index);
+    }
+  this->Groups[index] = group;
+  this->HardenPath(index);
+}
+
+//----------------------------------------------------------------------------
+const char* vtkSlicerVisuaLinePathStore::GetPathTransformNodeID(int index)
+{
+  if (index < 0 || index >= this->GetNumberOfPaths() || this->Groups[index] < 0)
+    {
+    return 0;
+    }
+  return this->TransformGroups[this->Groups[index]].TransformNodeID.c_str();
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLinePathStore
+::GetNumberOfPathsWithTransform(const char* transformNodeID)
+{
+  return static_cast<int>(this->GetPathsWithTransform(transformNodeID).size());
+}
+
+//----------------------------------------------------------------------------
+const std::vector<int>& vtkSlicerVisuaLinePathStore
+::GetPathsWithTransform(const char* transformNodeID)
+{
+  int group = this->GetGroup(transformNodeID, false);
+  return group >= 0 ? this->TransformGroups[group].Members : this->EmptyMembers;
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLinePathStore
+::SetTransformToWorld(const char* transformNodeID, vtkMatrix4x4* localToWorld)
+{
+  int group = this->GetGroup(transformNodeID, true);
+  if (group < 0)
+    {
+    return 0;
+    }
+  TransformGroup& transformGroup = this->TransformGroups[group];
+  if (localToWorld)
+    {
+    std::copy(&localToWorld->Element[0][0], &localToWorld->Element[0][0] + 16,
+              transformGroup.LocalToWorld);
+    }
+  else
+    {
+    vtkMatrix4x4::Identity(transformGroup.LocalToWorld);
+    }
+  vtkMatrix4x4::Invert(transformGroup.LocalToWorld, transformGroup.WorldToLocal);
+
+  // One pass over the group, no per-node work
+  const double* m = transformGroup.LocalToWorld;
+  const std::vector<int>& members = transformGroup.Members;
+  const int numberOfMembers = static_cast<int>(members.size());
+  for (int i = 0; i < numberOfMembers; ++i)
+    {
+    const double* local = &this->LocalPoints[6 * members[i]];
+    double* world = &this->WorldPoints[6 * members[i]];
+    TransformPoint(m, local, world);
+    TransformPoint(m, local + 3, world + 3);
+    }
+  if (numberOfMembers > 0)
+    {
+    this->Modified();
+    }
+  return numberOfMembers;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLinePathStore
+::WorldToLocal(int index, const double world[3], double local[3])
+{
+  if (index < 0 || index >= this->GetNumberOfPaths() || this->Groups[index] < 0)
+    {
+    std::copy(world, world + 3, local);
+    return;
+    }
+  TransformPoint(this->TransformGroups[this->Groups[index]].WorldToLocal, world, local);
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLinePathStore
+::LocalToWorld(int index, const double local[3], double world[3])
+{
+  if (index < 0 || index >= this->GetNumberOfPaths() || this->Groups[index] < 0)
+    {
+    std::copy(local, local + 3, world);
+    return;
+    }
+  TransformPoint(this->TransformGroups[this->Groups[index]].LocalToWorld, local, world);
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLinePathStore::GetGroup(const char* transformNodeID, bool create)
+{
+  if (!transformNodeID || !*transformNodeID)
+    {
+    return -1;
+    }
+  std::map<std::string, int>::iterator it =
+    this->GroupByTransformNodeID.find(transformNodeID);
+  if (it != this->GroupByTransformNodeID.end())
+    {
+    return it->second;
+    }
+  if (!create)
+    {
+    return -1;
+    }
+
+  TransformGroup group;
+  group.TransformNodeID = transformNodeID;
+  vtkMatrix4x4::Identity(group.LocalToWorld);
+  vtkMatrix4x4::Identity(group.WorldToLocal);
+  this->TransformGroups.push_back(group);
+  int index = static_cast<int>(this->TransformGroups.size()) - 1;
+  this->GroupByTransformNodeID[transformNodeID] = index;
+  return index;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLinePathStore::RemoveFromGroup(int index)
+{
+  int group = this->Groups[index];
+  if (group < 0)
+    {
+    return;
+    }
+  std::vector<int>& members = this->TransformGroups[group].Members;
+  int slot = this->GroupSlots[index];
+  int moved = members.back();
+  members[slot] = moved;
+  this->GroupSlots[moved] = slot;
+  members.pop_back();
+  this->Groups[index] = -1;
+  this->GroupSlots[index] = -1;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLinePathStore::HardenPath(int index)
+{
+  const double* local = &this->LocalPoints[6 * index];
+  double* world = &this->WorldPoints[6 * index];
+  int group = this->Groups[index];
+  if (group < 0)
+    {
+    std::copy(local, local + 6, world);
+    }
+  else
+    {
+    const double* m = this->TransformGroups[group].LocalToWorld;
+    TransformPoint(m, local, world);
+    TransformPoint(m, local + 3, world + 3);
+    }
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLinePathStore
+::SetPathMetric(int index, const char* name, double value)
+{
+  if (!name || index < 0 || index >= this->GetNumberOfPaths())
+    {
+    return;
+    }
+  std::vector<double>& metric = this->Metrics[name];
+  metric.resize(this->NodeIDs.size(), vtkMath::Nan());
+  metric[index] = value;
+}
+
+//----------------------------------------------------------------------------
+double vtkSlicerVisuaLinePathStore::GetPathMetric(int index, const char* name)
+{
+  const std::vector<double>* metric = this->GetMetric(name);
+  if (!metric || index < 0 || index >= static_cast<int>(metric->size()))
+    {
+    return vtkMath::Nan();
+    }
+  return (*metric)[index];
+}
+
+//----------------------------------------------------------------------------
+const std::vector<double>* vtkSlicerVisuaLinePathStore::GetMetric(const char* name)
+{
+  if (!name)
+    {
+    return 0;
+    }
+  std::map<std::string, std::vector<double> >::iterator it = this->Metrics.find(name);
+  return it != this->Metrics.end() ? &it->second : 0;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLinePathStore::GetMetricNames(std::vector<std::string>& names)
+{
+  names.clear();
+  std::map<std::string, std::vector<double> >::iterator it;
+  for (it = this->Metrics.begin(); it != this->Metrics.end(); ++it)
+    {
+    names.push_back(it->first);
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLinePathStore::GetPathNodeIDs(vtkStringArray* pathNodeIDs)
+{
+  if (!pathNodeIDs)
+    {
+    return;
+    }
+  pathNodeIDs->SetNumberOfValues(this->GetNumberOfPaths());
+  for (int i = 0; i < this->GetNumberOfPaths(); ++i)
+    {
+    pathNodeIDs->SetValue(i, this->NodeIDs[i]);
+    }
+}
+
+//----------------------------------------------------------------------------
+namespace
+{
+void CopyToArray(vtkDoubleArray* array, const std::vector<double>& values,
+                 int numberOfComponents)
+{
+  if (!array)
+    {
+    return;
+    }
+  array->Initialize();
+  array->SetNumberOfComponents(numberOfComponents);
+  array->SetNumberOfTuples(static_cast<vtkIdType>(values.size()) / numberOfComponents);
+  if (!values.empty())
+    {
+    std::copy(values.begin(), values.end(), array->GetPointer(0));
+    }
+}
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLinePathStore::GetLocalEndPointsArray(vtkDoubleArray* endPoints)
+{
+  CopyToArray(endPoints, this->LocalPoints, 6);
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLinePathStore::GetWorldEndPointsArray(vtkDoubleArray* endPoints)
+{
+  CopyToArray(endPoints, this->WorldPoints, 6);
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerVisuaLinePathStore
+::GetMetricArray(const char* name, vtkDoubleArray* values)
+{
+  std::map<std::string, std::vector<double> >::iterator it =
+    name ? this->Metrics.find(name) : this->Metrics.end();
+  if (it == this->Metrics.end())
+    {
+    CopyToArray(values, std::vector<double>(), 1);
+    return false;
+    }
+  CopyToArray(values, it->second, 1);
+  return true;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLinePathStore
+::SetCompactRecord(int index, const CompactRecord& record)
+{
+  if (index < 0 || index >= this->GetNumberOfPaths())
+    {
+    return;
+    }
+  int& slot = this->CompactSlots[index];
+  if (slot < 0)
+    {
+    if (this->FreeCompactSlots.empty())
+      {
+      slot = static_cast<int>(this->CompactRecords.size());
+      this->CompactRecords.push_back(record);
+      return;
+      }
+    slot = this->FreeCompactSlots.back();
+    this->FreeCompactSlots.pop_back();
+    }
+  this->CompactRecords[slot] = record;
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerVisuaLinePathStore::CompactRecord*
+vtkSlicerVisuaLinePathStore::GetCompactRecord(int index)
+{
+  if (index < 0 || index >= this->GetNumberOfPaths() ||
+      this->CompactSlots[index] < 0)
+    {
+    return 0;
+    }
+  return &this->CompactRecords[this->CompactSlots[index]];
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLinePathStore::RemoveCompactRecord(int index)
+{
+  if (index < 0 || index >= this->GetNumberOfPaths() ||
+      this->CompactSlots[index] < 0)
+    {
+    return;
+    }
+  int slot = this->CompactSlots[index];
+  // Free the name, the slot itself is reused
+  this->CompactRecords[slot] = CompactRecord();
+  this->FreeCompactSlots.push_back(slot);
+  this->CompactSlots[index] = -1;
+  if (this->FreeCompactSlots.size() == this->CompactRecords.size())
+    {
+    this->CompactRecords.clear();
+    this->FreeCompactSlots.clear();
+    }
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerVisuaLinePathStore::IsPathCompact(int index)
+{
+  return index >= 0 && index < this->GetNumberOfPaths() &&
+    this->CompactSlots[index] >= 0;
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLinePathStore::GetNumberOfCompactPaths()
+{
+  return static_cast<int>(this->CompactRecords.size() - this->FreeCompactSlots.size());
+}
+
+//----------------------------------------------------------------------------
+vtkIdType vtkSlicerVisuaLinePathStore::GetPathMemorySize(int index)
+{
+  if (index < 0 || index >= this->GetNumberOfPaths())
+    {
+    return 0;
+    }
+  // Arrays, node ID (twice with the lookup map) and metrics
+  vtkIdType size = 12 * sizeof(double) + 3 * sizeof(int) +
+    2 * static_cast<vtkIdType>(sizeof(std::string) + this->NodeIDs[index].capacity()) +
+    static_cast<vtkIdType>(this->Metrics.size() * sizeof(double));
+  const CompactRecord* record = this->GetCompactRecord(index);
+  if (record)
+    {
+    size += sizeof(CompactRecord) + record->Name.capacity();
+    }
+  return size;
+}
@@ -0,0 +1,191 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Laurent Chauvin, Brigham and Women's
+  Hospital. The project was supported by grants 5P01CA067165,
+  5R01CA124377, 5R01CA138586, 2R44DE019322, 7R01CA124377,
+  5R42CA137886, 8P41EB015898
+
+==============================================================================*/
+
+// .NAME vtkSlicerVisuaLinePathStore - contiguous storage of path geometry
+// .SECTION Description
+// Keeps the end points of every managed path in flat arrays, both in the
+// ruler (local) coordinates and hardened to world coordinates. Paths are
+// grouped by parent transform node so a transform change re-hardens all
+// of its paths in one pass over the arrays. Indices are dense: they only
+// change when a path is removed, the last path then takes its index.
+// Adding a path appends it; setting end points, transforms, metrics or
+// compact records never moves a path. Node IDs are stable.
+//
+// Compact paths have no MRML node: the store keeps a small record of what
+// is needed to create their nodes again, next to their geometry.
+
+#ifndef __vtkSlicerVisuaLinePathStore_h
+#define __vtkSlicerVisuaLinePathStore_h
+
+// VTK includes
+#include <vtkObject.h>
+
+// STD includes
+#include <map>
+#include <string>
+#include <vector>
+
+#include "vtkSlicerVisuaLineModuleLogicExport.h"
+
+class vtkDoubleArray;
+class vtkMatrix4x4;
+class vtkStringArray;
+
+/// \ingroup Slicer_QtModules_VisuaLine
+class VTK_SLICER_VISUALINE_MODULE_LOGIC_EXPORT vtkSlicerVisuaLinePathStore :
+  public vtkObject
+{
+public:
+
+  static vtkSlicerVisuaLinePathStore *New();
+  vtkTypeMacro(vtkSlicerVisuaLinePathStore, vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  /// Add a path (ruler node ID). Return its index, or the existing index
+  /// if it is already stored.
+  int AddPath(const char* pathNodeID);
+
+  /// Remove a path. The last path takes its index.
+  void RemovePath(const char* pathNodeID);
+  void RemoveAllPaths();
+
+  int GetNumberOfPaths();
+  int GetPathIndex(const char* pathNodeID);
+  const char* GetPathNodeID(int index);
+
+  /// End points in ruler coordinates. World end points are updated with
+  /// the current transform of the path.
+  void SetLocalEndPoints(int index, const double p1[3], const double p2[3]);
+  void GetLocalEndPoints(int index, double p1[3], double p2[3]);
+  void GetWorldEndPoints(int index, double p1[3], double p2[3]);
+
+  /// Parent transform of a path (NULL or empty for world coordinates)
+  void SetPathTransformNodeID(int index, const char* transformNodeID);
+  const char* GetPathTransformNodeID(int index);
+
+  /// Number of paths under a transform node
+  int GetNumberOfPathsWithTransform(const char* transformNodeID);
+
+  /// Set the local to world matrix of a transform node and re-harden all
+  /// its paths in one batch. Return the number of updated paths.
+  int SetTransformToWorld(const char* transformNodeID, vtkMatrix4x4* localToWorld);
+
+  /// Named per path value (length, clearance...), NaN when not set
+  void SetPathMetric(int index, const char* name, double value);
+  double GetPathMetric(int index, const char* name);
+
+  /// Convert a point between world and path local coordinates
+  void WorldToLocal(int index, const double world[3], double local[3]);
+  void LocalToWorld(int index, const double local[3], double world[3]);
+
+  /// Node IDs of all paths, by index
+  void GetPathNodeIDs(vtkStringArray* pathNodeIDs);
+
+  enum
+    {
+    VisibleFlag = 1,
+    LockedFlag = 2,
+    TargetVisibleFlag = 4
+    };
+
+  //BTX
+  /// State of a compact path besides its geometry, transform and metrics
+  struct CompactRecord
+    {
+    CompactRecord();
+    std::string Name;
+    float Color[3];
+    unsigned int Flags;
+    };
+
+  /// Make a path compact, or update its record
+  void SetCompactRecord(int index, const CompactRecord& record);
+  /// Record of a compact path, NULL otherwise. Valid until a record is
+  /// added or removed.
+  CompactRecord* GetCompactRecord(int index);
+  //ETX
+  void RemoveCompactRecord(int index);
+  bool IsPathCompact(int index);
+  int GetNumberOfCompactPaths();
+
+  /// Estimated memory (bytes) used by a path in the store
+  vtkIdType GetPathMemorySize(int index);
+
+  /// Copies of the stored arrays: end points have 6 components per path
+  /// (entry then target), metrics 1. Editing them leaves the store as is.
+  void GetLocalEndPointsArray(vtkDoubleArray* endPoints);
+  void GetWorldEndPointsArray(vtkDoubleArray* endPoints);
+  /// Return false (empty array) if the metric was never set
+  bool GetMetricArray(const char* name, vtkDoubleArray* values);
+
+  //BTX
+  /// Indices of the paths under a transform node
+  const std::vector<int>& GetPathsWithTransform(const char* transformNodeID);
+
+  /// Values of a metric indexed like the paths, NULL if never set
+  const std::vector<double>* GetMetric(const char* name);
+  /// Names of the metrics set so far, sorted
+  void GetMetricNames(std::vector<std::string>& names);
+  //ETX
+
+protected:
+  vtkSlicerVisuaLinePathStore();
+  virtual ~vtkSlicerVisuaLinePathStore();
+
+  //BTX
+  struct TransformGroup
+    {
+    std::string TransformNodeID;
+    double LocalToWorld[16];
+    double WorldToLocal[16];
+    std::vector<int> Members;
+    };
+
+  int GetGroup(const char* transformNodeID, bool create);
+  void RemoveFromGroup(int index);
+  void HardenPath(int index);
+
+  // Per path, indexed alike
+  std::vector<std::string> NodeIDs;
+  std::vector<double> LocalPoints;  // p1, p2: 6 per path
+  std::vector<double> WorldPoints;  // p1, p2: 6 per path
+  std::vector<int> Groups;          // transform group, -1 for world
+  std::vector<int> GroupSlots;      // position in the group member list
+  std::map<std::string, std::vector<double> > Metrics;
+  std::vector<int> CompactSlots;    // compact record, -1 if none
+
+  // Records of the compact paths, a slot is reused once freed
+  std::vector<CompactRecord> CompactRecords;
+  std::vector<int> FreeCompactSlots;
+
+  std::map<std::string, int> IndexByNodeID;
+  std::vector<TransformGroup> TransformGroups;
+  std::map<std::string, int> GroupByTransformNodeID;
+  std::vector<int> EmptyMembers;
+  //ETX
+
+private:
+  vtkSlicerVisuaLinePathStore(const vtkSlicerVisuaLinePathStore&); // Not implemented
+  void operator=(const vtkSlicerVisuaLinePathStore&);              // Not implemented
+};
+
+#endif
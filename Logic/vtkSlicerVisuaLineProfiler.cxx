@@ -0,0 +1,302 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Laurent Chauvin, Brigham and Women's
+  Hospital. The project was supported by grants 5P01CA067165,
+  5R01CA124377, 5R01CA138586, 2R44DE019322, 7R01CA124377,
+  5R42CA137886, 8P41EB015898
+
+==============================================================================*/
+
+// VisuaLine Logic includes
+#include "vtkSlicerVisuaLineProfiler.h"
+
+// VTK includes
+#include <vtkObjectFactory.h>
+
+// STD includes
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#if defined(_MSC_VER)
+# define VISUALINE_THREAD_LOCAL __declspec(thread)
+#else
+# define VISUALINE_THREAD_LOCAL __thread
+#endif
+
+namespace
+{
+struct SectionRegistry
+{
+  SectionRegistry() : NextSerial(1) {}
+  std::vector<const char*> Names;
+  unsigned long NextSerial;
+  vtkSimpleCriticalSection Lock;
+};
+
+SectionRegistry& GetSectionRegistry()
+{
+  static SectionRegistry registry;
+  return registry;
+}
+
+// Buffer of the last profiler used by the thread
+VISUALINE_THREAD_LOCAL unsigned long CachedSerial = 0;
+VISUALINE_THREAD_LOCAL void* CachedBuffer = 0;
+}
+
+//----------------------------------------------------------------------------
+vtkStandardNewMacro(vtkSlicerVisuaLineProfiler);
+
+//----------------------------------------------------------------------------
+vtkSlicerVisuaLineProfiler::vtkSlicerVisuaLineProfiler()
+{
+  this->Enabled = false;
+  SectionRegistry& registry = GetSectionRegistry();
+  registry.Lock.Lock();
+  this->Serial = registry.NextSerial++;
+  registry.Lock.Unlock();
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerVisuaLineProfiler::~vtkSlicerVisuaLineProfiler()
+{
+  for (size_t i = 0; i < this->ThreadBuffers.size(); ++i)
+    {
+    delete this->ThreadBuffers[i];
+    }
+  for (size_t i = 0; i < this->RetiredBuffers.size(); ++i)
+    {
+    delete this->RetiredBuffers[i];
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineProfiler::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os, indent);
+  os << indent << "Enabled: " << this->Enabled << "\n";
+  os << indent << "NumberOfThreadBuffers: " << this->ThreadBuffers.size() << "\n";
+  os << indent << "NumberOfRetiredBuffers: " << this->RetiredBuffers.size() << "\n";
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLineProfiler::RegisterSection(const char* name)
+{
+  SectionRegistry& registry = GetSectionRegistry();
+  registry.Lock.Lock();
+  int section = 0;
+  int numberOfSections = static_cast<int>(registry.Names.size());
+  while (section < numberOfSections && strcmp(registry.Names[section], name) != 0)
+    {
+    ++section;
+    }
+  if (section == numberOfSections)
+    {
+    registry.Names.push_back(name);
+    }
+  registry.Lock.Unlock();
+  return section;
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLineProfiler::GetNumberOfSections()
+{
+  SectionRegistry& registry = GetSectionRegistry();
+  registry.Lock.Lock();
+  int numberOfSections = static_cast<int>(registry.Names.size());
+  registry.Lock.Unlock();
+  return numberOfSections;
+}
+
+//----------------------------------------------------------------------------
+const char* vtkSlicerVisuaLineProfiler::GetSectionName(int section)
+{
+  SectionRegistry& registry = GetSectionRegistry();
+  registry.Lock.Lock();
+  const char* name = section >= 0 && section < static_cast<int>(registry.Names.size()) ?
+    registry.Names[section] : 0;
+  registry.Lock.Unlock();
+  return name;
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerVisuaLineProfiler::Statistics&
+vtkSlicerVisuaLineProfiler::GetStatistics(int section)
+{
+  ThreadBuffer* buffer = 0;
+  if (CachedSerial == this->Serial)
+    {
+    buffer = static_cast<ThreadBuffer*>(CachedBuffer);
+    }
+  else
+    {
+    // First call of the thread, another profiler was used meanwhile or
+    // this one was reset
+    vtkMultiThreaderIDType threadID = vtkMultiThreader::GetCurrentThreadID();
+    this->Lock.Lock();
+    for (size_t i = 0; i < this->ThreadIDs.size() && !buffer; ++i)
+      {
+      if (vtkMultiThreader::ThreadsEqual(this->ThreadIDs[i], threadID))
+        {
+        buffer = this->ThreadBuffers[i];
+        }
+      }
+    if (!buffer)
+      {
+      buffer = new ThreadBuffer;
+      this->ThreadBuffers.push_back(buffer);
+      this->ThreadIDs.push_back(threadID);
+      }
+    this->Lock.Unlock();
+    CachedSerial = this->Serial;
+    CachedBuffer = buffer;
+    }
+
+  if (section >= static_cast<int>(buffer->size()))
+    {
+    // Statistics may be merging meanwhile
+    this->Lock.Lock();
+    buffer->resize(GetNumberOfSections());
+    this->Lock.Unlock();
+    }
+  return (*buffer)[section];
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineProfiler::AddCall(int section, double seconds)
+{
+  if (section < 0)
+    {
+    return;
+    }
+  Statistics& statistics = this->GetStatistics(section);
+  ++statistics.Count;
+  statistics.TotalTime += seconds;
+  if (seconds > statistics.MaximumTime)
+    {
+    statistics.MaximumTime = seconds;
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineProfiler::AddEvent(int section)
+{
+  if (section >= 0)
+    {
+    ++this->GetStatistics(section).Count;
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineProfiler::Reset()
+{
+  // Threads hold their buffer and write it without lock: it is retired
+  // instead of cleared. A new serial misses the thread caches, so each
+  // thread gets a fresh buffer on its next call.
+  SectionRegistry& registry = GetSectionRegistry();
+  registry.Lock.Lock();
+  unsigned long serial = registry.NextSerial++;
+  registry.Lock.Unlock();
+
+  this->Lock.Lock();
+  this->RetiredBuffers.insert(this->RetiredBuffers.end(),
+                              this->ThreadBuffers.begin(), this->ThreadBuffers.end());
+  this->ThreadBuffers.clear();
+  this->ThreadIDs.clear();
+  this->Serial = serial;
+  this->Lock.Unlock();
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerVisuaLineProfiler::Statistics vtkSlicerVisuaLineProfiler::Merge(int section)
+{
+  // Only buffers since the last reset. Their threads keep recording: a
+  // value may miss its latest calls.
+  Statistics merged;
+  this->Lock.Lock();
+  for (size_t i = 0; i < this->ThreadBuffers.size(); ++i)
+    {
+    const ThreadBuffer& buffer = *this->ThreadBuffers[i];
+    if (section >= 0 && section < static_cast<int>(buffer.size()))
+      {
+      merged.Count += buffer[section].Count;
+      merged.TotalTime += buffer[section].TotalTime;
+      merged.MaximumTime = std::max(merged.MaximumTime, buffer[section].MaximumTime);
+      }
+    }
+  this->Lock.Unlock();
+  return merged;
+}
+
+//----------------------------------------------------------------------------
+vtkIdType vtkSlicerVisuaLineProfiler::GetCallCount(int section)
+{
+  return this->Merge(section).Count;
+}
+
+//----------------------------------------------------------------------------
+double vtkSlicerVisuaLineProfiler::GetTotalTime(int section)
+{
+  return this->Merge(section).TotalTime;
+}
+
+//----------------------------------------------------------------------------
+double vtkSlicerVisuaLineProfiler::GetMaximumTime(int section)
+{
+  return this->Merge(section).MaximumTime;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineProfiler::WriteJSON(ostream& os)
+{
+  this->Lock.Lock();
+  size_t numberOfThreads = this->ThreadBuffers.size();
+  this->Lock.Unlock();
+
+  os << "{\n  \"enabled\": " << (this->Enabled ? "true" : "false")
+     << ",\n  \"threads\": " << numberOfThreads
+     << ",\n  \"sections\": [";
+  bool first = true;
+  for (int i = 0; i < GetNumberOfSections(); ++i)
+    {
+    Statistics statistics = this->Merge(i);
+    if (statistics.Count == 0)
+      {
+      continue;
+      }
+    os << (first ? "\n" : ",\n")
+       << "    {\"name\": \"" << GetSectionName(i) << "\""
+       << ", \"count\": " << statistics.Count
+       << ", \"totalTime\": " << statistics.TotalTime
+       << ", \"maximumTime\": " << statistics.MaximumTime << "}";
+    first = false;
+    }
+  os << "\n  ]\n}\n";
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerVisuaLineProfiler::WriteJSON(const char* fileName)
+{
+  std::ofstream file(fileName ? fileName : "");
+  if (!file)
+    {
+    vtkErrorMacro("WriteJSON: cannot write " << (fileName ? fileName : "(null)"));
+    return false;
+    }
+  this->WriteJSON(file);
+  return !file.fail();
+}
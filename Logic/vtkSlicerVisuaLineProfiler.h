@@ -0,0 +1,163 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Laurent Chauvin, Brigham and Women's
+  Hospital. The project was supported by grants 5P01CA067165,
+  5R01CA124377, 5R01CA138586, 2R44DE019322, 7R01CA124377,
+  5R42CA137886, 8P41EB015898
+
+==============================================================================*/
+
+// .NAME vtkSlicerVisuaLineProfiler - call counts and timings of hot paths
+// .SECTION Description
+// Sections are named once per call site and get a process wide ID.
+// Each thread records its calls in its own buffer, found through a
+// thread local pointer, so recording takes no lock. Statistics merge
+// the buffers on request, while their threads keep recording: a merged
+// value may miss the latest calls. Reset swaps in fresh buffers, so no
+// buffer is ever written by two threads, and calls recorded by a thread
+// that has not seen the reset yet go to its former buffer, which is no
+// longer read. Recording is off by default and a disabled profiler only
+// costs the test of its flag.
+//
+// Use vtkSlicerVisuaLineProfileMacro(profiler, "Name") to time the
+// enclosing scope and vtkSlicerVisuaLineCountMacro(profiler, "Name") to
+// count an event.
+
+#ifndef __vtkSlicerVisuaLineProfiler_h
+#define __vtkSlicerVisuaLineProfiler_h
+
+// VTK includes
+#include <vtkCriticalSection.h>
+#include <vtkMultiThreader.h>
+#include <vtkObject.h>
+#include <vtkTimerLog.h>
+
+// STD includes
+#include <vector>
+
+#include "vtkSlicerVisuaLineModuleLogicExport.h"
+
+/// \ingroup Slicer_QtModules_VisuaLine
+class VTK_SLICER_VISUALINE_MODULE_LOGIC_EXPORT vtkSlicerVisuaLineProfiler :
+  public vtkObject
+{
+public:
+
+  static vtkSlicerVisuaLineProfiler *New();
+  vtkTypeMacro(vtkSlicerVisuaLineProfiler, vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  vtkSetMacro(Enabled, bool);
+  vtkGetMacro(Enabled, bool);
+  vtkBooleanMacro(Enabled, bool);
+
+  /// ID of a section name, registered on first call. Names are kept by
+  /// pointer: use string literals.
+  static int RegisterSection(const char* name);
+  static int GetNumberOfSections();
+  static const char* GetSectionName(int section);
+
+  /// Record a call of a section taking 'seconds', or an event (no time)
+  void AddCall(int section, double seconds);
+  void AddEvent(int section);
+
+  /// Forget all the calls recorded so far. The former buffers are kept
+  /// until the profiler is deleted, threads may still hold them.
+  void Reset();
+
+  /// Merged over all threads since the last reset
+  vtkIdType GetCallCount(int section);
+  double GetTotalTime(int section);
+  double GetMaximumTime(int section);
+
+  /// Statistics of the called sections as a JSON object
+  void WriteJSON(ostream& os);
+  bool WriteJSON(const char* fileName);
+
+protected:
+  vtkSlicerVisuaLineProfiler();
+  virtual ~vtkSlicerVisuaLineProfiler();
+
+  //BTX
+  struct Statistics
+    {
+    Statistics() : Count(0), TotalTime(0.0), MaximumTime(0.0) {}
+    vtkIdType Count;
+    double TotalTime;
+    double MaximumTime;
+    };
+  typedef std::vector<Statistics> ThreadBuffer;
+
+  Statistics& GetStatistics(int section);
+  Statistics Merge(int section);
+
+  bool Enabled;
+  // Told apart from a deleted profiler at the same address
+  unsigned long Serial;
+  std::vector<ThreadBuffer*> ThreadBuffers;
+  std::vector<vtkMultiThreaderIDType> ThreadIDs;
+  std::vector<ThreadBuffer*> RetiredBuffers;
+  vtkSimpleCriticalSection Lock;
+  //ETX
+
+private:
+  vtkSlicerVisuaLineProfiler(const vtkSlicerVisuaLineProfiler&); // Not implemented
+  void operator=(const vtkSlicerVisuaLineProfiler&);             // Not implemented
+};
+
+//BTX
+/// Time the enclosing scope in a section of a profiler (may be NULL)
+class vtkSlicerVisuaLineProfileScope
+{
+public:
+  vtkSlicerVisuaLineProfileScope(vtkSlicerVisuaLineProfiler* profiler, int section)
+    : Profiler(profiler && profiler->GetEnabled() ? profiler : 0), Section(section),
+      Start(this->Profiler ? vtkTimerLog::GetUniversalTime() : 0.0) {}
+  ~vtkSlicerVisuaLineProfileScope()
+    {
+    if (this->Profiler)
+      {
+      this->Profiler->AddCall(this->Section, vtkTimerLog::GetUniversalTime() - this->Start);
+      }
+    }
+
+private:
+  vtkSlicerVisuaLineProfiler* Profiler;
+  int Section;
+  double Start;
+};
+
+#define vtkSlicerVisuaLineProfileMacro(profiler, name) \
+  static const int vtkSlicerVisuaLineProfileSection = \
+    vtkSlicerVisuaLineProfiler::RegisterSection(name); \
+  vtkSlicerVisuaLineProfileScope vtkSlicerVisuaLineProfileScopeInstance( \
+    profiler, vtkSlicerVisuaLineProfileSection)
+
+#define vtkSlicerVisuaLineCountMacro(profiler, name) \
+  do \
+    { \
+    vtkSlicerVisuaLineProfiler* vtkSlicerVisuaLineCountProfiler = (profiler); \
+    if (vtkSlicerVisuaLineCountProfiler && vtkSlicerVisuaLineCountProfiler->GetEnabled()) \
+      { \
+      static const int vtkSlicerVisuaLineCountSection = \
+        vtkSlicerVisuaLineProfiler::RegisterSection(name); \
+      vtkSlicerVisuaLineCountProfiler->AddEvent(vtkSlicerVisuaLineCountSection); \
+      } \
+    } \
+  while (0)
+//ETX
+
+#endif
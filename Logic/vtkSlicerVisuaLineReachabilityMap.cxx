@@ -0,0 +1,546 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Laurent Chauvin, Brigham and Women's
+  Hospital. The project was supported by grants 5P01CA067165,
+  5R01CA124377, 5R01CA138586, 2R44DE019322, 7R01CA124377,
+  5R42CA137886, 8P41EB015898
+
+==============================================================================*/
+
+// VisuaLine Logic includes
+#include "vtkSlicerVisuaLineAnalysisCache.h"
+#include "vtkSlicerVisuaLineReachabilityMap.h"
+#include "vtkSlicerVisuaLineTemplateGrid.h"
+
+// VTK includes
+#include <vtkMath.h>
+#include <vtkNew.h>
+#include <vtkObjectFactory.h>
+
+// STD includes
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+const unsigned short NoGuide = 0xffff;
+
+//----------------------------------------------------------------------------
+// Bin of a direction on a cube map of n x n bins per face
+int GetDirectionBin(const double direction[3], int n)
+{
+  int axis = 0;
+  if (fabs(direction[1]) > fabs(direction[axis]))
+    {
+    axis = 1;
+    }
+  if (fabs(direction[2]) > fabs(direction[axis]))
+    {
+    axis = 2;
+    }
+  double major = fabs(direction[axis]);
+  if (major <= 0.0)
+    {
+    return -1;
+    }
+  int face = 2 * axis + (direction[axis] < 0.0 ? 1 : 0);
+  double u = direction[(axis + 1) % 3] / major;
+  double v = direction[(axis + 2) % 3] / major;
+  int iu = std::max(0, std::min(n - 1, static_cast<int>((u + 1.0) * 0.5 * n)));
+  int iv = std::max(0, std::min(n - 1, static_cast<int>((v + 1.0) * 0.5 * n)));
+  return (face * n + iv) * n + iu;
+}
+
+//----------------------------------------------------------------------------
+// Unit direction of the center of a bin
+void GetBinDirection(int bin, int n, double direction[3])
+{
+  int iu = bin % n;
+  int iv = (bin / n) % n;
+  int face = bin / (n * n);
+  int axis = face / 2;
+  direction[axis] = face % 2 ? -1.0 : 1.0;
+  direction[(axis + 1) % 3] = (iu + 0.5) * 2.0 / n - 1.0;
+  direction[(axis + 2) % 3] = (iv + 0.5) * 2.0 / n - 1.0;
+  vtkMath::Normalize(direction);
+}
+}
+
+//----------------------------------------------------------------------------
+vtkStandardNewMacro(vtkSlicerVisuaLineReachabilityMap);
+
+//----------------------------------------------------------------------------
+vtkSlicerVisuaLineReachabilityMap::vtkSlicerVisuaLineReachabilityMap()
+{
+  this->Spacing = 2.0;
+  this->DirectionResolution = 8;
+  this->MaximumSize = 128 * 1024 * 1024;
+  this->NumberOfThreads = 0;
+  this->CellValues = 0;
+  this->Origin[0] = this->Origin[1] = this->Origin[2] = 0.0;
+  this->VoxelSize = this->Spacing;
+  this->Dimensions[0] = this->Dimensions[1] = this->Dimensions[2] = 0;
+  this->NumberOfBins = 0;
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerVisuaLineReachabilityMap::~vtkSlicerVisuaLineReachabilityMap()
+{
+  this->ReleaseCells();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineReachabilityMap::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os, indent);
+  os << indent << "NumberOfGuides: " << this->Guides.size() << "\n";
+  os << indent << "Spacing: " << this->Spacing << "\n";
+  os << indent << "DirectionResolution: " << this->DirectionResolution << "\n";
+  os << indent << "MaximumSize: " << this->MaximumSize << "\n";
+  os << indent << "NumberOfThreads: " << this->NumberOfThreads << "\n";
+  os << indent << "VoxelSize: " << this->VoxelSize << "\n";
+  os << indent << "Dimensions: " << this->Dimensions[0] << " "
+     << this->Dimensions[1] << " " << this->Dimensions[2] << "\n";
+  os << indent << "Key: " << this->Key << "\n";
+  os << indent << "Cached: " << !this->MappedKey.empty() << "\n";
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLineReachabilityMap
+::AddGuide(const double point[3], const double axis[3], double maximumAngle,
+           double minimumDepth, double maximumDepth)
+{
+  if (this->Guides.size() >= NoGuide)
+    {
+    vtkErrorMacro("AddGuide: too many guides");
+    return -1;
+    }
+  Guide guide;
+  std::copy(point, point + 3, guide.Point);
+  std::copy(axis, axis + 3, guide.Axis);
+  if (vtkMath::Normalize(guide.Axis) <= 0.0)
+    {
+    vtkErrorMacro("AddGuide: null axis");
+    return -1;
+    }
+  maximumAngle = std::max(0.0, std::min(maximumAngle, 180.0));
+  guide.MaximumAngle = vtkMath::RadiansFromDegrees(maximumAngle);
+  guide.CosMaximumAngle = cos(guide.MaximumAngle);
+  guide.MinimumDepth = std::max(0.0, minimumDepth);
+  guide.MaximumDepth = std::max(guide.MinimumDepth, maximumDepth);
+  this->Guides.push_back(guide);
+  this->Modified();
+  return static_cast<int>(this->Guides.size()) - 1;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineReachabilityMap
+::AddTemplateGrid(vtkSlicerVisuaLineTemplateGrid* grid,
+                  double maximumAngle, double maximumDepth)
+{
+  for (int hole = 0; grid && hole < grid->GetNumberOfHoles(); ++hole)
+    {
+    double entry[3], target[3], axis[3];
+    grid->GetHoleTrajectory(hole, entry, target);
+    vtkMath::Subtract(target, entry, axis);
+    this->AddGuide(entry, axis, maximumAngle, 0.0, maximumDepth);
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineReachabilityMap::RemoveAllGuides()
+{
+  if (this->Guides.empty())
+    {
+    return;
+    }
+  this->Guides.clear();
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLineReachabilityMap::GetNumberOfGuides()
+{
+  return static_cast<int>(this->Guides.size());
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineReachabilityMap::SetCache(vtkSlicerVisuaLineAnalysisCache* cache)
+{
+  if (this->Cache == cache)
+    {
+    return;
+    }
+  // A mapping belongs to its cache: build again
+  this->ReleaseCells();
+  this->Cache = cache;
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerVisuaLineAnalysisCache* vtkSlicerVisuaLineReachabilityMap::GetCache()
+{
+  return this->Cache;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineReachabilityMap::ReleaseCells()
+{
+  if (!this->MappedKey.empty() && this->Cache)
+    {
+    this->Cache->Unmap(this->MappedKey);
+    }
+  this->MappedKey.clear();
+  std::vector<unsigned short>().swap(this->Cells);
+  this->CellValues = 0;
+}
+
+//----------------------------------------------------------------------------
+double vtkSlicerVisuaLineReachabilityMap::GetVoxelSize()
+{
+  return this->VoxelSize;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineReachabilityMap::GetDimensions(int dimensions[3])
+{
+  std::copy(this->Dimensions, this->Dimensions + 3, dimensions);
+}
+
+//----------------------------------------------------------------------------
+VTK_THREAD_RETURN_TYPE vtkSlicerVisuaLineReachabilityMap::BuildThread(void* arg)
+{
+  vtkMultiThreader::ThreadInfo* info =
+    static_cast<vtkMultiThreader::ThreadInfo*>(arg);
+  vtkSlicerVisuaLineReachabilityMap* self =
+    static_cast<vtkSlicerVisuaLineReachabilityMap*>(info->UserData);
+
+  // Each slice is written by one thread only. Guides are tested in order
+  // so the first one reaching a cell keeps it whatever the threads.
+  const int* dimensions = self->Dimensions;
+  int n = self->DirectionResolution;
+  double size = self->VoxelSize;
+  double radius = 0.5 * sqrt(3.0) * size;
+  int numberOfGuides = static_cast<int>(self->Guides.size());
+  for (int k = info->ThreadID; k < dimensions[2]; k += info->NumberOfThreads)
+    {
+    for (int j = 0; j < dimensions[1]; ++j)
+      {
+      for (int i = 0; i < dimensions[0]; ++i)
+        {
+        double center[3] = { self->Origin[0] + i * size,
+                             self->Origin[1] + j * size,
+                             self->Origin[2] + k * size };
+        vtkIdType voxel = i + dimensions[0] *
+          (j + static_cast<vtkIdType>(dimensions[1]) * k);
+        unsigned short* cells = &self->Cells[voxel * self->NumberOfBins];
+        for (int g = 0; g < numberOfGuides; ++g)
+          {
+          const Guide& guide = self->Guides[g];
+          double direction[3];
+          vtkMath::Subtract(center, guide.Point, direction);
+          double depth = vtkMath::Normalize(direction);
+          if (depth < guide.MinimumDepth - radius || depth > guide.MaximumDepth + radius)
+            {
+            continue;
+            }
+          // Some point of the voxel within the cone
+          double angle = acos(std::max(-1.0, std::min(1.0, vtkMath::Dot(direction, guide.Axis))));
+          if (depth > radius && angle > guide.MaximumAngle + asin(radius / depth))
+            {
+            continue;
+            }
+          // Directions to the center and corners, for the targets
+          // anywhere in the voxel
+          for (int corner = 0; corner < 9; ++corner)
+            {
+            double point[3];
+            for (int axis = 0; axis < 3; ++axis)
+              {
+              double offset = corner == 8 ? 0.0 : ((corner >> axis) & 1 ? 0.5 : -0.5);
+              point[axis] = center[axis] + offset * size - guide.Point[axis];
+              }
+            int bin = GetDirectionBin(point, n);
+            if (bin >= 0 && cells[bin] == NoGuide)
+              {
+              cells[bin] = static_cast<unsigned short>(g);
+              }
+            }
+          }
+        }
+      }
+    }
+  return VTK_THREAD_RETURN_VALUE;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineReachabilityMap::Update()
+{
+  if (this->BuildTime > this->GetMTime())
+    {
+    return;
+    }
+  this->BuildTime.Modified();
+  if (this->Guides.empty())
+    {
+    this->ReleaseCells();
+    this->Key.clear();
+    this->Dimensions[0] = this->Dimensions[1] = this->Dimensions[2] = 0;
+    return;
+    }
+
+  // Box of the guide cones: along each axis, the cone extends as far as
+  // its direction closest to the axis
+  double bounds[6] = { VTK_DOUBLE_MAX, -VTK_DOUBLE_MAX,
+                       VTK_DOUBLE_MAX, -VTK_DOUBLE_MAX,
+                       VTK_DOUBLE_MAX, -VTK_DOUBLE_MAX };
+  for (size_t g = 0; g < this->Guides.size(); ++g)
+    {
+    const Guide& guide = this->Guides[g];
+    for (int axis = 0; axis < 3; ++axis)
+      {
+      double axisAngle = acos(std::max(-1.0, std::min(1.0, guide.Axis[axis])));
+      double high = cos(std::max(0.0, axisAngle - guide.MaximumAngle));
+      double low = cos(std::max(0.0, vtkMath::Pi() - axisAngle - guide.MaximumAngle));
+      bounds[2 * axis] = std::min(bounds[2 * axis],
+        guide.Point[axis] - guide.MaximumDepth * std::max(0.0, low));
+      bounds[2 * axis + 1] = std::max(bounds[2 * axis + 1],
+        guide.Point[axis] + guide.MaximumDepth * std::max(0.0, high));
+      }
+    }
+
+  // Voxels are enlarged until the map fits
+  int numberOfBins = 6 * this->DirectionResolution * this->DirectionResolution;
+  double size = this->Spacing;
+  int dimensions[3];
+  vtkIdType numberOfVoxels = 0;
+  while (true)
+    {
+    numberOfVoxels = 1;
+    for (int axis = 0; axis < 3; ++axis)
+      {
+      double extent = bounds[2 * axis + 1] - bounds[2 * axis];
+      dimensions[axis] = static_cast<int>(ceil(extent / size)) + 1;
+      numberOfVoxels *= dimensions[axis];
+      }
+    double mapSize = static_cast<double>(numberOfVoxels) *
+      numberOfBins * sizeof(unsigned short);
+    if (mapSize <= this->MaximumSize)
+      {
+      break;
+      }
+    size *= 1.01 * pow(mapSize / this->MaximumSize, 1.0 / 3.0);
+    }
+  double origin[3] = { bounds[0], bounds[2], bounds[4] };
+
+  // Everything the map depends on. The same guides set again keep it.
+  vtkSlicerVisuaLineAnalysisCache::Key cacheKey;
+  cacheKey.Add(std::string("ReachabilityMap1"));
+  cacheKey.Add(&this->Guides[0], this->Guides.size() * sizeof(Guide));
+  cacheKey.Add(size);
+  cacheKey.Add(this->DirectionResolution);
+  cacheKey.Add(origin, sizeof(origin));
+  cacheKey.Add(dimensions, sizeof(dimensions));
+  std::string key = cacheKey.ToString();
+  if (key == this->Key && this->CellValues)
+    {
+    return;
+    }
+
+  this->ReleaseCells();
+  this->Key = key;
+  this->NumberOfBins = numberOfBins;
+  this->VoxelSize = size;
+  std::copy(origin, origin + 3, this->Origin);
+  std::copy(dimensions, dimensions + 3, this->Dimensions);
+  vtkIdType numberOfCells = numberOfVoxels * numberOfBins;
+  vtkIdType mapSize = numberOfCells * static_cast<vtkIdType>(sizeof(unsigned short));
+  if (this->Cache)
+    {
+    vtkIdType cachedSize = 0;
+    const void* cached = this->Cache->Map(key, cachedSize);
+    if (cached && cachedSize == mapSize)
+      {
+      this->CellValues = static_cast<const unsigned short*>(cached);
+      this->MappedKey = key;
+      return;
+      }
+    if (cached)
+      {
+      this->Cache->Unmap(key);
+      }
+    }
+
+  this->Cells.assign(numberOfCells, NoGuide);
+  vtkNew<vtkMultiThreader> threader;
+  int numberOfThreads = this->NumberOfThreads > 0 ?
+    this->NumberOfThreads : threader->GetNumberOfThreads();
+  threader->SetNumberOfThreads(
+    std::max(1, std::min(numberOfThreads, this->Dimensions[2])));
+  threader->SetSingleMethod(BuildThread, this);
+  threader->SingleMethodExecute();
+  this->CellValues = &this->Cells[0];
+
+  if (this->Cache)
+    {
+    this->Cache->Store(key, this->CellValues, mapSize);
+    this->Cache->Flush();
+    }
+}
+
+//----------------------------------------------------------------------------
+vtkIdType vtkSlicerVisuaLineReachabilityMap::GetVoxel(const double ras[3])
+{
+  vtkIdType voxel = 0;
+  vtkIdType stride = 1;
+  for (int axis = 0; axis < 3; ++axis)
+    {
+    int index = static_cast<int>(
+      floor((ras[axis] - this->Origin[axis]) / this->VoxelSize + 0.5));
+    if (index < 0 || index >= this->Dimensions[axis])
+      {
+      return -1;
+      }
+    voxel += index * stride;
+    stride *= this->Dimensions[axis];
+    }
+  return voxel;
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLineReachabilityMap
+::GetReachingGuide(const double entry[3], const double target[3])
+{
+  vtkIdType voxel = this->CellValues ? this->GetVoxel(target) : -1;
+  double direction[3];
+  vtkMath::Subtract(target, entry, direction);
+  int bin = GetDirectionBin(direction, this->DirectionResolution);
+  if (voxel < 0 || bin < 0)
+    {
+    return -1;
+    }
+  unsigned short guide = this->CellValues[voxel * this->NumberOfBins + bin];
+  return guide == NoGuide ? -1 : guide;
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerVisuaLineReachabilityMap
+::IsReachable(const double entry[3], const double target[3])
+{
+  return this->GetReachingGuide(entry, target) >= 0;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineReachabilityMap
+::ClampToGuide(int guideIndex, const double target[3],
+               double clampedTarget[3], double direction[3])
+{
+  // Through the guide to the target, brought back into the cone and depth
+  // range of the guide
+  const Guide& guide = this->Guides[guideIndex];
+  vtkMath::Subtract(target, guide.Point, direction);
+  double depth = vtkMath::Normalize(direction);
+  if (depth <= 0.0)
+    {
+    std::copy(guide.Axis, guide.Axis + 3, direction);
+    }
+  double cosine = vtkMath::Dot(direction, guide.Axis);
+  if (cosine < guide.CosMaximumAngle)
+    {
+    double normal[3];
+    for (int i = 0; i < 3; ++i)
+      {
+      normal[i] = direction[i] - cosine * guide.Axis[i];
+      }
+    if (vtkMath::Normalize(normal) <= 0.0)
+      {
+      double binormal[3];
+      vtkMath::Perpendiculars(guide.Axis, normal, binormal, 0.0);
+      }
+    double sine = sqrt(std::max(0.0, 1.0 - guide.CosMaximumAngle * guide.CosMaximumAngle));
+    for (int i = 0; i < 3; ++i)
+      {
+      direction[i] = guide.CosMaximumAngle * guide.Axis[i] + sine * normal[i];
+      }
+    }
+  depth = std::max(guide.MinimumDepth, std::min(depth, guide.MaximumDepth));
+  for (int i = 0; i < 3; ++i)
+    {
+    clampedTarget[i] = guide.Point[i] + depth * direction[i];
+    }
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerVisuaLineReachabilityMap
+::SnapToReachable(const double entry[3], const double target[3],
+                  double snappedEntry[3], double snappedTarget[3])
+{
+  if (!this->CellValues)
+    {
+    return false;
+    }
+  double direction[3];
+  vtkMath::Subtract(target, entry, direction);
+  double length = vtkMath::Normalize(direction);
+
+  // Reachable direction of the target voxel closest to the trajectory
+  int guideIndex = -1;
+  vtkIdType voxel = this->GetVoxel(target);
+  if (voxel >= 0)
+    {
+    const unsigned short* cells = this->CellValues + voxel * this->NumberOfBins;
+    double bestCosine = -VTK_DOUBLE_MAX;
+    for (int bin = 0; bin < this->NumberOfBins; ++bin)
+      {
+      if (cells[bin] == NoGuide)
+        {
+        continue;
+        }
+      double binDirection[3];
+      GetBinDirection(bin, this->DirectionResolution, binDirection);
+      double cosine = vtkMath::Dot(binDirection, direction);
+      if (cosine > bestCosine)
+        {
+        bestCosine = cosine;
+        guideIndex = cells[bin];
+        }
+      }
+    }
+
+  double clampedTarget[3], clampedDirection[3];
+  if (guideIndex < 0)
+    {
+    // Target out of reach: the guide reaching closest to it
+    double bestDistance2 = VTK_DOUBLE_MAX;
+    for (int g = 0; g < this->GetNumberOfGuides(); ++g)
+      {
+      this->ClampToGuide(g, target, clampedTarget, clampedDirection);
+      double distance2 = vtkMath::Distance2BetweenPoints(clampedTarget, target);
+      if (distance2 < bestDistance2)
+        {
+        bestDistance2 = distance2;
+        guideIndex = g;
+        }
+      }
+    }
+  this->ClampToGuide(guideIndex, target, clampedTarget, clampedDirection);
+  for (int i = 0; i < 3; ++i)
+    {
+    snappedTarget[i] = clampedTarget[i];
+    snappedEntry[i] = clampedTarget[i] - length * clampedDirection[i];
+    }
+  return true;
+}
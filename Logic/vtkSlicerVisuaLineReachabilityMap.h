@@ -0,0 +1,164 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Laurent Chauvin, Brigham and Women's
+  Hospital. The project was supported by grants 5P01CA067165,
+  5R01CA124377, 5R01CA138586, 2R44DE019322, 7R01CA124377,
+  5R42CA137886, 8P41EB015898
+
+==============================================================================*/
+
+// .NAME vtkSlicerVisuaLineReachabilityMap - trajectories a device can deliver
+// .SECTION Description
+// Reachable trajectories of a needle guide device (template, robot).
+// The device is a set of guides: a guide delivers needles through its
+// point, within a cone around its axis and a depth range. A template has
+// one guide per hole; a remote center of motion robot one guide with a
+// wide cone.
+//
+// Update() precomputes, in parallel, a map of the target space: for each
+// voxel and each bin of a cube map of directions, the first guide able
+// to deliver a needle to the voxel along the direction. Checking a
+// trajectory is then one lookup, at the resolution of the map: a voxel is
+// reached if any of its points is. With a cache, built maps are stored
+// under a key of the guides and resolution.
+
+#ifndef __vtkSlicerVisuaLineReachabilityMap_h
+#define __vtkSlicerVisuaLineReachabilityMap_h
+
+// VTK includes
+#include <vtkMultiThreader.h>
+#include <vtkObject.h>
+#include <vtkSmartPointer.h>
+#include <vtkTimeStamp.h>
+
+// STD includes
+#include <string>
+#include <vector>
+
+#include "vtkSlicerVisuaLineModuleLogicExport.h"
+
+class vtkSlicerVisuaLineAnalysisCache;
+class vtkSlicerVisuaLineTemplateGrid;
+
+/// \ingroup Slicer_QtModules_VisuaLine
+class VTK_SLICER_VISUALINE_MODULE_LOGIC_EXPORT vtkSlicerVisuaLineReachabilityMap :
+  public vtkObject
+{
+public:
+
+  static vtkSlicerVisuaLineReachabilityMap *New();
+  vtkTypeMacro(vtkSlicerVisuaLineReachabilityMap, vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  /// Add a guide: needles go through 'point' within 'maximumAngle'
+  /// (degrees) of 'axis', targets 'minimumDepth' to 'maximumDepth' (mm)
+  /// past the point. Return its index.
+  int AddGuide(const double point[3], const double axis[3], double maximumAngle,
+               double minimumDepth, double maximumDepth);
+  /// One guide per hole of a template, from the hole entry along its
+  /// trajectory. Holes need not be active.
+  void AddTemplateGrid(vtkSlicerVisuaLineTemplateGrid* grid,
+                       double maximumAngle, double maximumDepth);
+  void RemoveAllGuides();
+  int GetNumberOfGuides();
+
+  /// Voxel size (mm) of the target space
+  vtkSetClampMacro(Spacing, double, 0.1, VTK_DOUBLE_MAX);
+  vtkGetMacro(Spacing, double);
+
+  /// Direction bins along each side of a cube map face
+  vtkSetClampMacro(DirectionResolution, int, 1, 64);
+  vtkGetMacro(DirectionResolution, int);
+
+  /// Largest map (bytes), voxels are enlarged to fit. 128 MB by default.
+  vtkSetClampMacro(MaximumSize, vtkIdType, 1, VTK_ID_MAX);
+  vtkGetMacro(MaximumSize, vtkIdType);
+
+  vtkSetMacro(NumberOfThreads, int);
+  vtkGetMacro(NumberOfThreads, int);
+
+  /// Cache of the built maps, none by default
+  void SetCache(vtkSlicerVisuaLineAnalysisCache* cache);
+  vtkSlicerVisuaLineAnalysisCache* GetCache();
+
+  /// Build the map if the guides or the resolution changed. Guides set
+  /// again as they were keep the map.
+  void Update();
+
+  /// Voxel size and dimensions of the last update
+  double GetVoxelSize();
+  void GetDimensions(int dimensions[3]);
+
+  /// Guide delivering the trajectory from 'entry' to 'target', -1 if
+  /// none. Only the direction and target matter.
+  int GetReachingGuide(const double entry[3], const double target[3]);
+  bool IsReachable(const double entry[3], const double target[3]);
+
+  /// Closest reachable trajectory of the same length: through the guide
+  /// of the reachable direction of the target voxel closest to the
+  /// trajectory or, if none reaches the voxel, the guide reaching closest
+  /// to the target. False without guides.
+  bool SnapToReachable(const double entry[3], const double target[3],
+                       double snappedEntry[3], double snappedTarget[3]);
+
+protected:
+  vtkSlicerVisuaLineReachabilityMap();
+  virtual ~vtkSlicerVisuaLineReachabilityMap();
+
+  //BTX
+  vtkIdType GetVoxel(const double ras[3]);
+  void ClampToGuide(int guide, const double target[3],
+                    double clampedTarget[3], double direction[3]);
+  void ReleaseCells();
+  static VTK_THREAD_RETURN_TYPE BuildThread(void* arg);
+
+  struct Guide
+    {
+    double Point[3];
+    double Axis[3];
+    double MaximumAngle;
+    double CosMaximumAngle;
+    double MinimumDepth;
+    double MaximumDepth;
+    };
+  std::vector<Guide> Guides;
+
+  double Spacing;
+  int DirectionResolution;
+  vtkIdType MaximumSize;
+  int NumberOfThreads;
+
+  vtkSmartPointer<vtkSlicerVisuaLineAnalysisCache> Cache;
+  std::string Key;
+  std::string MappedKey;
+
+  // Guide (or 0xffff) of each voxel and direction bin, in Cells or in a
+  // cache mapping
+  const unsigned short* CellValues;
+  std::vector<unsigned short> Cells;
+  double Origin[3];
+  double VoxelSize;
+  int Dimensions[3];
+  int NumberOfBins;
+  vtkTimeStamp BuildTime;
+  //ETX
+
+private:
+  vtkSlicerVisuaLineReachabilityMap(const vtkSlicerVisuaLineReachabilityMap&); // Not implemented
+  void operator=(const vtkSlicerVisuaLineReachabilityMap&);                    // Not implemented
+};
+
+#endif
@@ -0,0 +1,390 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Laurent Chauvin, Brigham and Women's
+  Hospital. The project was supported by grants 5P01CA067165,
+  5R01CA124377, 5R01CA138586, 2R44DE019322, 7R01CA124377,
+  5R42CA137886, 8P41EB015898
+
+==============================================================================*/
+
+// VisuaLine Logic includes
+#include "vtkSlicerVisuaLineSurfaceLocator.h"
+
+// VTK includes
+#include <vtkCellArray.h>
+#include <vtkMath.h>
+#include <vtkMatrix4x4.h>
+#include <vtkNew.h>
+#include <vtkObjectFactory.h>
+#include <vtkPolyData.h>
+
+// STD includes
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+const int MaximumLeafSize = 4;
+
+struct CenterLess
+{
+  CenterLess(const std::vector<double>& centers, int axis)
+    : Centers(centers), Axis(axis) {}
+  bool operator()(int a, int b) const
+    {
+    return this->Centers[3 * a + this->Axis] < this->Centers[3 * b + this->Axis];
+    }
+  const std::vector<double>& Centers;
+  int Axis;
+};
+
+// Slab test of a segment (origin + t * direction, t in [0, tMax]) on a box
+bool IntersectBox(const double bounds[6], const double origin[3],
+                  const double inverseDirection[3], double tMax)
+{
+  double tMin = 0.0;
+  for (int axis = 0; axis < 3; ++axis)
+    {
+    double t0 = (bounds[2 * axis] - origin[axis]) * inverseDirection[axis];
+    double t1 = (bounds[2 * axis + 1] - origin[axis]) * inverseDirection[axis];
+    if (t0 > t1)
+      {
+      std::swap(t0, t1);
+      }
+    tMin = std::max(tMin, t0);
+    tMax = std::min(tMax, t1);
+    if (tMin > tMax)
+      {
+      return false;
+      }
+    }
+  return true;
+}
+}
+
+//----------------------------------------------------------------------------
+vtkStandardNewMacro(vtkSlicerVisuaLineSurfaceLocator);
+
+//----------------------------------------------------------------------------
+vtkSlicerVisuaLineSurfaceLocator::vtkSlicerVisuaLineSurfaceLocator()
+{
+  this->NumberOfThreads = 0;
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerVisuaLineSurfaceLocator::~vtkSlicerVisuaLineSurfaceLocator()
+{
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineSurfaceLocator::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os, indent);
+  os << indent << "NumberOfTriangles: " << this->GetNumberOfTriangles() << "\n";
+  os << indent << "NumberOfNodes: " << this->Nodes.size() << "\n";
+  os << indent << "NumberOfSegments: " << this->GetNumberOfSegments() << "\n";
+  os << indent << "NumberOfThreads: " << this->NumberOfThreads << "\n";
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLineSurfaceLocator::GetNumberOfTriangles()
+{
+  return static_cast<int>(this->Triangles.size());
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineSurfaceLocator
+::BuildLocator(vtkPolyData* surface, vtkMatrix4x4* surfaceToWorld)
+{
+  this->Vertices.clear();
+  this->Centers.clear();
+  this->Triangles.clear();
+  this->Nodes.clear();
+  this->Modified();
+  if (!surface || !surface->GetPoints() || !surface->GetPolys())
+    {
+    return;
+    }
+
+  // Fan triangulation of the polygons, in world coordinates
+  vtkCellArray* polys = surface->GetPolys();
+  vtkIdType numberOfCellPoints = 0;
+  vtkIdType* cellPoints = 0;
+  for (polys->InitTraversal(); polys->GetNextCell(numberOfCellPoints, cellPoints);)
+    {
+    for (vtkIdType i = 1; i + 1 < numberOfCellPoints; ++i)
+      {
+      vtkIdType corners[3] = { cellPoints[0], cellPoints[i], cellPoints[i + 1] };
+      double center[3] = { 0.0, 0.0, 0.0 };
+      for (int c = 0; c < 3; ++c)
+        {
+        double point[4] = { 0.0, 0.0, 0.0, 1.0 };
+        surface->GetPoint(corners[c], point);
+        if (surfaceToWorld)
+          {
+          surfaceToWorld->MultiplyPoint(point, point);
+          }
+        this->Vertices.insert(this->Vertices.end(), point, point + 3);
+        for (int j = 0; j < 3; ++j)
+          {
+          center[j] += point[j] / 3.0;
+          }
+        }
+      this->Centers.insert(this->Centers.end(), center, center + 3);
+      this->Triangles.push_back(static_cast<int>(this->Triangles.size()));
+      }
+    }
+  if (!this->Triangles.empty())
+    {
+    this->Nodes.reserve(2 * this->Triangles.size() / MaximumLeafSize + 1);
+    this->BuildNode(0, static_cast<int>(this->Triangles.size()));
+    }
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLineSurfaceLocator::BuildNode(int first, int count)
+{
+  int index = static_cast<int>(this->Nodes.size());
+  this->Nodes.push_back(Node());
+
+  double bounds[6] = { VTK_DOUBLE_MAX, -VTK_DOUBLE_MAX, VTK_DOUBLE_MAX,
+                       -VTK_DOUBLE_MAX, VTK_DOUBLE_MAX, -VTK_DOUBLE_MAX };
+  double centerBounds[6] = { VTK_DOUBLE_MAX, -VTK_DOUBLE_MAX, VTK_DOUBLE_MAX,
+                             -VTK_DOUBLE_MAX, VTK_DOUBLE_MAX, -VTK_DOUBLE_MAX };
+  for (int i = first; i < first + count; ++i)
+    {
+    int triangle = this->Triangles[i];
+    for (int c = 0; c < 3; ++c)
+      {
+      const double* vertex = &this->Vertices[9 * triangle + 3 * c];
+      for (int axis = 0; axis < 3; ++axis)
+        {
+        bounds[2 * axis] = std::min(bounds[2 * axis], vertex[axis]);
+        bounds[2 * axis + 1] = std::max(bounds[2 * axis + 1], vertex[axis]);
+        }
+      }
+    for (int axis = 0; axis < 3; ++axis)
+      {
+      double center = this->Centers[3 * triangle + axis];
+      centerBounds[2 * axis] = std::min(centerBounds[2 * axis], center);
+      centerBounds[2 * axis + 1] = std::max(centerBounds[2 * axis + 1], center);
+      }
+    }
+  std::copy(bounds, bounds + 6, this->Nodes[index].Bounds);
+
+  if (count <= MaximumLeafSize)
+    {
+    this->Nodes[index].First = first;
+    this->Nodes[index].Count = count;
+    return index;
+    }
+
+  // Median split along the longest axis of the triangle centers
+  int axis = 0;
+  for (int i = 1; i < 3; ++i)
+    {
+    if (centerBounds[2 * i + 1] - centerBounds[2 * i] >
+        centerBounds[2 * axis + 1] - centerBounds[2 * axis])
+      {
+      axis = i;
+      }
+    }
+  int half = count / 2;
+  std::nth_element(this->Triangles.begin() + first,
+                   this->Triangles.begin() + first + half,
+                   this->Triangles.begin() + first + count,
+                   CenterLess(this->Centers, axis));
+
+  // Children are stored after their parent, the right one after the
+  // whole left subtree
+  this->BuildNode(first, half);
+  int right = this->BuildNode(first + half, count - half);
+  this->Nodes[index].First = right;
+  this->Nodes[index].Count = 0;
+  return index;
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerVisuaLineSurfaceLocator
+::IntersectTriangle(int triangle, const double origin[3],
+                    const double direction[3], double& t)
+{
+  // Moller-Trumbore
+  const double* v0 = &this->Vertices[9 * triangle];
+  const double* v1 = v0 + 3;
+  const double* v2 = v0 + 6;
+  double edge1[3], edge2[3], p[3], q[3], s[3];
+  vtkMath::Subtract(v1, v0, edge1);
+  vtkMath::Subtract(v2, v0, edge2);
+  vtkMath::Cross(direction, edge2, p);
+  double determinant = vtkMath::Dot(edge1, p);
+  if (fabs(determinant) < 1e-15)
+    {
+    return false;
+    }
+  double inverseDeterminant = 1.0 / determinant;
+  vtkMath::Subtract(origin, v0, s);
+  double u = vtkMath::Dot(s, p) * inverseDeterminant;
+  if (u < 0.0 || u > 1.0)
+    {
+    return false;
+    }
+  vtkMath::Cross(s, edge1, q);
+  double v = vtkMath::Dot(direction, q) * inverseDeterminant;
+  if (v < 0.0 || u + v > 1.0)
+    {
+    return false;
+    }
+  t = vtkMath::Dot(edge2, q) * inverseDeterminant;
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerVisuaLineSurfaceLocator
+::IntersectWithSegment(const double p0[3], const double p1[3],
+                       double& t, double x[3])
+{
+  if (this->Nodes.empty())
+    {
+    return false;
+    }
+  double direction[3];
+  vtkMath::Subtract(p1, p0, direction);
+  double inverseDirection[3];
+  for (int axis = 0; axis < 3; ++axis)
+    {
+    inverseDirection[axis] = direction[axis] != 0.0 ?
+      1.0 / direction[axis] : VTK_DOUBLE_MAX;
+    }
+
+  // Depth first, closest hit so far bounds the boxes to visit
+  double closest = 1.0;
+  bool hit = false;
+  int stack[64];
+  int stackSize = 0;
+  stack[stackSize++] = 0;
+  while (stackSize > 0)
+    {
+    const Node& node = this->Nodes[stack[--stackSize]];
+    if (!IntersectBox(node.Bounds, p0, inverseDirection, closest))
+      {
+      continue;
+      }
+    if (node.Count == 0)
+      {
+      int left = static_cast<int>(&node - &this->Nodes[0]) + 1;
+      stack[stackSize++] = node.First;
+      stack[stackSize++] = left;
+      continue;
+      }
+    for (int i = node.First; i < node.First + node.Count; ++i)
+      {
+      double triangleT;
+      if (this->IntersectTriangle(this->Triangles[i], p0, direction, triangleT) &&
+          triangleT >= 0.0 && triangleT <= closest)
+        {
+        closest = triangleT;
+        hit = true;
+        }
+      }
+    }
+  if (hit)
+    {
+    t = closest;
+    for (int axis = 0; axis < 3; ++axis)
+      {
+      x[axis] = p0[axis] + t * direction[axis];
+      }
+    }
+  return hit;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineSurfaceLocator::RemoveAllSegments()
+{
+  this->Segments.clear();
+  this->SegmentHits.clear();
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLineSurfaceLocator
+::AddSegment(const double p0[3], const double p1[3])
+{
+  this->Segments.insert(this->Segments.end(), p0, p0 + 3);
+  this->Segments.insert(this->Segments.end(), p1, p1 + 3);
+  return this->GetNumberOfSegments() - 1;
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLineSurfaceLocator::GetNumberOfSegments()
+{
+  return static_cast<int>(this->Segments.size() / 6);
+}
+
+//----------------------------------------------------------------------------
+VTK_THREAD_RETURN_TYPE vtkSlicerVisuaLineSurfaceLocator
+::IntersectSegmentsThread(void* arg)
+{
+  vtkMultiThreader::ThreadInfo* info =
+    static_cast<vtkMultiThreader::ThreadInfo*>(arg);
+  vtkSlicerVisuaLineSurfaceLocator* self =
+    static_cast<vtkSlicerVisuaLineSurfaceLocator*>(info->UserData);
+
+  int numberOfSegments = self->GetNumberOfSegments();
+  for (int i = info->ThreadID; i < numberOfSegments; i += info->NumberOfThreads)
+    {
+    double* hit = &self->SegmentHits[4 * i];
+    if (!self->IntersectWithSegment(&self->Segments[6 * i], &self->Segments[6 * i + 3],
+                                    hit[0], hit + 1))
+      {
+      hit[0] = vtkMath::Nan();
+      }
+    }
+  return VTK_THREAD_RETURN_VALUE;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineSurfaceLocator::IntersectSegments()
+{
+  int numberOfSegments = this->GetNumberOfSegments();
+  this->SegmentHits.assign(4 * numberOfSegments, vtkMath::Nan());
+  if (numberOfSegments == 0 || this->Nodes.empty())
+    {
+    return;
+    }
+
+  vtkNew<vtkMultiThreader> threader;
+  int numberOfThreads = this->NumberOfThreads > 0 ?
+    this->NumberOfThreads : threader->GetNumberOfThreads();
+  threader->SetNumberOfThreads(std::max(1, std::min(numberOfThreads, numberOfSegments)));
+  threader->SetSingleMethod(IntersectSegmentsThread, this);
+  threader->SingleMethodExecute();
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerVisuaLineSurfaceLocator
+::GetSegmentIntersection(int segment, double& t, double x[3])
+{
+  if (segment < 0 || 4 * segment >= static_cast<int>(this->SegmentHits.size()) ||
+      vtkMath::IsNan(this->SegmentHits[4 * segment]))
+    {
+    return false;
+    }
+  const double* hit = &this->SegmentHits[4 * segment];
+  t = hit[0];
+  std::copy(hit + 1, hit + 4, x);
+  return true;
+}
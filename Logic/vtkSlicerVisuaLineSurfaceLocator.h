@@ -0,0 +1,113 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Laurent Chauvin, Brigham and Women's
+  Hospital. The project was supported by grants 5P01CA067165,
+  5R01CA124377, 5R01CA138586, 2R44DE019322, 7R01CA124377,
+  5R42CA137886, 8P41EB015898
+
+==============================================================================*/
+
+// .NAME vtkSlicerVisuaLineSurfaceLocator - segment queries on a surface
+// .SECTION Description
+// Bounding volume hierarchy over the triangles of a surface, hardened to
+// world coordinates at build time. Boxes are split at the median of
+// their longest axis down to a few triangles per leaf. Queries only read
+// the hierarchy and may run from several threads, unlike vtkOBBTree
+// which goes through the cells of its data set.
+
+#ifndef __vtkSlicerVisuaLineSurfaceLocator_h
+#define __vtkSlicerVisuaLineSurfaceLocator_h
+
+// VTK includes
+#include <vtkMultiThreader.h>
+#include <vtkObject.h>
+
+// STD includes
+#include <vector>
+
+#include "vtkSlicerVisuaLineModuleLogicExport.h"
+
+class vtkMatrix4x4;
+class vtkPolyData;
+
+/// \ingroup Slicer_QtModules_VisuaLine
+class VTK_SLICER_VISUALINE_MODULE_LOGIC_EXPORT vtkSlicerVisuaLineSurfaceLocator :
+  public vtkObject
+{
+public:
+
+  static vtkSlicerVisuaLineSurfaceLocator *New();
+  vtkTypeMacro(vtkSlicerVisuaLineSurfaceLocator, vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  /// Build the hierarchy of a surface. Polygons are split in triangles.
+  /// 'surfaceToWorld' may be NULL.
+  void BuildLocator(vtkPolyData* surface, vtkMatrix4x4* surfaceToWorld);
+
+  int GetNumberOfTriangles();
+
+  /// First intersection of the segment p0-p1 with the surface, from p0.
+  /// Return false if none, otherwise 't' is the parametric coordinate
+  /// (0 at p0, 1 at p1) and 'x' the point.
+  bool IntersectWithSegment(const double p0[3], const double p1[3],
+                            double& t, double x[3]);
+
+  /// Batch of segments intersected in parallel by IntersectSegments()
+  void RemoveAllSegments();
+  int AddSegment(const double p0[3], const double p1[3]);
+  int GetNumberOfSegments();
+  void IntersectSegments();
+
+  vtkSetMacro(NumberOfThreads, int);
+  vtkGetMacro(NumberOfThreads, int);
+
+  /// Result of the last IntersectSegments() for a segment
+  bool GetSegmentIntersection(int segment, double& t, double x[3]);
+
+protected:
+  vtkSlicerVisuaLineSurfaceLocator();
+  virtual ~vtkSlicerVisuaLineSurfaceLocator();
+
+  //BTX
+  struct Node
+    {
+    double Bounds[6];
+    int First;   // first triangle (leaf) or left child (inner node)
+    int Count;   // number of triangles, 0 for an inner node
+    };
+
+  int BuildNode(int first, int count);
+  bool IntersectTriangle(int triangle, const double origin[3],
+                         const double direction[3], double& t);
+  static VTK_THREAD_RETURN_TYPE IntersectSegmentsThread(void* arg);
+
+  int NumberOfThreads;
+
+  std::vector<double> Vertices;   // 9 per triangle
+  std::vector<double> Centers;    // 3 per triangle
+  std::vector<int> Triangles;     // order of the leaves
+  std::vector<Node> Nodes;
+
+  std::vector<double> Segments;   // 6 per segment
+  std::vector<double> SegmentHits; // t and point, t is NaN if no hit
+  //ETX
+
+private:
+  vtkSlicerVisuaLineSurfaceLocator(const vtkSlicerVisuaLineSurfaceLocator&); // Not implemented
+  void operator=(const vtkSlicerVisuaLineSurfaceLocator&);                   // Not implemented
+};
+
+#endif
@@ -0,0 +1,324 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Laurent Chauvin, Brigham and Women's
+  Hospital. The project was supported by grants 5P01CA067165,
+  5R01CA124377, 5R01CA138586, 2R44DE019322, 7R01CA124377,
+  5R42CA137886, 8P41EB015898
+
+==============================================================================*/
+
+// VisuaLine Logic includes
+#include "vtkSlicerVisuaLineTemplateGrid.h"
+
+// VTK includes
+#include <vtkCellArray.h>
+#include <vtkMatrix4x4.h>
+#include <vtkObjectFactory.h>
+#include <vtkPoints.h>
+#include <vtkPolyData.h>
+
+// STD includes
+#include <algorithm>
+#include <sstream>
+
+//----------------------------------------------------------------------------
+vtkStandardNewMacro(vtkSlicerVisuaLineTemplateGrid);
+
+//----------------------------------------------------------------------------
+vtkSlicerVisuaLineTemplateGrid::vtkSlicerVisuaLineTemplateGrid()
+{
+  this->Name = 0;
+  this->TemplateToRAS = vtkMatrix4x4::New();
+  this->NumberOfRows = 0;
+  this->NumberOfColumns = 0;
+  this->Pitch = 5.0;
+  this->DefaultDepth = 100.0;
+  this->ActiveHolesTime = 0;
+  this->TrajectoriesPolyData = vtkPolyData::New();
+  this->TrajectoriesTime = 0;
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerVisuaLineTemplateGrid::~vtkSlicerVisuaLineTemplateGrid()
+{
+  this->SetName(0);
+  this->TemplateToRAS->Delete();
+  this->TrajectoriesPolyData->Delete();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineTemplateGrid::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os, indent);
+  os << indent << "Name: " << (this->Name ? this->Name : "(none)") << "\n";
+  os << indent << "NumberOfRows: " << this->NumberOfRows << "\n";
+  os << indent << "NumberOfColumns: " << this->NumberOfColumns << "\n";
+  os << indent << "Pitch: " << this->Pitch << "\n";
+  os << indent << "DefaultDepth: " << this->DefaultDepth << "\n";
+  os << indent << "TemplateToRAS:\n";
+  this->TemplateToRAS->PrintSelf(os, indent.GetNextIndent());
+}
+
+//----------------------------------------------------------------------------
+unsigned long vtkSlicerVisuaLineTemplateGrid::GetMTime()
+{
+  unsigned long mtime = this->Superclass::GetMTime();
+  return std::max(mtime, this->TemplateToRAS->GetMTime());
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineTemplateGrid::SetTemplateToRAS(vtkMatrix4x4* matrix)
+{
+  if (!matrix)
+    {
+    this->TemplateToRAS->Identity();
+    }
+  else
+    {
+    this->TemplateToRAS->DeepCopy(matrix);
+    }
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineTemplateGrid::SetGridSize(int rows, int columns)
+{
+  rows = std::max(0, rows);
+  columns = std::max(0, columns);
+  if (rows == this->NumberOfRows && columns == this->NumberOfColumns)
+    {
+    return;
+    }
+  this->NumberOfRows = rows;
+  this->NumberOfColumns = columns;
+  this->Mask.assign(rows * columns, 0);
+  this->Materialized.assign(rows * columns, 0);
+  this->Depths.assign(rows * columns, -1.0);
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLineTemplateGrid::GetNumberOfHoles()
+{
+  return this->NumberOfRows * this->NumberOfColumns;
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLineTemplateGrid::GetHoleIndex(int row, int column)
+{
+  if (row < 0 || row >= this->NumberOfRows ||
+      column < 0 || column >= this->NumberOfColumns)
+    {
+    return -1;
+    }
+  return row * this->NumberOfColumns + column;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineTemplateGrid::GetHoleRowColumn(int hole, int& row, int& column)
+{
+  row = -1;
+  column = -1;
+  if (hole < 0 || hole >= this->GetNumberOfHoles())
+    {
+    return;
+    }
+  row = hole / this->NumberOfColumns;
+  column = hole % this->NumberOfColumns;
+}
+
+//----------------------------------------------------------------------------
+std::string vtkSlicerVisuaLineTemplateGrid::GetHoleName(int hole)
+{
+  int row, column;
+  this->GetHoleRowColumn(hole, row, column);
+  if (row < 0)
+    {
+    return std::string();
+    }
+  std::ostringstream name;
+  if (column >= 26)
+    {
+    name << static_cast<char>('A' + column / 26 - 1);
+    }
+  name << static_cast<char>('A' + column % 26) << (row + 1);
+  return name.str();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineTemplateGrid::SetHoleActive(int hole, bool active)
+{
+  if (hole < 0 || hole >= this->GetNumberOfHoles() ||
+      (this->Mask[hole] != 0) == active)
+    {
+    return;
+    }
+  this->Mask[hole] = active ? 1 : 0;
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerVisuaLineTemplateGrid::GetHoleActive(int hole)
+{
+  return hole >= 0 && hole < this->GetNumberOfHoles() && this->Mask[hole] != 0;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineTemplateGrid::SetAllHolesActive(bool active)
+{
+  std::fill(this->Mask.begin(), this->Mask.end(), active ? 1 : 0);
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineTemplateGrid::SetHoleDepth(int hole, double depth)
+{
+  if (hole < 0 || hole >= this->GetNumberOfHoles())
+    {
+    return;
+    }
+  depth = depth < 0 ? -1.0 : depth;
+  if (this->Depths[hole] == depth)
+    {
+    return;
+    }
+  this->Depths[hole] = depth;
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+double vtkSlicerVisuaLineTemplateGrid::GetHoleDepth(int hole)
+{
+  if (hole < 0 || hole >= this->GetNumberOfHoles() || this->Depths[hole] < 0)
+    {
+    return this->DefaultDepth;
+    }
+  return this->Depths[hole];
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineTemplateGrid::SetHoleMaterialized(int hole, bool materialized)
+{
+  if (hole < 0 || hole >= this->GetNumberOfHoles() ||
+      (this->Materialized[hole] != 0) == materialized)
+    {
+    return;
+    }
+  this->Materialized[hole] = materialized ? 1 : 0;
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerVisuaLineTemplateGrid::GetHoleMaterialized(int hole)
+{
+  return hole >= 0 && hole < this->GetNumberOfHoles() &&
+    this->Materialized[hole] != 0;
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLineTemplateGrid::GetNumberOfActiveHoles()
+{
+  this->UpdateActiveHoles();
+  return static_cast<int>(this->ActiveHoles.size());
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLineTemplateGrid::GetNthActiveHole(int n)
+{
+  this->UpdateActiveHoles();
+  if (n < 0 || n >= static_cast<int>(this->ActiveHoles.size()))
+    {
+    return -1;
+    }
+  return this->ActiveHoles[n];
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineTemplateGrid
+::GetHoleTrajectory(int hole, double entry[3], double target[3])
+{
+  int row, column;
+  this->GetHoleRowColumn(hole, row, column);
+  if (row < 0)
+    {
+    return;
+    }
+  double depth = this->GetHoleDepth(hole);
+  double holeInTemplate[4] = { column * this->Pitch, row * this->Pitch, 0.0, 1.0 };
+  double targetInTemplate[4] = { column * this->Pitch, row * this->Pitch, depth, 1.0 };
+  double entryRAS[4], targetRAS[4];
+  this->TemplateToRAS->MultiplyPoint(holeInTemplate, entryRAS);
+  this->TemplateToRAS->MultiplyPoint(targetInTemplate, targetRAS);
+  for (int i = 0; i < 3; ++i)
+    {
+    entry[i] = entryRAS[i];
+    target[i] = targetRAS[i];
+    }
+}
+
+//----------------------------------------------------------------------------
+vtkPolyData* vtkSlicerVisuaLineTemplateGrid::GetTrajectoriesPolyData()
+{
+  if (this->TrajectoriesTime >= this->GetMTime())
+    {
+    return this->TrajectoriesPolyData;
+    }
+
+  this->UpdateActiveHoles();
+  vtkPoints* points = vtkPoints::New();
+  vtkCellArray* lines = vtkCellArray::New();
+  for (size_t i = 0; i < this->ActiveHoles.size(); ++i)
+    {
+    int hole = this->ActiveHoles[i];
+    if (this->Materialized[hole])
+      {
+      continue;
+      }
+    double entry[3], target[3];
+    this->GetHoleTrajectory(hole, entry, target);
+    vtkIdType ids[2];
+    ids[0] = points->InsertNextPoint(entry);
+    ids[1] = points->InsertNextPoint(target);
+    lines->InsertNextCell(2, ids);
+    }
+  this->TrajectoriesPolyData->Initialize();
+  this->TrajectoriesPolyData->SetPoints(points);
+  this->TrajectoriesPolyData->SetLines(lines);
+  points->Delete();
+  lines->Delete();
+
+  this->TrajectoriesTime = this->GetMTime();
+  return this->TrajectoriesPolyData;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineTemplateGrid::UpdateActiveHoles()
+{
+  unsigned long mtime = this->vtkObject::GetMTime();
+  if (this->ActiveHolesTime >= mtime)
+    {
+    return;
+    }
+  this->ActiveHoles.clear();
+  for (int hole = 0; hole < this->GetNumberOfHoles(); ++hole)
+    {
+    if (this->Mask[hole])
+      {
+      this->ActiveHoles.push_back(hole);
+      }
+    }
+  this->ActiveHolesTime = mtime;
+}
@@ -0,0 +1,139 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Laurent Chauvin, Brigham and Women's
+  Hospital. The project was supported by grants 5P01CA067165,
+  5R01CA124377, 5R01CA138586, 2R44DE019322, 7R01CA124377,
+  5R42CA137886, 8P41EB015898
+
+==============================================================================*/
+
+// .NAME vtkSlicerVisuaLineTemplateGrid - procedural template-grid path source
+// .SECTION Description
+// Needle guide template with NumberOfRows x NumberOfColumns holes spaced
+// by Pitch. TemplateToRAS places hole (0, 0) at its origin, columns along
+// its X axis, rows along its Y axis and the insertion direction along Z.
+// Trajectories are computed on request from the pose, mask and per-hole
+// depth, no MRML node is created per hole.
+
+#ifndef __vtkSlicerVisuaLineTemplateGrid_h
+#define __vtkSlicerVisuaLineTemplateGrid_h
+
+// VTK includes
+#include <vtkObject.h>
+
+// STD includes
+#include <string>
+#include <vector>
+
+#include "vtkSlicerVisuaLineModuleLogicExport.h"
+
+class vtkMatrix4x4;
+class vtkPolyData;
+
+/// \ingroup Slicer_QtModules_VisuaLine
+class VTK_SLICER_VISUALINE_MODULE_LOGIC_EXPORT vtkSlicerVisuaLineTemplateGrid :
+  public vtkObject
+{
+public:
+
+  static vtkSlicerVisuaLineTemplateGrid *New();
+  vtkTypeMacro(vtkSlicerVisuaLineTemplateGrid, vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  /// Include the pose matrix modification time
+  virtual unsigned long GetMTime();
+
+  vtkSetStringMacro(Name);
+  vtkGetStringMacro(Name);
+
+  /// Template pose. The matrix is copied.
+  void SetTemplateToRAS(vtkMatrix4x4* matrix);
+  vtkGetObjectMacro(TemplateToRAS, vtkMatrix4x4);
+
+  /// Resize the grid. All holes are inactive afterwards.
+  void SetGridSize(int rows, int columns);
+  vtkGetMacro(NumberOfRows, int);
+  vtkGetMacro(NumberOfColumns, int);
+
+  /// Distance between two neighbor holes (mm)
+  vtkSetMacro(Pitch, double);
+  vtkGetMacro(Pitch, double);
+
+  /// Depth used by holes without their own depth (mm)
+  vtkSetMacro(DefaultDepth, double);
+  vtkGetMacro(DefaultDepth, double);
+
+  int GetNumberOfHoles();
+  int GetHoleIndex(int row, int column);
+  void GetHoleRowColumn(int hole, int& row, int& column);
+
+  /// Hole label, column letter then row number (e.g. "C5")
+  //BTX
+  std::string GetHoleName(int hole);
+  //ETX
+
+  void SetHoleActive(int hole, bool active);
+  bool GetHoleActive(int hole);
+  void SetAllHolesActive(bool active);
+
+  /// Depth of one hole. A negative depth resets it to DefaultDepth.
+  void SetHoleDepth(int hole, double depth);
+  double GetHoleDepth(int hole);
+
+  /// Holes turned into rulers are no longer drawn by the grid.
+  void SetHoleMaterialized(int hole, bool materialized);
+  bool GetHoleMaterialized(int hole);
+
+  /// Active holes, in row-major order. Rebuilt on demand.
+  int GetNumberOfActiveHoles();
+  int GetNthActiveHole(int n);
+
+  /// Entry (on the template) and target of a hole trajectory.
+  void GetHoleTrajectory(int hole, double entry[3], double target[3]);
+
+  /// Lines of all active, non-materialized holes. Rebuilt on demand.
+  vtkPolyData* GetTrajectoriesPolyData();
+
+protected:
+  vtkSlicerVisuaLineTemplateGrid();
+  virtual ~vtkSlicerVisuaLineTemplateGrid();
+
+  void UpdateActiveHoles();
+
+  char* Name;
+  vtkMatrix4x4* TemplateToRAS;
+  int NumberOfRows;
+  int NumberOfColumns;
+  double Pitch;
+  double DefaultDepth;
+
+  //BTX
+  std::vector<unsigned char> Mask;
+  std::vector<unsigned char> Materialized;
+  std::vector<double> Depths;
+  std::vector<int> ActiveHoles;
+  //ETX
+  unsigned long ActiveHolesTime;
+
+  vtkPolyData* TrajectoriesPolyData;
+  unsigned long TrajectoriesTime;
+
+private:
+  vtkSlicerVisuaLineTemplateGrid(const vtkSlicerVisuaLineTemplateGrid&); // Not implemented
+  void operator=(const vtkSlicerVisuaLineTemplateGrid&);                 // Not implemented
+};
+
+#endif
@@ -0,0 +1,463 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Laurent Chauvin, Brigham and Women's
+  Hospital. The project was supported by grants 5P01CA067165,
+  5R01CA124377, 5R01CA138586, 2R44DE019322, 7R01CA124377,
+  5R42CA137886, 8P41EB015898
+
+==============================================================================*/
+
+// VisuaLine Logic includes
+#include "vtkSlicerVisuaLineAnalysisCache.h"
+#include "vtkSlicerVisuaLineDistanceMap.h"
+#include "vtkSlicerVisuaLineUncertaintyAnalysis.h"
+
+// VTK includes
+#include <vtkDataArray.h>
+#include <vtkImageData.h>
+#include <vtkMath.h>
+#include <vtkNew.h>
+#include <vtkObjectFactory.h>
+#include <vtkPointData.h>
+
+// STD includes
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+//----------------------------------------------------------------------------
+// Random stream of one path (xorshift*). Not shared between threads.
+class RandomStream
+{
+public:
+  RandomStream(vtkTypeUInt64 seed)
+    : State(seed ? seed : 0x9E3779B97F4A7C15ULL)
+    {
+    }
+
+  // Uniform in (0, 1]
+  double Uniform()
+    {
+    this->State ^= this->State >> 12;
+    this->State ^= this->State << 25;
+    this->State ^= this->State >> 27;
+    vtkTypeUInt64 value = this->State * 2685821657736338717ULL;
+    return static_cast<double>((value >> 11) + 1) * (1.0 / 9007199254740992.0);
+    }
+
+  double Gaussian(double sigma)
+    {
+    if (sigma <= 0)
+      {
+      return 0.0;
+      }
+    double radius = sqrt(-2.0 * log(this->Uniform()));
+    return sigma * radius * cos(2.0 * vtkMath::Pi() * this->Uniform());
+    }
+
+private:
+  vtkTypeUInt64 State;
+};
+
+//----------------------------------------------------------------------------
+// Seed of a path stream from the analysis seed and the path ID
+vtkTypeUInt64 PathSeed(unsigned int seed, const std::string& pathNodeID)
+{
+  vtkTypeUInt64 hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < pathNodeID.size(); ++i)
+    {
+    hash ^= static_cast<unsigned char>(pathNodeID[i]);
+    hash *= 1099511628211ULL;
+    }
+  hash ^= static_cast<vtkTypeUInt64>(seed) * 0x9E3779B97F4A7C15ULL;
+  hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBULL;
+  return hash ^ (hash >> 31);
+}
+}
+
+//----------------------------------------------------------------------------
+vtkStandardNewMacro(vtkSlicerVisuaLineUncertaintyAnalysis);
+
+//----------------------------------------------------------------------------
+vtkSlicerVisuaLineUncertaintyAnalysis::vtkSlicerVisuaLineUncertaintyAnalysis()
+{
+  this->NumberOfSamples = 1000;
+  this->Seed = 1;
+  this->EntryError = 1.0;
+  this->TargetError = 1.0;
+  this->AngularError = 1.0;
+  this->DepthError = 1.0;
+  this->TargetTolerance = 5.0;
+  this->RiskMargin = 0.0;
+  this->NumberOfThreads = 0;
+  this->TargetLabel = 0;
+  this->NumberOfCachedPaths = 0;
+  this->DistanceMap = vtkSmartPointer<vtkSlicerVisuaLineDistanceMap>::New();
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerVisuaLineUncertaintyAnalysis::~vtkSlicerVisuaLineUncertaintyAnalysis()
+{
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineUncertaintyAnalysis::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os, indent);
+  os << indent << "NumberOfSamples: " << this->NumberOfSamples << "\n";
+  os << indent << "Seed: " << this->Seed << "\n";
+  os << indent << "EntryError: " << this->EntryError << "\n";
+  os << indent << "TargetError: " << this->TargetError << "\n";
+  os << indent << "AngularError: " << this->AngularError << "\n";
+  os << indent << "DepthError: " << this->DepthError << "\n";
+  os << indent << "TargetTolerance: " << this->TargetTolerance << "\n";
+  os << indent << "RiskMargin: " << this->RiskMargin << "\n";
+  os << indent << "NumberOfThreads: " << this->NumberOfThreads << "\n";
+  os << indent << "TargetLabel: " << this->TargetLabel << "\n";
+  os << indent << "NumberOfPaths: " << this->GetNumberOfPaths() << "\n";
+  os << indent << "NumberOfCachedPaths: " << this->NumberOfCachedPaths << "\n";
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineUncertaintyAnalysis
+::SetDistanceMap(vtkSlicerVisuaLineDistanceMap* distanceMap)
+{
+  if (this->DistanceMap == distanceMap)
+    {
+    return;
+    }
+  this->DistanceMap = distanceMap;
+  this->TargetLabelTime.Modified();
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerVisuaLineDistanceMap* vtkSlicerVisuaLineUncertaintyAnalysis::GetDistanceMap()
+{
+  return this->DistanceMap;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineUncertaintyAnalysis
+::SetCache(vtkSlicerVisuaLineAnalysisCache* cache)
+{
+  if (this->Cache == cache)
+    {
+    return;
+    }
+  this->Cache = cache;
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerVisuaLineAnalysisCache* vtkSlicerVisuaLineUncertaintyAnalysis::GetCache()
+{
+  return this->Cache;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineUncertaintyAnalysis::SetTargetLabel(int label)
+{
+  if (this->TargetLabel == label)
+    {
+    return;
+    }
+  this->TargetLabel = label;
+  this->TargetLabelTime.Modified();
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLineUncertaintyAnalysis::GetTargetLabel()
+{
+  return this->TargetLabel;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineUncertaintyAnalysis::RemoveAllPaths()
+{
+  this->PathNodeIDs.clear();
+  this->EndPoints.clear();
+  this->TargetHitProbabilities.clear();
+  this->RiskProbabilities.clear();
+  this->Clearances.clear();
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLineUncertaintyAnalysis
+::AddPath(const char* pathNodeID, const double entry[3], const double target[3])
+{
+  this->PathNodeIDs.push_back(pathNodeID ? pathNodeID : "");
+  this->EndPoints.insert(this->EndPoints.end(), entry, entry + 3);
+  this->EndPoints.insert(this->EndPoints.end(), target, target + 3);
+  this->TargetHitProbabilities.push_back(vtkMath::Nan());
+  this->RiskProbabilities.push_back(vtkMath::Nan());
+  this->Clearances.push_back(vtkMath::Nan());
+  return static_cast<int>(this->PathNodeIDs.size()) - 1;
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLineUncertaintyAnalysis::GetNumberOfPaths()
+{
+  return static_cast<int>(this->PathNodeIDs.size());
+}
+
+//----------------------------------------------------------------------------
+double vtkSlicerVisuaLineUncertaintyAnalysis::GetTargetHitProbability(int index)
+{
+  return index >= 0 && index < this->GetNumberOfPaths() ?
+    this->TargetHitProbabilities[index] : vtkMath::Nan();
+}
+
+//----------------------------------------------------------------------------
+double vtkSlicerVisuaLineUncertaintyAnalysis::GetRiskProbability(int index)
+{
+  return index >= 0 && index < this->GetNumberOfPaths() ?
+    this->RiskProbabilities[index] : vtkMath::Nan();
+}
+
+//----------------------------------------------------------------------------
+double vtkSlicerVisuaLineUncertaintyAnalysis::GetClearance(int index)
+{
+  return index >= 0 && index < this->GetNumberOfPaths() ?
+    this->Clearances[index] : vtkMath::Nan();
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLineUncertaintyAnalysis::GetNumberOfCachedPaths()
+{
+  return this->NumberOfCachedPaths;
+}
+
+//----------------------------------------------------------------------------
+std::string vtkSlicerVisuaLineUncertaintyAnalysis::GetPathKey(int index)
+{
+  vtkSlicerVisuaLineAnalysisCache::Key key;
+  key.Add(std::string("UncertaintyAnalysis1"));
+  key.Add(this->DistanceMap->GetKey());
+  key.Add(this->TargetLabel);
+  key.Add(this->NumberOfSamples);
+  key.Add(&this->Seed, sizeof(this->Seed));
+  key.Add(this->EntryError);
+  key.Add(this->TargetError);
+  key.Add(this->AngularError);
+  key.Add(this->DepthError);
+  key.Add(this->TargetTolerance);
+  key.Add(this->RiskMargin);
+  // The ID seeds the random stream of the path
+  key.Add(this->PathNodeIDs[index]);
+  key.Add(&this->EndPoints[6 * index], 6 * sizeof(double));
+  return key.ToString();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineUncertaintyAnalysis::UpdateTargetMask()
+{
+  vtkImageData* labelMap = this->DistanceMap ? this->DistanceMap->GetLabelMap() : 0;
+  if (this->TargetMaskTime > this->TargetLabelTime &&
+      (!labelMap || (this->TargetMaskTime > labelMap->GetMTime() &&
+                     this->TargetMaskTime > this->DistanceMap->GetMTime())))
+    {
+    return;
+    }
+  this->TargetMask.clear();
+  this->TargetMaskTime.Modified();
+
+  vtkDataArray* scalars = labelMap ? labelMap->GetPointData()->GetScalars() : 0;
+  if (!scalars || this->TargetLabel == 0)
+    {
+    return;
+    }
+  this->TargetMask.resize(scalars->GetNumberOfTuples());
+  for (vtkIdType voxel = 0; voxel < scalars->GetNumberOfTuples(); ++voxel)
+    {
+    this->TargetMask[voxel] = static_cast<int>(scalars->GetTuple1(voxel)) == this->TargetLabel;
+    }
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerVisuaLineUncertaintyAnalysis
+::IsInTarget(const double ras[3], const double plannedTarget[3])
+{
+  if (this->TargetMask.empty())
+    {
+    return vtkMath::Distance2BetweenPoints(ras, plannedTarget) <=
+      this->TargetTolerance * this->TargetTolerance;
+    }
+  vtkIdType voxel = this->DistanceMap->GetVoxel(ras);
+  return voxel >= 0 && this->TargetMask[voxel] != 0;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineUncertaintyAnalysis::AnalyzePath(int index)
+{
+  const double* entry = &this->EndPoints[6 * index];
+  const double* target = entry + 3;
+  RandomStream stream(PathSeed(this->Seed, this->PathNodeIDs[index]));
+
+  double plannedDirection[3] =
+    { target[0] - entry[0], target[1] - entry[1], target[2] - entry[2] };
+  if (vtkMath::Normalize(plannedDirection) == 0.0)
+    {
+    plannedDirection[2] = 1.0;
+    }
+  vtkSlicerVisuaLineDistanceMap* distanceMap = this->DistanceMap;
+  bool hasLabelMap = distanceMap->GetLabelMap() != 0;
+  bool hasRisks = distanceMap->HasRisks();
+  this->Clearances[index] = hasRisks ?
+    distanceMap->GetMinimumDistance(entry, target, -VTK_DOUBLE_MAX,
+                                    distanceMap->GetMinimumStep()) :
+    vtkMath::Nan();
+
+  double angularError = vtkMath::RadiansFromDegrees(this->AngularError);
+  int numberOfHits = 0;
+  int numberOfRisks = 0;
+  for (int sample = 0; sample < this->NumberOfSamples; ++sample)
+    {
+    double sampleEntry[3], sampleTarget[3];
+    for (int i = 0; i < 3; ++i)
+      {
+      sampleEntry[i] = entry[i] + stream.Gaussian(this->EntryError);
+      sampleTarget[i] = target[i] + stream.Gaussian(this->TargetError);
+      }
+    double direction[3] = { sampleTarget[0] - sampleEntry[0],
+                            sampleTarget[1] - sampleEntry[1],
+                            sampleTarget[2] - sampleEntry[2] };
+    double depth = vtkMath::Normalize(direction);
+    if (depth == 0.0)
+      {
+      std::copy(plannedDirection, plannedDirection + 3, direction);
+      }
+
+    // Tilt the insertion around a random axis normal to it
+    double normal1[3], normal2[3];
+    vtkMath::Perpendiculars(direction, normal1, normal2, 0.0);
+    double tilt = stream.Gaussian(angularError);
+    double azimuth = 2.0 * vtkMath::Pi() * stream.Uniform();
+    depth = std::max(0.0, depth + stream.Gaussian(this->DepthError));
+    double tip[3];
+    for (int i = 0; i < 3; ++i)
+      {
+      double tilted = cos(tilt) * direction[i] + sin(tilt) *
+        (cos(azimuth) * normal1[i] + sin(azimuth) * normal2[i]);
+      tip[i] = sampleEntry[i] + depth * tilted;
+      }
+
+    if (this->IsInTarget(tip, target))
+      {
+      ++numberOfHits;
+      }
+    if (hasRisks &&
+        distanceMap->GetMinimumDistance(sampleEntry, tip, this->RiskMargin,
+                                        VTK_DOUBLE_MAX) <= this->RiskMargin)
+      {
+      ++numberOfRisks;
+      }
+    }
+
+  double numberOfSamples = std::max(this->NumberOfSamples, 1);
+  this->TargetHitProbabilities[index] = numberOfHits / numberOfSamples;
+  this->RiskProbabilities[index] = hasLabelMap ?
+    numberOfRisks / numberOfSamples : vtkMath::Nan();
+}
+
+//----------------------------------------------------------------------------
+VTK_THREAD_RETURN_TYPE vtkSlicerVisuaLineUncertaintyAnalysis
+::AnalyzePathsThread(void* arg)
+{
+  vtkMultiThreader::ThreadInfo* info =
+    static_cast<vtkMultiThreader::ThreadInfo*>(arg);
+  vtkSlicerVisuaLineUncertaintyAnalysis* self =
+    static_cast<vtkSlicerVisuaLineUncertaintyAnalysis*>(info->UserData);
+
+  // Results only depend on the path, any thread may sample it
+  int numberOfPaths = self->GetNumberOfPaths();
+  for (int i = info->ThreadID; i < numberOfPaths; i += info->NumberOfThreads)
+    {
+    if (!self->CachedPaths[i])
+      {
+      self->AnalyzePath(i);
+      }
+    }
+  return VTK_THREAD_RETURN_VALUE;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineUncertaintyAnalysis::Update()
+{
+  if (!this->DistanceMap)
+    {
+    this->DistanceMap = vtkSmartPointer<vtkSlicerVisuaLineDistanceMap>::New();
+    }
+  this->DistanceMap->Update();
+  this->UpdateTargetMask();
+  this->NumberOfCachedPaths = 0;
+  int numberOfPaths = this->GetNumberOfPaths();
+  if (numberOfPaths == 0)
+    {
+    return;
+    }
+
+  // Results of a path: target hit, risk, clearance
+  std::vector<std::string> keys;
+  this->CachedPaths.assign(numberOfPaths, 0);
+  if (this->Cache && this->Cache->IsEnabled())
+    {
+    keys.resize(numberOfPaths);
+    for (int i = 0; i < numberOfPaths; ++i)
+      {
+      keys[i] = this->GetPathKey(i);
+      double results[3];
+      if (this->Cache->Read(keys[i], results, sizeof(results)))
+        {
+        this->TargetHitProbabilities[i] = results[0];
+        this->RiskProbabilities[i] = results[1];
+        this->Clearances[i] = results[2];
+        this->CachedPaths[i] = 1;
+        ++this->NumberOfCachedPaths;
+        }
+      }
+    }
+
+  int numberOfSampledPaths = numberOfPaths - this->NumberOfCachedPaths;
+  if (numberOfSampledPaths > 0)
+    {
+    vtkNew<vtkMultiThreader> threader;
+    int numberOfThreads = this->NumberOfThreads > 0 ?
+      this->NumberOfThreads : threader->GetNumberOfThreads();
+    threader->SetNumberOfThreads(
+      std::max(1, std::min(numberOfThreads, numberOfSampledPaths)));
+    threader->SetSingleMethod(AnalyzePathsThread, this);
+    threader->SingleMethodExecute();
+    }
+
+  if (!keys.empty())
+    {
+    for (int i = 0; i < numberOfPaths; ++i)
+      {
+      if (!this->CachedPaths[i])
+        {
+        double results[3] = { this->TargetHitProbabilities[i],
+                              this->RiskProbabilities[i],
+                              this->Clearances[i] };
+        this->Cache->Store(keys[i], results, sizeof(results));
+        }
+      }
+    this->Cache->Flush();
+    }
+}
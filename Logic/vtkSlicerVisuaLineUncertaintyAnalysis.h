@@ -0,0 +1,174 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Laurent Chauvin, Brigham and Women's
+  Hospital. The project was supported by grants 5P01CA067165,
+  5R01CA124377, 5R01CA138586, 2R44DE019322, 7R01CA124377,
+  5R42CA137886, 8P41EB015898
+
+==============================================================================*/
+
+// .NAME vtkSlicerVisuaLineUncertaintyAnalysis - Monte Carlo placement error
+// .SECTION Description
+// Samples perturbed insertions of straight paths from an error model
+// (entry and target position, angle and depth) and estimates for each
+// path the probability of reaching the target and of crossing a risk
+// structure. Targets and risks are labels of a label map; without label
+// map the target is a sphere around the planned target.
+//
+// Risks are tested against a shared vtkSlicerVisuaLineDistanceMap of the
+// risk labels, which also gives the label map. Paths are sampled
+// in parallel. Each path has its own random stream, seeded from the seed
+// and its ID, so results do not depend on the number of threads or the
+// order of the paths. This also makes results cacheable: with a cache,
+// the results of a path are stored under a key of the label map, the
+// path and the error model, and read back instead of sampled again.
+
+#ifndef __vtkSlicerVisuaLineUncertaintyAnalysis_h
+#define __vtkSlicerVisuaLineUncertaintyAnalysis_h
+
+// VTK includes
+#include <vtkMultiThreader.h>
+#include <vtkObject.h>
+#include <vtkSmartPointer.h>
+#include <vtkTimeStamp.h>
+
+// STD includes
+#include <string>
+#include <vector>
+
+#include "vtkSlicerVisuaLineModuleLogicExport.h"
+
+class vtkSlicerVisuaLineAnalysisCache;
+class vtkSlicerVisuaLineDistanceMap;
+
+/// \ingroup Slicer_QtModules_VisuaLine
+class VTK_SLICER_VISUALINE_MODULE_LOGIC_EXPORT vtkSlicerVisuaLineUncertaintyAnalysis :
+  public vtkObject
+{
+public:
+
+  static vtkSlicerVisuaLineUncertaintyAnalysis *New();
+  vtkTypeMacro(vtkSlicerVisuaLineUncertaintyAnalysis, vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  /// Number of perturbed insertions per path
+  vtkSetMacro(NumberOfSamples, int);
+  vtkGetMacro(NumberOfSamples, int);
+
+  /// Same seed, same paths and same error model give the same results
+  vtkSetMacro(Seed, unsigned int);
+  vtkGetMacro(Seed, unsigned int);
+
+  /// Error model: standard deviations of the entry and target positions
+  /// (mm, isotropic), of the insertion angle (degrees) and of the
+  /// insertion depth (mm).
+  vtkSetMacro(EntryError, double);
+  vtkGetMacro(EntryError, double);
+  vtkSetMacro(TargetError, double);
+  vtkGetMacro(TargetError, double);
+  vtkSetMacro(AngularError, double);
+  vtkGetMacro(AngularError, double);
+  vtkSetMacro(DepthError, double);
+  vtkGetMacro(DepthError, double);
+
+  /// Radius (mm) of the target around the planned target, used when no
+  /// target label is set.
+  vtkSetMacro(TargetTolerance, double);
+  vtkGetMacro(TargetTolerance, double);
+
+  /// Distance (mm) under which a path crosses a risk structure
+  vtkSetMacro(RiskMargin, double);
+  vtkGetMacro(RiskMargin, double);
+
+  vtkSetMacro(NumberOfThreads, int);
+  vtkGetMacro(NumberOfThreads, int);
+
+  /// Risk distances and label map. The analysis owns one by default.
+  void SetDistanceMap(vtkSlicerVisuaLineDistanceMap* distanceMap);
+  vtkSlicerVisuaLineDistanceMap* GetDistanceMap();
+
+  /// Cache of the path results, none by default
+  void SetCache(vtkSlicerVisuaLineAnalysisCache* cache);
+  vtkSlicerVisuaLineAnalysisCache* GetCache();
+
+  /// Target label of the label map, 0 for the target tolerance sphere
+  void SetTargetLabel(int label);
+  int GetTargetLabel();
+
+  void RemoveAllPaths();
+  /// Add a path (world entry and target). Return its index.
+  int AddPath(const char* pathNodeID, const double entry[3], const double target[3]);
+  int GetNumberOfPaths();
+
+  /// Sample all paths
+  void Update();
+
+  /// Number of paths read from the cache by the last update
+  int GetNumberOfCachedPaths();
+
+  /// Results of the last update, NaN if not computed. The clearance is
+  /// the smallest distance of the planned path to a risk structure.
+  double GetTargetHitProbability(int index);
+  double GetRiskProbability(int index);
+  double GetClearance(int index);
+
+protected:
+  vtkSlicerVisuaLineUncertaintyAnalysis();
+  virtual ~vtkSlicerVisuaLineUncertaintyAnalysis();
+
+  void UpdateTargetMask();
+  void AnalyzePath(int index);
+  static VTK_THREAD_RETURN_TYPE AnalyzePathsThread(void* arg);
+
+  //BTX
+  bool IsInTarget(const double ras[3], const double plannedTarget[3]);
+  std::string GetPathKey(int index);
+
+  int NumberOfSamples;
+  unsigned int Seed;
+  double EntryError;
+  double TargetError;
+  double AngularError;
+  double DepthError;
+  double TargetTolerance;
+  double RiskMargin;
+  int NumberOfThreads;
+
+  vtkSmartPointer<vtkSlicerVisuaLineDistanceMap> DistanceMap;
+  vtkSmartPointer<vtkSlicerVisuaLineAnalysisCache> Cache;
+  int TargetLabel;
+  vtkTimeStamp TargetLabelTime;
+
+  // Voxels of the target label, indexed like the label map
+  std::vector<char> TargetMask;
+  vtkTimeStamp TargetMaskTime;
+
+  // Per path, indexed alike
+  std::vector<std::string> PathNodeIDs;
+  std::vector<double> EndPoints;   // entry, target: 6 per path
+  std::vector<double> TargetHitProbabilities;
+  std::vector<double> RiskProbabilities;
+  std::vector<double> Clearances;
+  std::vector<char> CachedPaths;
+  int NumberOfCachedPaths;
+  //ETX
+
+private:
+  vtkSlicerVisuaLineUncertaintyAnalysis(const vtkSlicerVisuaLineUncertaintyAnalysis&); // Not implemented
+  void operator=(const vtkSlicerVisuaLineUncertaintyAnalysis&);                         // Not implemented
+};
+
+#endif
@@ -0,0 +1,642 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Laurent Chauvin, Brigham and Women's
+  Hospital. The project was supported by grants 5P01CA067165,
+  5R01CA124377, 5R01CA138586, 2R44DE019322, 7R01CA124377,
+  5R42CA137886, 8P41EB015898
+
+==============================================================================*/
+
+// VisuaLine Logic includes
+#include "vtkSlicerVisuaLineUndoJournal.h"
+
+// VTK includes
+#include <vtkObjectFactory.h>
+#include <vtkTimerLog.h>
+
+// STD includes
+#include <algorithm>
+#include <deque>
+#include <map>
+
+//----------------------------------------------------------------------------
+class vtkSlicerVisuaLineUndoJournal::vtkInternal
+{
+public:
+  typedef vtkSlicerVisuaLineUndoJournal::PathState PathState;
+  typedef vtkSlicerVisuaLineUndoJournal::PathChange PathChange;
+
+  // Changed fields only: for each field of the mask, in mask order, its
+  // values before then after.
+  struct Delta
+    {
+    std::string PathNodeID;
+    unsigned char Fields;
+    std::vector<double> Values;
+    std::string HierarchyBefore;
+    std::string HierarchyAfter;
+    };
+
+  struct Entry
+    {
+    Entry() : Revision(0), Time(0.0), Closed(false), Memory(sizeof(Entry)) {}
+    vtkIdType Revision;
+    double Time;
+    // No more coalescing
+    bool Closed;
+    std::vector<Delta> Deltas;
+    vtkIdType Memory;
+    };
+
+  static int Compare(const PathState& a, const PathState& b);
+  static void CopyFields(const PathState& from, int fields, PathState& to);
+  static void Merge(const PathChange& next, PathChange& merged);
+  static void Encode(const PathChange& change, Delta& delta);
+  static void Decode(const Delta& delta, PathChange& change);
+  static vtkIdType GetMemory(const Delta& delta);
+
+  void AddToOpenEntry(const PathChange& change);
+  void SetDelta(Entry& entry, size_t index, const PathChange& change);
+
+  // Applied entries are before the cursor, undone ones after it
+  std::deque<Entry> Entries;
+  size_t Cursor;
+  std::map<std::string, PathState> States;
+  vtkIdType NextRevision;
+  // Revision of the last dropped entry
+  vtkIdType BaseRevision;
+  vtkIdType Memory;
+  int EntryDepth;
+  // Entry of Begin/EndEntry, added on its first change
+  bool EntryOpen;
+  // Delta of each path in the open entry
+  std::map<std::string, size_t> OpenDeltas;
+};
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLineUndoJournal::vtkInternal
+::Compare(const PathState& a, const PathState& b)
+{
+  int fields = 0;
+  for (int i = 0; i < 3; ++i)
+    {
+    if (a.Position1[i] != b.Position1[i] || a.Position2[i] != b.Position2[i])
+      {
+      fields |= GeometryField;
+      }
+    }
+  if (a.VirtualOffset != b.VirtualOffset)
+    {
+    fields |= VirtualOffsetField;
+    }
+  if (a.Visible != b.Visible)
+    {
+    fields |= VisibilityField;
+    }
+  if (a.Managed != b.Managed)
+    {
+    fields |= ManagedField;
+    }
+  return fields;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineUndoJournal::vtkInternal
+::CopyFields(const PathState& from, int fields, PathState& to)
+{
+  if (fields & GeometryField)
+    {
+    for (int i = 0; i < 3; ++i)
+      {
+      to.Position1[i] = from.Position1[i];
+      to.Position2[i] = from.Position2[i];
+      }
+    }
+  if (fields & VirtualOffsetField)
+    {
+    to.VirtualOffset = from.VirtualOffset;
+    }
+  if (fields & VisibilityField)
+    {
+    to.Visible = from.Visible;
+    }
+  if (fields & ManagedField)
+    {
+    to.Managed = from.Managed;
+    to.HierarchyNodeID = from.HierarchyNodeID;
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineUndoJournal::vtkInternal
+::Merge(const PathChange& next, PathChange& merged)
+{
+  // First before, last after of each field
+  CopyFields(next.Before, next.Fields & ~merged.Fields, merged.Before);
+  CopyFields(next.After, next.Fields, merged.After);
+  merged.Fields |= next.Fields;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineUndoJournal::vtkInternal
+::Encode(const PathChange& change, Delta& delta)
+{
+  int fields = change.Fields;
+  delta.PathNodeID = change.PathNodeID;
+  delta.Fields = static_cast<unsigned char>(fields);
+  std::vector<double> values;
+  values.reserve(((fields & GeometryField) ? 12 : 0) +
+                 ((fields & VirtualOffsetField) ? 2 : 0) +
+                 ((fields & VisibilityField) ? 2 : 0) +
+                 ((fields & ManagedField) ? 2 : 0));
+  const PathState* states[2] = { &change.Before, &change.After };
+  if (fields & GeometryField)
+    {
+    for (int s = 0; s < 2; ++s)
+      {
+      values.insert(values.end(), states[s]->Position1, states[s]->Position1 + 3);
+      values.insert(values.end(), states[s]->Position2, states[s]->Position2 + 3);
+      }
+    }
+  if (fields & VirtualOffsetField)
+    {
+    values.push_back(change.Before.VirtualOffset);
+    values.push_back(change.After.VirtualOffset);
+    }
+  if (fields & VisibilityField)
+    {
+    values.push_back(change.Before.Visible);
+    values.push_back(change.After.Visible);
+    }
+  delta.HierarchyBefore.clear();
+  delta.HierarchyAfter.clear();
+  if (fields & ManagedField)
+    {
+    values.push_back(change.Before.Managed);
+    values.push_back(change.After.Managed);
+    delta.HierarchyBefore = change.Before.HierarchyNodeID;
+    delta.HierarchyAfter = change.After.HierarchyNodeID;
+    }
+  delta.Values.swap(values);
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineUndoJournal::vtkInternal
+::Decode(const Delta& delta, PathChange& change)
+{
+  change = PathChange();
+  change.PathNodeID = delta.PathNodeID;
+  change.Fields = delta.Fields;
+  PathState* states[2] = { &change.Before, &change.After };
+  std::vector<double>::const_iterator value = delta.Values.begin();
+  if (delta.Fields & GeometryField)
+    {
+    for (int s = 0; s < 2; ++s)
+      {
+      std::copy(value, value + 3, states[s]->Position1);
+      std::copy(value + 3, value + 6, states[s]->Position2);
+      value += 6;
+      }
+    }
+  if (delta.Fields & VirtualOffsetField)
+    {
+    change.Before.VirtualOffset = *value++;
+    change.After.VirtualOffset = *value++;
+    }
+  if (delta.Fields & VisibilityField)
+    {
+    change.Before.Visible = *value++ != 0.0;
+    change.After.Visible = *value++ != 0.0;
+    }
+  if (delta.Fields & ManagedField)
+    {
+    change.Before.Managed = *value++ != 0.0;
+    change.After.Managed = *value++ != 0.0;
+    change.Before.HierarchyNodeID = delta.HierarchyBefore;
+    change.After.HierarchyNodeID = delta.HierarchyAfter;
+    }
+}
+
+//----------------------------------------------------------------------------
+vtkIdType vtkSlicerVisuaLineUndoJournal::vtkInternal::GetMemory(const Delta& delta)
+{
+  return static_cast<vtkIdType>(sizeof(Delta) + delta.PathNodeID.size() +
+    delta.Values.size() * sizeof(double) +
+    delta.HierarchyBefore.size() + delta.HierarchyAfter.size());
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineUndoJournal::vtkInternal
+::SetDelta(Entry& entry, size_t index, const PathChange& change)
+{
+  if (index == entry.Deltas.size())
+    {
+    entry.Deltas.push_back(Delta());
+    }
+  else
+    {
+    entry.Memory -= GetMemory(entry.Deltas[index]);
+    this->Memory -= GetMemory(entry.Deltas[index]);
+    }
+  Encode(change, entry.Deltas[index]);
+  entry.Memory += GetMemory(entry.Deltas[index]);
+  this->Memory += GetMemory(entry.Deltas[index]);
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineUndoJournal::vtkInternal
+::AddToOpenEntry(const PathChange& change)
+{
+  Entry& entry = this->Entries.back();
+  std::map<std::string, size_t>::iterator it = this->OpenDeltas.find(change.PathNodeID);
+  if (it == this->OpenDeltas.end())
+    {
+    this->OpenDeltas[change.PathNodeID] = entry.Deltas.size();
+    this->SetDelta(entry, entry.Deltas.size(), change);
+    return;
+    }
+  PathChange merged;
+  Decode(entry.Deltas[it->second], merged);
+  Merge(change, merged);
+  this->SetDelta(entry, it->second, merged);
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerVisuaLineUndoJournal::PathState::PathState()
+  : VirtualOffset(0.0), Visible(true), Managed(false)
+{
+  for (int i = 0; i < 3; ++i)
+    {
+    this->Position1[i] = 0.0;
+    this->Position2[i] = 0.0;
+    }
+}
+
+//----------------------------------------------------------------------------
+vtkStandardNewMacro(vtkSlicerVisuaLineUndoJournal);
+
+//----------------------------------------------------------------------------
+vtkSlicerVisuaLineUndoJournal::vtkSlicerVisuaLineUndoJournal()
+{
+  this->CoalescingTime = 1.0;
+  this->MaximumMemory = 4 * 1024 * 1024;
+  this->Internal = new vtkInternal;
+  this->Internal->Cursor = 0;
+  this->Internal->NextRevision = 1;
+  this->Internal->BaseRevision = 0;
+  this->Internal->Memory = 0;
+  this->Internal->EntryDepth = 0;
+  this->Internal->EntryOpen = false;
+}
+
+//----------------------------------------------------------------------------
+vtkSlicerVisuaLineUndoJournal::~vtkSlicerVisuaLineUndoJournal()
+{
+  delete this->Internal;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineUndoJournal::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os, indent);
+  os << indent << "NumberOfEntries: " << this->Internal->Entries.size() << "\n";
+  os << indent << "Revision: " << this->GetRevision() << "\n";
+  os << indent << "MemorySize: " << this->Internal->Memory << "\n";
+  os << indent << "MaximumMemory: " << this->MaximumMemory << "\n";
+  os << indent << "CoalescingTime: " << this->CoalescingTime << "\n";
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineUndoJournal
+::RecordState(const std::string& pathNodeID, const PathState& state)
+{
+  vtkInternal* internal = this->Internal;
+  std::map<std::string, PathState>::iterator it = internal->States.find(pathNodeID);
+  if (it == internal->States.end())
+    {
+    internal->States[pathNodeID] = state;
+    return;
+    }
+  int fields = vtkInternal::Compare(it->second, state);
+  if (!fields)
+    {
+    // Hierarchy moves are not undone but restored with the path
+    it->second.HierarchyNodeID = state.HierarchyNodeID;
+    return;
+    }
+  PathChange change;
+  change.PathNodeID = pathNodeID;
+  change.Fields = fields;
+  vtkInternal::CopyFields(it->second, fields, change.Before);
+  vtkInternal::CopyFields(state, fields, change.After);
+  it->second = state;
+
+  double now = vtkTimerLog::GetUniversalTime();
+  if (internal->EntryDepth > 0)
+    {
+    if (!internal->EntryOpen)
+      {
+      this->TruncateRedo();
+      vtkInternal::Entry entry;
+      entry.Revision = internal->NextRevision++;
+      entry.Time = now;
+      internal->Entries.push_back(entry);
+      internal->Memory += entry.Memory;
+      internal->Cursor = internal->Entries.size();
+      internal->EntryOpen = true;
+      }
+    internal->AddToOpenEntry(change);
+    this->Modified();
+    return;
+    }
+
+  this->TruncateRedo();
+  vtkInternal::Entry* last = internal->Entries.empty() ? 0 : &internal->Entries.back();
+  if (last && !last->Closed && last->Deltas.size() == 1 &&
+      last->Deltas[0].PathNodeID == pathNodeID && last->Deltas[0].Fields == fields &&
+      (fields == GeometryField || fields == VirtualOffsetField) &&
+      now - last->Time <= this->CoalescingTime)
+    {
+    // Drag or slider move: keep the state before the first change
+    PathChange merged;
+    vtkInternal::Decode(last->Deltas[0], merged);
+    vtkInternal::Merge(change, merged);
+    internal->SetDelta(*last, 0, merged);
+    last->Time = now;
+    }
+  else
+    {
+    vtkInternal::Entry entry;
+    entry.Revision = internal->NextRevision++;
+    entry.Time = now;
+    internal->Entries.push_back(entry);
+    internal->Memory += entry.Memory;
+    internal->SetDelta(internal->Entries.back(), 0, change);
+    internal->Cursor = internal->Entries.size();
+    }
+  this->ReduceMemory();
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineUndoJournal::ForgetPath(const std::string& pathNodeID)
+{
+  this->Internal->States.erase(pathNodeID);
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineUndoJournal::BeginEntry()
+{
+  // The entry is added with its first change: an empty batch leaves the
+  // history as it is
+  ++this->Internal->EntryDepth;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineUndoJournal::EndEntry()
+{
+  vtkInternal* internal = this->Internal;
+  if (internal->EntryDepth == 0 || --internal->EntryDepth > 0)
+    {
+    return;
+    }
+  if (!internal->EntryOpen)
+    {
+    return;
+    }
+  internal->Entries.back().Closed = true;
+  internal->EntryOpen = false;
+  internal->OpenDeltas.clear();
+  this->ReduceMemory();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineUndoJournal::CloseEntry()
+{
+  if (!this->Internal->Entries.empty() && this->Internal->EntryDepth == 0)
+    {
+    this->Internal->Entries.back().Closed = true;
+    }
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerVisuaLineUndoJournal::Undo(std::vector<PathChange>& changes)
+{
+  vtkInternal* internal = this->Internal;
+  changes.clear();
+  if (!this->CanUndo())
+    {
+    return false;
+    }
+  vtkInternal::Entry& entry = internal->Entries[--internal->Cursor];
+  entry.Closed = true;
+  changes.resize(entry.Deltas.size());
+  for (size_t i = 0; i < entry.Deltas.size(); ++i)
+    {
+    vtkInternal::Decode(entry.Deltas[i], changes[i]);
+    std::map<std::string, PathState>::iterator it =
+      internal->States.find(changes[i].PathNodeID);
+    if (it != internal->States.end())
+      {
+      RestoreState(changes[i], false, it->second);
+      }
+    }
+  this->Modified();
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerVisuaLineUndoJournal::Redo(std::vector<PathChange>& changes)
+{
+  vtkInternal* internal = this->Internal;
+  changes.clear();
+  if (!this->CanRedo())
+    {
+    return false;
+    }
+  vtkInternal::Entry& entry = internal->Entries[internal->Cursor++];
+  changes.resize(entry.Deltas.size());
+  for (size_t i = 0; i < entry.Deltas.size(); ++i)
+    {
+    vtkInternal::Decode(entry.Deltas[i], changes[i]);
+    std::map<std::string, PathState>::iterator it =
+      internal->States.find(changes[i].PathNodeID);
+    if (it != internal->States.end())
+      {
+      RestoreState(changes[i], true, it->second);
+      }
+    }
+  this->Modified();
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerVisuaLineUndoJournal
+::GetChanges(vtkIdType fromRevision, std::vector<PathChange>& changes)
+{
+  vtkInternal* internal = this->Internal;
+  changes.clear();
+
+  // Only revisions of applied entries, or the first kept state
+  size_t start = 0;
+  if (fromRevision != internal->BaseRevision)
+    {
+    while (start < internal->Cursor && internal->Entries[start].Revision != fromRevision)
+      {
+      ++start;
+      }
+    if (start == internal->Cursor)
+      {
+      return false;
+      }
+    ++start;
+    }
+
+  std::map<std::string, size_t> indices;
+  PathChange change;
+  for (size_t i = start; i < internal->Cursor; ++i)
+    {
+    const vtkInternal::Entry& entry = internal->Entries[i];
+    for (size_t j = 0; j < entry.Deltas.size(); ++j)
+      {
+      vtkInternal::Decode(entry.Deltas[j], change);
+      std::map<std::string, size_t>::iterator it = indices.find(change.PathNodeID);
+      if (it == indices.end())
+        {
+        indices[change.PathNodeID] = changes.size();
+        changes.push_back(change);
+        }
+      else
+        {
+        vtkInternal::Merge(change, changes[it->second]);
+        }
+      }
+    }
+
+  // Fields changed back and forth are no change
+  size_t numberOfChanges = 0;
+  for (size_t i = 0; i < changes.size(); ++i)
+    {
+    int fields = changes[i].Fields &
+      vtkInternal::Compare(changes[i].Before, changes[i].After);
+    if (fields)
+      {
+      changes[i].Fields = fields;
+      changes[numberOfChanges++] = changes[i];
+      }
+    }
+  changes.resize(numberOfChanges);
+  return true;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineUndoJournal
+::RestoreState(const PathChange& change, bool after, PathState& state)
+{
+  vtkInternal::CopyFields(after ? change.After : change.Before, change.Fields, state);
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerVisuaLineUndoJournal::CanUndo()
+{
+  return this->Internal->EntryDepth == 0 && this->Internal->Cursor > 0;
+}
+
+//----------------------------------------------------------------------------
+bool vtkSlicerVisuaLineUndoJournal::CanRedo()
+{
+  return this->Internal->EntryDepth == 0 &&
+    this->Internal->Cursor < this->Internal->Entries.size();
+}
+
+//----------------------------------------------------------------------------
+int vtkSlicerVisuaLineUndoJournal::GetNumberOfEntries()
+{
+  return static_cast<int>(this->Internal->Entries.size());
+}
+
+//----------------------------------------------------------------------------
+vtkIdType vtkSlicerVisuaLineUndoJournal::GetRevision()
+{
+  return this->Internal->Cursor > 0 ?
+    this->Internal->Entries[this->Internal->Cursor - 1].Revision :
+    this->Internal->BaseRevision;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineUndoJournal::Clear()
+{
+  vtkInternal* internal = this->Internal;
+  internal->Entries.clear();
+  internal->States.clear();
+  internal->OpenDeltas.clear();
+  internal->Cursor = 0;
+  internal->Memory = 0;
+  internal->EntryDepth = 0;
+  internal->EntryOpen = false;
+  internal->BaseRevision = internal->NextRevision - 1;
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineUndoJournal::SetMaximumMemory(vtkIdType bytes)
+{
+  if (this->MaximumMemory == bytes)
+    {
+    return;
+    }
+  this->MaximumMemory = bytes;
+  this->ReduceMemory();
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+vtkIdType vtkSlicerVisuaLineUndoJournal::GetMemorySize()
+{
+  return this->Internal->Memory;
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineUndoJournal::TruncateRedo()
+{
+  vtkInternal* internal = this->Internal;
+  while (internal->Entries.size() > internal->Cursor)
+    {
+    internal->Memory -= internal->Entries.back().Memory;
+    internal->Entries.pop_back();
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkSlicerVisuaLineUndoJournal::ReduceMemory()
+{
+  // Undone entries go first, then the oldest ones. The last entry is
+  // kept whatever its size.
+  vtkInternal* internal = this->Internal;
+  while (internal->Memory > this->MaximumMemory && internal->Entries.size() > 1)
+    {
+    if (internal->Cursor < internal->Entries.size())
+      {
+      internal->Memory -= internal->Entries.back().Memory;
+      internal->Entries.pop_back();
+      continue;
+      }
+    internal->BaseRevision = internal->Entries.front().Revision;
+    internal->Memory -= internal->Entries.front().Memory;
+    internal->Entries.pop_front();
+    --internal->Cursor;
+    }
+}
@@ -0,0 +1,158 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Laurent Chauvin, Brigham and Women's
+  Hospital. The project was supported by grants 5P01CA067165,
+  5R01CA124377, 5R01CA138586, 2R44DE019322, 7R01CA124377,
+  5R42CA137886, 8P41EB015898
+
+==============================================================================*/
+
+// .NAME vtkSlicerVisuaLineUndoJournal - undo history of path edits
+// .SECTION Description
+// Each entry holds the deltas of the paths it changed: only the changed
+// fields (geometry, virtual offset, visibility, managed state) are kept,
+// before and after. The journal keeps the last recorded state of each
+// path and compares new states to it, so undo and redo only touch the
+// paths of one entry. Successive geometry (drag) or offset changes of a
+// path are coalesced into one entry. The oldest entries are dropped once
+// the history goes over its memory budget.
+//
+// Entries are numbered with increasing revisions: the deltas between a
+// revision and the current one describe a revision of the plan.
+
+#ifndef __vtkSlicerVisuaLineUndoJournal_h
+#define __vtkSlicerVisuaLineUndoJournal_h
+
+// VTK includes
+#include <vtkObject.h>
+
+// STD includes
+#include <string>
+#include <vector>
+
+#include "vtkSlicerVisuaLineModuleLogicExport.h"
+
+/// \ingroup Slicer_QtModules_VisuaLine
+class VTK_SLICER_VISUALINE_MODULE_LOGIC_EXPORT vtkSlicerVisuaLineUndoJournal :
+  public vtkObject
+{
+public:
+
+  static vtkSlicerVisuaLineUndoJournal *New();
+  vtkTypeMacro(vtkSlicerVisuaLineUndoJournal, vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  enum
+    {
+    GeometryField = 1,
+    VirtualOffsetField = 2,
+    VisibilityField = 4,
+    ManagedField = 8
+    };
+
+  //BTX
+  struct PathState
+    {
+    PathState();
+    /// Ruler points, in ruler (local) coordinates
+    double Position1[3];
+    double Position2[3];
+    double VirtualOffset;
+    bool Visible;
+    bool Managed;
+    /// Path list, restored with the managed state
+    std::string HierarchyNodeID;
+    };
+
+  /// Fields of a path changed by an entry, before and after it. Fields
+  /// out of the mask are left to their default.
+  struct PathChange
+    {
+    PathChange() : Fields(0) {}
+    std::string PathNodeID;
+    int Fields;
+    PathState Before;
+    PathState After;
+    };
+
+  /// Record the current state of a path. A path first recorded is only
+  /// taken as reference; later states make an entry with their changed
+  /// fields, unless nothing changed.
+  void RecordState(const std::string& pathNodeID, const PathState& state);
+  /// Drop the reference state of a path, e.g. once its node is deleted
+  void ForgetPath(const std::string& pathNodeID);
+
+  /// Move back (forward) one entry. 'changes' are the deltas of that
+  /// entry: restore their Before (After) fields. Return false if there is
+  /// nothing to undo (redo).
+  bool Undo(std::vector<PathChange>& changes);
+  bool Redo(std::vector<PathChange>& changes);
+
+  /// Deltas from a revision to the current one, one per changed path.
+  /// Return false if the revision was dropped or undone.
+  bool GetChanges(vtkIdType fromRevision, std::vector<PathChange>& changes);
+
+  /// Copy the fields of a change into a state, after or before it
+  static void RestoreState(const PathChange& change, bool after, PathState& state);
+  //ETX
+
+  /// Changes recorded between Begin and EndEntry make one entry, e.g. a
+  /// batch visibility change. Calls can be nested.
+  void BeginEntry();
+  void EndEntry();
+  /// Stop coalescing changes into the last entry
+  void CloseEntry();
+
+  bool CanUndo();
+  bool CanRedo();
+  int GetNumberOfEntries();
+  /// Revision of the last applied entry, 0 before any entry
+  vtkIdType GetRevision();
+
+  /// Forget all entries and recorded states
+  void Clear();
+
+  /// Changes of the same path and fields coalesce within this delay (s)
+  vtkSetMacro(CoalescingTime, double);
+  vtkGetMacro(CoalescingTime, double);
+
+  /// History budget in bytes, 4 MB by default
+  void SetMaximumMemory(vtkIdType bytes);
+  vtkGetMacro(MaximumMemory, vtkIdType);
+  /// Estimated memory of the entries
+  vtkIdType GetMemorySize();
+
+protected:
+  vtkSlicerVisuaLineUndoJournal();
+  virtual ~vtkSlicerVisuaLineUndoJournal();
+
+  void TruncateRedo();
+  void ReduceMemory();
+
+  double CoalescingTime;
+  vtkIdType MaximumMemory;
+
+  //BTX
+  class vtkInternal;
+  vtkInternal* Internal;
+  //ETX
+
+private:
+  vtkSlicerVisuaLineUndoJournal(const vtkSlicerVisuaLineUndoJournal&); // Not implemented
+  void operator=(const vtkSlicerVisuaLineUndoJournal&);                // Not implemented
+};
+
+#endif
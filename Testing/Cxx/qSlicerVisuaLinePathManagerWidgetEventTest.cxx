@@ -0,0 +1,322 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Laurent Chauvin, Brigham and Women's
+  Hospital. The project was supported by grants 5P01CA067165,
+  5R01CA124377, 5R01CA138586, 2R44DE019322, 7R01CA124377,
+  5R42CA137886, 8P41EB015898
+
+==============================================================================*/
+
+// Qt includes
+#include <QAbstractItemModel>
+#include <QApplication>
+#include <QSignalSpy>
+#include <QTreeView>
+
+// VisuaLine includes
+#include "qSlicerVisuaLinePathManagerWidget.h"
+#include "qSlicerVisuaLineTestingUtilities.h"
+#include "vtkSlicerVisuaLineLogic.h"
+
+// MRML includes
+#include <vtkMRMLAnnotationHierarchyNode.h>
+#include <vtkMRMLAnnotationRulerNode.h>
+#include <vtkMRMLDisplayNode.h>
+#include <vtkMRMLScene.h>
+
+// VTK includes
+#include <vtkCallbackCommand.h>
+#include <vtkCollection.h>
+#include <vtkNew.h>
+#include <vtkSmartPointer.h>
+
+// STD includes
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+using qSlicerVisuaLineTestingUtilities::ProcessEvents;
+
+// Each scripted operation on a path list runs with every scene node
+// observed and the tree model spied. It fails when its modified events,
+// tree model signals or render requests go over the operation budget, as
+// a feedback loop between the widget, the logic and the nodes would.
+// Without 3D view, render requests are counted as the display node
+// modifications and node additions/removals the displayable managers
+// render on. Within a scene batch process they do not render, the end of
+// the batch renders once.
+
+namespace
+{
+const int NumberOfPaths = 50;
+
+//----------------------------------------------------------------------------
+struct EventCounts
+{
+  EventCounts() : ModifiedEvents(0), RenderRequests(0) {}
+  int ModifiedEvents;
+  int RenderRequests;
+};
+
+//----------------------------------------------------------------------------
+void CountEvent(vtkObject* caller, unsigned long event, void* clientData, void*)
+{
+  EventCounts* counts = static_cast<EventCounts*>(clientData);
+  if (event == vtkCommand::ModifiedEvent)
+    {
+    ++counts->ModifiedEvents;
+    vtkMRMLDisplayNode* displayNode = vtkMRMLDisplayNode::SafeDownCast(caller);
+    if (displayNode &&
+        !(displayNode->GetScene() && displayNode->GetScene()->IsBatchProcessing()))
+      {
+      ++counts->RenderRequests;
+      }
+    }
+  else if (event == vtkMRMLScene::EndBatchProcessEvent ||
+           !vtkMRMLScene::SafeDownCast(caller)->IsBatchProcessing())
+    {
+    ++counts->RenderRequests;
+    }
+}
+
+//----------------------------------------------------------------------------
+class EventRecorder
+{
+public:
+  EventRecorder(vtkMRMLScene* scene, QAbstractItemModel* model)
+    : Scene(scene)
+    {
+    this->Callback->SetCallback(CountEvent);
+    this->Callback->SetClientData(&this->Counts);
+
+    // Nodes are held so that deleted ones can still be unobserved
+    vtkCollection* nodes = scene->GetNodes();
+    for (int i = 0; i < nodes->GetNumberOfItems(); ++i)
+      {
+      vtkObject* node = nodes->GetItemAsObject(i);
+      this->Nodes.push_back(node);
+      this->Tags.push_back(node->AddObserver(vtkCommand::ModifiedEvent,
+                                             this->Callback.GetPointer()));
+      }
+    this->SceneTags.push_back(scene->AddObserver(vtkMRMLScene::NodeAddedEvent,
+                                                 this->Callback.GetPointer()));
+    this->SceneTags.push_back(scene->AddObserver(vtkMRMLScene::NodeRemovedEvent,
+                                                 this->Callback.GetPointer()));
+    this->SceneTags.push_back(scene->AddObserver(vtkMRMLScene::EndBatchProcessEvent,
+                                                 this->Callback.GetPointer()));
+
+    const char* modelSignals[] =
+      {
+      SIGNAL(dataChanged(QModelIndex,QModelIndex)),
+      SIGNAL(rowsInserted(QModelIndex,int,int)),
+      SIGNAL(rowsRemoved(QModelIndex,int,int)),
+      SIGNAL(layoutChanged()),
+      SIGNAL(modelReset())
+      };
+    for (size_t i = 0; i < sizeof(modelSignals) / sizeof(modelSignals[0]); ++i)
+      {
+      this->Spies.push_back(new QSignalSpy(model, modelSignals[i]));
+      }
+    }
+
+  ~EventRecorder()
+    {
+    for (size_t i = 0; i < this->Nodes.size(); ++i)
+      {
+      this->Nodes[i]->RemoveObserver(this->Tags[i]);
+      }
+    for (size_t i = 0; i < this->SceneTags.size(); ++i)
+      {
+      this->Scene->RemoveObserver(this->SceneTags[i]);
+      }
+    qDeleteAll(this->Spies);
+    }
+
+  int GetModelSignals()const
+    {
+    int count = 0;
+    foreach(QSignalSpy* spy, this->Spies)
+      {
+      count += spy->count();
+      }
+    return count;
+    }
+
+  EventCounts Counts;
+
+private:
+  vtkMRMLScene* Scene;
+  vtkNew<vtkCallbackCommand> Callback;
+  std::vector<vtkSmartPointer<vtkObject> > Nodes;
+  std::vector<unsigned long> Tags;
+  std::vector<unsigned long> SceneTags;
+  QList<QSignalSpy*> Spies;
+};
+
+//----------------------------------------------------------------------------
+struct Budget
+{
+  int ModifiedEvents;
+  int ModelSignals;
+  int RenderRequests;
+};
+
+//----------------------------------------------------------------------------
+bool CheckBudget(const char* operation, const EventRecorder& recorder,
+                 const Budget& budget)
+{
+  int modelSignals = recorder.GetModelSignals();
+  std::cout << operation
+            << ": " << recorder.Counts.ModifiedEvents << " modified events"
+            << ", " << modelSignals << " model signals"
+            << ", " << recorder.Counts.RenderRequests << " render requests"
+            << std::endl;
+  if (recorder.Counts.ModifiedEvents > budget.ModifiedEvents ||
+      modelSignals > budget.ModelSignals ||
+      recorder.Counts.RenderRequests > budget.RenderRequests)
+    {
+    std::cerr << operation << ": over budget ("
+              << budget.ModifiedEvents << " modified events, "
+              << budget.ModelSignals << " model signals, "
+              << budget.RenderRequests << " render requests)" << std::endl;
+    return false;
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+vtkMRMLAnnotationRulerNode* AddRuler(vtkMRMLScene* scene,
+                                     vtkMRMLAnnotationHierarchyNode* pathList,
+                                     int index)
+{
+  std::ostringstream name;
+  name << "Path" << index;
+  double entry[3] = { 10.0 * index, 0.0, 100.0 };
+  double target[3] = { 10.0 * index, 0.0, 0.0 };
+  return qSlicerVisuaLineTestingUtilities::AddRuler(
+    scene, pathList, name.str().c_str(), entry, target);
+}
+
+} // end of anonymous namespace
+
+//----------------------------------------------------------------------------
+int qSlicerVisuaLinePathManagerWidgetEventTest(int argc, char* argv[])
+{
+  QApplication app(argc, argv);
+
+  vtkNew<vtkMRMLScene> scene;
+  vtkSmartPointer<vtkSlicerVisuaLineLogic> logic =
+    vtkSmartPointer<vtkSlicerVisuaLineLogic>::New();
+  logic->SetMRMLScene(scene.GetPointer());
+
+  qSlicerVisuaLinePathManagerWidget widget;
+  widget.setLogic(logic);
+  widget.setMRMLScene(scene.GetPointer());
+
+  // Synthetic path list
+  vtkNew<vtkMRMLAnnotationHierarchyNode> pathList;
+  pathList->SetName("Plan");
+  scene->AddNode(pathList.GetPointer());
+  std::vector<std::string> pathNodeIDs;
+  for (int i = 0; i < NumberOfPaths; ++i)
+    {
+    pathNodeIDs.push_back(AddRuler(scene.GetPointer(), pathList.GetPointer(), i)->GetID());
+    }
+  QMetaObject::invokeMethod(&widget, "onHierarchyNodeChanged",
+                            Q_ARG(vtkMRMLNode*, pathList.GetPointer()));
+  ProcessEvents();
+
+  QTreeView* treeView = widget.findChild<QTreeView*>("PathTreeView");
+  QAbstractItemModel* model = treeView ? treeView->model() : 0;
+  if (!model || model->rowCount() != NumberOfPaths)
+    {
+    std::cerr << "Line " << __LINE__ << ": expected " << NumberOfPaths
+              << " paths in the tree, got " << (model ? model->rowCount() : 0)
+              << std::endl;
+    return EXIT_FAILURE;
+    }
+  vtkMRMLAnnotationRulerNode* path = logic->GetPathNode(pathNodeIDs[0].c_str());
+
+  // Budgets of single path operations do not depend on the number of
+  // paths: a change that refreshes the whole list goes over them.
+  bool success = true;
+  {
+  EventRecorder recorder(scene.GetPointer(), model);
+  AddRuler(scene.GetPointer(), pathList.GetPointer(), NumberOfPaths);
+  logic->UpdatePathHierarchy(pathList->GetID());
+  ProcessEvents();
+  Budget budget = { 40, 20, 30 };
+  success = CheckBudget("Add", recorder, budget) && success;
+  }
+  {
+  EventRecorder recorder(scene.GetPointer(), model);
+  for (int i = 1; i <= 10; ++i)
+    {
+    // Drag of the entry point: one modification per mouse move
+    double entry[3] = { 0.0, i, 100.0 };
+    path->SetPosition1(entry);
+    }
+  ProcessEvents();
+  Budget budget = { 10 * 6, 20, 10 * 4 };
+  success = CheckBudget("Drag", recorder, budget) && success;
+  }
+  {
+  EventRecorder recorder(scene.GetPointer(), model);
+  path->SetName("Renamed");
+  ProcessEvents();
+  Budget budget = { 10, 10, 5 };
+  success = CheckBudget("Rename", recorder, budget) && success;
+  }
+  {
+  // First offset creates the offset ruler, later ones move it
+  EventRecorder recorder(scene.GetPointer(), model);
+  for (int i = 1; i <= 10; ++i)
+    {
+    logic->SetPathVirtualOffset(path->GetID(), i);
+    }
+  ProcessEvents();
+  Budget budget = { 10 * 8, 20, 10 * 6 };
+  success = CheckBudget("Virtual offset", recorder, budget) && success;
+  }
+  {
+  // Batch operations: modified events per path, a single model range
+  // and render per batch
+  EventRecorder recorder(scene.GetPointer(), model);
+  widget.hideAllPaths();
+  ProcessEvents();
+  widget.showAllPaths();
+  ProcessEvents();
+  int n = 2 * (NumberOfPaths + 1);
+  Budget budget = { 6 * n, 2, 2 };
+  success = CheckBudget("Visibility", recorder, budget) && success;
+  }
+  {
+  EventRecorder recorder(scene.GetPointer(), model);
+  scene->RemoveNode(path);
+  ProcessEvents();
+  Budget budget = { 30, 10, 20 };
+  success = CheckBudget("Delete", recorder, budget) && success;
+  }
+
+  if (model->rowCount() != NumberOfPaths)
+    {
+    std::cerr << "Line " << __LINE__ << ": expected " << NumberOfPaths
+              << " paths after add and delete, got " << model->rowCount() << std::endl;
+    return EXIT_FAILURE;
+    }
+  return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,640 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Laurent Chauvin, Brigham and Women's
+  Hospital. The project was supported by grants 5P01CA067165,
+  5R01CA124377, 5R01CA138586, 2R44DE019322, 7R01CA124377,
+  5R42CA137886, 8P41EB015898
+
+==============================================================================*/
+
+// Qt includes
+#include <QAbstractItemModel>
+#include <QApplication>
+#include <QTreeView>
+
+// VisuaLine includes
+#include "qSlicerVisuaLinePathManagerWidget.h"
+#include "qSlicerVisuaLineTestingUtilities.h"
+#include "vtkSlicerVisuaLineLogic.h"
+#include "vtkSlicerVisuaLinePathStore.h"
+
+// MRML includes
+#include <vtkMRMLAnnotationFiducialNode.h>
+#include <vtkMRMLAnnotationHierarchyNode.h>
+#include <vtkMRMLAnnotationRulerNode.h>
+#include <vtkMRMLScene.h>
+
+// VTK includes
+#include <vtkCollection.h>
+#include <vtkNew.h>
+#include <vtkSmartPointer.h>
+#include <vtkTimerLog.h>
+#include <vtkWeakPointer.h>
+
+// STD includes
+#include <cstdlib>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using qSlicerVisuaLineTestingUtilities::ProcessEvents;
+
+// Random add, remove, rename, drag, offset, visibility, move, path list
+// switch and pre-indexing operations on synthetic scenes of increasing
+// size. After each operation the tree, the logic and the scene must
+// agree:
+//  - the tree lists the rulers of the selected path list, by name
+//  - a managed path list holds the rulers filed under it in the scene
+//  - managed paths are in the scene, listed ones with their target
+//  - no target or offset refers to a ruler missing from the scene
+// Once the widget, the logic and the scene are deleted no ruler may be
+// left. Throughput is printed per operation and scene size.
+//
+// Usage: qSlicerVisuaLinePathManagerWidgetFuzzTest [operations [seed]]
+
+namespace
+{
+const int DefaultNumberOfOperations = 1000;
+const unsigned int DefaultSeed = 1;
+const int NumberOfPathLists = 4;
+const int SceneSizes[] = { 100, 1000 };
+
+// Tags of the logic on the target and virtual offset nodes
+const char* TargetOfAttributeName = "VisuaLine.TargetOf";
+const char* VirtualOffsetOfAttributeName = "VisuaLine.VirtualOffsetOf";
+
+enum Operation
+{
+  AddOperation = 0,
+  RemoveOperation,
+  RenameOperation,
+  DragOperation,
+  OffsetOperation,
+  VisibilityOperation,
+  MoveOperation,
+  SwitchOperation,
+  PreIndexOperation,
+  NumberOfOperationTypes
+};
+
+const char* OperationNames[NumberOfOperationTypes] =
+{
+  "Add", "Remove", "Rename", "Drag", "Virtual offset", "Visibility",
+  "Move", "Switch list", "Pre-index"
+};
+
+// Relative frequencies
+const int OperationWeights[NumberOfOperationTypes] =
+{
+  15, 10, 15, 15, 10, 10, 10, 10, 5
+};
+
+//----------------------------------------------------------------------------
+// Same sequence on every platform for a given seed
+class RandomSequence
+{
+public:
+  RandomSequence(unsigned int seed) : State(seed) {}
+
+  int Integer(int count)
+    {
+    return count > 0 ? static_cast<int>(this->Next() % count) : 0;
+    }
+
+  double Uniform(double min, double max)
+    {
+    return min + (max - min) * (this->Next() % 1000000) / 1000000.0;
+    }
+
+private:
+  unsigned int Next()
+    {
+    this->State = this->State * 1103515245u + 12345u;
+    unsigned int high = (this->State >> 16) & 0x7fff;
+    this->State = this->State * 1103515245u + 12345u;
+    return (high << 15) | ((this->State >> 16) & 0x7fff);
+    }
+
+  unsigned int State;
+};
+
+//----------------------------------------------------------------------------
+struct Throughput
+{
+  Throughput() : Count(0), Time(0.0) {}
+  int Count;
+  double Time;
+};
+
+//----------------------------------------------------------------------------
+// Rulers filed directly under a path list, virtual offsets excluded
+void GetListRulers(vtkMRMLAnnotationHierarchyNode* pathList,
+                   std::vector<vtkMRMLAnnotationRulerNode*>& rulers)
+{
+  rulers.clear();
+  int childCount = pathList->GetNumberOfChildrenNodes();
+  for (int i = 0; i < childCount; ++i)
+    {
+    vtkMRMLHierarchyNode* child = pathList->GetNthChildNode(i);
+    vtkMRMLAnnotationRulerNode* ruler = child ?
+      vtkMRMLAnnotationRulerNode::SafeDownCast(child->GetAssociatedNode()) : 0;
+    if (ruler && ruler->GetID() &&
+        !ruler->GetAttribute(VirtualOffsetOfAttributeName))
+      {
+      rulers.push_back(ruler);
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+class Harness
+{
+public:
+  Harness(vtkMRMLScene* scene, vtkSlicerVisuaLineLogic* logic,
+          qSlicerVisuaLinePathManagerWidget* widget, unsigned int seed)
+    : Scene(scene), Logic(logic), Widget(widget), Random(seed),
+      NameCounter(0), CheckTime(0.0)
+    {
+    }
+
+  void BuildScene(int numberOfPaths);
+  bool Run(int numberOfOperations);
+  bool CheckInvariants(int operationIndex, int operation);
+  void PrintThroughput(int numberOfPaths);
+
+  /// Every ruler created, to find the leaked ones
+  std::vector<vtkWeakPointer<vtkMRMLAnnotationRulerNode> > CreatedRulers;
+
+private:
+  vtkMRMLAnnotationRulerNode* AddRuler(vtkMRMLAnnotationHierarchyNode* pathList);
+  vtkMRMLAnnotationRulerNode* RandomRuler();
+  void RunOperation(int operation);
+  int RandomOperation();
+  QAbstractItemModel* TreeModel();
+
+  vtkMRMLScene* Scene;
+  vtkSlicerVisuaLineLogic* Logic;
+  qSlicerVisuaLinePathManagerWidget* Widget;
+  RandomSequence Random;
+  int NameCounter;
+
+  std::vector<vtkSmartPointer<vtkMRMLAnnotationHierarchyNode> > PathLists;
+  vtkWeakPointer<vtkMRMLAnnotationHierarchyNode> SelectedPathList;
+  std::vector<vtkWeakPointer<vtkMRMLAnnotationRulerNode> > Rulers;
+
+  Throughput Operations[NumberOfOperationTypes];
+  double CheckTime;
+};
+
+//----------------------------------------------------------------------------
+vtkMRMLAnnotationRulerNode* Harness
+::AddRuler(vtkMRMLAnnotationHierarchyNode* pathList)
+{
+  std::ostringstream name;
+  name << "Path" << this->NameCounter++;
+  double entry[3] =
+    {
+    this->Random.Uniform(-100.0, 100.0),
+    this->Random.Uniform(-100.0, 100.0),
+    this->Random.Uniform(50.0, 150.0)
+    };
+  double target[3] =
+    {
+    this->Random.Uniform(-20.0, 20.0),
+    this->Random.Uniform(-20.0, 20.0),
+    this->Random.Uniform(-20.0, 20.0)
+    };
+  vtkMRMLAnnotationRulerNode* ruler = qSlicerVisuaLineTestingUtilities::AddRuler(
+    this->Scene, pathList, name.str().c_str(), entry, target);
+  this->Rulers.push_back(ruler);
+  this->CreatedRulers.push_back(ruler);
+  return ruler;
+}
+
+//----------------------------------------------------------------------------
+vtkMRMLAnnotationRulerNode* Harness::RandomRuler()
+{
+  // Removed rulers are dropped on the way
+  while (!this->Rulers.empty())
+    {
+    int index = this->Random.Integer(static_cast<int>(this->Rulers.size()));
+    if (this->Rulers[index] && this->Scene->IsNodePresent(this->Rulers[index]))
+      {
+      return this->Rulers[index];
+      }
+    this->Rulers[index] = this->Rulers.back();
+    this->Rulers.pop_back();
+    }
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+QAbstractItemModel* Harness::TreeModel()
+{
+  QTreeView* treeView = this->Widget->findChild<QTreeView*>("PathTreeView");
+  return treeView ? treeView->model() : 0;
+}
+
+//----------------------------------------------------------------------------
+void Harness::BuildScene(int numberOfPaths)
+{
+  // Imported as a scene: the lists are queued for pre-indexing
+  this->Scene->StartState(vtkMRMLScene::BatchProcessState);
+  this->Scene->StartState(vtkMRMLScene::ImportState);
+  vtkNew<vtkMRMLAnnotationHierarchyNode> topLevel;
+  topLevel->SetName("All Annotations");
+  this->Scene->AddNode(topLevel.GetPointer());
+  for (int i = 0; i < NumberOfPathLists; ++i)
+    {
+    std::ostringstream name;
+    name << "Plan" << i;
+    vtkNew<vtkMRMLAnnotationHierarchyNode> pathList;
+    pathList->SetName(name.str().c_str());
+    this->Scene->AddNode(pathList.GetPointer());
+    pathList->SetParentNodeID(topLevel->GetID());
+    this->PathLists.push_back(pathList.GetPointer());
+    }
+  for (int i = 0; i < numberOfPaths; ++i)
+    {
+    this->AddRuler(this->PathLists[i % NumberOfPathLists]);
+    }
+  this->Scene->EndState(vtkMRMLScene::ImportState);
+  this->Scene->EndState(vtkMRMLScene::BatchProcessState);
+  ProcessEvents();
+}
+
+//----------------------------------------------------------------------------
+int Harness::RandomOperation()
+{
+  int totalWeight = 0;
+  for (int i = 0; i < NumberOfOperationTypes; ++i)
+    {
+    totalWeight += OperationWeights[i];
+    }
+  int weight = this->Random.Integer(totalWeight);
+  for (int i = 0; i < NumberOfOperationTypes; ++i)
+    {
+    if (weight < OperationWeights[i])
+      {
+      return i;
+      }
+    weight -= OperationWeights[i];
+    }
+  return AddOperation;
+}
+
+//----------------------------------------------------------------------------
+void Harness::RunOperation(int operation)
+{
+  vtkMRMLAnnotationHierarchyNode* pathList =
+    this->PathLists[this->Random.Integer(NumberOfPathLists)];
+  vtkMRMLAnnotationRulerNode* ruler =
+    operation == AddOperation ? 0 : this->RandomRuler();
+  if (!ruler && operation != SwitchOperation &&
+      operation != PreIndexOperation && operation != VisibilityOperation)
+    {
+    operation = AddOperation;
+    }
+
+  switch (operation)
+    {
+    case AddOperation:
+      {
+      this->AddRuler(pathList);
+      this->Logic->UpdatePathHierarchy(pathList->GetID());
+      break;
+      }
+    case RemoveOperation:
+      {
+      vtkMRMLHierarchyNode* rulerHierarchy =
+        vtkMRMLHierarchyNode::GetAssociatedHierarchyNode(this->Scene, ruler->GetID());
+      this->Scene->RemoveNode(ruler);
+      if (rulerHierarchy)
+        {
+        this->Scene->RemoveNode(rulerHierarchy);
+        }
+      break;
+      }
+    case RenameOperation:
+      {
+      std::ostringstream name;
+      name << "Renamed" << this->NameCounter++;
+      ruler->SetName(name.str().c_str());
+      break;
+      }
+    case DragOperation:
+      {
+      // A few mouse moves of the entry point
+      double entry[3];
+      ruler->GetPosition1(entry);
+      for (int i = 0; i < 5; ++i)
+        {
+        entry[0] += this->Random.Uniform(-2.0, 2.0);
+        entry[1] += this->Random.Uniform(-2.0, 2.0);
+        ruler->SetPosition1(entry);
+        }
+      break;
+      }
+    case OffsetOperation:
+      {
+      this->Logic->SetPathVirtualOffset(ruler->GetID(),
+                                        this->Random.Uniform(0.0, 20.0));
+      break;
+      }
+    case VisibilityOperation:
+      {
+      int kind = this->Random.Integer(3);
+      if (kind == 0)
+        {
+        this->Widget->hideAllPaths();
+        }
+      else if (kind == 1)
+        {
+        this->Widget->showAllPaths();
+        }
+      else
+        {
+        std::vector<std::string> pathNodeIDs;
+        vtkSlicerVisuaLinePathStore* store = this->Logic->GetPathStore();
+        for (int i = 0; i < store->GetNumberOfPaths(); ++i)
+          {
+          if (this->Random.Integer(2))
+            {
+            pathNodeIDs.push_back(store->GetPathNodeID(i));
+            }
+          }
+        this->Logic->SetPathsVisibility(pathNodeIDs, this->Random.Integer(2) != 0);
+        }
+      break;
+      }
+    case MoveOperation:
+      {
+      vtkMRMLHierarchyNode* rulerHierarchy =
+        vtkMRMLHierarchyNode::GetAssociatedHierarchyNode(this->Scene, ruler->GetID());
+      if (!rulerHierarchy || !rulerHierarchy->GetParentNodeID())
+        {
+        break;
+        }
+      std::string previousListID = rulerHierarchy->GetParentNodeID();
+      rulerHierarchy->SetParentNodeID(pathList->GetID());
+      this->Logic->UpdatePathHierarchy(previousListID.c_str());
+      this->Logic->UpdatePathHierarchy(pathList->GetID());
+      break;
+      }
+    case SwitchOperation:
+      {
+      this->SelectedPathList = pathList;
+      QMetaObject::invokeMethod(this->Widget, "onHierarchyNodeChanged",
+                                Q_ARG(vtkMRMLNode*, pathList));
+      break;
+      }
+    case PreIndexOperation:
+      {
+      // As the module does while the application is idle
+      this->Logic->PreIndexPathHierarchies(1 + this->Random.Integer(50));
+      break;
+      }
+    default:
+      break;
+    }
+  ProcessEvents();
+}
+
+//----------------------------------------------------------------------------
+bool Harness::CheckInvariants(int operationIndex, int operation)
+{
+  std::ostringstream context;
+  context << "Operation " << operationIndex << " ("
+          << OperationNames[operation] << "): ";
+
+  // Managed path lists hold the rulers filed under them
+  std::vector<vtkMRMLAnnotationRulerNode*> rulers;
+  for (size_t i = 0; i < this->PathLists.size(); ++i)
+    {
+    vtkMRMLAnnotationHierarchyNode* pathList = this->PathLists[i];
+    if (!this->Logic->IsPathHierarchyManaged(pathList->GetID()))
+      {
+      continue;
+      }
+    GetListRulers(pathList, rulers);
+    std::set<std::string> sceneIDs;
+    for (size_t j = 0; j < rulers.size(); ++j)
+      {
+      sceneIDs.insert(rulers[j]->GetID());
+      }
+    std::vector<std::string> pathNodeIDs;
+    this->Logic->GetHierarchyPaths(pathList->GetID(), pathNodeIDs);
+    std::set<std::string> logicIDs(pathNodeIDs.begin(), pathNodeIDs.end());
+    if (sceneIDs != logicIDs)
+      {
+      std::cerr << context.str() << pathList->GetName() << " has "
+                << sceneIDs.size() << " rulers in the scene, "
+                << logicIDs.size() << " managed" << std::endl;
+      return false;
+      }
+    }
+
+  // Managed paths are in the scene. Pre-indexed paths are in no managed
+  // list yet and have no target.
+  vtkSlicerVisuaLinePathStore* store = this->Logic->GetPathStore();
+  for (int i = 0; i < store->GetNumberOfPaths(); ++i)
+    {
+    const char* pathNodeID = store->GetPathNodeID(i);
+    vtkMRMLAnnotationRulerNode* path = this->Logic->GetPathNode(pathNodeID);
+    vtkMRMLAnnotationFiducialNode* target = this->Logic->GetPathTargetNode(pathNodeID);
+    if (!path || !this->Scene->IsNodePresent(path))
+      {
+      std::cerr << context.str() << "managed path " << pathNodeID
+                << " is not in the scene" << std::endl;
+      return false;
+      }
+    bool listed = this->Logic->GetPathHierarchyNodeID(pathNodeID) != 0;
+    if (listed != (target && this->Scene->IsNodePresent(target)))
+      {
+      std::cerr << context.str() << "managed path " << pathNodeID
+                << (listed ? " has no target" : " has a target in no list")
+                << std::endl;
+      return false;
+      }
+    }
+
+  // No target or offset refers to a ruler missing from the scene
+  vtkCollection* nodes = this->Scene->GetNodes();
+  for (int i = 0; i < nodes->GetNumberOfItems(); ++i)
+    {
+    vtkMRMLNode* node = vtkMRMLNode::SafeDownCast(nodes->GetItemAsObject(i));
+    const char* pathNodeID = node ? node->GetAttribute(TargetOfAttributeName) : 0;
+    if (node && !pathNodeID)
+      {
+      pathNodeID = node->GetAttribute(VirtualOffsetOfAttributeName);
+      }
+    if (pathNodeID && !vtkMRMLAnnotationRulerNode::SafeDownCast(
+          this->Scene->GetNodeByID(pathNodeID)))
+      {
+      std::cerr << context.str() << node->GetID() << " refers to ruler "
+                << pathNodeID << ", not in the scene" << std::endl;
+      return false;
+      }
+    }
+
+  // The tree lists the rulers of the selected list
+  QAbstractItemModel* model = this->TreeModel();
+  if (this->SelectedPathList && model)
+    {
+    GetListRulers(this->SelectedPathList, rulers);
+    std::set<std::string> sceneNames;
+    for (size_t j = 0; j < rulers.size(); ++j)
+      {
+      sceneNames.insert(rulers[j]->GetName() ? rulers[j]->GetName() : "");
+      }
+    std::set<std::string> treeNames;
+    for (int row = 0; row < model->rowCount(); ++row)
+      {
+      treeNames.insert(
+        model->data(model->index(row, 0)).toString().toStdString());
+      }
+    if (model->rowCount() != static_cast<int>(rulers.size()) ||
+        treeNames != sceneNames)
+      {
+      std::cerr << context.str() << "tree of " << this->SelectedPathList->GetName()
+                << " has " << model->rowCount() << " rows for "
+                << rulers.size() << " rulers" << std::endl;
+      return false;
+      }
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool Harness::Run(int numberOfOperations)
+{
+  for (int i = 0; i < numberOfOperations; ++i)
+    {
+    int operation = this->RandomOperation();
+    double start = vtkTimerLog::GetUniversalTime();
+    this->RunOperation(operation);
+    double end = vtkTimerLog::GetUniversalTime();
+    ++this->Operations[operation].Count;
+    this->Operations[operation].Time += end - start;
+
+    bool valid = this->CheckInvariants(i, operation);
+    this->CheckTime += vtkTimerLog::GetUniversalTime() - end;
+    if (!valid)
+      {
+      return false;
+      }
+    }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+void Harness::PrintThroughput(int numberOfPaths)
+{
+  int count = 0;
+  double time = 0.0;
+  std::cout << numberOfPaths << " paths, "
+            << this->Logic->GetPathStore()->GetNumberOfPaths()
+            << " managed at the end:" << std::endl;
+  for (int i = 0; i < NumberOfOperationTypes; ++i)
+    {
+    const Throughput& throughput = this->Operations[i];
+    std::cout << "  " << OperationNames[i] << ": " << throughput.Count << " ops";
+    if (throughput.Time > 0.0)
+      {
+      std::cout << ", " << throughput.Count / throughput.Time << " ops/s";
+      }
+    std::cout << std::endl;
+    count += throughput.Count;
+    time += throughput.Time;
+    }
+  std::cout << "  All: " << count << " ops";
+  if (time > 0.0)
+    {
+    std::cout << ", " << count / time << " ops/s";
+    }
+  std::cout << ", invariant checks " << this->CheckTime << " s" << std::endl;
+}
+
+//----------------------------------------------------------------------------
+bool RunHarness(int numberOfPaths, int numberOfOperations, unsigned int seed)
+{
+  std::vector<vtkWeakPointer<vtkMRMLAnnotationRulerNode> > createdRulers;
+  bool success = true;
+  {
+  vtkNew<vtkMRMLScene> scene;
+  vtkSmartPointer<vtkSlicerVisuaLineLogic> logic =
+    vtkSmartPointer<vtkSlicerVisuaLineLogic>::New();
+  logic->SetMRMLScene(scene.GetPointer());
+
+  // Deleted first, with its items
+  qSlicerVisuaLinePathManagerWidget widget;
+  widget.setLogic(logic);
+  widget.setMRMLScene(scene.GetPointer());
+
+  Harness harness(scene.GetPointer(), logic, &widget, seed);
+  harness.BuildScene(numberOfPaths);
+  success = harness.Run(numberOfOperations);
+  harness.PrintThroughput(numberOfPaths);
+  createdRulers = harness.CreatedRulers;
+  }
+
+  // Nothing holds a ruler once its scene is gone
+  int leakedRulers = 0;
+  for (size_t i = 0; i < createdRulers.size(); ++i)
+    {
+    if (createdRulers[i])
+      {
+      ++leakedRulers;
+      }
+    }
+  if (leakedRulers > 0)
+    {
+    std::cerr << numberOfPaths << " paths: " << leakedRulers
+              << " rulers leaked" << std::endl;
+    success = false;
+    }
+  return success;
+}
+
+} // end of anonymous namespace
+
+//----------------------------------------------------------------------------
+int qSlicerVisuaLinePathManagerWidgetFuzzTest(int argc, char* argv[])
+{
+  QApplication app(argc, argv);
+
+  int numberOfOperations = argc > 1 ? atoi(argv[1]) : DefaultNumberOfOperations;
+  unsigned int seed = argc > 2 ?
+    static_cast<unsigned int>(atoi(argv[2])) : DefaultSeed;
+  std::cout << "Seed " << seed << ", " << numberOfOperations
+            << " operations per scene" << std::endl;
+
+  // Same operations on each scene size: per operation throughput shows
+  // how they scale
+  bool success = true;
+  for (size_t i = 0; i < sizeof(SceneSizes) / sizeof(SceneSizes[0]); ++i)
+    {
+    if (!RunHarness(SceneSizes[i], numberOfOperations, seed))
+      {
+      std::cerr << "Failed with " << SceneSizes[i] << " paths, seed "
+                << seed << std::endl;
+      success = false;
+      }
+    }
+  return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,73 @@
+/*==============================================================================
+
+  Program: 3D Slicer
+
+  Portions (c) Copyright Brigham and Women's Hospital (BWH) All Rights Reserved.
+
+  See COPYRIGHT.txt
+  or http://www.slicer.org/copyright/copyright.txt for details.
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  This file was originally developed by Laurent Chauvin, Brigham and Women's
+  Hospital. The project was supported by grants 5P01CA067165,
+  5R01CA124377, 5R01CA138586, 2R44DE019322, 7R01CA124377,
+  5R42CA137886, 8P41EB015898
+
+==============================================================================*/
+
+#ifndef __qSlicerVisuaLineTestingUtilities_h
+#define __qSlicerVisuaLineTestingUtilities_h
+
+// Qt includes
+#include <QApplication>
+
+// MRML includes
+#include <vtkMRMLAnnotationHierarchyNode.h>
+#include <vtkMRMLAnnotationRulerNode.h>
+#include <vtkMRMLScene.h>
+
+// VTK includes
+#include <vtkNew.h>
+
+/// Helpers shared by the VisuaLine widget tests
+namespace qSlicerVisuaLineTestingUtilities
+{
+
+//----------------------------------------------------------------------------
+/// Add a ruler to the scene and file it under a path list
+inline vtkMRMLAnnotationRulerNode* AddRuler(vtkMRMLScene* scene,
+                                            vtkMRMLAnnotationHierarchyNode* pathList,
+                                            const char* name,
+                                            double entry[3], double target[3])
+{
+  vtkNew<vtkMRMLAnnotationRulerNode> ruler;
+  ruler->SetName(name);
+  ruler->SetPosition1(entry);
+  ruler->SetPosition2(target);
+  ruler->Initialize(scene);
+
+  // As the annotation module files a ruler under the active list
+  vtkNew<vtkMRMLAnnotationHierarchyNode> rulerHierarchy;
+  rulerHierarchy->HideFromEditorsOn();
+  scene->AddNode(rulerHierarchy.GetPointer());
+  rulerHierarchy->SetDisplayableNodeID(ruler->GetID());
+  rulerHierarchy->SetParentNodeID(pathList->GetID());
+  return ruler.GetPointer();
+}
+
+//----------------------------------------------------------------------------
+inline void ProcessEvents()
+{
+  // Change sets are collected on the next event loop pass
+  QApplication::processEvents();
+  QApplication::processEvents();
+}
+
+} // end of qSlicerVisuaLineTestingUtilities namespace
+
+#endif
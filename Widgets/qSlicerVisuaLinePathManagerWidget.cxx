@@ -21,9 +21,21 @@
 ==============================================================================*/
 
 #include <sstream>
+#include <string>
 #include <vector>
 #include <iomanip>
 
+#include <QBrush>
+#include <QFileDialog>
+#include <QFileInfo>
+#include <QHash>
+#include <QMenu>
+#include <QMessageBox>
+#include <QRegExp>
+#include <QSet>
+#include <QStringList>
+#include <QTimer>
+
 //#include "qSlicerVisuaLineTreeModel.h"
 
 // PathManager Widgets includes
@@ -31,16 +43,40 @@
 #include "ui_qSlicerVisuaLinePathManagerWidget.h"
 #include "qSlicerVisuaLineTreeItem.h"
 
-#include <vtkCollection.h>
+// Annotations Widgets includes
+#include <qMRMLAnnotationFiducialProjectionPropertyWidget.h>
+#include <qMRMLAnnotationRulerProjectionPropertyWidget.h>
+
+// SlicerQt includes
+#include <qMRMLThreeDView.h>
+#include <qMRMLThreeDWidget.h>
+#include <qSlicerApplication.h>
+#include <qSlicerLayoutManager.h>
+
+// VisuaLine Logic includes
+#include "vtkSlicerVisuaLineDeflectionModel.h"
+#include "vtkSlicerVisuaLineLogic.h"
+#include "vtkSlicerVisuaLinePathClustering.h"
+#include "vtkSlicerVisuaLineProfiler.h"
+#include "vtkSlicerVisuaLineReachabilityMap.h"
+#include "vtkSlicerVisuaLineTemplateGrid.h"
+#include "vtkSlicerVisuaLineUndoJournal.h"
 
 #include <vtkMRMLAnnotationFiducialNode.h>
 #include <vtkMRMLAnnotationHierarchyNode.h>
 #include <vtkMRMLAnnotationLineDisplayNode.h>
 #include <vtkMRMLAnnotationPointDisplayNode.h>
 #include <vtkMRMLAnnotationRulerNode.h>
+#include <vtkMRMLModelNode.h>
 #include <vtkMRMLNode.h>
+#include <vtkMRMLScalarVolumeNode.h>
 #include <vtkMRMLScene.h>
 
+#include <vtkCamera.h>
+#include <vtkMath.h>
+#include <vtkRenderWindow.h>
+#include <vtkWeakPointer.h>
+
 //-----------------------------------------------------------------------------
 /// \ingroup Slicer_QtModules_VisuaLine
 class qSlicerVisuaLinePathManagerWidgetPrivate
@@ -55,11 +91,56 @@ public:
     qSlicerVisuaLinePathManagerWidget& object);
   virtual void setupUi(qSlicerVisuaLinePathManagerWidget*);
   QString convertCoordinatesToQString(double coord[3]);
+  void populateTemplateGridItem(qSlicerVisuaLineTreeItem* gridItem);
+  bool areTemplateHoleItemsCurrent(qSlicerVisuaLineTreeItem* gridItem);
+  void updateTemplateGridItems(QStandardItemModel* model);
+  void removePathRows(int row, int count);
+  QStandardItemModel* hierarchyModel(const QString& hierarchyNodeID);
+  qSlicerVisuaLineTreeItem* createPathItem(const char* pathNodeID,
+                                           QStandardItemModel* model);
+  void updatePathColumns(qSlicerVisuaLineTreeItem* item);
+  void updateAllPathColumns();
+  bool parseFilter(const QString& text, vtkSlicerVisuaLineLogic::PathFilter& filter);
+  QSet<QString> modelPathIDs(QStandardItemModel* model);
+  void setPathsVisibility(const QList<qSlicerVisuaLineTreeItem*>& items, bool visible);
+  QList<qSlicerVisuaLineTreeItem*> currentPathItems();
+  QList<qSlicerVisuaLineTreeItem*> selectedPathItems();
+  QList<qSlicerVisuaLineTreeItem*> filteredPathItems();
+  QList<qSlicerVisuaLineTreeItem*> duplicateGroupItems();
+  void removeDuplicateGroups();
+  void removeDuplicateGroups(const QSet<QString>& pathNodeIDs);
+  void updateProjectionWidgets();
+  qMRMLThreeDView* threeDView();
+  vtkSlicerVisuaLineProfiler* profiler();
 
   QModelIndex SelectedRow;
   QModelIndex TopLevelSelection;
+  // Model of the selected hierarchy
   QStandardItemModel* PathTreeModel;
-  vtkMRMLAnnotationHierarchyNode* SelectedHierarchyNode;
+  // Built when their group is first expanded
+  qMRMLAnnotationRulerProjectionPropertyWidget* PathProjectionWidget;
+  qMRMLAnnotationFiducialProjectionPropertyWidget* TargetProjectionWidget;
+  vtkWeakPointer<vtkMRMLAnnotationHierarchyNode> SelectedHierarchyNode;
+  vtkSlicerVisuaLineLogic* Logic;
+
+  // One model per hierarchy, kept when switching
+  QHash<QString, QStandardItemModel*> Models;
+  // Top level items by path node ID, all models
+  QHash<QString, qSlicerVisuaLineTreeItem*> PathItems;
+  bool PathChangesPending;
+
+  // Paths of the current model shown by the filter
+  QSet<QString> ShownPaths;
+  bool FilterActive;
+
+  // Coalesces camera and selection changes into one level of detail pass
+  QTimer* LevelOfDetailTimer;
+  vtkWeakPointer<vtkCamera> ObservedCamera;
+
+  // Statistics panel, refreshed while recording
+  QTimer* StatisticsTimer;
+  vtkWeakPointer<vtkRenderWindow> ObservedRenderWindow;
+  double RenderStartTime;
 };
 
 // --------------------------------------------------------------------------
@@ -68,8 +149,15 @@ qSlicerVisuaLinePathManagerWidgetPrivate
   qSlicerVisuaLinePathManagerWidget& object)
   : q_ptr(&object)
 {
-  this->SelectedHierarchyNode = NULL;
-  this->PathTreeModel = new QStandardItemModel();
+  this->Logic = NULL;
+  this->PathChangesPending = false;
+  this->FilterActive = false;
+  this->PathTreeModel = NULL;
+  this->PathProjectionWidget = NULL;
+  this->TargetProjectionWidget = NULL;
+  this->LevelOfDetailTimer = NULL;
+  this->StatisticsTimer = NULL;
+  this->RenderStartTime = 0.0;
 }
 
 // --------------------------------------------------------------------------
@@ -96,470 +184,2015 @@ QString qSlicerVisuaLinePathManagerWidgetPrivate
 }
 
 //-----------------------------------------------------------------------------
-// qSlicerVisuaLinePathManagerWidget methods
-
-//-----------------------------------------------------------------------------
-qSlicerVisuaLinePathManagerWidget
-::qSlicerVisuaLinePathManagerWidget(QWidget* parentWidget)
-  : Superclass( parentWidget )
-  , d_ptr( new qSlicerVisuaLinePathManagerWidgetPrivate(*this) )
+void qSlicerVisuaLinePathManagerWidgetPrivate
+::populateTemplateGridItem(qSlicerVisuaLineTreeItem* gridItem)
 {
-  Q_D(qSlicerVisuaLinePathManagerWidget);
-  d->setupUi(this);
-
-  connect(d->HierarchySelectorWidget, SIGNAL(nodeActivated(vtkMRMLNode*)),
-          this, SLOT(onHierarchyNodeChanged(vtkMRMLNode*)));
-
-  connect(d->DeleteButton, SIGNAL(clicked()),
-          this, SLOT(onDeleteButtonClicked()));
-
-  connect(d->ClearButton, SIGNAL(clicked()),
-          this, SLOT(onClearButtonClicked()));
-
-  if (d->PathTreeModel && d->PathTreeView)
+  vtkSlicerVisuaLineTemplateGrid* grid = gridItem->getTemplateGrid();
+  gridItem->removeRows(0, gridItem->rowCount());
+  if (!grid)
     {
-    d->PathTreeView->setModel(d->PathTreeModel);
-    connect(d->PathTreeView, SIGNAL(clicked(const QModelIndex&)),
-            this, SLOT(onRowSelected(const QModelIndex&)));
-    connect(d->PathTreeModel, SIGNAL(itemChanged(QStandardItem*)),
-            this, SLOT(onItemChanged(QStandardItem*)));
+    return;
     }
 
-  connect(d->VirtualOffsetSlider, SIGNAL(valueChanged(double)),
-          this, SLOT(onVirtualOffsetChanged(double)));
+  // Holes are only listed, their rulers are created on selection
+  for (int i = 0; i < grid->GetNumberOfActiveHoles(); ++i)
+    {
+    int hole = grid->GetNthActiveHole(i);
+    qSlicerVisuaLineTreeItem* holeItem =
+      new qSlicerVisuaLineTreeItem(QString::fromStdString(grid->GetHoleName(hole)));
+    holeItem->setTemplateGrid(grid, hole);
+    holeItem->setEditable(false);
+    gridItem->appendRow(holeItem);
+    }
+  gridItem->setData(true, Qt::UserRole);
 }
 
 //-----------------------------------------------------------------------------
-qSlicerVisuaLinePathManagerWidget
-::~qSlicerVisuaLinePathManagerWidget()
+QStandardItemModel* qSlicerVisuaLinePathManagerWidgetPrivate
+::hierarchyModel(const QString& hierarchyNodeID)
 {
-  Q_D(qSlicerVisuaLinePathManagerWidget);
+  Q_Q(qSlicerVisuaLinePathManagerWidget);
 
-  // Clear widget to call items destructor and avoid leaks
-  d->PathTreeModel->removeRows(0, d->PathTreeModel->rowCount());
+  QStandardItemModel* model = this->Models.value(hierarchyNodeID, NULL);
+  if (!model)
+    {
+    model = new QStandardItemModel(q);
+    model->setHorizontalHeaderLabels(QStringList()
+      << "Path" << "Skin Entry" << "Depth" << "Tip Depth" << "Tip Error"
+      << "Reachable");
+    QObject::connect(model, SIGNAL(itemChanged(QStandardItem*)),
+                     q, SLOT(onItemChanged(QStandardItem*)));
+    this->Models.insert(hierarchyNodeID, model);
+    }
+  return model;
 }
 
 //-----------------------------------------------------------------------------
-void qSlicerVisuaLinePathManagerWidget
-::onHierarchyNodeChanged(vtkMRMLNode* newHierarchy)
+qSlicerVisuaLineTreeItem* qSlicerVisuaLinePathManagerWidgetPrivate
+::createPathItem(const char* pathNodeID, QStandardItemModel* model)
 {
-  Q_D(qSlicerVisuaLinePathManagerWidget);
-  
-  if (!newHierarchy)
+  // Show ruler, compact paths keep their visibility flags
+  if (this->Logic && !this->Logic->IsPathCompact(pathNodeID))
     {
-    return;
+    vtkMRMLAnnotationRulerNode* ruler = this->Logic->GetPathNode(pathNodeID);
+    if (ruler)
+      {
+      ruler->SetDisplayVisibility(1);
+      }
     }
+  
+  // Create a top node
+  qSlicerVisuaLineTreeItem* topNode = new qSlicerVisuaLineTreeItem(
+    this->Logic ? this->Logic->GetPathName(pathNodeID) : pathNodeID);
+  topNode->setLogic(this->Logic);
+  topNode->setPathNodeID(pathNodeID);
+  topNode->setCheckable(true);
+  topNode->setCheckState(Qt::Unchecked);
 
-  vtkMRMLAnnotationHierarchyNode* oldHierarchy =
-    d->SelectedHierarchyNode;
-
-  d->SelectedHierarchyNode = 
-    vtkMRMLAnnotationHierarchyNode::SafeDownCast(newHierarchy);
-  if (!d->SelectedHierarchyNode)
+  // Values against the entry surface, read only
+  QList<QStandardItem*> row;
+  row << topNode;
+  for (int column = 1; column < model->columnCount(); ++column)
     {
-    return;
+    QStandardItem* columnItem = new QStandardItem();
+    columnItem->setEditable(false);
+    row << columnItem;
     }
-
-  d->ActiveNodeLabel->setText(d->SelectedHierarchyNode->GetName());
-
-  // Clear table
-  this->onClearButtonClicked();
+  model->appendRow(row);
+  this->PathItems.insert(pathNodeID, topNode);
   
-  // Load new hierarchy table
-  this->populateTreeView();
+  // Create Path node
+  qSlicerVisuaLineTreeItem* pathNode = new qSlicerVisuaLineTreeItem("Path");
+  pathNode->setCheckable(true);
+  pathNode->setPathItem(true);
+  pathNode->setCheckState(Qt::Checked);
+  topNode->appendRow(pathNode);
+  
+  // Create target node, named from its world coordinates
+  qSlicerVisuaLineTreeItem* targetNode = new qSlicerVisuaLineTreeItem("Target");
+  targetNode->setCheckable(true);
+  targetNode->setCheckState(Qt::Unchecked);
+  topNode->appendRow(targetNode);
+  topNode->updateTargetText();
 
-  // Observe modifications of hierarchy node and update view
-  qvtkReconnect(oldHierarchy, newHierarchy, vtkCommand::ModifiedEvent,
-		this, SLOT(updateWidgetFromMRML()));
+  this->updatePathColumns(topNode);
+  return topNode;
 }
 
 //-----------------------------------------------------------------------------
-void qSlicerVisuaLinePathManagerWidget
-::updateWidgetFromMRML()
+void qSlicerVisuaLinePathManagerWidgetPrivate
+::updatePathColumns(qSlicerVisuaLineTreeItem* item)
 {
-  Q_D(qSlicerVisuaLinePathManagerWidget);
-  
-  // Extract rulers from hierarchy
-  vtkCollection* nodeRulers = vtkCollection::New();
-  double childCount = d->SelectedHierarchyNode->GetNumberOfChildrenNodes();
-  for (int i = 0; i < childCount; i++)
+  QStandardItemModel* model = item ? item->model() : NULL;
+  if (!this->Logic || !model || model->columnCount() < 6)
     {
-    vtkMRMLAnnotationRulerNode* isRuler = 
-      vtkMRMLAnnotationRulerNode::SafeDownCast(d->SelectedHierarchyNode->GetNthChildNode(i)->GetAssociatedNode());
-    
-    if (isRuler)
-      {
-      nodeRulers->AddItem(isRuler);
-      }
+    return;
     }
 
-  int numberOfRulers = nodeRulers->GetNumberOfItems();
-  int numberOfLines = d->PathTreeModel->rowCount();
-
-  // First import new trajectories
-  for (int j = 0; j < numberOfRulers; j++)
+  QByteArray pathNodeID = item->getPathNodeID().toLatin1();
+  QStringList texts;
+  double entry[3];
+  if (this->Logic->GetPathSkinEntry(pathNodeID, entry))
     {
-    vtkMRMLAnnotationRulerNode* ruler = 
-      vtkMRMLAnnotationRulerNode::SafeDownCast(nodeRulers->GetItemAsObject(j));
-    
-    bool rulerFound = false;
-    for (int k = 0; k < numberOfLines; k++)
-      {
-      qSlicerVisuaLineTreeItem* tmpItem =
-	dynamic_cast<qSlicerVisuaLineTreeItem*>(d->PathTreeModel->item(k));
-      if (tmpItem->getPathNode() == ruler)
-	{
-	rulerFound = true;
-
-	// Update name if different
-	if (strcmp(ruler->GetName(), tmpItem->text().toStdString().c_str()) != 0)
-	  {
-	  tmpItem->setText(ruler->GetName());
-	  }
-
-	break;
-	}
-      }
-    
-    if (!rulerFound)
-      {
-      this->addNewPath(ruler);
-      }
+    texts << this->convertCoordinatesToQString(entry)
+          << QString("%1 mm").arg(this->Logic->GetPathInsertionDepth(pathNodeID), 0, 'f', 1)
+          << QString("%1 mm").arg(this->Logic->GetPathTipDepth(pathNodeID), 0, 'f', 1);
     }
-
-  // Then check if trajectories have been removed
-  for (int l = 0; l < numberOfLines; l++)
+  else
     {
-    qSlicerVisuaLineTreeItem* tmpItem =
-      dynamic_cast<qSlicerVisuaLineTreeItem*>(d->PathTreeModel->item(l));
-
-    bool lineFound = false;
-    for (int m = 0; m < numberOfRulers; m++)
-      {
-      vtkMRMLAnnotationRulerNode* ruler = 
-	vtkMRMLAnnotationRulerNode::SafeDownCast(nodeRulers->GetItemAsObject(m));
-      if (tmpItem->getPathNode() == ruler)
-	{
-	lineFound = true;
-	break;
-	}
-      }
-
-    if (!lineFound)
+    texts << QString() << QString() << QString();
+    }
+  double tipError = this->Logic->GetPathTipError(pathNodeID);
+  texts << (vtkMath::IsNan(tipError) ? QString() :
+            QString("%1 mm").arg(tipError, 0, 'f', 1));
+  // Flagged only when the device has guides
+  bool hasGuides = this->Logic->GetReachabilityMap()->GetNumberOfGuides() > 0;
+  bool reachable = this->Logic->IsPathReachable(pathNodeID);
+  texts << (!hasGuides ? QString() :
+            (reachable ? QObject::tr("Yes") : QObject::tr("No")));
+  for (int column = 1; column < 6; ++column)
+    {
+    QStandardItem* columnItem = model->item(item->row(), column);
+    if (columnItem && columnItem->text() != texts[column - 1])
       {
-      d->PathTreeModel->removeRows(l,1);
-      numberOfLines = d->PathTreeModel->rowCount();
+      columnItem->setText(texts[column - 1]);
       }
     }
-
-
-  nodeRulers->Delete();
+  QStandardItem* reachableItem = model->item(item->row(), 5);
+  QBrush reachableBrush = reachable ? QBrush() : QBrush(Qt::red);
+  if (reachableItem && reachableItem->foreground() != reachableBrush)
+    {
+    reachableItem->setForeground(reachableBrush);
+    }
 }
 
 //-----------------------------------------------------------------------------
-void qSlicerVisuaLinePathManagerWidget
-::onDeleteButtonClicked()
+void qSlicerVisuaLinePathManagerWidgetPrivate::updateAllPathColumns()
 {
-  Q_D(qSlicerVisuaLinePathManagerWidget);
-
-  if (!d->TopLevelSelection.isValid())
-    {
-    return;
-    }
-  
-  if (!d->PathTreeModel || !d->PathTreeView ||
-      !d->PathProjectionWidget || !d->TargetProjectionWidget ||
-      !d->VirtualOffsetSlider)
-    {
-    return;
-    }
-
-  // Update index before removing
-  QModelIndex newTopLevel = d->TopLevelSelection.sibling(d->TopLevelSelection.row()-1,0);
-
-  d->PathTreeModel->removeRows(d->TopLevelSelection.row(), 1);
-
-  if (newTopLevel.isValid())
+  foreach(qSlicerVisuaLineTreeItem* item, this->PathItems)
     {
-    d->PathTreeView->selectionModel()->select(newTopLevel, QItemSelectionModel::ClearAndSelect | QItemSelectionModel::Rows);
-    d->TopLevelSelection = newTopLevel;
-    d->SelectedRow = newTopLevel;
-    this->onRowSelected(d->TopLevelSelection);
+    this->updatePathColumns(item);
     }
+}
 
-  if (d->PathTreeModel->rowCount() == 0)
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidgetPrivate
+::removePathRows(int row, int count)
+{
+  // Paths are no longer managed once their row is gone
+  for (int i = row; this->Logic && i < row + count; ++i)
     {
-    d->VirtualOffsetSlider->setValue(0);
+    qSlicerVisuaLineTreeItem* item =
+      dynamic_cast<qSlicerVisuaLineTreeItem*>(this->PathTreeModel->item(i));
+    if (item && !item->getPathNodeID().isEmpty())
+      {
+      this->PathItems.remove(item->getPathNodeID());
+      this->Logic->RemovePathNode(item->getPathNodeID().toLatin1());
+      }
     }
+  this->PathTreeModel->removeRows(row, count);
 }
 
 //-----------------------------------------------------------------------------
-void qSlicerVisuaLinePathManagerWidget
-::onClearButtonClicked()
+bool qSlicerVisuaLinePathManagerWidgetPrivate
+::areTemplateHoleItemsCurrent(qSlicerVisuaLineTreeItem* gridItem)
 {
-  Q_D(qSlicerVisuaLinePathManagerWidget);
-
-  if (!d->PathTreeModel ||
-      !d->PathProjectionWidget || !d->TargetProjectionWidget ||
-      !d->VirtualOffsetSlider)
+  // Holes can be swapped without changing their number
+  vtkSlicerVisuaLineTemplateGrid* grid = gridItem->getTemplateGrid();
+  if (!grid || gridItem->rowCount() != grid->GetNumberOfActiveHoles())
     {
-    return;
+    return false;
     }
-
-  d->PathTreeModel->removeRows(0, d->PathTreeModel->rowCount());
-  d->VirtualOffsetSlider->setValue(0);
+  for (int i = 0; i < gridItem->rowCount(); ++i)
+    {
+    qSlicerVisuaLineTreeItem* holeItem =
+      dynamic_cast<qSlicerVisuaLineTreeItem*>(gridItem->child(i));
+    int hole = grid->GetNthActiveHole(i);
+    if (!holeItem || holeItem->getTemplateHole() != hole ||
+        holeItem->text() != QString::fromStdString(grid->GetHoleName(hole)))
+      {
+      return false;
+      }
+    }
+  return true;
 }
 
 //-----------------------------------------------------------------------------
-void qSlicerVisuaLinePathManagerWidget
-::onRowSelected(const QModelIndex& index)
+void qSlicerVisuaLinePathManagerWidgetPrivate
+::updateTemplateGridItems(QStandardItemModel* model)
 {
-  Q_D(qSlicerVisuaLinePathManagerWidget);
-
-  if (!index.isValid())
+  // Drop items of removed grids, refresh the others
+  QList<vtkSlicerVisuaLineTemplateGrid*> listedGrids;
+  for (int i = model->rowCount() - 1; i >= 0; --i)
     {
-    return;
+    qSlicerVisuaLineTreeItem* gridItem =
+      dynamic_cast<qSlicerVisuaLineTreeItem*>(model->item(i));
+    if (!gridItem || !gridItem->getTemplateGrid())
+      {
+      continue;
+      }
+    vtkSlicerVisuaLineTemplateGrid* grid = gridItem->getTemplateGrid();
+    bool found = false;
+    for (int j = 0; this->Logic && j < this->Logic->GetNumberOfTemplateGrids(); ++j)
+      {
+      found |= (this->Logic->GetNthTemplateGrid(j) == grid);
+      }
+    if (!found)
+      {
+      model->removeRows(i, 1);
+      continue;
+      }
+    listedGrids << grid;
+    gridItem->setText(grid->GetName() ? grid->GetName() : "Template");
+    if (gridItem->data(Qt::UserRole).toBool() &&
+        !this->areTemplateHoleItemsCurrent(gridItem))
+      {
+      this->populateTemplateGridItem(gridItem);
+      }
     }
 
-  if (!d->PathProjectionWidget || !d->TargetProjectionWidget ||
-      !d->VirtualOffsetSlider)
+  if (!this->Logic)
     {
     return;
     }
 
-  d->SelectedRow = index;
-
-  // Get top level selection
-  d->TopLevelSelection = index;
-  if (index.parent().isValid())
+  for (int i = 0; i < this->Logic->GetNumberOfTemplateGrids(); ++i)
     {
-    d->TopLevelSelection = index.parent();
+    vtkSlicerVisuaLineTemplateGrid* grid = this->Logic->GetNthTemplateGrid(i);
+    if (listedGrids.contains(grid))
+      {
+      continue;
+      }
+    qSlicerVisuaLineTreeItem* gridItem =
+      new qSlicerVisuaLineTreeItem(grid->GetName() ? grid->GetName() : "Template");
+    gridItem->setTemplateGrid(grid, -1);
+    gridItem->setCheckable(true);
+    gridItem->setCheckState(Qt::Checked);
+    gridItem->setData(false, Qt::UserRole);
+    // Placeholder so the grid can be expanded before holes are listed
+    gridItem->appendRow(new QStandardItem("..."));
+    model->appendRow(gridItem);
     }
-  
-  // Get item
-  qSlicerVisuaLineTreeItem* topLevelItem
-    = dynamic_cast<qSlicerVisuaLineTreeItem*>(d->PathTreeModel->itemFromIndex(d->TopLevelSelection));
-  if (topLevelItem)
+}
+
+//-----------------------------------------------------------------------------
+bool qSlicerVisuaLinePathManagerWidgetPrivate
+::parseFilter(const QString& text, vtkSlicerVisuaLineLogic::PathFilter& filter)
+{
+  // Name words, plus "length<120", "clearance>5", "visible" or "hidden"
+  QRegExp metricExpression("^(length|clearance)([<>])([0-9]*\\.?[0-9]+)$",
+                           Qt::CaseInsensitive);
+  QStringList nameWords;
+  bool active = false;
+  foreach(const QString& word, text.split(' ', QString::SkipEmptyParts))
     {
-    if (topLevelItem->getPathNode())
+    if (metricExpression.indexIn(word) == 0)
       {
-      d->PathProjectionWidget->setMRMLRulerNode(topLevelItem->getPathNode());
+      bool isLength = metricExpression.cap(1).toLower() == "length";
+      double* range = isLength ? filter.LengthRange : filter.ClearanceRange;
+      range[metricExpression.cap(2) == "<" ? 1 : 0] =
+        metricExpression.cap(3).toDouble();
       }
-    if (topLevelItem->getTargetNode())
+    else if (word.compare("visible", Qt::CaseInsensitive) == 0)
       {
-      d->TargetProjectionWidget->setMRMLFiducialNode(topLevelItem->getTargetNode());
+      filter.Visibility = 1;
       }
-    if (!topLevelItem->getVirtualOffsetNode())
+    else if (word.compare("hidden", Qt::CaseInsensitive) == 0)
       {
-      d->VirtualOffsetSlider->setValue(0);
+      filter.Visibility = 0;
       }
     else
       {
-      d->VirtualOffsetSlider->setValue(topLevelItem->getVirtualOffset());
+      nameWords << word;
       }
+    active = true;
     }
+  filter.Text = nameWords.join(" ").toStdString();
+  return active;
 }
 
 //-----------------------------------------------------------------------------
-void qSlicerVisuaLinePathManagerWidget
-::onVirtualOffsetChanged(double newOffset)
+QSet<QString> qSlicerVisuaLinePathManagerWidgetPrivate
+::modelPathIDs(QStandardItemModel* model)
 {
-  Q_D(qSlicerVisuaLinePathManagerWidget);
-
-  if (!d->TopLevelSelection.isValid())
+  QSet<QString> pathNodeIDs;
+  for (int i = 0; model && i < model->rowCount(); ++i)
     {
-    return;
+    qSlicerVisuaLineTreeItem* item =
+      dynamic_cast<qSlicerVisuaLineTreeItem*>(model->item(i));
+    if (item && !item->getPathNodeID().isEmpty())
+      {
+      pathNodeIDs.insert(item->getPathNodeID());
+      }
     }
+  return pathNodeIDs;
+}
 
-  if (!d->PathTreeModel)
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidgetPrivate
+::setPathsVisibility(const QList<qSlicerVisuaLineTreeItem*>& items, bool visible)
+{
+  if (!this->Logic || items.isEmpty())
     {
     return;
     }
 
-  // Get Item
-  qSlicerVisuaLineTreeItem* item
-    = dynamic_cast<qSlicerVisuaLineTreeItem*>(d->PathTreeModel->itemFromIndex(d->TopLevelSelection));
-
-  if (item)
+  std::vector<std::string> pathNodeIDs;
+  pathNodeIDs.reserve(items.size());
+  foreach(qSlicerVisuaLineTreeItem* item, items)
     {
-    if (!item->getVirtualOffsetNode())
+    pathNodeIDs.push_back(item->getPathNodeID().toStdString());
+    }
+  this->Logic->SetPathsVisibility(pathNodeIDs, visible);
+
+  // Check boxes follow without going through onItemChanged. The model
+  // signals one range over the rows, the view repaints the children with
+  // the viewport.
+  Qt::CheckState state = visible ? Qt::Checked : Qt::Unchecked;
+  QStandardItemModel* model = this->PathTreeModel;
+  int firstRow = model->rowCount();
+  int lastRow = -1;
+  bool wasBlocked = model->blockSignals(true);
+  foreach(qSlicerVisuaLineTreeItem* item, items)
+    {
+    item->setCheckState(state);
+    for (int i = 0; i < item->rowCount(); ++i)
       {
-      // Create new ruler for virtual tip
-      vtkSmartPointer<vtkMRMLAnnotationRulerNode> virtualTip
-        = vtkSmartPointer<vtkMRMLAnnotationRulerNode>::New();
-      virtualTip->HideFromEditorsOff();
-      virtualTip->Initialize(this->mrmlScene());
-      item->setVirtualOffsetNode(virtualTip);
+      item->child(i)->setCheckState(state);
       }
-    item->setVirtualOffset(newOffset);
+    if (item->model() == model && !item->parent())
+      {
+      firstRow = qMin(firstRow, item->row());
+      lastRow = qMax(lastRow, item->row());
+      }
+    }
+  model->blockSignals(wasBlocked);
+  if (firstRow <= lastRow)
+    {
+    // Signals are protected in Qt 4
+    QMetaObject::invokeMethod(model, "dataChanged", Qt::DirectConnection,
+                              Q_ARG(QModelIndex, model->index(firstRow, 0)),
+                              Q_ARG(QModelIndex, model->index(lastRow, 0)));
     }
+  this->PathTreeView->viewport()->update();
+  this->LevelOfDetailTimer->start();
 }
 
 //-----------------------------------------------------------------------------
-void qSlicerVisuaLinePathManagerWidget
-::onItemChanged(QStandardItem* item)
+QList<qSlicerVisuaLineTreeItem*> qSlicerVisuaLinePathManagerWidgetPrivate
+::currentPathItems()
 {
-  Q_D(qSlicerVisuaLinePathManagerWidget);
-
-  if (!item || !d->PathTreeModel)
+  QList<qSlicerVisuaLineTreeItem*> items;
+  foreach(qSlicerVisuaLineTreeItem* item, this->PathItems)
     {
-    return;
+    if (item->model() == this->PathTreeModel)
+      {
+      items << item;
+      }
     }
+  return items;
+}
 
-  qSlicerVisuaLineTreeItem* itemModified
-    = dynamic_cast<qSlicerVisuaLineTreeItem*>(item);
-
-  if (!itemModified)
+//-----------------------------------------------------------------------------
+QList<qSlicerVisuaLineTreeItem*> qSlicerVisuaLinePathManagerWidgetPrivate
+::selectedPathItems()
+{
+  QList<qSlicerVisuaLineTreeItem*> items;
+  QSet<qSlicerVisuaLineTreeItem*> added;
+  foreach(const QModelIndex& index,
+          this->PathTreeView->selectionModel()->selectedRows())
     {
-    return;
+    QModelIndex topLevel = index.parent().isValid() ? index.parent() : index;
+    qSlicerVisuaLineTreeItem* item = dynamic_cast<qSlicerVisuaLineTreeItem*>(
+      this->PathTreeModel->itemFromIndex(topLevel));
+    if (item && !item->getPathNodeID().isEmpty() && !added.contains(item))
+      {
+      added.insert(item);
+      items << item;
+      }
     }
+  return items;
+}
 
-  // Get index of item
-  QModelIndex itemIndex =
-    d->PathTreeModel->indexFromItem(itemModified);
-
-  if (!itemIndex.isValid())
+//-----------------------------------------------------------------------------
+QList<qSlicerVisuaLineTreeItem*> qSlicerVisuaLinePathManagerWidgetPrivate
+::filteredPathItems()
+{
+  QList<qSlicerVisuaLineTreeItem*> items;
+  QSet<QString> pathNodeIDs = this->FilterActive ?
+    this->ShownPaths : this->modelPathIDs(this->PathTreeModel);
+  foreach(const QString& pathNodeID, pathNodeIDs)
     {
-    return;
+    qSlicerVisuaLineTreeItem* item = this->PathItems.value(pathNodeID, NULL);
+    if (item && item->model() == this->PathTreeModel)
+      {
+      items << item;
+      }
     }
+  return items;
+}
 
-  if (itemModified->hasChildren())
+//-----------------------------------------------------------------------------
+QList<qSlicerVisuaLineTreeItem*> qSlicerVisuaLinePathManagerWidgetPrivate
+::duplicateGroupItems()
+{
+  QList<qSlicerVisuaLineTreeItem*> items;
+  for (int i = 0; this->PathTreeModel && i < this->PathTreeModel->rowCount(); ++i)
     {
-    // Top level item
-    itemModified->setVisibility(itemModified->checkState() == Qt::Checked);
-    
-    // Update children too
-    for (int i = 0; i < itemModified->rowCount(); i++)
+    qSlicerVisuaLineTreeItem* item =
+      dynamic_cast<qSlicerVisuaLineTreeItem*>(this->PathTreeModel->item(i));
+    if (item && item->isDuplicateGroup())
       {
-      QStandardItem* childItem = itemModified->child(i);
-      if (childItem)
-        {
-        childItem->setCheckState(itemModified->checkState());
-        }
+      items << item;
       }
     }
-  else
+  return items;
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidgetPrivate
+::removeDuplicateGroups()
+{
+  // Rows after a removed group shift, the selection is dropped
+  for (int i = this->PathTreeModel ? this->PathTreeModel->rowCount() - 1 : -1; i >= 0; --i)
     {
-    // Child item
-    if (!itemIndex.parent().isValid())
+    qSlicerVisuaLineTreeItem* item =
+      dynamic_cast<qSlicerVisuaLineTreeItem*>(this->PathTreeModel->item(i));
+    if (!item || !item->isDuplicateGroup())
       {
-      return;
+      continue;
       }
-
-    // Get parent
-    qSlicerVisuaLineTreeItem* parentItem
-      = dynamic_cast<qSlicerVisuaLineTreeItem*>(d->PathTreeModel->itemFromIndex(itemIndex.parent()));
-    
-    // Update visibility
-    if (parentItem)
+    if (this->TopLevelSelection.isValid() && this->TopLevelSelection.row() >= i)
       {
-      if (itemModified->isPathItem())
-        {
-        parentItem->setPathVisibility(itemModified->checkState() == Qt::Checked);
-        parentItem->setOffsetVisibility(itemModified->checkState() == Qt::Checked);
-        }
-      else
+      this->TopLevelSelection = QModelIndex();
+      this->SelectedRow = QModelIndex();
+      }
+    this->PathTreeModel->removeRows(i, 1);
+    }
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidgetPrivate
+::removeDuplicateGroups(const QSet<QString>& pathNodeIDs)
+{
+  // Groups are a snapshot, the ones listing a changed path are dropped
+  foreach(QStandardItemModel* model, this->Models)
+    {
+    for (int i = model->rowCount() - 1; i >= 0; --i)
+      {
+      qSlicerVisuaLineTreeItem* item =
+        dynamic_cast<qSlicerVisuaLineTreeItem*>(model->item(i));
+      if (!item || !item->isDuplicateGroup())
         {
-        parentItem->setTargetVisibility(itemModified->checkState() == Qt::Checked);
+        continue;
         }
-
-      // TODO: Define behavior
-      // If all childs are turned off, turn off parent
-      bool allSame = true;
-      Qt::CheckState newState = parentItem->checkState();
-      for (int i = 0; i < parentItem->rowCount(); i++)
+      bool stale = false;
+      for (int j = 0; !stale && j < item->rowCount(); ++j)
         {
-        if (parentItem->child(i)->checkState() == parentItem->checkState())
-          {
-          // At least one has the same state. Exit the loop.
-          allSame &= false;
-          break;
-          }
-        newState = parentItem->child(i)->checkState();
+        qSlicerVisuaLineTreeItem* duplicateItem =
+          dynamic_cast<qSlicerVisuaLineTreeItem*>(item->child(j));
+        stale = duplicateItem && pathNodeIDs.contains(duplicateItem->getPathNodeID());
         }
-      
-      if (allSame)
+      if (!stale)
         {
-        // All children have different state. Update parent.
-        parentItem->setCheckState(newState);
+        continue;
         }
+      if (model == this->PathTreeModel && this->TopLevelSelection.isValid() &&
+          this->TopLevelSelection.row() >= i)
+        {
+        this->TopLevelSelection = QModelIndex();
+        this->SelectedRow = QModelIndex();
+        }
+      model->removeRows(i, 1);
       }
     }
 }
 
 //-----------------------------------------------------------------------------
-void qSlicerVisuaLinePathManagerWidget
-::populateTreeView()
+void qSlicerVisuaLinePathManagerWidgetPrivate
+::updateProjectionWidgets()
+{
+  qSlicerVisuaLineTreeItem* topLevelItem = this->TopLevelSelection.isValid() ?
+    dynamic_cast<qSlicerVisuaLineTreeItem*>(
+      this->PathTreeModel->itemFromIndex(this->TopLevelSelection)) : NULL;
+  if (!topLevelItem)
+    {
+    return;
+    }
+  // The projections edit the nodes of the selected path
+  vtkMRMLAnnotationRulerNode* pathNode = this->Logic ?
+    this->Logic->GetOrExpandPathNode(topLevelItem->getPathNodeID().toLatin1()) : NULL;
+  if (this->PathProjectionWidget && pathNode)
+    {
+    this->PathProjectionWidget->setMRMLRulerNode(pathNode);
+    }
+  if (this->TargetProjectionWidget && topLevelItem->getTargetNode())
+    {
+    this->TargetProjectionWidget->setMRMLFiducialNode(topLevelItem->getTargetNode());
+    }
+}
+
+//-----------------------------------------------------------------------------
+qMRMLThreeDView* qSlicerVisuaLinePathManagerWidgetPrivate::threeDView()
+{
+  qSlicerApplication* application = qSlicerApplication::application();
+  qSlicerLayoutManager* layoutManager =
+    application ? application->layoutManager() : NULL;
+  qMRMLThreeDWidget* threeDWidget =
+    layoutManager && layoutManager->threeDViewCount() > 0 ?
+    layoutManager->threeDWidget(0) : NULL;
+  return threeDWidget ? threeDWidget->threeDView() : NULL;
+}
+
+//-----------------------------------------------------------------------------
+vtkSlicerVisuaLineProfiler* qSlicerVisuaLinePathManagerWidgetPrivate::profiler()
+{
+  return this->Logic ? this->Logic->GetProfiler() : NULL;
+}
+
+//-----------------------------------------------------------------------------
+// qSlicerVisuaLinePathManagerWidget methods
+
+//-----------------------------------------------------------------------------
+qSlicerVisuaLinePathManagerWidget
+::qSlicerVisuaLinePathManagerWidget(QWidget* parentWidget)
+  : Superclass( parentWidget )
+  , d_ptr( new qSlicerVisuaLinePathManagerWidgetPrivate(*this) )
 {
   Q_D(qSlicerVisuaLinePathManagerWidget);
+  d->setupUi(this);
 
-  if (!d->SelectedHierarchyNode || !d->PathTreeModel)
+  connect(d->HierarchySelectorWidget, SIGNAL(nodeActivated(vtkMRMLNode*)),
+          this, SLOT(onHierarchyNodeChanged(vtkMRMLNode*)));
+
+  connect(d->DeleteButton, SIGNAL(clicked()),
+          this, SLOT(onDeleteButtonClicked()));
+
+  connect(d->ClearButton, SIGNAL(clicked()),
+          this, SLOT(onClearButtonClicked()));
+
+  connect(d->ExportButton, SIGNAL(clicked()),
+          this, SLOT(onExportButtonClicked()));
+
+  connect(d->UndoButton, SIGNAL(clicked()),
+          this, SLOT(onUndoButtonClicked()));
+  connect(d->RedoButton, SIGNAL(clicked()),
+          this, SLOT(onRedoButtonClicked()));
+
+  // Empty model until a hierarchy is selected
+  d->PathTreeModel = d->hierarchyModel(QString());
+  if (d->PathTreeView)
     {
-    return;
+    d->PathTreeView->setModel(d->PathTreeModel);
+    connect(d->PathTreeView, SIGNAL(clicked(const QModelIndex&)),
+            this, SLOT(onRowSelected(const QModelIndex&)));
+    connect(d->PathTreeView, SIGNAL(expanded(const QModelIndex&)),
+            this, SLOT(onRowExpanded(const QModelIndex&)));
     }
 
-  double childCount = d->SelectedHierarchyNode->GetNumberOfChildrenNodes();
-  for (int i = 0; i < childCount; i++)
+  connect(d->VirtualOffsetSlider, SIGNAL(valueChanged(double)),
+          this, SLOT(onVirtualOffsetChanged(double)));
+
+  // Projection panels are rarely opened, they are built on first expand
+  connect(d->PathProjectionGroup, SIGNAL(contentsCollapsed(bool)),
+          this, SLOT(onProjectionGroupCollapsed(bool)));
+  connect(d->TargetProjectionGroup, SIGNAL(contentsCollapsed(bool)),
+          this, SLOT(onProjectionGroupCollapsed(bool)));
+
+  connect(d->FilterLineEdit, SIGNAL(textChanged(const QString&)),
+          this, SLOT(applyFilter()));
+
+  // Batch visibility. Metric thresholds go through the filter
+  // (e.g. "length>120").
+  QMenu* visibilityMenu = new QMenu(d->VisibilityButton);
+  visibilityMenu->addAction(tr("Show all"), this, SLOT(showAllPaths()));
+  visibilityMenu->addAction(tr("Hide all"), this, SLOT(hideAllPaths()));
+  visibilityMenu->addSeparator();
+  visibilityMenu->addAction(tr("Show selected"), this, SLOT(showSelectedPaths()));
+  visibilityMenu->addAction(tr("Hide selected"), this, SLOT(hideSelectedPaths()));
+  visibilityMenu->addSeparator();
+  visibilityMenu->addAction(tr("Show filtered"), this, SLOT(showFilteredPaths()));
+  visibilityMenu->addAction(tr("Hide filtered"), this, SLOT(hideFilteredPaths()));
+  d->VisibilityButton->setMenu(visibilityMenu);
+
+  // Camera moves fire many events, the labels are laid out at most once
+  // per interval
+  d->LevelOfDetailTimer = new QTimer(this);
+  d->LevelOfDetailTimer->setSingleShot(true);
+  d->LevelOfDetailTimer->setInterval(50);
+  connect(d->LevelOfDetailTimer, SIGNAL(timeout()),
+          this, SLOT(updateLevelOfDetail()));
+  connect(d->LevelOfDetailCheckBox, SIGNAL(toggled(bool)),
+          this, SLOT(onLevelOfDetailToggled(bool)));
+  connect(d->LevelOfDetailDistanceSlider, SIGNAL(valueChanged(double)),
+          this, SLOT(onLevelOfDetailDistanceChanged(double)));
+
+  connect(d->EntrySurfaceSelector, SIGNAL(currentNodeChanged(vtkMRMLNode*)),
+          this, SLOT(onEntrySurfaceChanged(vtkMRMLNode*)));
+
+  d->StatisticsTimer = new QTimer(this);
+  d->StatisticsTimer->setInterval(1000);
+  connect(d->StatisticsTimer, SIGNAL(timeout()),
+          this, SLOT(updateStatistics()));
+  connect(d->ProfilingCheckBox, SIGNAL(toggled(bool)),
+          this, SLOT(onProfilingToggled(bool)));
+  connect(d->ResetStatisticsButton, SIGNAL(clicked()),
+          this, SLOT(onResetStatisticsClicked()));
+  connect(d->SaveStatisticsButton, SIGNAL(clicked()),
+          this, SLOT(onSaveStatisticsClicked()));
+  connect(d->SaveMemoryReportButton, SIGNAL(clicked()),
+          this, SLOT(onSaveMemoryReportClicked()));
+  connect(d->CompactStorageCheckBox, SIGNAL(toggled(bool)),
+          this, SLOT(onCompactStorageToggled(bool)));
+
+  connect(d->FindDuplicatesButton, SIGNAL(clicked()),
+          this, SLOT(onFindDuplicatesClicked()));
+  connect(d->MergeDuplicatesButton, SIGNAL(clicked()),
+          this, SLOT(onMergeDuplicatesClicked()));
+
+  connect(d->DeflectionCheckBox, SIGNAL(toggled(bool)),
+          this, SLOT(onDeflectionToggled(bool)));
+  connect(d->DeflectionTissueSelector, SIGNAL(currentNodeChanged(vtkMRMLNode*)),
+          this, SLOT(onDeflectionTissueChanged(vtkMRMLNode*)));
+  connect(d->DeflectionRadiusSlider, SIGNAL(valueChanged(double)),
+          this, SLOT(updateDeflectionModel()));
+  connect(d->DeflectionBevelAngleSlider, SIGNAL(valueChanged(double)),
+          this, SLOT(updateDeflectionModel()));
+
+  connect(d->ReachabilityCheckBox, SIGNAL(toggled(bool)),
+          this, SLOT(updateReachabilityMap()));
+  connect(d->ReachabilityAngleSlider, SIGNAL(valueChanged(double)),
+          this, SLOT(updateReachabilityMap()));
+  connect(d->ReachabilityDepthSlider, SIGNAL(valueChanged(double)),
+          this, SLOT(updateReachabilityMap()));
+  connect(d->SnapReachableButton, SIGNAL(clicked()),
+          this, SLOT(onSnapReachableClicked()));
+}
+
+//-----------------------------------------------------------------------------
+qSlicerVisuaLinePathManagerWidget
+::~qSlicerVisuaLinePathManagerWidget()
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+
+  // Models and their items are deleted with the widget
+  d->PathItems.clear();
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidget
+::setLogic(vtkSlicerVisuaLineLogic* logic)
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+  qvtkReconnect(d->Logic, logic,
+                vtkSlicerVisuaLineLogic::TemplateGridsModifiedEvent,
+                this, SLOT(updateTemplateGrids()));
+  qvtkReconnect(d->Logic, logic,
+                vtkSlicerVisuaLineLogic::PathsModifiedEvent,
+                this, SLOT(onPathsModified()));
+  qvtkReconnect(d->Logic, logic,
+                vtkSlicerVisuaLineLogic::PathsLoadedEvent,
+                this, SLOT(onPathsLoaded()));
+  qvtkReconnect(d->Logic ? d->Logic->GetUndoJournal() : NULL,
+                logic ? logic->GetUndoJournal() : NULL,
+                vtkCommand::ModifiedEvent, this, SLOT(updateUndoButtons()));
+  d->Logic = logic;
+  if (d->Logic)
     {
-    // Get ruler
-    vtkMRMLAnnotationRulerNode* ruler = 
-      vtkMRMLAnnotationRulerNode::SafeDownCast(d->SelectedHierarchyNode->GetNthChildNode(i)->GetAssociatedNode());
-    
-    this->addNewPath(ruler);
+    d->Logic->SetLevelOfDetailEnabled(d->LevelOfDetailCheckBox->isChecked());
+    d->Logic->SetLevelOfDetailDistance(d->LevelOfDetailDistanceSlider->value());
+    d->Logic->SetEntrySurfaceNode(
+      vtkMRMLModelNode::SafeDownCast(d->EntrySurfaceSelector->currentNode()));
+    d->Logic->GetProfiler()->SetEnabled(d->ProfilingCheckBox->isChecked());
+    d->Logic->SetCompactStorage(d->CompactStorageCheckBox->isChecked());
+    d->Logic->SetDeflectionTissueNode(vtkMRMLScalarVolumeNode::SafeDownCast(
+      d->DeflectionTissueSelector->currentNode()));
+    d->Logic->SetDeflectionPredictionEnabled(d->DeflectionCheckBox->isChecked());
+    this->updateDeflectionModel();
     }
+  this->updateTemplateGrids();
+  this->updateReachabilityMap();
+  this->updateUndoButtons();
+  d->LevelOfDetailTimer->start();
+}
+
+//-----------------------------------------------------------------------------
+vtkSlicerVisuaLineLogic* qSlicerVisuaLinePathManagerWidget
+::logic()const
+{
+  Q_D(const qSlicerVisuaLinePathManagerWidget);
+  return d->Logic;
 }
 
 //-----------------------------------------------------------------------------
 void qSlicerVisuaLinePathManagerWidget
-::addNewPath(vtkMRMLAnnotationRulerNode* ruler)
+::onHierarchyNodeChanged(vtkMRMLNode* newHierarchy)
 {
   Q_D(qSlicerVisuaLinePathManagerWidget);
+  
+  if (!newHierarchy)
+    {
+    return;
+    }
 
-  if (!ruler)
+  vtkMRMLAnnotationHierarchyNode* hierarchy =
+    vtkMRMLAnnotationHierarchyNode::SafeDownCast(newHierarchy);
+  if (!hierarchy || !hierarchy->GetID())
     {
     return;
     }
+  d->SelectedHierarchyNode = hierarchy;
+  d->ActiveNodeLabel->setText(hierarchy->GetName());
+
+  // Paths of all hierarchies stay managed, only the view changes
+  QString hierarchyNodeID = hierarchy->GetID();
+  bool managed = d->Logic && d->Logic->IsPathHierarchyManaged(hierarchy->GetID());
+  bool modelExists = d->Models.contains(hierarchyNodeID);
+  d->PathTreeModel = d->hierarchyModel(hierarchyNodeID);
+  d->PathTreeView->setModel(d->PathTreeModel);
+  d->TopLevelSelection = QModelIndex();
+  d->SelectedRow = QModelIndex();
+  d->FilterActive = false;
+
+  if (!managed && d->Logic)
+    {
+    d->Logic->AddPathHierarchy(hierarchy);
+    }
+  if (!managed || !modelExists)
+    {
+    // First selection: load hierarchy table
+    this->populateTreeView();
+    d->updateTemplateGridItems(d->PathTreeModel);
+    }
+  this->applyFilter();
+}
 
-  // Show ruler
-  ruler->SetDisplayVisibility(1);
-  
-  // Create a top node
-  qSlicerVisuaLineTreeItem* topNode = new qSlicerVisuaLineTreeItem(ruler->GetName());
-  topNode->setCheckable(true);
-  topNode->setCheckState(Qt::Unchecked);
-  d->PathTreeModel->appendRow(topNode);
-  
-  // Create Path node
-  qSlicerVisuaLineTreeItem* pathNode = new qSlicerVisuaLineTreeItem("Path");
-  pathNode->setCheckable(true);
-  pathNode->setPathItem(true);
-  pathNode->setCheckState(Qt::Checked);
-  topNode->appendRow(pathNode);
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidget
+::updateWidgetFromMRML()
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+  vtkSlicerVisuaLineProfileMacro(d->profiler(), "Widget::updateWidgetFromMRML");
   
-  // Create target node
-  double targetPosition[3];
-  QString targetName = QString("Target ");
-  ruler->GetPosition2(targetPosition);
-  targetName.append(d->convertCoordinatesToQString(targetPosition));
-  qSlicerVisuaLineTreeItem* targetNode = new qSlicerVisuaLineTreeItem(targetName);
-  targetNode->setCheckable(true);
-  targetNode->setCheckState(Qt::Unchecked);
-  topNode->appendRow(targetNode);
+  // Tree is built once the scene is loaded
+  if (!d->SelectedHierarchyNode ||
+      (this->mrmlScene() && this->mrmlScene()->IsBatchProcessing()))
+    {
+    return;
+    }
+
+  // Hierarchies are observed by the logic, synchronize now rather than
+  // on the next event loop pass
+  if (d->Logic && d->SelectedHierarchyNode->GetID())
+    {
+    d->Logic->UpdatePathHierarchy(d->SelectedHierarchyNode->GetID());
+    }
+  this->processPathChanges();
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidget
+::onDeleteButtonClicked()
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+
+  if (!d->TopLevelSelection.isValid())
+    {
+    return;
+    }
   
-  // Create fiducial at target point (hiden by default)
-  // Info: Disable ModifiedEvent to avoid infinite loop of refreshing
-  // PathNode is not set when ModifiedEvent is triggered,
-  // comparison in updateWidgetfromMRML will fail, creating a new ruler
-  // etc...
-  d->SelectedHierarchyNode->DisableModifiedEventOn();
-  vtkSmartPointer<vtkMRMLAnnotationFiducialNode> targetFiducial =
-    vtkSmartPointer<vtkMRMLAnnotationFiducialNode>::New();
-  targetFiducial->Initialize(this->mrmlScene());
-  targetFiducial->SetFiducialCoordinates(targetPosition);
-  d->SelectedHierarchyNode->DisableModifiedEventOff();
+  if (!d->PathTreeModel || !d->PathTreeView ||
+      !d->VirtualOffsetSlider)
+    {
+    return;
+    }
+
+  // Removing a template grid drops its item through updateTemplateGrids
+  qSlicerVisuaLineTreeItem* selectedItem = dynamic_cast<qSlicerVisuaLineTreeItem*>(
+    d->PathTreeModel->itemFromIndex(d->TopLevelSelection));
+  if (selectedItem && selectedItem->getTemplateGrid())
+    {
+    if (d->Logic)
+      {
+      d->TopLevelSelection = QModelIndex();
+      d->SelectedRow = QModelIndex();
+      d->Logic->RemoveTemplateGrid(selectedItem->getTemplateGrid());
+      }
+    return;
+    }
+
+  // Update index before removing
+  QModelIndex newTopLevel = d->TopLevelSelection.sibling(d->TopLevelSelection.row()-1,0);
+
+  d->removePathRows(d->TopLevelSelection.row(), 1);
+
+  if (newTopLevel.isValid())
+    {
+    d->PathTreeView->selectionModel()->select(newTopLevel, QItemSelectionModel::ClearAndSelect | QItemSelectionModel::Rows);
+    d->TopLevelSelection = newTopLevel;
+    d->SelectedRow = newTopLevel;
+    this->onRowSelected(d->TopLevelSelection);
+    }
+
+  if (d->PathTreeModel->rowCount() == 0)
+    {
+    d->VirtualOffsetSlider->setValue(0);
+    }
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidget
+::onClearButtonClicked()
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+
+  if (!d->PathTreeModel ||
+      !d->VirtualOffsetSlider)
+    {
+    return;
+    }
+
+  // Stop managing the selected hierarchy, selecting it again reloads it
+  if (d->Logic && d->SelectedHierarchyNode && d->SelectedHierarchyNode->GetID())
+    {
+    d->Logic->RemovePathHierarchy(d->SelectedHierarchyNode->GetID());
+    }
+  for (int i = d->PathTreeModel->rowCount() - 1; i >= 0; --i)
+    {
+    qSlicerVisuaLineTreeItem* item =
+      dynamic_cast<qSlicerVisuaLineTreeItem*>(d->PathTreeModel->item(i));
+    if (!item || !item->getTemplateGrid())
+      {
+      d->removePathRows(i, 1);
+      }
+    }
+  d->TopLevelSelection = QModelIndex();
+  d->SelectedRow = QModelIndex();
+  d->VirtualOffsetSlider->setValue(0);
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidget
+::onRowSelected(const QModelIndex& index)
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+
+  if (!index.isValid())
+    {
+    return;
+    }
+  if (index.column() != 0)
+    {
+    // Value columns select their path
+    this->onRowSelected(index.sibling(index.row(), 0));
+    return;
+    }
+
+  if (!d->VirtualOffsetSlider)
+    {
+    return;
+    }
+
+  d->SelectedRow = index;
+  d->LevelOfDetailTimer->start();
+
+  // Get top level selection
+  d->TopLevelSelection = index;
+  if (index.parent().isValid())
+    {
+    d->TopLevelSelection = index.parent();
+    }
   
-  // Set nodes to top level node
-  topNode->setPathNode(ruler);
-  topNode->setTargetNode(targetFiducial);
-  topNode->setTargetVisibility(false);
+  // Get item
+  qSlicerVisuaLineTreeItem* topLevelItem
+    = dynamic_cast<qSlicerVisuaLineTreeItem*>(d->PathTreeModel->itemFromIndex(d->TopLevelSelection));
+  if (topLevelItem && topLevelItem->getTemplateGrid())
+    {
+    // Template hole selected: make it an editable ruler
+    qSlicerVisuaLineTreeItem* holeItem
+      = dynamic_cast<qSlicerVisuaLineTreeItem*>(d->PathTreeModel->itemFromIndex(index));
+    if (!d->Logic || !holeItem || holeItem->getTemplateHole() < 0)
+      {
+      return;
+      }
+    vtkMRMLAnnotationRulerNode* ruler = d->Logic->MaterializeTemplateHole(
+      holeItem->getTemplateGrid(), holeItem->getTemplateHole(),
+      d->SelectedHierarchyNode);
+    if (!ruler)
+      {
+      return;
+      }
+    if (d->SelectedHierarchyNode)
+      {
+      this->updateWidgetFromMRML();
+      }
+    qSlicerVisuaLineTreeItem* pathItem = d->PathItems.value(ruler->GetID(), NULL);
+    if (pathItem)
+      {
+      QModelIndex pathIndex = pathItem->index();
+      d->PathTreeView->selectionModel()->select(
+        pathIndex, QItemSelectionModel::ClearAndSelect | QItemSelectionModel::Rows);
+      this->onRowSelected(pathIndex);
+      return;
+      }
+    if (d->PathProjectionWidget)
+      {
+      d->PathProjectionWidget->setMRMLRulerNode(ruler);
+      }
+    return;
+    }
+  if (topLevelItem && topLevelItem->isDuplicateGroup())
+    {
+    // Duplicate selected: select its path
+    qSlicerVisuaLineTreeItem* duplicateItem
+      = dynamic_cast<qSlicerVisuaLineTreeItem*>(d->PathTreeModel->itemFromIndex(index));
+    qSlicerVisuaLineTreeItem* pathItem = duplicateItem ?
+      d->PathItems.value(duplicateItem->getPathNodeID(), NULL) : NULL;
+    if (pathItem && pathItem->model() == d->PathTreeModel)
+      {
+      QModelIndex pathIndex = pathItem->index();
+      d->PathTreeView->setRowHidden(pathIndex.row(), QModelIndex(), false);
+      d->PathTreeView->selectionModel()->select(
+        pathIndex, QItemSelectionModel::ClearAndSelect | QItemSelectionModel::Rows);
+      d->PathTreeView->scrollTo(pathIndex);
+      this->onRowSelected(pathIndex);
+      }
+    return;
+    }
+  if (topLevelItem)
+    {
+    d->updateProjectionWidgets();
+    // Kept by the logic, compact paths included
+    d->VirtualOffsetSlider->setValue(topLevelItem->getVirtualOffset());
+    }
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidget
+::onProjectionGroupCollapsed(bool collapsed)
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+
+  if (collapsed)
+    {
+    return;
+    }
+  if (!d->PathProjectionWidget && !d->PathProjectionGroup->collapsed())
+    {
+    d->PathProjectionWidget =
+      new qMRMLAnnotationRulerProjectionPropertyWidget(d->PathProjectionGroup);
+    d->PathProjectionWidget->setEnabled(false);
+    d->PathProjectionGroup->layout()->addWidget(d->PathProjectionWidget);
+    }
+  if (!d->TargetProjectionWidget && !d->TargetProjectionGroup->collapsed())
+    {
+    d->TargetProjectionWidget =
+      new qMRMLAnnotationFiducialProjectionPropertyWidget(d->TargetProjectionGroup);
+    d->TargetProjectionGroup->layout()->addWidget(d->TargetProjectionWidget);
+    }
+  d->updateProjectionWidgets();
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidget
+::onVirtualOffsetChanged(double newOffset)
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+  vtkSlicerVisuaLineProfileMacro(d->profiler(), "Widget::onVirtualOffsetChanged");
+
+  if (!d->TopLevelSelection.isValid())
+    {
+    return;
+    }
+
+  if (!d->PathTreeModel)
+    {
+    return;
+    }
+
+  // Get Item
+  qSlicerVisuaLineTreeItem* item
+    = dynamic_cast<qSlicerVisuaLineTreeItem*>(d->PathTreeModel->itemFromIndex(d->TopLevelSelection));
+
+  // Offset ruler is created by the logic on first use
+  if (item && !item->getTemplateGrid())
+    {
+    item->setVirtualOffset(newOffset);
+    }
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidget
+::onItemChanged(QStandardItem* item)
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+  vtkSlicerVisuaLineProfileMacro(d->profiler(), "Widget::onItemChanged");
+
+  if (!item || !d->PathTreeModel)
+    {
+    return;
+    }
+
+  qSlicerVisuaLineTreeItem* itemModified
+    = dynamic_cast<qSlicerVisuaLineTreeItem*>(item);
+
+  if (!itemModified)
+    {
+    return;
+    }
+
+  // Get index of item
+  QModelIndex itemIndex =
+    d->PathTreeModel->indexFromItem(itemModified);
+
+  if (!itemIndex.isValid())
+    {
+    return;
+    }
+
+  if (itemModified->getTemplateGrid())
+    {
+    if (itemModified->getTemplateHole() < 0 && d->Logic)
+      {
+      d->Logic->SetTemplateGridVisibility(itemModified->getTemplateGrid(),
+                                          itemModified->checkState() == Qt::Checked);
+      }
+    return;
+    }
+
+  if (itemModified->hasChildren())
+    {
+    // Top level item, children follow without re-entering here
+    QList<qSlicerVisuaLineTreeItem*> items;
+    items << itemModified;
+    d->setPathsVisibility(items, itemModified->checkState() == Qt::Checked);
+    }
+  else
+    {
+    // Child item
+    if (!itemIndex.parent().isValid())
+      {
+      return;
+      }
+
+    // Get parent
+    qSlicerVisuaLineTreeItem* parentItem
+      = dynamic_cast<qSlicerVisuaLineTreeItem*>(d->PathTreeModel->itemFromIndex(itemIndex.parent()));
+    
+    // Update visibility
+    if (parentItem)
+      {
+      if (itemModified->isPathItem())
+        {
+        parentItem->setPathVisibility(itemModified->checkState() == Qt::Checked);
+        parentItem->setOffsetVisibility(itemModified->checkState() == Qt::Checked);
+        }
+      else
+        {
+        parentItem->setTargetVisibility(itemModified->checkState() == Qt::Checked);
+        }
+
+      // TODO: Define behavior
+      // If all childs are turned off, turn off parent
+      bool allSame = true;
+      Qt::CheckState newState = parentItem->checkState();
+      for (int i = 0; i < parentItem->rowCount(); i++)
+        {
+        if (parentItem->child(i)->checkState() == parentItem->checkState())
+          {
+          // At least one has the same state. Exit the loop.
+          allSame &= false;
+          break;
+          }
+        newState = parentItem->child(i)->checkState();
+        }
+      
+      if (allSame)
+        {
+        // All children have different state. Update parent.
+        parentItem->setCheckState(newState);
+        }
+      }
+    }
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidget
+::populateTreeView()
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+  vtkSlicerVisuaLineProfileMacro(d->profiler(), "Widget::populateTreeView");
+
+  if (!d->SelectedHierarchyNode || !d->PathTreeModel)
+    {
+    return;
+    }
+
+  double childCount = d->SelectedHierarchyNode->GetNumberOfChildrenNodes();
+  for (int i = 0; i < childCount; i++)
+    {
+    // Get ruler
+    vtkMRMLAnnotationRulerNode* ruler = 
+      vtkMRMLAnnotationRulerNode::SafeDownCast(d->SelectedHierarchyNode->GetNthChildNode(i)->GetAssociatedNode());
+    
+    this->addNewPath(ruler);
+    }
+
+  // Compact paths of the list have no node in the scene
+  if (!d->Logic)
+    {
+    return;
+    }
+  std::vector<std::string> pathNodeIDs;
+  d->Logic->GetHierarchyPaths(d->SelectedHierarchyNode->GetID(), pathNodeIDs);
+  for (size_t i = 0; i < pathNodeIDs.size(); ++i)
+    {
+    if (!d->PathItems.contains(pathNodeIDs[i].c_str()))
+      {
+      d->createPathItem(pathNodeIDs[i].c_str(), d->PathTreeModel);
+      }
+    }
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidget
+::addNewPath(vtkMRMLAnnotationRulerNode* ruler)
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+
+  if (!ruler || !ruler->GetID() || d->PathItems.contains(ruler->GetID()))
+    {
+    return;
+    }
+
+  // Paths of managed hierarchies are already managed
+  if (d->Logic)
+    {
+    d->Logic->AddPathNode(ruler);
+    }
+  d->createPathItem(ruler->GetID(), d->PathTreeModel);
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidget
+::updateTemplateGrids()
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+
+  // Grids are listed in every path list
+  foreach(QStandardItemModel* model, d->Models)
+    {
+    d->updateTemplateGridItems(model);
+    }
+  // Moved templates reach other trajectories
+  if (d->ReachabilityCheckBox->isChecked())
+    {
+    this->updateReachabilityMap();
+    }
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidget
+::onRowExpanded(const QModelIndex& index)
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+
+  qSlicerVisuaLineTreeItem* gridItem =
+    dynamic_cast<qSlicerVisuaLineTreeItem*>(d->PathTreeModel->itemFromIndex(index));
+  if (!gridItem || !gridItem->getTemplateGrid() ||
+      gridItem->getTemplateHole() >= 0 || gridItem->data(Qt::UserRole).toBool())
+    {
+    return;
+    }
+  d->populateTemplateGridItem(gridItem);
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidget
+::onPathsModified()
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+
+  // Collect everything modified until control returns to the event loop
+  if (d->PathChangesPending)
+    {
+    return;
+    }
+  d->PathChangesPending = true;
+  QTimer::singleShot(0, this, SLOT(processPathChanges()));
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidget
+::processPathChanges()
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+  vtkSlicerVisuaLineProfileMacro(d->profiler(), "Widget::processPathChanges");
+
+  d->PathChangesPending = false;
+  if (!d->Logic || !d->PathTreeModel)
+    {
+    return;
+    }
+
+  std::vector<std::string> pathNodeIDs;
+  d->Logic->TakeModifiedPaths(pathNodeIDs);
+  if (!pathNodeIDs.empty())
+    {
+    QSet<QString> modifiedPathIDs;
+    for (size_t i = 0; i < pathNodeIDs.size(); ++i)
+      {
+      modifiedPathIDs.insert(QString::fromStdString(pathNodeIDs[i]));
+      }
+    d->removeDuplicateGroups(modifiedPathIDs);
+    }
+  // Moved paths cross the entry surface in one batch
+  d->Logic->UpdatePathEntries();
+  // Only the changed paths are simulated and checked again
+  d->Logic->UpdatePathDeflections();
+  d->Logic->UpdatePathReachability(pathNodeIDs);
+  for (size_t i = 0; i < pathNodeIDs.size(); ++i)
+    {
+    QString pathNodeID = QString::fromStdString(pathNodeIDs[i]);
+    qSlicerVisuaLineTreeItem* item = d->PathItems.value(pathNodeID, NULL);
+    bool managed = d->Logic->IsPathManaged(pathNodeIDs[i].c_str());
+    const char* hierarchyNodeID = managed ?
+      d->Logic->GetPathHierarchyNodeID(pathNodeIDs[i].c_str()) : NULL;
+    QStandardItemModel* model = hierarchyNodeID ?
+      d->Models.value(hierarchyNodeID, NULL) : NULL;
+
+    if (item && (!managed || (model && item->model() != model)))
+      {
+      // Path node deleted, no longer managed or moved to another list
+      if (item->model() == d->PathTreeModel && d->TopLevelSelection.isValid() &&
+          d->TopLevelSelection.row() == item->row())
+        {
+        d->TopLevelSelection = QModelIndex();
+        d->SelectedRow = QModelIndex();
+        }
+      d->PathItems.remove(pathNodeID);
+      item->model()->removeRows(item->row(), 1);
+      item = NULL;
+      }
+
+    // Names are read without expanding compact paths
+    const char* name = managed ?
+      d->Logic->GetPathName(pathNodeIDs[i].c_str()) : NULL;
+    if (!item && model && name)
+      {
+      // New path of a listed hierarchy, hidden until the filter
+      // accepts it
+      qSlicerVisuaLineTreeItem* newItem =
+        d->createPathItem(pathNodeIDs[i].c_str(), model);
+      if (d->FilterActive && model == d->PathTreeModel)
+        {
+        d->PathTreeView->setRowHidden(newItem->row(), QModelIndex(), true);
+        }
+      }
+    else if (item && name)
+      {
+      if (item->text() != name)
+        {
+        item->setText(name);
+        }
+      item->updateTargetText();
+      d->updatePathColumns(item);
+      }
+    }
+
+  // Renamed or new paths may enter or leave the filter
+  if (d->FilterActive && !pathNodeIDs.empty())
+    {
+    this->applyFilter();
+    }
+  if (!pathNodeIDs.empty())
+    {
+    d->LevelOfDetailTimer->start();
+    }
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidget
+::onPathsLoaded()
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+
+  if (!d->PathTreeModel)
+    {
+    return;
+    }
+
+  if (d->SelectedHierarchyNode && this->mrmlScene() &&
+      !this->mrmlScene()->IsNodePresent(d->SelectedHierarchyNode))
+    {
+    d->SelectedHierarchyNode = NULL;
+    }
+  QString selectedID = d->SelectedHierarchyNode ?
+    QString(d->SelectedHierarchyNode->GetID()) : QString();
+
+  // Models of other hierarchies with loaded paths are rebuilt when
+  // selected again, the others are kept
+  d->PathTreeModel = d->hierarchyModel(selectedID);
+  d->PathTreeView->setModel(d->PathTreeModel);
+  QSet<QStandardItemModel*> staleModels;
+  staleModels.insert(d->PathTreeModel);
+  std::vector<std::string> loadedHierarchyNodeIDs;
+  if (d->Logic)
+    {
+    d->Logic->GetLoadedPathHierarchies(loadedHierarchyNodeIDs);
+    }
+  for (size_t i = 0; i < loadedHierarchyNodeIDs.size(); ++i)
+    {
+    QString hierarchyNodeID = QString::fromStdString(loadedHierarchyNodeIDs[i]);
+    if (hierarchyNodeID != selectedID && d->Models.contains(hierarchyNodeID))
+      {
+      QStandardItemModel* model = d->Models.take(hierarchyNodeID);
+      staleModels.insert(model);
+      model->deleteLater();
+      }
+    }
+  foreach(const QString& pathNodeID, d->PathItems.keys())
+    {
+    if (staleModels.contains(d->PathItems.value(pathNodeID)->model()))
+      {
+      d->PathItems.remove(pathNodeID);
+      }
+    }
+
+  // Rebuild the tree in one pass. Rows are dropped without unmanaging
+  // their paths, the logic already manages the loaded ones.
+  d->PathTreeView->setUpdatesEnabled(false);
+  for (int i = d->PathTreeModel->rowCount() - 1; i >= 0; --i)
+    {
+    qSlicerVisuaLineTreeItem* item =
+      dynamic_cast<qSlicerVisuaLineTreeItem*>(d->PathTreeModel->item(i));
+    if (!item || !item->getTemplateGrid())
+      {
+      d->PathTreeModel->removeRows(i, 1);
+      }
+    }
+  d->TopLevelSelection = QModelIndex();
+  d->SelectedRow = QModelIndex();
+  if (d->Logic && d->SelectedHierarchyNode)
+    {
+    d->Logic->AddPathHierarchy(d->SelectedHierarchyNode);
+    }
+  this->populateTreeView();
+  d->updateTemplateGridItems(d->PathTreeModel);
+  d->FilterActive = false;
+  this->applyFilter();
+  d->PathTreeView->setUpdatesEnabled(true);
+  d->LevelOfDetailTimer->start();
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidget
+::applyFilter()
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+  vtkSlicerVisuaLineProfileMacro(d->profiler(), "Widget::applyFilter");
+
+  if (!d->Logic || !d->PathTreeModel || !d->PathTreeView)
+    {
+    return;
+    }
+
+  vtkSlicerVisuaLineLogic::PathFilter filter;
+  bool active = d->parseFilter(d->FilterLineEdit->text(), filter);
+  if (!active && !d->FilterActive)
+    {
+    return;
+    }
+
+  // Matches come from the logic indexes, not from the items
+  QSet<QString> shown;
+  if (active)
+    {
+    std::vector<std::string> pathNodeIDs;
+    d->Logic->FindPaths(filter, pathNodeIDs);
+    for (size_t i = 0; i < pathNodeIDs.size(); ++i)
+      {
+      QString pathNodeID = QString::fromStdString(pathNodeIDs[i]);
+      qSlicerVisuaLineTreeItem* item = d->PathItems.value(pathNodeID, NULL);
+      if (item && item->model() == d->PathTreeModel)
+        {
+        shown.insert(pathNodeID);
+        }
+      }
+    }
+  else
+    {
+    shown = d->modelPathIDs(d->PathTreeModel);
+    }
+
+  // Only rows whose state changes are touched
+  QSet<QString> previous = d->FilterActive ?
+    d->ShownPaths : d->modelPathIDs(d->PathTreeModel);
+  foreach(const QString& pathNodeID, previous)
+    {
+    qSlicerVisuaLineTreeItem* item = d->PathItems.value(pathNodeID, NULL);
+    if (item && item->model() == d->PathTreeModel && !shown.contains(pathNodeID))
+      {
+      d->PathTreeView->setRowHidden(item->row(), QModelIndex(), true);
+      }
+    }
+  foreach(const QString& pathNodeID, shown)
+    {
+    if (!previous.contains(pathNodeID))
+      {
+      d->PathTreeView->setRowHidden(d->PathItems.value(pathNodeID)->row(),
+                                    QModelIndex(), false);
+      }
+    }
+
+  d->ShownPaths = active ? shown : QSet<QString>();
+  d->FilterActive = active;
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidget
+::showAllPaths()
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+  d->setPathsVisibility(d->currentPathItems(), true);
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidget
+::hideAllPaths()
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+  d->setPathsVisibility(d->currentPathItems(), false);
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidget
+::showSelectedPaths()
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+  d->setPathsVisibility(d->selectedPathItems(), true);
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidget
+::hideSelectedPaths()
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+  d->setPathsVisibility(d->selectedPathItems(), false);
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidget
+::showFilteredPaths()
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+  d->setPathsVisibility(d->filteredPathItems(), true);
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidget
+::hideFilteredPaths()
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+  d->setPathsVisibility(d->filteredPathItems(), false);
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidget
+::onLevelOfDetailToggled(bool enabled)
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+
+  d->LevelOfDetailDistanceSlider->setEnabled(enabled);
+  if (d->Logic)
+    {
+    d->Logic->SetLevelOfDetailEnabled(enabled);
+    }
+  this->updateLevelOfDetail();
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidget
+::onLevelOfDetailDistanceChanged(double distance)
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+
+  if (d->Logic)
+    {
+    d->Logic->SetLevelOfDetailDistance(distance);
+    }
+  d->LevelOfDetailTimer->start();
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidget
+::updateLevelOfDetail()
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+  vtkSlicerVisuaLineProfileMacro(d->profiler(), "Widget::updateLevelOfDetail");
+
+  d->LevelOfDetailTimer->stop();
+  qMRMLThreeDView* view = d->threeDView();
+  vtkCamera* camera = view ? view->activeCamera() : NULL;
+  qvtkReconnect(d->ObservedCamera, camera, vtkCommand::ModifiedEvent,
+                this, SLOT(onCameraModified()));
+  d->ObservedCamera = camera;
+  vtkRenderWindow* renderWindow = view ? view->renderWindow() : NULL;
+  qvtkReconnect(d->ObservedRenderWindow, renderWindow, vtkCommand::StartEvent,
+                this, SLOT(onRenderStarted()));
+  qvtkReconnect(d->ObservedRenderWindow, renderWindow, vtkCommand::EndEvent,
+                this, SLOT(onRenderEnded()));
+  d->ObservedRenderWindow = renderWindow;
+  if (!d->Logic || !view)
+    {
+    return;
+    }
+
+  std::vector<std::string> selectedPathIDs;
+  foreach(qSlicerVisuaLineTreeItem* item, d->selectedPathItems())
+    {
+    selectedPathIDs.push_back(item->getPathNodeID().toStdString());
+    }
+  d->Logic->SetSelectedPaths(selectedPathIDs);
+  d->Logic->UpdateLevelOfDetail(camera, view->width(), view->height());
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidget
+::onCameraModified()
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+
+  // Updated while the camera moves, not only once it stops
+  if (!d->LevelOfDetailTimer->isActive())
+    {
+    d->LevelOfDetailTimer->start();
+    }
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidget
+::onEntrySurfaceChanged(vtkMRMLNode* surface)
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+
+  // Every path is marked modified, columns follow with the change set
+  if (d->Logic)
+    {
+    d->Logic->SetEntrySurfaceNode(vtkMRMLModelNode::SafeDownCast(surface));
+    }
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidget
+::onExportButtonClicked()
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+
+  if (!d->Logic)
+    {
+    return;
+    }
+  QString fileName = QFileDialog::getSaveFileName(
+    this, tr("Export Paths"), QString(),
+    tr("CSV files (*.csv);;JSON files (*.json)"));
+  if (fileName.isEmpty())
+    {
+    return;
+    }
+  int format = QFileInfo(fileName).suffix().toLower() == "json" ?
+    vtkSlicerVisuaLineLogic::JSONFormat : vtkSlicerVisuaLineLogic::CSVFormat;
+  d->Logic->UpdatePathEntries();
+  if (!d->Logic->ExportPaths(fileName.toLocal8Bit(), format))
+    {
+    QMessageBox::warning(this, tr("Export Paths"),
+                         tr("Cannot write %1").arg(fileName));
+    }
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidget
+::onUndoButtonClicked()
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+
+  // Rows follow with the change set of the restored paths
+  if (d->Logic)
+    {
+    d->Logic->Undo();
+    }
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidget
+::onRedoButtonClicked()
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+
+  if (d->Logic)
+    {
+    d->Logic->Redo();
+    }
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidget
+::updateUndoButtons()
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+
+  vtkSlicerVisuaLineUndoJournal* journal =
+    d->Logic ? d->Logic->GetUndoJournal() : NULL;
+  d->UndoButton->setEnabled(journal && journal->CanUndo());
+  d->RedoButton->setEnabled(journal && journal->CanRedo());
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidget
+::onProfilingToggled(bool enabled)
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+
+  if (d->Logic)
+    {
+    d->Logic->GetProfiler()->SetEnabled(enabled);
+    }
+  if (enabled)
+    {
+    d->StatisticsTimer->start();
+    }
+  else
+    {
+    d->StatisticsTimer->stop();
+    }
+  this->updateStatistics();
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidget
+::updateStatistics()
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+
+  vtkSlicerVisuaLineProfiler* profiler = d->profiler();
+  if (!profiler || d->StatisticsGroup->collapsed())
+    {
+    return;
+    }
+  // Times in ms
+  QString text = QString("%1 %2 %3 %4 %5\n")
+    .arg(tr("Section"), -32).arg(tr("Calls"), 10)
+    .arg(tr("Total"), 10).arg(tr("Mean"), 10).arg(tr("Max"), 10);
+  for (int i = 0; i < vtkSlicerVisuaLineProfiler::GetNumberOfSections(); ++i)
+    {
+    vtkIdType count = profiler->GetCallCount(i);
+    if (count == 0)
+      {
+      continue;
+      }
+    double totalTime = 1000.0 * profiler->GetTotalTime(i);
+    text += QString("%1 %2 %3 %4 %5\n")
+      .arg(vtkSlicerVisuaLineProfiler::GetSectionName(i), -32)
+      .arg(static_cast<qlonglong>(count), 10)
+      .arg(totalTime, 10, 'f', 1)
+      .arg(totalTime / count, 10, 'f', 3)
+      .arg(1000.0 * profiler->GetMaximumTime(i), 10, 'f', 3);
+    }
+
+  // Memory of each path list, in kB
+  vtkMRMLScene* scene = d->Logic->GetMRMLScene();
+  std::vector<vtkMRMLNode*> hierarchies;
+  if (scene)
+    {
+    scene->GetNodesByClass("vtkMRMLAnnotationHierarchyNode", hierarchies);
+    }
+  text += QString("\n%1 %2 %3 %4\n")
+    .arg(tr("Path list"), -32).arg(tr("Paths"), 10)
+    .arg(tr("Compact"), 10).arg(tr("Memory"), 10);
+  for (size_t i = 0; i < hierarchies.size(); ++i)
+    {
+    vtkSlicerVisuaLineLogic::MemoryUsage usage;
+    d->Logic->GetHierarchyMemoryUsage(hierarchies[i]->GetID(), usage);
+    if (usage.NumberOfPaths == 0)
+      {
+      continue;
+      }
+    text += QString("%1 %2 %3 %4\n")
+      .arg(hierarchies[i]->GetName(), -32)
+      .arg(usage.NumberOfPaths, 10)
+      .arg(usage.NumberOfCompactPaths, 10)
+      .arg((usage.NodeSize + usage.RecordSize) / 1024.0, 10, 'f', 1);
+    }
+  d->StatisticsTextEdit->setPlainText(text);
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidget
+::onResetStatisticsClicked()
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+
+  if (d->profiler())
+    {
+    d->profiler()->Reset();
+    }
+  this->updateStatistics();
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidget
+::onSaveStatisticsClicked()
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+
+  if (!d->profiler())
+    {
+    return;
+    }
+  QString fileName = QFileDialog::getSaveFileName(
+    this, tr("Save Statistics"), QString(), tr("JSON files (*.json)"));
+  if (!fileName.isEmpty() && !d->profiler()->WriteJSON(fileName.toLocal8Bit()))
+    {
+    QMessageBox::warning(this, tr("Save Statistics"),
+                         tr("Cannot write %1").arg(fileName));
+    }
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidget
+::onSaveMemoryReportClicked()
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+
+  if (!d->Logic)
+    {
+    return;
+    }
+  QString fileName = QFileDialog::getSaveFileName(
+    this, tr("Save Memory Report"), QString(), tr("Text files (*.txt)"));
+  if (!fileName.isEmpty() && !d->Logic->WriteMemoryReport(fileName.toLocal8Bit()))
+    {
+    QMessageBox::warning(this, tr("Save Memory Report"),
+                         tr("Cannot write %1").arg(fileName));
+    }
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidget
+::onFindDuplicatesClicked()
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+  vtkSlicerVisuaLineProfileMacro(d->profiler(), "Widget::onFindDuplicatesClicked");
+
+  if (!d->Logic || !d->PathTreeModel)
+    {
+    return;
+    }
+  d->removeDuplicateGroups();
+
+  // Paths of the current list only
+  std::vector<std::string> pathNodeIDs;
+  foreach(qSlicerVisuaLineTreeItem* item, d->currentPathItems())
+    {
+    pathNodeIDs.push_back(item->getPathNodeID().toStdString());
+    }
+  std::vector<std::vector<std::string> > clusters;
+  if (!pathNodeIDs.empty())
+    {
+    vtkSlicerVisuaLinePathClustering* clustering = d->Logic->GetPathClustering();
+    clustering->SetEntryTolerance(d->DuplicateEntryToleranceSlider->value());
+    clustering->SetTargetTolerance(d->DuplicateTargetToleranceSlider->value());
+    clustering->SetAngularTolerance(d->DuplicateAngularToleranceSlider->value());
+    d->Logic->FindDuplicatePaths(pathNodeIDs, clusters);
+    }
+
+  // One group per cluster after the paths, the kept path first
+  for (size_t i = 0; i < clusters.size(); ++i)
+    {
+    qSlicerVisuaLineTreeItem* groupItem = new qSlicerVisuaLineTreeItem(
+      tr("Duplicates %1 (%2 paths)").arg(i + 1).arg(clusters[i].size()));
+    groupItem->setDuplicateGroup(true);
+    groupItem->setEditable(false);
+    for (size_t j = 0; j < clusters[i].size(); ++j)
+      {
+      QString name = d->Logic->GetPathName(clusters[i][j].c_str());
+      qSlicerVisuaLineTreeItem* duplicateItem = new qSlicerVisuaLineTreeItem(
+        j == 0 ? tr("%1 (kept)").arg(name) : name);
+      duplicateItem->setPathNodeID(QString::fromStdString(clusters[i][j]));
+      duplicateItem->setEditable(false);
+      groupItem->appendRow(duplicateItem);
+      }
+    d->PathTreeModel->appendRow(groupItem);
+    }
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidget
+::onMergeDuplicatesClicked()
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+
+  if (!d->Logic || !d->PathTreeModel)
+    {
+    return;
+    }
+
+  // The selected group, all groups if none is selected
+  QList<qSlicerVisuaLineTreeItem*> groupItems;
+  qSlicerVisuaLineTreeItem* selectedItem = d->TopLevelSelection.isValid() ?
+    dynamic_cast<qSlicerVisuaLineTreeItem*>(
+      d->PathTreeModel->itemFromIndex(d->TopLevelSelection)) : NULL;
+  if (selectedItem && selectedItem->isDuplicateGroup())
+    {
+    groupItems << selectedItem;
+    }
+  else
+    {
+    groupItems = d->duplicateGroupItems();
+    }
+  QList<std::vector<std::string> > clusters;
+  int numberOfDuplicates = 0;
+  foreach(qSlicerVisuaLineTreeItem* groupItem, groupItems)
+    {
+    std::vector<std::string> pathNodeIDs;
+    for (int i = 0; i < groupItem->rowCount(); ++i)
+      {
+      qSlicerVisuaLineTreeItem* duplicateItem =
+        dynamic_cast<qSlicerVisuaLineTreeItem*>(groupItem->child(i));
+      if (duplicateItem)
+        {
+        pathNodeIDs.push_back(duplicateItem->getPathNodeID().toStdString());
+        }
+      }
+    numberOfDuplicates += static_cast<int>(pathNodeIDs.size()) - 1;
+    clusters << pathNodeIDs;
+    }
+  if (numberOfDuplicates <= 0 ||
+      QMessageBox::question(this, tr("Merge Duplicates"),
+        tr("Remove %1 duplicate paths from the scene and keep one path per group?\n"
+           "The merge cannot be undone.").arg(numberOfDuplicates),
+        QMessageBox::Ok | QMessageBox::Cancel) != QMessageBox::Ok)
+    {
+    return;
+    }
+
+  // Groups are a snapshot, they are dropped once merged
+  if (selectedItem && selectedItem->isDuplicateGroup())
+    {
+    d->TopLevelSelection = QModelIndex();
+    d->SelectedRow = QModelIndex();
+    d->PathTreeModel->removeRow(selectedItem->row());
+    }
+  else
+    {
+    d->removeDuplicateGroups();
+    }
+  for (int i = 0; i < clusters.size(); ++i)
+    {
+    d->Logic->MergePaths(clusters[i]);
+    }
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidget
+::onDeflectionToggled(bool enabled)
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+
+  if (d->Logic)
+    {
+    d->Logic->SetDeflectionPredictionEnabled(enabled);
+    this->updateDeflections();
+    }
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidget
+::onDeflectionTissueChanged(vtkMRMLNode* tissue)
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+
+  if (d->Logic)
+    {
+    d->Logic->SetDeflectionTissueNode(vtkMRMLScalarVolumeNode::SafeDownCast(tissue));
+    this->updateDeflections();
+    }
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidget
+::updateDeflectionModel()
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+
+  if (!d->Logic)
+    {
+    return;
+    }
+  // The needle bends along circles of the radius in the reference tissue
+  vtkSlicerVisuaLineDeflectionModel* deflection = d->Logic->GetDeflectionModel();
+  deflection->SetCurvature(1.0 / d->DeflectionRadiusSlider->value());
+  deflection->SetBevelAngle(d->DeflectionBevelAngleSlider->value());
+  this->updateDeflections();
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidget
+::updateDeflections()
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+  vtkSlicerVisuaLineProfileMacro(d->profiler(), "Widget::updateDeflections");
+
+  if (!d->Logic)
+    {
+    return;
+    }
+  // Every prediction may change, not only those of the moved paths
+  d->Logic->UpdatePathDeflections();
+  d->updateAllPathColumns();
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidget
+::updateReachabilityMap()
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+  vtkSlicerVisuaLineProfileMacro(d->profiler(), "Widget::updateReachabilityMap");
+
+  if (!d->Logic)
+    {
+    return;
+    }
+  // The templates are the device. Unchanged guides keep the built map.
+  vtkSlicerVisuaLineReachabilityMap* map = d->Logic->GetReachabilityMap();
+  map->RemoveAllGuides();
+  for (int i = 0; d->ReachabilityCheckBox->isChecked() &&
+         i < d->Logic->GetNumberOfTemplateGrids(); ++i)
+    {
+    map->AddTemplateGrid(d->Logic->GetNthTemplateGrid(i),
+                         d->ReachabilityAngleSlider->value(),
+                         d->ReachabilityDepthSlider->value());
+    }
+  d->Logic->UpdatePathReachability();
+  d->updateAllPathColumns();
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidget
+::onSnapReachableClicked()
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+
+  if (!d->Logic)
+    {
+    return;
+    }
+  // Columns follow with the change set
+  std::vector<std::string> pathNodeIDs;
+  foreach(qSlicerVisuaLineTreeItem* item, d->selectedPathItems())
+    {
+    pathNodeIDs.push_back(item->getPathNodeID().toStdString());
+    }
+  d->Logic->SnapPathsToReachable(pathNodeIDs);
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidget
+::onCompactStorageToggled(bool enabled)
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+
+  if (d->Logic)
+    {
+    d->Logic->SetCompactStorage(enabled);
+    }
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidget
+::onRenderStarted()
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+
+  vtkSlicerVisuaLineProfiler* profiler = d->profiler();
+  d->RenderStartTime = profiler && profiler->GetEnabled() ?
+    vtkTimerLog::GetUniversalTime() : 0.0;
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLinePathManagerWidget
+::onRenderEnded()
+{
+  Q_D(qSlicerVisuaLinePathManagerWidget);
+
+  // Whole 3D view render, not only the paths
+  static const int renderSection =
+    vtkSlicerVisuaLineProfiler::RegisterSection("Widget::Render");
+  vtkSlicerVisuaLineProfiler* profiler = d->profiler();
+  if (profiler && profiler->GetEnabled() && d->RenderStartTime > 0.0)
+    {
+    profiler->AddCall(renderSection,
+                      vtkTimerLog::GetUniversalTime() - d->RenderStartTime);
+    }
+  d->RenderStartTime = 0.0;
 }
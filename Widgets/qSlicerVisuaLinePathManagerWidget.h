@@ -38,7 +38,9 @@
 class qSlicerVisuaLinePathManagerWidgetPrivate;
 class vtkMRMLScene;
 class vtkMRMLNode;
+class vtkObject;
 class vtkMRMLAnnotationRulerNode;
+class vtkSlicerVisuaLineLogic;
 
 /// \ingroup Slicer_QtModules_VisuaLine
 class Q_SLICER_MODULE_VISUALINE_WIDGETS_EXPORT qSlicerVisuaLinePathManagerWidget
@@ -51,19 +53,61 @@ public:
   qSlicerVisuaLinePathManagerWidget(QWidget *parent=0);
   virtual ~qSlicerVisuaLinePathManagerWidget();
 
+  void setLogic(vtkSlicerVisuaLineLogic* logic);
+  vtkSlicerVisuaLineLogic* logic()const;
+
 public slots:
+  /// Batch visibility of the paths listed in the current path list
+  void showAllPaths();
+  void hideAllPaths();
+  void showSelectedPaths();
+  void hideSelectedPaths();
+  void showFilteredPaths();
+  void hideFilteredPaths();
 
 protected slots:
   void onHierarchyNodeChanged(vtkMRMLNode* newHierarchy);
   void onDeleteButtonClicked();
   void onClearButtonClicked();
+  void onExportButtonClicked();
+  void onUndoButtonClicked();
+  void onRedoButtonClicked();
+  void updateUndoButtons();
   void onRowSelected(const QModelIndex& index);
+  void onProjectionGroupCollapsed(bool collapsed);
   void onVirtualOffsetChanged(double newOffset);
   void onItemChanged(QStandardItem*);
   void populateTreeView();
   void updateWidgetFromMRML();
   void addNewPath(vtkMRMLAnnotationRulerNode* ruler);
-  
+  void updateTemplateGrids();
+  void onRowExpanded(const QModelIndex& index);
+  void onPathsModified();
+  void processPathChanges();
+  void onPathsLoaded();
+  void applyFilter();
+  void onLevelOfDetailToggled(bool enabled);
+  void onLevelOfDetailDistanceChanged(double distance);
+  void updateLevelOfDetail();
+  void onEntrySurfaceChanged(vtkMRMLNode* surface);
+  void onProfilingToggled(bool enabled);
+  void updateStatistics();
+  void onResetStatisticsClicked();
+  void onSaveStatisticsClicked();
+  void onSaveMemoryReportClicked();
+  void onCompactStorageToggled(bool enabled);
+  void onFindDuplicatesClicked();
+  void onMergeDuplicatesClicked();
+  void onDeflectionToggled(bool enabled);
+  void onDeflectionTissueChanged(vtkMRMLNode* tissue);
+  void updateDeflectionModel();
+  void updateDeflections();
+  void updateReachabilityMap();
+  void onSnapReachableClicked();
+  void onRenderStarted();
+  void onRenderEnded();
+  void onCameraModified();
+
 protected:
   QScopedPointer<qSlicerVisuaLinePathManagerWidgetPrivate> d_ptr;
 
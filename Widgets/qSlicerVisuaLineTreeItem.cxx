@@ -22,184 +22,105 @@
 
 #include "qSlicerVisuaLineTreeItem.h"
 
+// VisuaLine Logic includes
+#include "vtkSlicerVisuaLinePathStore.h"
+
+// STD includes
+#include <sstream>
+
 // --------------------------------------------------------------------------
 qSlicerVisuaLineTreeItem
 ::qSlicerVisuaLineTreeItem(const QString& text) : QStandardItem(text)
 {
-  this->PathNode = NULL;
-  this->TargetNode = NULL;
-  this->VirtualOffsetNode = NULL;
-  this->OffsetValue = 0;
+  this->Logic = NULL;
   this->PathItem = false;
+  this->DuplicateGroup = false;
+  this->TemplateGrid = NULL;
+  this->TemplateHole = -1;
 }
 
 // --------------------------------------------------------------------------
 qSlicerVisuaLineTreeItem::
 ~qSlicerVisuaLineTreeItem()
 {
-  // BUG: Crash when calling this methods.
-  // Probably nodes have been deleted but pointers not set to NULL
-  //this->setVisibility(false);
 }
 
 // --------------------------------------------------------------------------
 void qSlicerVisuaLineTreeItem::
-setPathNode(vtkMRMLAnnotationRulerNode* rulerNode)
-{
-  if (rulerNode)
-    {
-    qvtkReconnect(this->PathNode, rulerNode, vtkCommand::ModifiedEvent,
-		  this, SLOT(onPathNodeModified()));
-    this->PathNode = rulerNode;
-    }
-}
-
-// --------------------------------------------------------------------------
-vtkMRMLAnnotationRulerNode* qSlicerVisuaLineTreeItem::
-getPathNode()
+setLogic(vtkSlicerVisuaLineLogic* logic)
 {
-  return this->PathNode;
+  this->Logic = logic;
 }
 
 // --------------------------------------------------------------------------
 void qSlicerVisuaLineTreeItem::
-setTargetNode(vtkMRMLAnnotationFiducialNode* fiducialNode)
+setPathNodeID(const QString& pathNodeID)
 {
-  if (fiducialNode)
-    {
-    qvtkReconnect(this->TargetNode, fiducialNode, vtkCommand::ModifiedEvent,
-		  this, SLOT(onTargetNodeModified()));
-    this->TargetNode = fiducialNode;
-    }
+  this->PathNodeID = pathNodeID;
 }
 
 // --------------------------------------------------------------------------
-vtkMRMLAnnotationFiducialNode* qSlicerVisuaLineTreeItem::
-getTargetNode()
+QString qSlicerVisuaLineTreeItem::
+getPathNodeID()
 {
-  return this->TargetNode;
+  return this->PathNodeID;
 }
 
 // --------------------------------------------------------------------------
 void qSlicerVisuaLineTreeItem::
-setVirtualOffsetNode(vtkMRMLAnnotationRulerNode* virtualTip)
+setVirtualOffset(double offset)
 {
-  if (!virtualTip || !this->PathNode)
-    {
-    return;
-    }
-
-  // Set color to green
-  if (virtualTip->GetAnnotationLineDisplayNode() &&
-      virtualTip->GetAnnotationPointDisplayNode() &&
-      virtualTip->GetAnnotationTextDisplayNode())
+  if (this->Logic)
     {
-    virtualTip->GetAnnotationLineDisplayNode()->SetColor(0,1,0);
-    virtualTip->GetAnnotationPointDisplayNode()->SetColor(0,1,0);
-    virtualTip->GetAnnotationTextDisplayNode()->SetColor(0,1,0);
+    this->Logic->SetPathVirtualOffset(this->PathNodeID.toLatin1(), offset);
     }
-
-  // Set points to target point
-  double p2[3];
-  this->PathNode->GetPosition2(p2);
-  virtualTip->SetPosition1(p2);
-  virtualTip->SetPosition2(p2);
-  virtualTip->SetLocked(1);
-  this->VirtualOffsetNode = virtualTip;
-  this->setOffsetVisibility(true);
 }
 
 // --------------------------------------------------------------------------
-vtkMRMLAnnotationRulerNode* qSlicerVisuaLineTreeItem::
-getVirtualOffsetNode()
+double qSlicerVisuaLineTreeItem::
+getVirtualOffset()
 {
-  return this->VirtualOffsetNode;
+  return this->Logic ?
+    this->Logic->GetPathVirtualOffset(this->PathNodeID.toLatin1()) : 0;
 }
 
 // --------------------------------------------------------------------------
 void qSlicerVisuaLineTreeItem::
-setVirtualOffset(double offset)
+setTemplateGrid(vtkSlicerVisuaLineTemplateGrid* grid, int hole)
 {
-  if (!this->VirtualOffsetNode || !this->PathNode)
-    {
-    return;
-    }
-
-  // Set points position
-  double p1[3], p2[3], p2minusp1[3];
-  this->PathNode->GetPosition1(p1);
-  this->PathNode->GetPosition2(p2);
-  vtkMath::Subtract(p2,p1,p2minusp1);
-  vtkMath::Normalize(p2minusp1);
-  
-  double offsetCoordinates[3];
-  offsetCoordinates[0] = p2[0] + p2minusp1[0]*offset;
-  offsetCoordinates[1] = p2[1] + p2minusp1[1]*offset;
-  offsetCoordinates[2] = p2[2] + p2minusp1[2]*offset;
-  
-  this->VirtualOffsetNode->SetPosition1(p2);
-  this->VirtualOffsetNode->SetPosition2(offsetCoordinates);
-  this->OffsetValue = offset;
-
-  // Workaround for issue on top
-  this->setOffsetVisibility(offset == 0 ? false : true);
-  this->VirtualOffsetNode->Modified();
+  this->TemplateGrid = grid;
+  this->TemplateHole = hole;
 }
 
 // --------------------------------------------------------------------------
-double qSlicerVisuaLineTreeItem::
-getVirtualOffset()
+vtkSlicerVisuaLineTemplateGrid* qSlicerVisuaLineTreeItem::
+getTemplateGrid()
 {
-
-/*
- *  !! Bug with Annotation ruler. DistanceMeasurement always return 0.
- *  DistanceMeasurement is not initialized when creating ruler,
- *  only when a point is moved. 
- *
- *  if (this->VirtualOffsetNode)
- *   {
- *   return this->VirtualOffsetNode->GetDistanceMeasurement();
- *   }
- *  return 0;
-*/
-  return this->OffsetValue;
+  return this->TemplateGrid;
 }
 
 // --------------------------------------------------------------------------
-void qSlicerVisuaLineTreeItem::
-onPathNodeModified()
+int qSlicerVisuaLineTreeItem::
+getTemplateHole()
 {
-  if (!this->PathNode || !this->TargetNode)
-    {
-    return;
-    }
-
-  // Update target
-  double p2[3];
-  this->PathNode->GetPosition2(p2);
-  this->TargetNode->SetFiducialCoordinates(p2);
-  
-  // Update virtual offset
-  if (this->VirtualOffsetNode && this->OffsetValue != 0)
-    {
-    this->setVirtualOffset(this->OffsetValue);
-    }
+  return this->TemplateHole;
 }
 
 // --------------------------------------------------------------------------
 void qSlicerVisuaLineTreeItem::
-onTargetNodeModified()
+updateTargetText()
 {
-  if (!this->TargetNode || !this->PathNode)
+  // Read from the path store, compact paths have no target node
+  vtkSlicerVisuaLinePathStore* store =
+    this->Logic ? this->Logic->GetPathStore() : NULL;
+  int index = store ? store->GetPathIndex(this->PathNodeID.toLatin1()) : -1;
+  if (index < 0 || !this->hasChildren())
     {
     return;
     }
 
-  double* targetPosition;
-  targetPosition = this->TargetNode->GetFiducialCoordinates();
-
-  // Modify ruler target point
-  this->PathNode->SetPosition2(targetPosition);
+  double entryPosition[3], targetPosition[3];
+  store->GetWorldEndPoints(index, entryPosition, targetPosition);
 
   // Update text
   std::stringstream targetStream;
@@ -212,20 +133,11 @@ onTargetNodeModified()
   QString targetString = QString(targetStream.str().c_str());
 
   // Get last child
-  if (this->hasChildren())
+  qSlicerVisuaLineTreeItem* targetItem
+    = dynamic_cast<qSlicerVisuaLineTreeItem*>(this->child(this->rowCount()-1));
+  if (targetItem && !targetItem->isPathItem() &&
+      targetItem->text() != targetString)
     {
-    qSlicerVisuaLineTreeItem* targetItem
-      = dynamic_cast<qSlicerVisuaLineTreeItem*>(this->child(this->rowCount()-1));
-    if (targetItem && !targetItem->isPathItem())
-      {
-      targetItem->setData(targetString, Qt::DisplayRole);
-      }
-    }
-
-  // Update virtual offset
-  if (this->VirtualOffsetNode && this->OffsetValue != 0)
-    {
-    this->setVirtualOffset(this->OffsetValue);
+    targetItem->setData(targetString, Qt::DisplayRole);
     }
 }
-
@@ -23,39 +23,34 @@
 #ifndef __qSlicerVisuaLineTreeItem_h
 #define __qSlicerVisuaLineTreeItem_h
 
-// Standards
-#include <sstream>
-
 // Qt includes
 #include <QStandardItem>
 
 // MRML includes
 #include "vtkMRMLAnnotationFiducialNode.h"
-#include "vtkMRMLAnnotationLineDisplayNode.h"
-#include "vtkMRMLAnnotationPointDisplayNode.h"
 #include "vtkMRMLAnnotationRulerNode.h"
-#include "vtkMRMLAnnotationTextDisplayNode.h"
 
-// VTK includes
-#include "vtkMath.h"
-#include <ctkVTKObject.h>
+// VisuaLine Logic includes
+#include "vtkSlicerVisuaLineLogic.h"
+
+class vtkSlicerVisuaLineTemplateGrid;
 
-class qSlicerVisuaLineTreeRootItem;
-class qSlicerVisuaLineTreeItem : public QObject, public QStandardItem
+// Nodes are owned and observed by the logic, items only keep the path
+// node ID and look the nodes up (NULL once deleted).
+class qSlicerVisuaLineTreeItem : public QStandardItem
 {
-  Q_OBJECT
-  QVTK_OBJECT
  public:
     qSlicerVisuaLineTreeItem(const QString& text);
   ~qSlicerVisuaLineTreeItem();
-  
+
+  void setLogic(vtkSlicerVisuaLineLogic* logic);
+
   // MRML Nodes
-  void setPathNode(vtkMRMLAnnotationRulerNode* rulerNode);
-  vtkMRMLAnnotationRulerNode* getPathNode();
-  void setTargetNode(vtkMRMLAnnotationFiducialNode* fiducialNode);
-  vtkMRMLAnnotationFiducialNode* getTargetNode();
-  void setVirtualOffsetNode(vtkMRMLAnnotationRulerNode* virtualTip);
-  vtkMRMLAnnotationRulerNode* getVirtualOffsetNode();
+  void setPathNodeID(const QString& pathNodeID);
+  QString getPathNodeID();
+  inline vtkMRMLAnnotationRulerNode* getPathNode();
+  inline vtkMRMLAnnotationFiducialNode* getTargetNode();
+  inline vtkMRMLAnnotationRulerNode* getVirtualOffsetNode();
   inline void setVisibility(bool visibility);
   inline void setPathVisibility(bool visibility);
   inline void setTargetVisibility(bool visibility);
@@ -63,28 +58,60 @@ class qSlicerVisuaLineTreeItem : public QObject, public QStandardItem
   inline void setPathItem(bool isPath);
   inline bool isPathItem();
 
+  // Group of near-duplicate paths, its rows name the paths
+  inline void setDuplicateGroup(bool isGroup);
+  inline bool isDuplicateGroup();
+
   // Virtual offset
   void setVirtualOffset(double offset);
   double getVirtualOffset();
-  
- protected slots:
-   void onPathNodeModified();
-   void onTargetNodeModified();
-  
- private:
 
-  // MRML Nodes
-  vtkMRMLAnnotationRulerNode* PathNode;
-  vtkMRMLAnnotationRulerNode* VirtualOffsetNode;
-  vtkMRMLAnnotationFiducialNode* TargetNode;
+  // Template grid (hole -1) or one of its holes, without MRML nodes
+  void setTemplateGrid(vtkSlicerVisuaLineTemplateGrid* grid, int hole);
+  vtkSlicerVisuaLineTemplateGrid* getTemplateGrid();
+  int getTemplateHole();
 
-  // Virtual offset
-  double OffsetValue;
+  // Refresh target label from the path store
+  void updateTargetText();
+
+ private:
+
+  vtkSlicerVisuaLineLogic* Logic;
+  QString PathNodeID;
 
   // Differentiation between target and path
   bool PathItem;
+  bool DuplicateGroup;
+
+  // Template grid
+  vtkSlicerVisuaLineTemplateGrid* TemplateGrid;
+  int TemplateHole;
 };
 
+//----------------------------------------------------------------------------
+vtkMRMLAnnotationRulerNode* qSlicerVisuaLineTreeItem::
+getPathNode()
+{
+  return this->Logic ?
+    this->Logic->GetPathNode(this->PathNodeID.toLatin1()) : NULL;
+}
+
+//----------------------------------------------------------------------------
+vtkMRMLAnnotationFiducialNode* qSlicerVisuaLineTreeItem::
+getTargetNode()
+{
+  return this->Logic ?
+    this->Logic->GetPathTargetNode(this->PathNodeID.toLatin1()) : NULL;
+}
+
+//----------------------------------------------------------------------------
+vtkMRMLAnnotationRulerNode* qSlicerVisuaLineTreeItem::
+getVirtualOffsetNode()
+{
+  return this->Logic ?
+    this->Logic->GetPathVirtualOffsetNode(this->PathNodeID.toLatin1()) : NULL;
+}
+
 //----------------------------------------------------------------------------
 void qSlicerVisuaLineTreeItem::
 setVisibility(bool visibility)
@@ -98,9 +125,12 @@ setVisibility(bool visibility)
 void qSlicerVisuaLineTreeItem::
 setPathVisibility(bool visibility)
 {
-  if (this->PathNode)
+  // Compact paths get their nodes back to show them one by one
+  vtkMRMLAnnotationRulerNode* pathNode = this->Logic ?
+    this->Logic->GetOrExpandPathNode(this->PathNodeID.toLatin1()) : NULL;
+  if (pathNode)
     {
-    this->PathNode->SetDisplayVisibility(visibility);
+    pathNode->SetDisplayVisibility(visibility);
     }
 }
 
@@ -108,9 +138,14 @@ setPathVisibility(bool visibility)
 void qSlicerVisuaLineTreeItem::
 setTargetVisibility(bool visibility)
 {
-  if (this->TargetNode)
+  if (this->Logic)
+    {
+    this->Logic->ExpandPath(this->PathNodeID.toLatin1());
+    }
+  vtkMRMLAnnotationFiducialNode* targetNode = this->getTargetNode();
+  if (targetNode)
     {
-    this->TargetNode->SetDisplayVisibility(visibility);
+    targetNode->SetDisplayVisibility(visibility);
     }
 }
 
@@ -118,9 +153,10 @@ setTargetVisibility(bool visibility)
 void qSlicerVisuaLineTreeItem::
 setOffsetVisibility(bool visibility)
 {
-  if (this->VirtualOffsetNode)
+  vtkMRMLAnnotationRulerNode* offsetNode = this->getVirtualOffsetNode();
+  if (offsetNode)
     {
-    this->VirtualOffsetNode->SetDisplayVisibility(visibility);
+    offsetNode->SetDisplayVisibility(visibility);
     }
 }
 
@@ -138,4 +174,18 @@ isPathItem()
   return this->PathItem;
 }
 
+//----------------------------------------------------------------------------
+void qSlicerVisuaLineTreeItem::
+setDuplicateGroup(bool isGroup)
+{
+  this->DuplicateGroup = isGroup;
+}
+
+//----------------------------------------------------------------------------
+bool qSlicerVisuaLineTreeItem::
+isDuplicateGroup()
+{
+  return this->DuplicateGroup;
+}
+
 #endif
@@ -22,9 +22,15 @@
 ==============================================================================*/
 
 // Qt includes
+#include <QDir>
+#include <QTimer>
 #include <QtPlugin>
 
+// SlicerQt includes
+#include <qSlicerCoreApplication.h>
+
 // VisuaLine Logic includes
+#include <vtkSlicerVisuaLineAnalysisCache.h>
 #include <vtkSlicerVisuaLineLogic.h>
 
 // VisuaLine includes
@@ -40,6 +46,8 @@ class qSlicerVisuaLineModulePrivate
 {
 public:
   qSlicerVisuaLineModulePrivate();
+
+  QTimer* PreIndexTimer;
 };
 
 //-----------------------------------------------------------------------------
@@ -49,6 +57,7 @@ public:
 qSlicerVisuaLineModulePrivate
 ::qSlicerVisuaLineModulePrivate()
 {
+  this->PreIndexTimer = NULL;
 }
 
 //-----------------------------------------------------------------------------
@@ -112,6 +121,40 @@ QStringList qSlicerVisuaLineModule::dependencies() const
 void qSlicerVisuaLineModule::setup()
 {
   this->Superclass::setup();
+
+  // Analyses of a case reopened later are read back from the cache
+  vtkSlicerVisuaLineLogic* logic =
+    vtkSlicerVisuaLineLogic::SafeDownCast(this->logic());
+  qSlicerCoreApplication* app = qSlicerCoreApplication::application();
+  if (logic && app)
+    {
+    QString directory = QDir(app->temporaryPath()).filePath("VisuaLine/AnalysisCache");
+    logic->GetAnalysisCache()->SetDirectory(directory.toLocal8Bit().constData());
+    }
+
+  // Path lists of a loaded scene are indexed before the module is shown,
+  // selecting one then only fills the tree
+  Q_D(qSlicerVisuaLineModule);
+  d->PreIndexTimer = new QTimer(this);
+  d->PreIndexTimer->setSingleShot(true);
+  d->PreIndexTimer->setInterval(0);
+  connect(d->PreIndexTimer, SIGNAL(timeout()),
+          this, SLOT(preIndexPathHierarchies()));
+  qvtkConnect(logic, vtkSlicerVisuaLineLogic::PathHierarchiesQueuedEvent,
+              d->PreIndexTimer, SLOT(start()));
+}
+
+//-----------------------------------------------------------------------------
+void qSlicerVisuaLineModule::preIndexPathHierarchies()
+{
+  Q_D(qSlicerVisuaLineModule);
+  vtkSlicerVisuaLineLogic* logic =
+    vtkSlicerVisuaLineLogic::SafeDownCast(this->logic());
+  // Small enough for the application to stay responsive
+  if (logic && logic->PreIndexPathHierarchies(50) > 0)
+    {
+    d->PreIndexTimer->start();
+    }
 }
 
 //-----------------------------------------------------------------------------
@@ -24,6 +24,9 @@
 #ifndef __qSlicerVisuaLineModule_h
 #define __qSlicerVisuaLineModule_h
 
+// CTK includes
+#include <ctkVTKObject.h>
+
 // SlicerQt includes
 #include "qSlicerLoadableModule.h"
 
@@ -37,6 +40,7 @@ qSlicerVisuaLineModule
   : public qSlicerLoadableModule
 {
   Q_OBJECT
+  QVTK_OBJECT
   Q_INTERFACES(qSlicerLoadableModule);
 
 public:
@@ -67,6 +71,11 @@ protected:
   /// Create and return the logic associated to this module
   virtual vtkMRMLAbstractLogic* createLogic();
 
+protected slots:
+  /// Index the path lists of a loaded scene a few paths at a time,
+  /// while the application is idle
+  void preIndexPathHierarchies();
+
 protected:
   QScopedPointer<qSlicerVisuaLineModulePrivate> d_ptr;
 
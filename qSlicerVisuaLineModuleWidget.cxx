@@ -28,6 +28,9 @@
 #include "qSlicerVisuaLineModuleWidget.h"
 #include "ui_qSlicerVisuaLineModuleWidget.h"
 
+// VisuaLine Logic includes
+#include "vtkSlicerVisuaLineLogic.h"
+
 //-----------------------------------------------------------------------------
 /// \ingroup Slicer_QtModules_ExtensionTemplate
 class qSlicerVisuaLineModuleWidgetPrivate: public Ui_qSlicerVisuaLineModuleWidget
@@ -65,5 +68,7 @@ void qSlicerVisuaLineModuleWidget::setup()
   Q_D(qSlicerVisuaLineModuleWidget);
   d->setupUi(this);
   this->Superclass::setup();
+
+  d->PathManager->setLogic(vtkSlicerVisuaLineLogic::SafeDownCast(this->logic()));
 }
 